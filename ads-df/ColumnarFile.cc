@@ -0,0 +1,864 @@
+/**
+ * Copyright (c) 2012, Akamai Technologies
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * 
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ * 
+ *   Neither the name of the Akamai Technologies nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <boost/filesystem.hpp>
+#include <boost/unordered_map.hpp>
+#include "zlib.h"
+#include "IQLInterpreter.hh"
+#include "ColumnarFile.hh"
+
+const char * ColumnarFile::MAGIC = "TRCF";
+
+void ColumnarFile::Footer::write(std::string& out) const
+{
+  PortableEncoding::putVarint(out, VERSION);
+  PortableEncoding::putVarint(out, mColumnTypes.size());
+  for(std::vector<int32_t>::const_iterator it = mColumnTypes.begin();
+      it != mColumnTypes.end();
+      ++it) {
+    PortableEncoding::putVarint(out, (uint64_t) *it);
+  }
+  PortableEncoding::putVarint(out, mRowGroups.size());
+  for(std::vector<RowGroup>::const_iterator it = mRowGroups.begin();
+      it != mRowGroups.end();
+      ++it) {
+    PortableEncoding::putVarint(out, it->mNumRows);
+    for(std::vector<Chunk>::const_iterator c = it->mChunks.begin();
+	c != it->mChunks.end();
+	++c) {
+      PortableEncoding::putVarint(out, c->mOffset);
+      PortableEncoding::putVarint(out, c->mSize);
+      c->mStatistics.write(out);
+    }
+  }
+}
+
+void ColumnarFile::Footer::read(const uint8_t * in, const uint8_t * end)
+{
+  if (VERSION != PortableEncoding::getVarint(in, end)) {
+    throw std::runtime_error("Unsupported columnar file version");
+  }
+  mColumnTypes.resize((std::size_t) PortableEncoding::getVarint(in, end));
+  for(std::size_t i=0; i<mColumnTypes.size(); ++i) {
+    mColumnTypes[i] = (int32_t) PortableEncoding::getVarint(in, end);
+  }
+  mRowGroups.resize((std::size_t) PortableEncoding::getVarint(in, end));
+  for(std::size_t i=0; i<mRowGroups.size(); ++i) {
+    RowGroup & rg(mRowGroups[i]);
+    rg.mNumRows = PortableEncoding::getVarint(in, end);
+    rg.mChunks.resize(mColumnTypes.size());
+    for(std::size_t j=0; j<rg.mChunks.size(); ++j) {
+      rg.mChunks[j].mOffset = PortableEncoding::getVarint(in, end);
+      rg.mChunks[j].mSize = PortableEncoding::getVarint(in, end);
+      rg.mChunks[j].mStatistics.read(in, end);
+    }
+  }
+  if (in != end) {
+    throw std::runtime_error("Corrupt columnar file footer");
+  }
+}
+
+void ColumnarFile::Footer::getStatistics(std::size_t rowGroup, 
+					 std::vector<ColumnStatistics>& stats) const
+{
+  stats.clear();
+  const RowGroup & rg(mRowGroups[rowGroup]);
+  for(std::vector<Chunk>::const_iterator c = rg.mChunks.begin();
+      c != rg.mChunks.end();
+      ++c) {
+    stats.push_back(c->mStatistics);
+  }
+}
+
+ColumnarFile::Field::Field(const RecordType * ty, 
+			   const std::string& name, 
+			   int32_t column)
+  :
+  mAddress(ty->getMemberOffset(name)),
+  mType(ty->getMember(name).GetType()->GetEnum()),
+  mSize((uint32_t) ty->getMember(name).GetType()->GetAllocSize()),
+  mNullable(ty->getMember(name).GetType()->isNullable()),
+  mColumn(column)
+{
+}
+
+/**
+ * Run length encoding of a sequence of integers.
+ */
+class ColumnarRunLengthEncoder
+{
+private:
+  std::string & mOut;
+  int64_t mValue;
+  uint64_t mRun;
+  bool mSigned;
+  void flush()
+  {
+    if (mRun) {
+      if (mSigned) {
+	PortableEncoding::putZigZag(mOut, mValue);
+      } else {
+	PortableEncoding::putVarint(mOut, (uint64_t) mValue);
+      }
+      PortableEncoding::putVarint(mOut, mRun);
+    }
+  }
+public:
+  ColumnarRunLengthEncoder(std::string& out, bool isSigned)
+    :
+    mOut(out),
+    mValue(0),
+    mRun(0),
+    mSigned(isSigned)
+  {
+  }
+  ~ColumnarRunLengthEncoder()
+  {
+    flush();
+  }
+  void add(int64_t val)
+  {
+    if (mRun && val == mValue) {
+      mRun += 1;
+    } else {
+      flush();
+      mValue = val;
+      mRun = 1;
+    }
+  }
+};
+
+class ColumnarRunLengthDecoder
+{
+private:
+  const uint8_t * & mIn;
+  const uint8_t * mEnd;
+  int64_t mValue;
+  uint64_t mRun;
+  bool mSigned;
+public:
+  ColumnarRunLengthDecoder(const uint8_t * & in, const uint8_t * end, bool isSigned)
+    :
+    mIn(in),
+    mEnd(end),
+    mValue(0),
+    mRun(0),
+    mSigned(isSigned)
+  {
+  }
+  int64_t next()
+  {
+    if (0 == mRun) {
+      mValue = mSigned ? PortableEncoding::getZigZag(mIn, mEnd) :
+	(int64_t) PortableEncoding::getVarint(mIn, mEnd);
+      mRun = PortableEncoding::getVarint(mIn, mEnd);
+      if (0 == mRun) {
+	throw std::runtime_error("Corrupt columnar run length");
+      }
+    }
+    mRun -= 1;
+    return mValue;
+  }
+};
+
+static void getStringValue(const ColumnarFile::Field& field, RecordBuffer buf,
+			   const char * & ptr, std::size_t & sz)
+{
+  if (field.mType == FieldType::VARCHAR) {
+    const Varchar * v = field.mAddress.getVarcharPtr(buf);
+    ptr = v->c_str();
+    sz = (std::size_t) v->size();
+  } else {
+    // CHAR without terminator
+    ptr = field.mAddress.getCharPtr(buf);
+    sz = field.mSize - 1;
+  }
+}
+
+static void setStringValue(const ColumnarFile::Field& field, RecordBuffer buf,
+			   const char * ptr, std::size_t sz)
+{
+  if (field.mType == FieldType::VARCHAR) {
+    field.mAddress.SetVariableLengthString(buf, ptr, sz);
+  } else {
+    if (sz != field.mSize - 1) {
+      throw std::runtime_error("Corrupt columnar CHAR value");
+    }
+    field.mAddress.SetFixedLengthString(buf, ptr, sz);
+  }
+}
+
+void ColumnarFile::encode(const Field& field, 
+			  const std::vector<RecordBuffer>& records,
+			  bool compress,
+			  std::string& out,
+			  ColumnStatistics& stats)
+{
+  std::string raw;
+  std::vector<RecordBuffer> present;
+  present.reserve(records.size());
+  if (field.mNullable) {
+    raw.resize((records.size() + 7)/8, 0);
+    for(std::size_t i=0; i<records.size(); ++i) {
+      if (field.mAddress.isNull(records[i])) {
+	raw[i/8] |= (char) (1 << (i%8));
+	stats.addNull();
+      } else {
+	present.push_back(records[i]);
+      }
+    }
+  } else {
+    present = records;
+  }
+
+  FieldType::FieldTypeEnum ty = (FieldType::FieldTypeEnum) field.mType;
+  uint8_t encoding = PLAIN;
+  switch(ColumnStatistics::getDomain(ty)) {
+  case ColumnStatistics::INTEGER:
+    {
+      // Use whichever of delta and run length is smaller.
+      std::string delta;
+      std::string rle;
+      {
+	ColumnarRunLengthEncoder enc(rle, true);
+	int64_t prev = 0;
+	for(std::vector<RecordBuffer>::const_iterator it = present.begin();
+	    it != present.end();
+	    ++it) {
+	  int64_t val = ColumnStatistics::getInteger(field.mAddress, ty, *it);
+	  stats.add(val);
+	  PortableEncoding::putZigZag(delta, (int64_t) ((uint64_t) val - (uint64_t) prev));
+	  enc.add(val);
+	  prev = val;
+	}
+      }
+      if (rle.size() < delta.size()) {
+	encoding = RLE;
+	raw += rle;
+      } else {
+	encoding = DELTA;
+	raw += delta;
+      }
+      break;
+    }
+  case ColumnStatistics::STRING:
+    {
+      typedef boost::unordered_map<std::string, uint32_t> dictionary_type;
+      dictionary_type dict;
+      std::vector<uint32_t> indexes;
+      indexes.reserve(present.size());
+      std::string dictValues;
+      for(std::vector<RecordBuffer>::const_iterator it = present.begin();
+	  it != present.end();
+	  ++it) {
+	const char * ptr;
+	std::size_t sz;
+	getStringValue(field, *it, ptr, sz);
+	stats.add(ptr, sz);
+	std::pair<dictionary_type::iterator, bool> ins = 
+	  dict.insert(std::make_pair(std::string(ptr, sz), (uint32_t) dict.size()));
+	if (ins.second) {
+	  PortableEncoding::putString(dictValues, ptr, sz);
+	}
+	indexes.push_back(ins.first->second);
+      }
+      if (present.size() && 2*dict.size() <= present.size()) {
+	encoding = DICTIONARY;
+	PortableEncoding::putVarint(raw, dict.size());
+	raw += dictValues;
+	ColumnarRunLengthEncoder enc(raw, false);
+	for(std::vector<uint32_t>::const_iterator it = indexes.begin();
+	    it != indexes.end();
+	    ++it) {
+	  enc.add(*it);
+	}
+      } else {
+	for(std::vector<RecordBuffer>::const_iterator it = present.begin();
+	    it != present.end();
+	    ++it) {
+	  const char * ptr;
+	  std::size_t sz;
+	  getStringValue(field, *it, ptr, sz);
+	  PortableEncoding::putString(raw, ptr, sz);
+	}
+      }
+      break;
+    }
+  default:
+    for(std::vector<RecordBuffer>::const_iterator it = present.begin();
+	it != present.end();
+	++it) {
+      if (ty == FieldType::DOUBLE) {
+	stats.add(field.mAddress.getDouble(*it));
+      }
+      raw.append(field.mAddress.getCharPtr(*it), field.mSize);
+    }
+    break;
+  }
+
+  // Page header and (maybe compressed) contents
+  std::string compressed;
+  uint8_t flags = 0;
+  if (compress && raw.size()) {
+    uLongf sz = ::compressBound((uLong) raw.size());
+    compressed.resize(sz);
+    if (Z_OK == ::compress2((Bytef *) &compressed[0], &sz, 
+			    (const Bytef *) raw.c_str(), (uLong) raw.size(),
+			    Z_BEST_SPEED) &&
+	sz < raw.size()) {
+      compressed.resize(sz);
+      flags = 1;
+    }
+  }
+  const std::string & stored(flags ? compressed : raw);
+  out.push_back((char) encoding);
+  out.push_back((char) flags);
+  PortableEncoding::putUInt32(out, (uint32_t) raw.size());
+  PortableEncoding::putUInt32(out, (uint32_t) stored.size());
+  PortableEncoding::putUInt32(out, (uint32_t) ::crc32(0, (const Bytef *) stored.c_str(), 
+						      (uInt) stored.size()));
+  out += stored;
+}
+
+void ColumnarFile::decode(const Field& field,
+			  const uint8_t * begin,
+			  const uint8_t * end,
+			  const std::vector<RecordBuffer>& records)
+{
+  uint8_t encoding = *PortableEncoding::getBytes(begin, end, 1);
+  uint8_t flags = *PortableEncoding::getBytes(begin, end, 1);
+  uint32_t rawSize = PortableEncoding::getUInt32(begin, end);
+  uint32_t storedSize = PortableEncoding::getUInt32(begin, end);
+  uint32_t checksum = PortableEncoding::getUInt32(begin, end);
+  if (storedSize != (uint32_t) (end - begin)) {
+    throw std::runtime_error("Corrupt columnar page: size mismatch");
+  }
+  if (checksum != (uint32_t) ::crc32(0, begin, storedSize)) {
+    throw std::runtime_error("Corrupt columnar page: checksum mismatch");
+  }
+  std::vector<uint8_t> uncompressed;
+  if (flags & 1) {
+    uncompressed.resize(rawSize);
+    uLongf sz = rawSize;
+    if (Z_OK != ::uncompress(&uncompressed[0], &sz, begin, storedSize) ||
+	sz != rawSize) {
+      throw std::runtime_error("Corrupt columnar page: decompression failed");
+    }
+    begin = &uncompressed[0];
+    end = begin + rawSize;
+  } else if (rawSize != storedSize) {
+    throw std::runtime_error("Corrupt columnar page: size mismatch");
+  }
+
+  const uint8_t * nulls = NULL;
+  if (field.mNullable) {
+    nulls = PortableEncoding::getBytes(begin, end, (records.size() + 7)/8);
+  }
+  FieldType::FieldTypeEnum ty = (FieldType::FieldTypeEnum) field.mType;
+  ColumnStatistics::Domain domain = ColumnStatistics::getDomain(ty);
+  if ((domain == ColumnStatistics::INTEGER && 
+       encoding != DELTA && encoding != RLE) ||
+      (domain == ColumnStatistics::STRING && 
+       encoding != PLAIN && encoding != DICTIONARY) ||
+      (domain != ColumnStatistics::INTEGER && 
+       domain != ColumnStatistics::STRING && encoding != PLAIN)) {
+    throw std::runtime_error("Corrupt columnar page: invalid encoding");
+  }
+  // Dictionary entries point into the page.
+  std::vector<std::pair<const char *, std::size_t> > dict;
+  if (encoding == DICTIONARY) {
+    dict.resize((std::size_t) PortableEncoding::getVarint(begin, end));
+    for(std::size_t i=0; i<dict.size(); ++i) {
+      dict[i].second = (std::size_t) PortableEncoding::getVarint(begin, end);
+      dict[i].first = (const char *) PortableEncoding::getBytes(begin, end, 
+								dict[i].second);
+    }
+  }
+  ColumnarRunLengthDecoder runs(begin, end, encoding == RLE);
+  int64_t prev = 0;
+  for(std::size_t i=0; i<records.size(); ++i) {
+    RecordBuffer buf = records[i];
+    if (nulls && (nulls[i/8] & (1 << (i%8)))) {
+      field.mAddress.setNull(buf);
+      continue;
+    }
+    switch(encoding) {
+    case DELTA:
+    case RLE:
+      {
+	int64_t val;
+	if (encoding == DELTA) {
+	  val = prev = (int64_t) ((uint64_t) prev + 
+				  (uint64_t) PortableEncoding::getZigZag(begin, end));
+	} else {
+	  val = runs.next();
+	}
+	field.mAddress.clearNull(buf);
+	switch(ty) {
+	case FieldType::INT32:
+	case FieldType::INTERVAL:
+	  field.mAddress.setInt32((int32_t) val, buf);
+	  break;
+	case FieldType::INT64:
+	  field.mAddress.setInt64(val, buf);
+	  break;
+	case FieldType::DATE:
+	  {
+	    int32_t tmp = (int32_t) val;
+	    memcpy(field.mAddress.getCharPtr(buf), &tmp, sizeof(tmp));
+	    break;
+	  }
+	default:
+	  memcpy(field.mAddress.getCharPtr(buf), &val, sizeof(val));
+	  break;
+	}
+	break;
+      }
+    case DICTIONARY:
+      {
+	uint64_t idx = (uint64_t) runs.next();
+	if (idx >= dict.size()) {
+	  throw std::runtime_error("Corrupt columnar page: invalid dictionary index");
+	}
+	setStringValue(field, buf, dict[idx].first, dict[idx].second);
+	break;
+      }
+    default:
+      if (domain == ColumnStatistics::STRING) {
+	std::size_t sz = (std::size_t) PortableEncoding::getVarint(begin, end);
+	const char * ptr = (const char *) PortableEncoding::getBytes(begin, end, sz);
+	setStringValue(field, buf, ptr, sz);
+      } else {
+	field.mAddress.clearNull(buf);
+	memcpy(field.mAddress.getCharPtr(buf), 
+	       PortableEncoding::getBytes(begin, end, field.mSize),
+	       field.mSize);
+      }
+      break;
+    }
+  }
+  if (begin != end) {
+    throw std::runtime_error("Corrupt columnar page: trailing data");
+  }
+}
+
+class RuntimeColumnarWriteOperator : public RuntimeOperatorBase<RuntimeColumnarWriteOperatorType>
+{
+private:
+  typedef RuntimeColumnarWriteOperatorType operator_type;
+
+  enum State { START, READ };
+  State mState;
+  int mFile;
+  uint64_t mOffset;
+  RecordBuffer mInput;
+  // Records of the row group being built
+  std::vector<RecordBuffer> mRecords;
+  ColumnarFile::Footer mFooter;
+  std::string mBuffer;
+
+  void writeBytes(const std::string& buf)
+  {
+    const char * ptr = buf.c_str();
+    std::size_t sz = buf.size();
+    while(sz > 0) {
+      ssize_t ret = ::write(mFile, ptr, sz);
+      if (ret < 0) {
+	if (errno == EINTR) continue;
+	throw std::runtime_error((boost::format("Failed writing columnar file %1%: %2%") %
+				  getMyOperatorType().mFile % strerror(errno)).str());
+      }
+      ptr += ret;
+      sz -= (std::size_t) ret;
+    }
+    mOffset += buf.size();
+  }
+
+  void writeRowGroup()
+  {
+    const operator_type & opType(getMyOperatorType());
+    ColumnarFile::RowGroup rg;
+    rg.mNumRows = mRecords.size();
+    for(std::vector<ColumnarFile::Field>::const_iterator it = opType.mFields.begin();
+	it != opType.mFields.end();
+	++it) {
+      ColumnarFile::Chunk c;
+      c.mOffset = mOffset;
+      c.mStatistics = ColumnStatistics(ColumnStatistics::getDomain((FieldType::FieldTypeEnum) it->mType));
+      mBuffer.clear();
+      ColumnarFile::encode(*it, mRecords, opType.mCompress, mBuffer, c.mStatistics);
+      c.mSize = mBuffer.size();
+      writeBytes(mBuffer);
+      rg.mChunks.push_back(c);
+    }
+    mFooter.mRowGroups.push_back(rg);
+    for(std::vector<RecordBuffer>::iterator it = mRecords.begin();
+	it != mRecords.end();
+	++it) {
+      opType.mFree.free(*it);
+    }
+    mRecords.clear();
+  }
+
+  void writeFooter()
+  {
+    mBuffer.clear();
+    mFooter.write(mBuffer);
+    PortableEncoding::putUInt32(mBuffer, (uint32_t) mBuffer.size());
+    mBuffer.append(ColumnarFile::MAGIC, ColumnarFile::MAGIC_SIZE);
+    writeBytes(mBuffer);
+  }
+
+public:
+  RuntimeColumnarWriteOperator(RuntimeOperator::Services& services, 
+			       const RuntimeColumnarWriteOperatorType& opType)
+    :
+    RuntimeOperatorBase<RuntimeColumnarWriteOperatorType>(services, opType),
+    mState(START),
+    mFile(-1),
+    mOffset(0)
+  {
+  }
+
+  ~RuntimeColumnarWriteOperator()
+  {
+    if (mFile != -1) {
+      ::close(mFile);
+    }
+  }
+
+  void start()
+  {
+    boost::filesystem::path p (getMyOperatorType().mFile);
+    if (!p.parent_path().empty()) {
+      boost::filesystem::create_directories(p.parent_path());
+    }
+    mFile = ::open(getMyOperatorType().mFile.c_str(),
+		   O_WRONLY|O_CREAT|O_TRUNC,
+		   S_IRUSR | S_IRGRP | S_IROTH | S_IWUSR | S_IWGRP);
+    if (mFile == -1) {
+      throw std::runtime_error((boost::format("Couldn't create file %1%") %
+				getMyOperatorType().mFile).str());
+    }
+    mOffset = 0;
+    writeBytes(std::string(ColumnarFile::MAGIC, ColumnarFile::MAGIC_SIZE));
+    mFooter.mColumnTypes.clear();
+    for(std::vector<ColumnarFile::Field>::const_iterator it = getMyOperatorType().mFields.begin();
+	it != getMyOperatorType().mFields.end();
+	++it) {
+      mFooter.mColumnTypes.push_back(it->mType);
+    }
+    mRecords.reserve(getMyOperatorType().mRowGroupSize);
+    mState = START;
+    onEvent(NULL);
+  }
+
+  void onEvent(RuntimePort * port)
+  {
+    switch(mState) {
+    case START:
+      while(true) {
+	requestRead(0);
+	mState = READ;
+	return;
+      case READ:
+	read(port, mInput);
+	if (mInput == RecordBuffer()) {
+	  break;
+	}
+	mRecords.push_back(mInput);
+	mInput = RecordBuffer();
+	if (mRecords.size() == (std::size_t) getMyOperatorType().mRowGroupSize) {
+	  writeRowGroup();
+	}
+      }
+      if (mRecords.size()) {
+	writeRowGroup();
+      }
+      writeFooter();
+      ::close(mFile);
+      mFile = -1;
+      return;
+    }
+  }
+
+  void shutdown()
+  {
+  }
+};
+
+RuntimeColumnarWriteOperatorType::RuntimeColumnarWriteOperatorType(const RecordType * input,
+								   const std::string& file,
+								   int32_t rowGroupSize,
+								   bool compress)
+  :
+  RuntimeOperatorType("RuntimeColumnarWriteOperatorType"),
+  mFree(input->getFree()),
+  mFile(file),
+  mRowGroupSize(rowGroupSize),
+  mCompress(compress)
+{
+  int32_t column = 0;
+  for(RecordType::const_member_iterator m = input->begin_members();
+      m != input->end_members(); ++m, ++column) {
+    mFields.push_back(ColumnarFile::Field(input, m->GetName(), column));
+  }
+}
+
+RuntimeColumnarWriteOperatorType::~RuntimeColumnarWriteOperatorType()
+{
+}
+
+RuntimeOperator * RuntimeColumnarWriteOperatorType::create(RuntimeOperator::Services & s) const
+{
+  return new RuntimeColumnarWriteOperator(s, *this);
+}
+
+class RuntimeColumnarReadOperator : public RuntimeOperatorBase<RuntimeColumnarReadOperatorType>
+{
+private:
+  typedef RuntimeColumnarReadOperatorType operator_type;
+
+  enum State { START, WRITE, WRITE_EOF };
+  State mState;
+  int mFile;
+  ColumnarFile::Footer mFooter;
+  std::size_t mRowGroup;
+  std::vector<RecordBuffer> mRecords;
+  std::size_t mRecordIt;
+  std::vector<uint8_t> mBuffer;
+  std::vector<ColumnStatistics> mStatistics;
+  class InterpreterContext * mRuntimeContext;
+
+  void readBytes(uint64_t offset, std::size_t sz)
+  {
+    mBuffer.resize(sz);
+    std::size_t pos = 0;
+    while(pos < sz) {
+      ssize_t ret = ::pread(mFile, &mBuffer[pos], sz - pos, (off_t) (offset + pos));
+      if (ret < 0 && errno == EINTR) {
+	continue;
+      } else if (ret <= 0) {
+	throw std::runtime_error((boost::format("Failed reading columnar file %1%") %
+				  getMyOperatorType().mFile).str());
+      }
+      pos += (std::size_t) ret;
+    }
+  }
+
+  void readFooter()
+  {
+    const operator_type & opType(getMyOperatorType());
+    struct stat st;
+    if (::fstat(mFile, &st) != 0 ||
+	st.st_size < (off_t) (2*ColumnarFile::MAGIC_SIZE + 4)) {
+      throw std::runtime_error((boost::format("%1% is not a columnar file") %
+				opType.mFile).str());
+    }
+    uint64_t fileSize = (uint64_t) st.st_size;
+    readBytes(fileSize - ColumnarFile::MAGIC_SIZE - 4, ColumnarFile::MAGIC_SIZE + 4);
+    const uint8_t * ptr = &mBuffer[0];
+    uint32_t footerSize = PortableEncoding::getUInt32(ptr, ptr + 4);
+    if (memcmp(ptr, ColumnarFile::MAGIC, ColumnarFile::MAGIC_SIZE) ||
+	footerSize > fileSize - 2*ColumnarFile::MAGIC_SIZE - 4) {
+      throw std::runtime_error((boost::format("%1% is not a columnar file") %
+				opType.mFile).str());
+    }
+    readBytes(fileSize - ColumnarFile::MAGIC_SIZE - 4 - footerSize, footerSize);
+    mFooter.read(&mBuffer[0], &mBuffer[0] + footerSize);
+    if (mFooter.mColumnTypes != opType.mColumnTypes) {
+      throw std::runtime_error((boost::format("Columnar file %1% does not match format") %
+				opType.mFile).str());
+    }
+  }
+
+  bool selectRowGroup(std::size_t rowGroup)
+  {
+    if ((int32_t) (rowGroup % getNumPartitions()) != getPartition()) {
+      return false;
+    }
+    if (getMyOperatorType().mZoneMap.empty()) {
+      return true;
+    }
+    mFooter.getStatistics(rowGroup, mStatistics);
+    return getMyOperatorType().mZoneMap.mayMatch(mStatistics);
+  }
+
+  void loadRowGroup(std::size_t rowGroup)
+  {
+    const operator_type & opType(getMyOperatorType());
+    const ColumnarFile::RowGroup & rg(mFooter.mRowGroups[rowGroup]);
+    mRecords.resize((std::size_t) rg.mNumRows);
+    for(std::vector<RecordBuffer>::iterator it = mRecords.begin();
+	it != mRecords.end();
+	++it) {
+      *it = opType.mMalloc.malloc();
+    }
+    for(std::vector<ColumnarFile::Field>::const_iterator it = opType.mFields.begin();
+	it != opType.mFields.end();
+	++it) {
+      const ColumnarFile::Chunk & c(rg.mChunks[it->mColumn]);
+      readBytes(c.mOffset, (std::size_t) c.mSize);
+      ColumnarFile::decode(*it, &mBuffer[0], &mBuffer[0] + mBuffer.size(), mRecords);
+    }
+  }
+
+public:
+  RuntimeColumnarReadOperator(RuntimeOperator::Services& services, 
+			      const RuntimeColumnarReadOperatorType& opType)
+    :
+    RuntimeOperatorBase<RuntimeColumnarReadOperatorType>(services, opType),
+    mState(START),
+    mFile(-1),
+    mRowGroup(0),
+    mRecordIt(0),
+    mRuntimeContext(new InterpreterContext())
+  {
+  }
+
+  ~RuntimeColumnarReadOperator()
+  {
+    if (mFile != -1) {
+      ::close(mFile);
+    }
+    for(std::size_t i=mRecordIt; i<mRecords.size(); ++i) {
+      getMyOperatorType().mFree.free(mRecords[i]);
+    }
+    delete mRuntimeContext;
+  }
+
+  void start()
+  {
+    mFile = ::open(getMyOperatorType().mFile.c_str(), O_RDONLY);
+    if (mFile == -1) {
+      throw std::runtime_error((boost::format("Couldn't open file %1%") %
+				getMyOperatorType().mFile).str());
+    }
+    readFooter();
+    mState = START;
+    onEvent(NULL);
+  }
+
+  void onEvent(RuntimePort * port)
+  {
+    const operator_type & opType(getMyOperatorType());
+    switch(mState) {
+    case START:
+      for(mRowGroup = 0; mRowGroup < mFooter.mRowGroups.size(); ++mRowGroup) {
+	if (!selectRowGroup(mRowGroup)) {
+	  continue;
+	}
+	loadRowGroup(mRowGroup);
+	for(mRecordIt = 0; mRecordIt < mRecords.size(); ++mRecordIt) {
+	  if (opType.mPredicate &&
+	      0 == opType.mPredicate->execute(mRecords[mRecordIt], 
+					      RecordBuffer(), 
+					      mRuntimeContext)) {
+	    opType.mFree.free(mRecords[mRecordIt]);
+	    continue;
+	  }
+	  requestWrite(0);
+	  mState = WRITE;
+	  return;
+	case WRITE:
+	  if (opType.mTransfer) {
+	    RecordBuffer output;
+	    opType.mTransfer->execute(mRecords[mRecordIt], output, 
+				      mRuntimeContext, true);
+	    opType.mFree.free(mRecords[mRecordIt]);
+	    write(port, output, false);
+	  } else {
+	    write(port, mRecords[mRecordIt], false);
+	  }
+	}
+	mRecords.clear();
+	mRecordIt = 0;
+      }
+      requestWrite(0);
+      mState = WRITE_EOF;
+      return;
+    case WRITE_EOF:
+      write(port, RecordBuffer(), true);
+      return;
+    }
+  }
+
+  void shutdown()
+  {
+    if (mFile != -1) {
+      ::close(mFile);
+      mFile = -1;
+    }
+  }
+};
+
+RuntimeColumnarReadOperatorType::RuntimeColumnarReadOperatorType(const std::string& file,
+								 const RecordType * format,
+								 const RecordType * scan,
+								 const ZoneMapPredicate& zoneMap,
+								 const RecordTypeFunction * pred,
+								 const RecordTypeTransfer * transfer)
+  :
+  RuntimeOperatorType("RuntimeColumnarReadOperatorType"),
+  mFile(file),
+  mMalloc(scan->getMalloc()),
+  mFree(scan->getFree()),
+  mZoneMap(zoneMap),
+  mPredicate(pred ? pred->create() : NULL),
+  mTransfer(transfer ? transfer->create() : NULL)
+{
+  int32_t column = 0;
+  for(RecordType::const_member_iterator m = format->begin_members();
+      m != format->end_members(); ++m, ++column) {
+    mColumnTypes.push_back(m->GetType()->GetEnum());
+    if (scan->hasMember(m->GetName())) {
+      mFields.push_back(ColumnarFile::Field(scan, m->GetName(), column));
+    }
+  }
+}
+
+RuntimeColumnarReadOperatorType::~RuntimeColumnarReadOperatorType()
+{
+  delete mPredicate;
+  delete mTransfer;
+}
+
+RuntimeOperator * RuntimeColumnarReadOperatorType::create(RuntimeOperator::Services & s) const
+{
+  return new RuntimeColumnarReadOperator(s, *this);
+}
@@ -0,0 +1,264 @@
+/**
+ * Copyright (c) 2012, Akamai Technologies
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * 
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ * 
+ *   Neither the name of the Akamai Technologies nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if !defined(__COLUMNARFILE_HH)
+#define __COLUMNARFILE_HH
+
+#include <string>
+#include <vector>
+#include "RuntimeOperator.hh"
+#include "ZoneMap.hh"
+
+/**
+ * Native columnar file format.
+ *
+ * A file is a sequence of row groups followed by a footer:
+ *
+ * ["TRCF"][row group]...[footer][uint32 footer size]["TRCF"]
+ *
+ * A row group holds one chunk per column, in order, each for
+ * the same rows.  A chunk is a single page:
+ *
+ * [uint8 encoding][uint8 flags][uint32 raw size][uint32 stored size]
+ * [uint32 crc32 of stored bytes][stored bytes]
+ *
+ * If bit 0 of flags is set the stored bytes are zlib compressed. 
+ * Uncompressed, a chunk of a nullable column starts with a bitmap 
+ * of its NULLs followed by the non NULL values in the encoding
+ * chosen for the chunk:
+ *
+ * PLAIN: fixed size values verbatim, VARCHAR as length and bytes.
+ * DELTA: (integer types) zigzag varint differences from the 
+ * previous value.
+ * RLE: (integer types) pairs of zigzag varint value and run length.
+ * DICTIONARY: (VARCHAR and CHAR) the distinct values followed by
+ * run length encoded indexes into them.
+ *
+ * The footer records the type of each column and for each row 
+ * group its number of rows and the location and ColumnStatistics 
+ * of each chunk; readers use the statistics to skip row groups 
+ * that can't satisfy a predicate.  All integers are little endian.
+ */
+class ColumnarFile
+{
+public:
+  enum Encoding { PLAIN, DELTA, RLE, DICTIONARY };
+  enum { VERSION = 1, PAGE_HEADER_SIZE = 14 };
+  static const char * MAGIC;
+  static const uint32_t MAGIC_SIZE = 4;
+
+  /**
+   * Location of a chunk in the file.
+   */
+  class Chunk
+  {
+  public:
+    uint64_t mOffset;
+    uint64_t mSize;
+    ColumnStatistics mStatistics;
+  };
+
+  class RowGroup
+  {
+  public:
+    uint64_t mNumRows;
+    std::vector<Chunk> mChunks;
+  };
+
+  /**
+   * Column type tags and row group directory.
+   */
+  class Footer
+  {
+  public:
+    std::vector<int32_t> mColumnTypes;
+    std::vector<RowGroup> mRowGroups;
+    void write(std::string& out) const;
+    void read(const uint8_t * in, const uint8_t * end);
+    /**
+     * Statistics of every column in a row group.
+     */
+    void getStatistics(std::size_t rowGroup, 
+		       std::vector<ColumnStatistics>& stats) const;
+  };
+
+  /**
+   * A field of a record type read or written as a column.
+   */
+  class Field
+  {
+  public:
+    FieldAddress mAddress;
+    int32_t mType;
+    uint32_t mSize;
+    bool mNullable;
+    // Position of the column in the file.
+    int32_t mColumn;
+  private:
+    // Serialization
+    friend class boost::serialization::access;
+    template <class Archive>
+    void serialize(Archive & ar, const unsigned int version)
+    {
+      ar & BOOST_SERIALIZATION_NVP(mAddress);
+      ar & BOOST_SERIALIZATION_NVP(mType);
+      ar & BOOST_SERIALIZATION_NVP(mSize);
+      ar & BOOST_SERIALIZATION_NVP(mNullable);
+      ar & BOOST_SERIALIZATION_NVP(mColumn);
+    }
+  public:
+    Field()
+      :
+      mType(FieldType::INT32),
+      mSize(0),
+      mNullable(false),
+      mColumn(0)
+    {
+    }
+    Field(const RecordType * ty, const std::string& name, int32_t column);
+  };
+
+  /**
+   * Encode a field of a set of records as a chunk, appending to out
+   * and accumulating statistics.
+   */
+  static void encode(const Field& field, 
+		     const std::vector<RecordBuffer>& records,
+		     bool compress,
+		     std::string& out,
+		     ColumnStatistics& stats);
+  /**
+   * Decode a chunk into a field of a set of records.
+   * Throws if the chunk is corrupt.
+   */
+  static void decode(const Field& field,
+		     const uint8_t * begin,
+		     const uint8_t * end,
+		     const std::vector<RecordBuffer>& records);
+};
+
+class RuntimeColumnarWriteOperatorType : public RuntimeOperatorType
+{
+  friend class RuntimeColumnarWriteOperator;
+private:
+  RecordTypeFree mFree;
+  std::vector<ColumnarFile::Field> mFields;
+  std::string mFile;
+  int32_t mRowGroupSize;
+  bool mCompress;
+
+  // Serialization
+  friend class boost::serialization::access;
+  template <class Archive>
+  void serialize(Archive & ar, const unsigned int version)
+  {
+    ar & BOOST_SERIALIZATION_BASE_OBJECT_NVP(RuntimeOperatorType);
+    ar & BOOST_SERIALIZATION_NVP(mFree);
+    ar & BOOST_SERIALIZATION_NVP(mFields);
+    ar & BOOST_SERIALIZATION_NVP(mFile);
+    ar & BOOST_SERIALIZATION_NVP(mRowGroupSize);
+    ar & BOOST_SERIALIZATION_NVP(mCompress);
+  }
+  RuntimeColumnarWriteOperatorType()
+  {
+  }
+public:
+  RuntimeColumnarWriteOperatorType(const RecordType * input,
+				   const std::string& file,
+				   int32_t rowGroupSize,
+				   bool compress);
+  ~RuntimeColumnarWriteOperatorType();
+  RuntimeOperator * create(RuntimeOperator::Services & s) const;
+};
+
+/**
+ * Read a columnar file decoding only the fields of the output. 
+ * Row groups are spread across partitions and those that can't 
+ * satisfy the zone map predicate are skipped.  The remaining 
+ * records are filtered by the full predicate.  When the predicate 
+ * refers to fields not in the output, records are decoded into
+ * a wider scan type and transferred to the output.
+ */
+class RuntimeColumnarReadOperatorType : public RuntimeOperatorType
+{
+  friend class RuntimeColumnarReadOperator;
+private:
+  std::string mFile;
+  // Types of all columns in the file
+  std::vector<int32_t> mColumnTypes;
+  // Fields of the scan type
+  std::vector<ColumnarFile::Field> mFields;
+  RecordTypeMalloc mMalloc;
+  RecordTypeFree mFree;
+  ZoneMapPredicate mZoneMap;
+  IQLFunctionModule * mPredicate;
+  IQLTransferModule * mTransfer;
+
+  // Serialization
+  friend class boost::serialization::access;
+  template <class Archive>
+  void serialize(Archive & ar, const unsigned int version)
+  {
+    ar & BOOST_SERIALIZATION_BASE_OBJECT_NVP(RuntimeOperatorType);
+    ar & BOOST_SERIALIZATION_NVP(mFile);
+    ar & BOOST_SERIALIZATION_NVP(mColumnTypes);
+    ar & BOOST_SERIALIZATION_NVP(mFields);
+    ar & BOOST_SERIALIZATION_NVP(mMalloc);
+    ar & BOOST_SERIALIZATION_NVP(mFree);
+    ar & BOOST_SERIALIZATION_NVP(mZoneMap);
+    ar & BOOST_SERIALIZATION_NVP(mPredicate);
+    ar & BOOST_SERIALIZATION_NVP(mTransfer);
+  }
+  RuntimeColumnarReadOperatorType()
+    :
+    mPredicate(NULL),
+    mTransfer(NULL)
+  {
+  }
+public:
+  /**
+   * format is the type of the file, scan the fields to decode.  
+   * pred and transfer may be NULL.
+   */
+  RuntimeColumnarReadOperatorType(const std::string& file,
+				  const RecordType * format,
+				  const RecordType * scan,
+				  const ZoneMapPredicate& zoneMap,
+				  const RecordTypeFunction * pred,
+				  const RecordTypeTransfer * transfer);
+  ~RuntimeColumnarReadOperatorType();
+  RuntimeOperator * create(RuntimeOperator::Services & s) const;
+};
+
+#endif
@@ -0,0 +1,498 @@
+/**
+ * Copyright (c) 2012, Akamai Technologies
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * 
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ * 
+ *   Neither the name of the Akamai Technologies nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <vector>
+#include "zlib.h"
+#include "CompactOperator.hh"
+#include "FileSystem.hh"
+
+static inline void compactWriteUInt32(uint8_t * out, uint32_t val)
+{
+  out[0] = (uint8_t) val;
+  out[1] = (uint8_t) (val >> 8);
+  out[2] = (uint8_t) (val >> 16);
+  out[3] = (uint8_t) (val >> 24);
+}
+
+static inline uint32_t compactReadUInt32(const uint8_t * in)
+{
+  return ((uint32_t) in[0]) | (((uint32_t) in[1]) << 8) |
+    (((uint32_t) in[2]) << 16) | (((uint32_t) in[3]) << 24);
+}
+
+LogicalCompactEncode::LogicalCompactEncode()
+  :
+  LogicalOperator(1,1,1,1),
+  mStreamBlock(NULL),
+  mBlockSize(64*1024),
+  mCompress(false)
+{
+}
+
+LogicalCompactEncode::~LogicalCompactEncode()
+{
+}
+
+void LogicalCompactEncode::check(PlanCheckContext& ctxt)
+{
+  for(const_param_iterator it = begin_params();
+      it != end_params();
+      ++it) {
+    try {
+      if (it->equals("blockSize")) {
+	mBlockSize = getInt32Value(ctxt, *it);
+	if (mBlockSize <= 0) {
+	  ctxt.logError(*this, *it, "blockSize must be positive");
+	}
+      } else if (it->equals("compress")) {
+	mCompress = getBooleanValue(ctxt, *it);
+      } else {
+	checkDefaultParam(*it);
+      }
+    } catch(std::runtime_error& ex) {
+      ctxt.logError(*this, *it, ex.what());
+    }
+  }
+
+  // Room for a frame whether or not compression pays off.
+  int32_t capacity = RuntimeCompactEncodeOperatorType::FRAME_HEADER_SIZE +
+    (int32_t) ::compressBound((uLong) mBlockSize);
+  mStreamBlock = StreamBufferBlock::getStreamBufferType(ctxt, capacity);
+  getOutput(0)->setRecordType(mStreamBlock);
+}
+
+void LogicalCompactEncode::create(class RuntimePlanBuilder& plan)
+{
+  RuntimeOperatorType * opType = 
+    new RuntimeCompactEncodeOperatorType(getInput(0)->getRecordType(),
+					 mStreamBlock,
+					 mBlockSize,
+					 mCompress);
+  plan.addOperatorType(opType);
+  plan.mapInputPort(this, 0, opType, 0);  
+  plan.mapOutputPort(this, 0, opType, 0);  
+}
+
+LogicalCompactDecode::LogicalCompactDecode()
+  :
+  LogicalOperator(1,1,1,1),
+  mFormat(NULL)
+{
+}
+
+LogicalCompactDecode::~LogicalCompactDecode()
+{
+}
+
+void LogicalCompactDecode::check(PlanCheckContext& ctxt)
+{
+  const LogicalOperatorParam * formatParam=NULL;
+  for(const_param_iterator it = begin_params();
+      it != end_params();
+      ++it) {
+    try {
+      if (it->equals("format")) {
+	mStringFormat = getStringValue(ctxt, *it);
+	formatParam = &*it;
+      } else if (it->equals("formatfile")) {
+	std::string filename(getStringValue(ctxt, *it));
+	mStringFormat = FileSystem::readFile(filename);
+	formatParam = &*it;
+      } else {
+	checkDefaultParam(*it);
+      }
+    } catch(std::runtime_error& ex) {
+      ctxt.logError(*this, *it, ex.what());
+    }
+  }
+
+  if (!StreamBufferBlock::isStreamBufferType(getInput(0)->getRecordType())) {
+    ctxt.logError(*this, "Invalid type on input; must be stream type");
+  }
+
+  if (NULL == formatParam || 0==mStringFormat.size()) {
+    ctxt.logError(*this, "Must specify format argument");
+  } else {
+    try {
+      IQLRecordTypeBuilder bld(ctxt, mStringFormat, false);
+      mFormat = bld.getProduct();
+      getOutput(0)->setRecordType(mFormat);
+    } catch(std::exception& ex) {
+      ctxt.logError(*this, *formatParam, ex.what());
+    }
+  }
+}
+
+void LogicalCompactDecode::create(class RuntimePlanBuilder& plan)
+{
+  RuntimeOperatorType * opType = 
+    new RuntimeCompactDecodeOperatorType(getInput(0)->getRecordType(),
+					 mFormat);
+  plan.addOperatorType(opType);
+  plan.mapInputPort(this, 0, opType, 0);  
+  plan.mapOutputPort(this, 0, opType, 0);  
+}
+
+class RuntimeCompactEncodeOperator : public RuntimeOperatorBase<RuntimeCompactEncodeOperatorType>
+{
+private:
+  typedef RuntimeCompactEncodeOperatorType operator_type;
+
+  enum State { START, READ, WRITE, WRITE_LAST, WRITE_EOF };
+  State mState;
+  RecordBuffer mInput;
+  // Records of the current frame before compression
+  std::vector<uint8_t> mRaw;
+  uint8_t * mRawPtr;
+  uint32_t mNumRecords;
+  CompactStringDictionary mDictionary;
+
+  void resetFrame()
+  {
+    mRawPtr = &mRaw[0];
+    mNumRecords = 0;
+    mDictionary.clear();
+  }
+
+  /**
+   * Encode the next record into the current frame.
+   */
+  bool append()
+  {
+    if (getMyOperatorType().mSerialize.doit(mRawPtr, &mRaw[0] + mRaw.size(), 
+					    mInput, mDictionary)) {
+      getMyOperatorType().mFree.free(mInput);
+      mInput = RecordBuffer();
+      mNumRecords += 1;
+      return true;
+    }
+    return false;
+  }
+
+  /**
+   * Package the current frame into a stream block and start a new 
+   * frame.
+   */
+  RecordBuffer flush()
+  {
+    const StreamBufferBlock & block(getMyOperatorType().mStreamBlock);
+    RecordBuffer output = getMyOperatorType().mStreamMalloc.malloc();
+    uint8_t * header = block.begin(output);
+    uint8_t * payload = header + operator_type::FRAME_HEADER_SIZE;
+    uint32_t rawSize = (uint32_t) (mRawPtr - &mRaw[0]);
+    uLongf payloadSize = (uLongf) (block.capacity() - operator_type::FRAME_HEADER_SIZE);
+    uint8_t flags = 0;
+    if (getMyOperatorType().mCompress &&
+	Z_OK == ::compress2(payload, &payloadSize, &mRaw[0], rawSize, Z_BEST_SPEED) &&
+	payloadSize < rawSize) {
+      flags = 1;
+    } else {
+      // Not asked for or didn't pay off
+      memcpy(payload, &mRaw[0], rawSize);
+      payloadSize = rawSize;
+    }
+    compactWriteUInt32(header, (uint32_t) (operator_type::FRAME_HEADER_SIZE - 4 + payloadSize));
+    header[4] = flags;
+    compactWriteUInt32(header + 5, mNumRecords);
+    compactWriteUInt32(header + 9, rawSize);
+    block.setSize((int32_t) (operator_type::FRAME_HEADER_SIZE + payloadSize), output);
+    resetFrame();
+    return output;
+  }
+
+public:
+  RuntimeCompactEncodeOperator(RuntimeOperator::Services& services, 
+			       const RuntimeCompactEncodeOperatorType& opType)
+    :
+    RuntimeOperatorBase<RuntimeCompactEncodeOperatorType>(services, opType),
+    mState(START),
+    mRaw(opType.mBlockSize),
+    mRawPtr(NULL),
+    mNumRecords(0)
+  {
+  }
+
+  ~RuntimeCompactEncodeOperator()
+  {
+  }
+
+  void start()
+  {
+    resetFrame();
+    mState = START;
+    onEvent(NULL);
+  }
+
+  void onEvent(RuntimePort * port)
+  {
+    switch(mState) {
+    case START:
+      while(true) {
+	requestRead(0);
+	mState = READ;
+	return;
+      case READ:
+	read(port, mInput);
+	if (mInput == RecordBuffer()) {
+	  break;
+	}
+	if (!append()) {
+	  if (0 == mNumRecords) {
+	    throw std::runtime_error((boost::format("Record too large for encode "
+						    "blockSize %1%") % 
+				      getMyOperatorType().mBlockSize).str());
+	  }
+	  // Frame is full.  Send it along and retry the record in
+	  // a new one.
+	  requestWriteThrough(0);
+	  mState = WRITE;
+	  return;
+	case WRITE:
+	  write(port, flush(), true);
+	  if (!append()) {
+	    throw std::runtime_error((boost::format("Record too large for encode "
+						    "blockSize %1%") % 
+				      getMyOperatorType().mBlockSize).str());
+	  }
+	}
+      }
+      if (mNumRecords > 0) {
+	requestWriteThrough(0);
+	mState = WRITE_LAST;
+	return;
+      case WRITE_LAST:
+	write(port, flush(), true);
+      }
+      requestWrite(0);
+      mState = WRITE_EOF;
+      return;
+    case WRITE_EOF:
+      write(port, RecordBuffer(), true);
+      return;
+    }
+  }
+
+  void shutdown()
+  {
+  }
+};
+
+RuntimeCompactEncodeOperatorType::RuntimeCompactEncodeOperatorType(const RecordType * input,
+								   const RecordType * streamBlockTy,
+								   int32_t blockSize,
+								   bool compress)
+  :
+  RuntimeOperatorType("RuntimeCompactEncodeOperatorType"),
+  mFree(input->getFree()),
+  mSerialize(input->getCompactSerialize()),
+  mStreamMalloc(streamBlockTy->getMalloc()),
+  mStreamBlock(streamBlockTy),
+  mBlockSize(blockSize),
+  mCompress(compress)
+{
+}
+
+RuntimeCompactEncodeOperatorType::~RuntimeCompactEncodeOperatorType()
+{
+}
+
+RuntimeOperator * RuntimeCompactEncodeOperatorType::create(RuntimeOperator::Services & s) const
+{
+  return new RuntimeCompactEncodeOperator(s, *this);
+}
+
+class RuntimeCompactDecodeOperator : public RuntimeOperatorBase<RuntimeCompactDecodeOperatorType>
+{
+private:
+  typedef RuntimeCompactDecodeOperatorType operator_type;
+
+  enum State { START, READ, WRITE, WRITE_EOF };
+  State mState;
+  RecordBuffer mInput;
+  // Bytes received that have not been decoded.  Frames may
+  // span input blocks.
+  std::vector<uint8_t> mPending;
+  std::size_t mPendingOffset;
+  // Uncompressed payload of the current frame when compressed.
+  std::vector<uint8_t> mRaw;
+  // Records remaining in the current frame.
+  const uint8_t * mFramePtr;
+  const uint8_t * mFrameEnd;
+  uint32_t mRecordsLeft;
+  CompactStringDictionary mDictionary;
+
+  /**
+   * Set up the next complete frame in mPending for decoding.
+   * Returns false if there isn't one yet.
+   */
+  bool nextFrame()
+  {
+    std::size_t avail = mPending.size() - mPendingOffset;
+    if (avail < RuntimeCompactEncodeOperatorType::FRAME_HEADER_SIZE) {
+      return false;
+    }
+    const uint8_t * header = &mPending[mPendingOffset];
+    std::size_t frameSize = 4 + (std::size_t) compactReadUInt32(header);
+    if (frameSize < RuntimeCompactEncodeOperatorType::FRAME_HEADER_SIZE) {
+      throw std::runtime_error("Corrupt compact frame");
+    }
+    if (avail < frameSize) {
+      return false;
+    }
+    uint8_t flags = header[4];
+    mRecordsLeft = compactReadUInt32(header + 5);
+    uint32_t rawSize = compactReadUInt32(header + 9);
+    const uint8_t * payload = header + RuntimeCompactEncodeOperatorType::FRAME_HEADER_SIZE;
+    uLong payloadSize = (uLong) (frameSize - RuntimeCompactEncodeOperatorType::FRAME_HEADER_SIZE);
+    if (flags & 1) {
+      mRaw.resize(rawSize);
+      uLongf sz = (uLongf) rawSize;
+      int ret = ::uncompress(&mRaw[0], &sz, payload, payloadSize);
+      if (Z_OK != ret || sz != rawSize) {
+	throw std::runtime_error((boost::format("Error decompressing compact frame: "
+						"uncompress returned %1%") % ret).str());
+      }
+      mFramePtr = &mRaw[0];
+    } else {
+      if (payloadSize != rawSize) {
+	throw std::runtime_error("Corrupt compact frame");
+      }
+      mFramePtr = payload;
+    }
+    mFrameEnd = mFramePtr + rawSize;
+    mPendingOffset += frameSize;
+    mDictionary.clear();
+    return true;
+  }
+
+public:
+  RuntimeCompactDecodeOperator(RuntimeOperator::Services& services, 
+			       const RuntimeCompactDecodeOperatorType& opType)
+    :
+    RuntimeOperatorBase<RuntimeCompactDecodeOperatorType>(services, opType),
+    mState(START),
+    mPendingOffset(0),
+    mFramePtr(NULL),
+    mFrameEnd(NULL),
+    mRecordsLeft(0)
+  {
+  }
+
+  ~RuntimeCompactDecodeOperator()
+  {
+  }
+
+  void start()
+  {
+    mState = START;
+    onEvent(NULL);
+  }
+
+  void onEvent(RuntimePort * port)
+  {
+    switch(mState) {
+    case START:
+      while(true) {
+	requestRead(0);
+	mState = READ;
+	return;
+      case READ:
+	read(port, mInput);
+	if (mInput == RecordBuffer()) {
+	  break;
+	}
+	{
+	  const StreamBufferBlock & block(getMyOperatorType().mStreamBlock);
+	  mPending.insert(mPending.end(), block.begin(mInput), block.end(mInput));
+	  getMyOperatorType().mStreamFree.free(mInput);
+	  mInput = RecordBuffer();
+	}
+	while(nextFrame()) {
+	  while(mRecordsLeft > 0) {
+	    requestWrite(0);
+	    mState = WRITE;
+	    return;
+	  case WRITE:
+	    {
+	      RecordBuffer output = getMyOperatorType().mMalloc.malloc();
+	      getMyOperatorType().mDeserialize.doit(mFramePtr, mFrameEnd, 
+						    output, mDictionary);
+	      write(port, output, false);
+	    }
+	    mRecordsLeft -= 1;
+	  }
+	  if (mFramePtr != mFrameEnd) {
+	    throw std::runtime_error("Corrupt compact frame");
+	  }
+	}
+	// Done with complete frames; keep the partial one.
+	mPending.erase(mPending.begin(), mPending.begin() + mPendingOffset);
+	mPendingOffset = 0;
+      }
+      if (mPending.size()) {
+	throw std::runtime_error("Truncated compact frame at end of stream");
+      }
+      requestWrite(0);
+      mState = WRITE_EOF;
+      return;
+    case WRITE_EOF:
+      write(port, RecordBuffer(), true);
+      return;
+    }
+  }
+
+  void shutdown()
+  {
+  }
+};
+
+RuntimeCompactDecodeOperatorType::RuntimeCompactDecodeOperatorType(const RecordType * streamBlockTy,
+								   const RecordType * output)
+  :
+  RuntimeOperatorType("RuntimeCompactDecodeOperatorType"),
+  mStreamFree(streamBlockTy->getFree()),
+  mStreamBlock(streamBlockTy),
+  mMalloc(output->getMalloc()),
+  mDeserialize(output->getCompactDeserialize())
+{
+}
+
+RuntimeCompactDecodeOperatorType::~RuntimeCompactDecodeOperatorType()
+{
+}
+
+RuntimeOperator * RuntimeCompactDecodeOperatorType::create(RuntimeOperator::Services & s) const
+{
+  return new RuntimeCompactDecodeOperator(s, *this);
+}
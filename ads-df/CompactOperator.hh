@@ -0,0 +1,151 @@
+/**
+ * Copyright (c) 2012, Akamai Technologies
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * 
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ * 
+ *   Neither the name of the Akamai Technologies nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if !defined(__COMPACTOPERATOR_HH)
+#define __COMPACTOPERATOR_HH
+
+#include "RuntimeOperator.hh"
+#include "StreamBufferBlock.hh"
+
+/**
+ * Encode records into blocks of the compact record format (see
+ * RecordTypeCompactSerialize) for transfer with tcp_write.  Each 
+ * output block holds one frame:
+ *
+ * [uint32 length of rest of frame][uint8 flags][uint32 records]
+ * [uint32 uncompressed size][payload]
+ *
+ * Integers are little endian.  If bit 0 of flags is set the payload 
+ * is zlib compressed.  Every frame starts with an empty string 
+ * dictionary so frames may be decoded independently.
+ */
+class LogicalCompactEncode : public LogicalOperator
+{
+private:
+  const RecordType * mStreamBlock;
+  int32_t mBlockSize;
+  bool mCompress;
+public:
+  LogicalCompactEncode();
+  ~LogicalCompactEncode();
+  void check(PlanCheckContext& log);
+  void create(class RuntimePlanBuilder& plan);  
+};
+
+/**
+ * Decode a stream of compact record frames (e.g. from tcp_read)
+ * into records of the format given in the format or formatfile
+ * parameter.  The format must be the same as that of the encoder's
+ * input.
+ */
+class LogicalCompactDecode : public LogicalOperator
+{
+private:
+  const RecordType * mFormat;
+  std::string mStringFormat;
+public:
+  LogicalCompactDecode();
+  ~LogicalCompactDecode();
+  void check(PlanCheckContext& log);
+  void create(class RuntimePlanBuilder& plan);  
+};
+
+class RuntimeCompactEncodeOperatorType : public RuntimeOperatorType
+{
+  friend class RuntimeCompactEncodeOperator;
+private:
+  RecordTypeFree mFree;
+  RecordTypeCompactSerialize mSerialize;
+  RecordTypeMalloc mStreamMalloc;
+  StreamBufferBlock mStreamBlock;
+  int32_t mBlockSize;
+  bool mCompress;
+
+  // Serialization
+  friend class boost::serialization::access;
+  template <class Archive>
+  void serialize(Archive & ar, const unsigned int version)
+  {
+    ar & BOOST_SERIALIZATION_BASE_OBJECT_NVP(RuntimeOperatorType);
+    ar & BOOST_SERIALIZATION_NVP(mFree);
+    ar & BOOST_SERIALIZATION_NVP(mSerialize);
+    ar & BOOST_SERIALIZATION_NVP(mStreamMalloc);
+    ar & BOOST_SERIALIZATION_NVP(mStreamBlock);
+    ar & BOOST_SERIALIZATION_NVP(mBlockSize);
+    ar & BOOST_SERIALIZATION_NVP(mCompress);
+  }
+  RuntimeCompactEncodeOperatorType()
+  {
+  }
+public:
+  enum { FRAME_HEADER_SIZE = 13 };
+  RuntimeCompactEncodeOperatorType(const RecordType * input,
+				    const RecordType * streamBlockTy,
+				    int32_t blockSize,
+				    bool compress);
+  ~RuntimeCompactEncodeOperatorType();
+  RuntimeOperator * create(RuntimeOperator::Services & s) const;  
+};
+
+class RuntimeCompactDecodeOperatorType : public RuntimeOperatorType
+{
+  friend class RuntimeCompactDecodeOperator;
+private:
+  RecordTypeFree mStreamFree;
+  StreamBufferBlock mStreamBlock;
+  RecordTypeMalloc mMalloc;
+  RecordTypeCompactDeserialize mDeserialize;
+
+  // Serialization
+  friend class boost::serialization::access;
+  template <class Archive>
+  void serialize(Archive & ar, const unsigned int version)
+  {
+    ar & BOOST_SERIALIZATION_BASE_OBJECT_NVP(RuntimeOperatorType);
+    ar & BOOST_SERIALIZATION_NVP(mStreamFree);
+    ar & BOOST_SERIALIZATION_NVP(mStreamBlock);
+    ar & BOOST_SERIALIZATION_NVP(mMalloc);
+    ar & BOOST_SERIALIZATION_NVP(mDeserialize);
+  }
+  RuntimeCompactDecodeOperatorType()
+  {
+  }
+public:
+  RuntimeCompactDecodeOperatorType(const RecordType * streamBlockTy,
+				    const RecordType * output);
+  ~RuntimeCompactDecodeOperatorType();
+  RuntimeOperator * create(RuntimeOperator::Services & s) const;  
+};
+
+#endif
@@ -33,12 +33,15 @@
  */
 
 #include <iostream>
+#include <boost/algorithm/string/predicate.hpp>
 #include <boost/asio/io_service.hpp>
 #include <boost/assert.hpp>
 #include <boost/thread.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include "DataflowRuntime.hh"
 #include "RuntimeOperator.hh"
+#include "RuntimeMetrics.hh"
+#include "RuntimeTrace.hh"
 
 RuntimeOperatorProcess::RuntimeOperatorProcess(int32_t partitionStart, 
 					       int32_t partitionEnd,
@@ -60,6 +63,75 @@ RuntimeOperatorProcess::~RuntimeOperatorProcess()
 {
 }
 
+DataflowSchedulerPolicy::DataflowSchedulerPolicy()
+  :
+  mTarget(FIXED),
+  mPollIntervalNanos(0)
+{
+}
+
+DataflowSchedulerPolicy& DataflowSchedulerPolicy::get()
+{
+  static DataflowSchedulerPolicy policy;
+  return policy;
+}
+
+bool DataflowSchedulerPolicy::setTarget(const std::string& target)
+{
+  if (boost::algorithm::iequals(target, "fixed")) {
+    mTarget = FIXED;
+  } else if (boost::algorithm::iequals(target, "latency")) {
+    mTarget = LATENCY;
+  } else if (boost::algorithm::iequals(target, "throughput")) {
+    mTarget = THROUGHPUT;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+uint64_t DataflowSchedulerPolicy::getPollIntervalNanos() const
+{
+  if (mPollIntervalNanos) {
+    return mPollIntervalNanos;
+  }
+  return mTarget == LATENCY ? 200*1000 : 5*1000*1000;
+}
+
+int64_t DataflowSchedulerPolicy::getMinIterations() const
+{
+  switch(mTarget) {
+  case LATENCY:
+    return 64;
+  case THROUGHPUT:
+    return 1000;
+  default:
+    return 10000;
+  }
+}
+
+int64_t DataflowSchedulerPolicy::getMaxIterations() const
+{
+  switch(mTarget) {
+  case LATENCY:
+    return 10000;
+  case THROUGHPUT:
+    return 1000000;
+  default:
+    return 10000;
+  }
+}
+
+uint64_t DataflowSchedulerPolicy::getMinWritesBeforeYield() const
+{
+  return mTarget == LATENCY ? 14 : 14*10;
+}
+
+uint64_t DataflowSchedulerPolicy::getMaxWritesBeforeYield() const
+{
+  return mTarget == THROUGHPUT ? 14*80 : 14*10;
+}
+
 DataflowScheduler::DataflowScheduler(int32_t partition, int32_t numPartitions)
   :
   mState(INITIALIZED),
@@ -68,14 +140,47 @@ DataflowScheduler::DataflowScheduler(int32_t partition, int32_t numPartitions)
   mNumPartitions(numPartitions),
   mCurrentPort(NULL),
   mMaxWritesBeforeYield(14*10),
+  mIterationsBeforePoll(10000),
+  mAdaptive(false),
+  mPollIntervalNanos(0),
+  mMinIterations(10000),
+  mMaxIterations(10000),
+  mMinWritesBeforeYield(14*10),
+  mMaxWritesBeforeYieldLimit(14*10),
   mIOService(NULL),
   mNumIOPoll(0),
   mNumInternalWriteBufferFlush(0),
-  mNumIOWaits(0)
+  mNumIOWaits(0),
+  mNumIOCompletions(0),
+  mCollectTicks(false),
+  mTrace(NULL),
+  mTraceFlushName(0),
+  mTraceIOWaitName(0),
+  mTraceYield(RuntimeTraceBuffer::NONE)
 {
   mQueues[0].mMask = 0;
   mQueues[1].mMask = 0;
+  const DataflowSchedulerPolicy& policy(DataflowSchedulerPolicy::get());
+  if (policy.getTarget() != DataflowSchedulerPolicy::FIXED) {
+    mAdaptive = true;
+    mPollIntervalNanos = policy.getPollIntervalNanos();
+    mMinIterations = policy.getMinIterations();
+    mMaxIterations = policy.getMaxIterations();
+    mMinWritesBeforeYield = policy.getMinWritesBeforeYield();
+    mMaxWritesBeforeYieldLimit = policy.getMaxWritesBeforeYield();
+    mIterationsBeforePoll = std::min(std::max(mIterationsBeforePoll, 
+					      mMinIterations), 
+				     mMaxIterations);
+    mMaxWritesBeforeYield = std::min(std::max(mMaxWritesBeforeYield, 
+					      mMinWritesBeforeYield), 
+				     mMaxWritesBeforeYieldLimit);
+  }
   mIOService = new boost::asio::io_service();
+  mTrace = RuntimeTrace::get().createBuffer(partition);
+  if (mTrace) {
+    mTraceFlushName = RuntimeTrace::get().intern("flush");
+    mTraceIOWaitName = RuntimeTrace::get().intern("io_wait");
+  }
 }
 
 DataflowScheduler::~DataflowScheduler()
@@ -115,8 +220,54 @@ void DataflowScheduler::cleanup()
   mDisabled.clear();
 }
 
+uint32_t DataflowScheduler::getTraceName(RuntimeOperator & op)
+{
+  if (0 == op.getTraceName()) {
+    op.setTraceName(RuntimeTrace::get().intern(op.getName()));
+  }
+  return op.getTraceName();
+}
+
+void DataflowScheduler::traceRequest(RuntimePort * ports)
+{
+  // Classify the request: reads, writes, a mix of the two 
+  // (requestIO) or a wait for a service completion.
+  uint16_t reason = RuntimeTraceBuffer::NONE;
+  RuntimePort * it = ports;
+  do {
+    uint16_t r = RuntimeTraceBuffer::WRITE;
+    if (it->getPortType() == RuntimePort::TARGET) {
+      r = RuntimeTraceBuffer::READ;
+      RuntimeOperator & op(it->getOperator());
+      for(RuntimeOperator::completion_port_iterator c = op.completion_port_begin();
+	  c != op.completion_port_end();
+	  ++c) {
+	if (*c == it) {
+	  r = RuntimeTraceBuffer::COMPLETION;
+	  break;
+	}
+      }
+    }
+    reason = (reason == RuntimeTraceBuffer::NONE || reason == r) ? 
+      r : RuntimeTraceBuffer::READ_WRITE;
+    it = it->request_next();
+  } while (it != ports);
+  mTraceYield = reason;
+  mTrace->record(RuntimeTraceBuffer::REQUEST_IO, 
+		 getTraceName(ports->getOperator()),
+		 RuntimeTraceBuffer::now(), 0,
+		 (RuntimeTraceBuffer::Reason) reason);
+}
+
 void DataflowScheduler::runOperator(RuntimePort & port)
 {
+  uint64_t traceStart = 0;
+  uint32_t traceName = 0;
+  if (mTrace) {
+    traceStart = RuntimeTraceBuffer::now();
+    traceName = getTraceName(port.getOperator());
+    mTraceYield = RuntimeTraceBuffer::NONE;
+  }
   // Either there is new data on port to read or there is data on port to flush.
   // This also has the important side effect of clearing the read/write request 
   // that lead to this operator being scheduled.
@@ -158,6 +309,12 @@ void DataflowScheduler::runOperator(RuntimePort & port)
     internalRequestFlush(port);
     port->sync();
   }
+
+  if (mTrace) {
+    mTrace->record(RuntimeTraceBuffer::RUN_OPERATOR, traceName,
+		   traceStart, RuntimeTraceBuffer::now() - traceStart,
+		   (RuntimeTraceBuffer::Reason) mTraceYield);
+  }
 }
 
 void DataflowScheduler::writeAndSync(RuntimePort * port, RecordBuffer buf)
@@ -173,6 +330,9 @@ void DataflowScheduler::writeAndSync(RuntimePort * port, RecordBuffer buf)
 void DataflowScheduler::internalRequestIO(RuntimePort * ports)
 {
   // TODO: Add assertions
+  if (mTrace) {
+    traceRequest(ports);
+  }
   boost::mutex::scoped_lock sl(mLock);
   RuntimePort * it = ports;
   do {
@@ -235,6 +395,7 @@ return (uint64_t)hi << 32 | lo;
 
 void DataflowScheduler::init()
 {
+  mCollectTicks = RuntimeMetrics::get().isEnabled();
   // Gentlemen, start you're engines...
   start(mOperators.begin(), mOperators.end());
 }
@@ -270,12 +431,14 @@ DataflowScheduler::runSome(int64_t maxIterations)
     if (!zeroFlag && bitOffset > 0) {
       BOOST_ASSERT(!mQueues[0].mQueues[bitOffset].empty());
       RuntimePort& port(mQueues[0].mQueues[bitOffset].front());
-      // RuntimeOperator& op(port.getOperator());
       mLock.unlock();
-      {
-	// uint64_t tick = rdtsc();
+      if (mCollectTicks) {
+	RuntimeOperator& op(port.getOperator());
+	uint64_t tick = rdtsc();
+	runOperator(port);
+	op.addTicks(rdtsc()-tick);
+      } else {
 	runOperator(port);
-	// op.addTicks(rdtsc()-tick);
       }
       continue;
     }
@@ -290,13 +453,14 @@ DataflowScheduler::runSome(int64_t maxIterations)
     if(!zeroFlag && bitOffset>0) {
       BOOST_ASSERT(!mQueues[1].mQueues[bitOffset].empty());
       RuntimePort& port(mQueues[1].mQueues[bitOffset].front());
-      // RuntimeOperator& op(port.getOperator());
       mLock.unlock();
-
-      {
-	// uint64_t tick = rdtsc();
+      if (mCollectTicks) {
+	RuntimeOperator& op(port.getOperator());
+	uint64_t tick = rdtsc();
+	runOperator(port);
+	op.addTicks(rdtsc()-tick);
+      } else {
 	runOperator(port);
-	// op.addTicks(rdtsc()-tick);
       }
       continue;
     }
@@ -344,6 +508,36 @@ void DataflowScheduler::complete()
   }
 }
 
+void DataflowScheduler::adaptToPoll(uint64_t elapsed, std::size_t ioBacklog)
+{
+  if (elapsed > mPollIntervalNanos) {
+    // IO completions (if any) waited too long.  Scale the
+    // run down to what would have met the interval.
+    mIterationsBeforePoll = std::max(mMinIterations, 
+				     (int64_t) ((mIterationsBeforePoll*mPollIntervalNanos)/elapsed));
+  } else if (0 == ioBacklog) {
+    // Nothing is waiting on us: run longer (but not past the interval)
+    // and let operators write bigger batches before yielding.
+    int64_t limit = elapsed ? 
+      (int64_t) ((mIterationsBeforePoll*mPollIntervalNanos)/elapsed) : 
+      mMaxIterations;
+    mIterationsBeforePoll = std::min(std::min(2*mIterationsBeforePoll, limit), 
+				     mMaxIterations);
+    mMaxWritesBeforeYield = std::min(2*mMaxWritesBeforeYield, 
+				     mMaxWritesBeforeYieldLimit);
+  }
+  // If IO completions were waiting but were serviced within the
+  // interval the run length is right.
+}
+
+void DataflowScheduler::adaptToFlush()
+{
+  // We starved with records stuck in port buffers; downstream
+  // operators would have rather had them sooner.
+  mMaxWritesBeforeYield = std::max(mMaxWritesBeforeYield/2, 
+				   mMinWritesBeforeYield);
+}
+
 void DataflowScheduler::run()
 {
   init();
@@ -351,8 +545,10 @@ void DataflowScheduler::run()
     // The trick here is to pick a number of dataflow requests
     // to process before running a poll so that we do
     // not degrade performance but still service IO with
-    // acceptable latency.
-    RunCompletion ret = runSome(10000);
+    // acceptable latency.  Unless the policy is fixed, this
+    // number is adapted to what we see at each poll.
+    uint64_t runStart = mAdaptive ? RuntimeTraceBuffer::now() : 0;
+    RunCompletion ret = runSome(mIterationsBeforePoll);
     if (ret == NO_REQUESTS_OUTSTANDING) {
       break;
     }
@@ -363,6 +559,10 @@ void DataflowScheduler::run()
     // due to IO waits.  Could also opt to busy wait (poll multiple
     // times) for a bit before giving up.
     std::size_t processed = mIOService->poll();
+    mNumIOCompletions += processed;
+    if (mAdaptive && MAX_ITERATIONS_REACHED == ret) {
+      adaptToPoll(RuntimeTraceBuffer::now() - runStart, processed);
+    }
     if (0 != processed || MAX_ITERATIONS_REACHED == ret) {
       // An IO completed or there are dataflow ops
       // outstanding so try to run operators again
@@ -385,6 +585,9 @@ void DataflowScheduler::run()
     // flush buffers.
     if (flushSomePortBuffers()) {
       mNumInternalWriteBufferFlush += 1;
+      if (mAdaptive) {
+	adaptToFlush();
+      }
       continue;
     }
 
@@ -392,10 +595,16 @@ void DataflowScheduler::run()
     // Only block on the first request because it 
     // will likely result in us having more work to do while subsequent 
     // IO's may not be ready yet and we shouldn't need to wait for them.
-    mIOService->run_one();
-    mIOService->poll();
+    uint64_t traceStart = mTrace ? RuntimeTraceBuffer::now() : 0;
+    mNumIOCompletions += mIOService->run_one();
+    mNumIOCompletions += mIOService->poll();
     mIOService->reset();
     mNumIOWaits += 1;
+    if (mTrace) {
+      mTrace->record(RuntimeTraceBuffer::IO_WAIT, mTraceIOWaitName,
+		     traceStart, RuntimeTraceBuffer::now() - traceStart,
+		     RuntimeTraceBuffer::NONE);
+    }
     // TODO: Should spin for a bit and then wait in an
     // alertable state.
     // if (0 == --spins) {
@@ -442,15 +651,26 @@ bool DataflowScheduler::flushSomePortBuffers()
   // iterating on a shared queue is much more complicated.
   // Note we do not have to lock the disabled ports since it
   // is state owned exclusively by this scheduler.  
+  uint64_t traceStart = mTrace ? RuntimeTraceBuffer::now() : 0;
   for(RuntimePort::SchedulerQueue::iterator p = mDisabled.begin(),
 	e = mDisabled.end(); p != e; ++p) {
     if (p->flush() != 0) {
       // RuntimeOperator& op(p->getOperator());
       // std::cout << "Successfully flushed a local write buffer" <<
       // 	" on operator: " << op.getName().c_str() << std::endl;
+      if (mTrace) {
+	mTrace->record(RuntimeTraceBuffer::FLUSH, getTraceName(p->getOperator()),
+		       traceStart, RuntimeTraceBuffer::now() - traceStart,
+		       RuntimeTraceBuffer::WRITE);
+      }
       return true;
     }
   }
+  if (mTrace) {
+    mTrace->record(RuntimeTraceBuffer::FLUSH, mTraceFlushName,
+		   traceStart, RuntimeTraceBuffer::now() - traceStart,
+		   RuntimeTraceBuffer::NONE);
+  }
   return false;
 }
 
@@ -496,6 +716,13 @@ void DataflowScheduler::ioComplete(RuntimePort & ports)
     mRequestsOutstanding -= 1;
     mDisabled.push_back(port);
     port.setDisabled();
+    if (mTrace) {
+      mTrace->record(RuntimeTraceBuffer::IO_COMPLETE, 
+		     getTraceName(port.getOperator()),
+		     RuntimeTraceBuffer::now(), 0,
+		     port.getPortType() == RuntimePort::SOURCE ? 
+		     RuntimeTraceBuffer::WRITE : RuntimeTraceBuffer::READ);
+    }
     it = it->request_next();
   } while(it != &ports);
 }
@@ -577,6 +804,7 @@ uint64_t InProcessFifo::flush(InProcessPort<InProcessFifo> & port)
 					      mTargetScheduler);
     uint64_t sz = mSource->getLocalBuffer().getSize();
     if (sz != 0) {
+      mRecordsRead += sz;
       mSource->getLocalBuffer().popAndPushAllTo(mQueue);
       mTargetScheduler.reprioritizeReadRequest(*mTarget); 
     }
@@ -591,7 +819,6 @@ void InProcessFifo::writeSomeToPort()
   // Move data into the target port.
   // Clear the associated read request in the target port's scheduler
   // Possibly reprioritize a pending request on the source port's scheduler
-  // TODO: Update statistics on RecordsRead
   // TODO: Eliminate the call to reprioritze (and the corresponding lock)
   // if the priority hasn't changed.
   boost::mutex::scoped_lock channelGuard(mLock);
@@ -606,16 +833,23 @@ void InProcessFifo::readAllFromPort()
   // Move data from the target port.
   // Clear the associated write request in the source port's scheduler
   // Possibly reprioritize a pending request on the target port's scheduler
-  // TODO: Update statistics on RecordsRead
   // TODO: Eliminate the call to reprioritze (and the corresponding lock)
   // if the priority hasn't changed.
   boost::mutex::scoped_lock channelGuard(mLock);
   TwoDataflowSchedulerScopedLock schedGuard(mSourceScheduler, mTargetScheduler);
+  mRecordsRead += mSource->getLocalBuffer().getSize();
   mSource->getLocalBuffer().popAndPushAllTo(mQueue);
   mSourceScheduler.writeComplete(*mSource);
   mTargetScheduler.reprioritizeReadRequest(*mTarget); 
 }
 
+void InProcessFifo::getStatistics(uint64_t& recordsRead, uint64_t& queueSize)
+{
+  boost::mutex::scoped_lock channelGuard(mLock);
+  recordsRead = mRecordsRead;
+  queueSize = mQueue.getSize();
+}
+
 // class MemcpyStateMachine
 // {
 // private:
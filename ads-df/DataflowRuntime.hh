@@ -35,6 +35,7 @@
 #if !defined(__DATAFLOW_RUNTIME_HH)
 #define __DATAFLOW_RUNTIME_HH
 
+#include <string>
 #include <vector>
 #include <list>
 
@@ -50,6 +51,7 @@ class RuntimePort;
 class RuntimeOperator;
 class InProcessFifo;
 class DataflowScheduler;
+class RuntimeTraceBuffer;
 
 /**
  * A runtime operator process contains a collection of partitions that
@@ -234,6 +236,12 @@ public:
   {
     mBuffered = buffered;
   }
+
+  /**
+   * Total number of records that have entered the channel and the
+   * number of records currently queued in it.
+   */
+  void getStatistics(uint64_t& recordsRead, uint64_t& queueSize);
 };
 
 /**
@@ -458,6 +466,61 @@ public:
  * TODO: Figure out whether it is worth implementing this.
  */
 
+/**
+ * How schedulers trade latency of IO completions and of records
+ * sitting in port buffers against uninterrupted operator runs.
+ * FIXED is the classic behavior: a poll for IO every 10000 
+ * operator invocations and yield after 140 buffered writes.
+ * LATENCY and THROUGHPUT adapt both to observed IO completion backlog
+ * and port buffer flushes, aiming for a wall clock interval between
+ * IO polls (short for LATENCY, long for THROUGHPUT).  Configured 
+ * once per process before schedulers are created.
+ */
+class DataflowSchedulerPolicy
+{
+public:
+  enum Target { FIXED, LATENCY, THROUGHPUT };
+private:
+  Target mTarget;
+  uint64_t mPollIntervalNanos;
+  DataflowSchedulerPolicy();
+public:
+  static DataflowSchedulerPolicy& get();
+  Target getTarget() const
+  {
+    return mTarget;
+  }
+  /**
+   * Set the target; returns false if the name isn't one of 
+   * fixed, latency or throughput.
+   */
+  bool setTarget(const std::string& target);
+  void setTarget(Target target)
+  {
+    mTarget = target;
+  }
+  /**
+   * Wall clock time between IO polls the adaptive policy aims for.
+   * If not set explicitly this depends on the target.
+   */
+  uint64_t getPollIntervalNanos() const;
+  void setPollIntervalMicros(uint64_t micros)
+  {
+    mPollIntervalNanos = 1000*micros;
+  }
+  /**
+   * Bounds on the number of operator invocations between IO polls.
+   */
+  int64_t getMinIterations() const;
+  int64_t getMaxIterations() const;
+  /**
+   * Bounds on the number of records buffered in a port before
+   * the writing operator yields.
+   */
+  uint64_t getMinWritesBeforeYield() const;
+  uint64_t getMaxWritesBeforeYield() const;
+};
+
 /**
  * An operator scheduler manages a collection of runtime operators
  * and decides when they run.  It does this by carefully managing the
@@ -467,6 +530,8 @@ public:
 class DataflowScheduler {
   friend class DataflowSchedulerScopedLock;
   friend class TwoDataflowSchedulerScopedLock;
+  // Unit tests drive the adaptive tuning directly.
+  friend class DataflowSchedulerTest;
 private:
 
   /**
@@ -589,6 +654,19 @@ private:
    */
   uint64_t mMaxWritesBeforeYield;
 
+  /**
+   * Number of operator invocations between polls for IO completions.
+   * Along with mMaxWritesBeforeYield this is tuned between IO polls 
+   * unless the policy target is FIXED.
+   */
+  int64_t mIterationsBeforePoll;
+  bool mAdaptive;
+  uint64_t mPollIntervalNanos;
+  int64_t mMinIterations;
+  int64_t mMaxIterations;
+  uint64_t mMinWritesBeforeYield;
+  uint64_t mMaxWritesBeforeYieldLimit;
+
   /**
    * Asynchronous IO Service object 
    *
@@ -639,6 +717,29 @@ private:
   std::size_t mNumIOPoll;
   std::size_t mNumInternalWriteBufferFlush;
   std::size_t mNumIOWaits;
+  std::size_t mNumIOCompletions;
+
+  /**
+   * Whether to accumulate TSC ticks spent in each operator.  Sampled
+   * from RuntimeMetrics at init since reading the TSC is not free.
+   */
+  bool mCollectTicks;
+
+  /**
+   * Event trace; NULL unless tracing is enabled.  mTraceYield
+   * remembers the kind of the last request queued by an operator so
+   * that we can say why it yielded.
+   */
+  RuntimeTraceBuffer * mTrace;
+  uint32_t mTraceFlushName;
+  uint32_t mTraceIOWaitName;
+  uint16_t mTraceYield;
+
+  /**
+   * Trace helpers; only called when mTrace is not NULL.
+   */
+  uint32_t getTraceName(RuntimeOperator & op);
+  void traceRequest(RuntimePort * ports);
 
   /** 
    * Run an operator for a bit of time.
@@ -663,6 +764,17 @@ private:
 
   void ioComplete(RuntimePort & ports);
 
+  /**
+   * Tune mIterationsBeforePoll and mMaxWritesBeforeYield after
+   * running for elapsed nanoseconds and finding ioBacklog
+   * completed IOs waiting.
+   */
+  void adaptToPoll(uint64_t elapsed, std::size_t ioBacklog);
+  /**
+   * Tune after blocking with records left in port buffers.
+   */
+  void adaptToFlush();
+
 public:
   DataflowScheduler(int32_t partition=0, int32_t numPartitions=1);
   ~DataflowScheduler();
@@ -676,6 +788,34 @@ public:
   {
     return mNumPartitions;
   }
+  std::size_t getNumIOPoll() const
+  {
+    return mNumIOPoll;
+  }
+  std::size_t getNumInternalWriteBufferFlush() const
+  {
+    return mNumInternalWriteBufferFlush;
+  }
+  std::size_t getNumIOWaits() const
+  {
+    return mNumIOWaits;
+  }
+  std::size_t getNumIOCompletions() const
+  {
+    return mNumIOCompletions;
+  }
+  int64_t getIterationsBeforePoll() const
+  {
+    return mIterationsBeforePoll;
+  }
+  uint64_t getMaxWritesBeforeYield() const
+  {
+    return mMaxWritesBeforeYield;
+  }
+  int32_t getRequestsOutstanding() const
+  {
+    return mRequestsOutstanding;
+  }
   // TODO: Fix this API.
   void setOperator(RuntimeOperator * op);
   template <typename _InputIterator>
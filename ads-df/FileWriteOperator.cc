@@ -124,6 +124,9 @@ private:
   AsyncWriter<RuntimeWriteOperator> mWriter;
   boost::thread * mWriterThread;
   int64_t mRead;
+  std::vector<ColumnStatistics> mStatistics;
+
+  void writeStatistics();
 public:
   RuntimeWriteOperator(RuntimeOperator::Services& services, const RuntimeOperatorType& opType);
   ~RuntimeWriteOperator();
@@ -170,6 +173,9 @@ void RuntimeWriteOperator::start()
     if (mFile == -1) {
       throw std::runtime_error("Couldn't create file");
     }
+    if (getWriteType().mStatistics) {
+      getWriteType().mStatistics->init(mStatistics);
+    }
   }
   // Start a thread that will write
   mWriterThread = new boost::thread(boost::bind(&AsyncWriter<RuntimeWriteOperator>::run, 
@@ -199,6 +205,9 @@ void RuntimeWriteOperator::writeToHdfs(RecordBuffer input, bool isEOS)
   }
   if (!isEOS) {
     mPrinter.print(input, true);
+    if (getWriteType().mStatistics && mFile != STDOUT_FILENO) {
+      getWriteType().mStatistics->add(input, mStatistics);
+    }
     getWriteType().mFree.free(input);
     if (mCompressor) {
       mCompressor->put((const uint8_t *) mPrinter.c_str(), mPrinter.size(), 
@@ -233,11 +242,29 @@ void RuntimeWriteOperator::writeToHdfs(RecordBuffer input, bool isEOS)
     // Clean close of file and file system
     if (mFile != STDOUT_FILENO) {
       ::close(mFile);
+      if (getWriteType().mStatistics) {
+	writeStatistics();
+      }
     }
     mFile = -1;
   }
 }
 
+void RuntimeWriteOperator::writeStatistics()
+{
+  std::string buf;
+  getWriteType().mStatistics->write(mStatistics, buf);
+  std::string fileName(getWriteType().mFile + RecordTypeStatistics::SUFFIX);
+  std::ofstream statsFile(fileName.c_str(), 
+			  std::ios_base::out | std::ios_base::binary);
+  statsFile.write(buf.c_str(), buf.size());
+  statsFile.flush();
+  if (!statsFile) {
+    throw std::runtime_error((boost::format("Couldn't write statistics file %1%") %
+			      fileName).str());
+  }
+}
+
 void RuntimeWriteOperator::onEvent(RuntimePort * port)
 {
   switch(mState) {
@@ -551,14 +578,29 @@ void HdfsFileRename::dispose()
   }
 }
 
+/**
+ * Path of the statistics sidecar of a file.
+ */
+static PathPtr getStatisticsPath(PathPtr p)
+{
+  return Path::get(p->toString() + RecordTypeStatistics::SUFFIX);
+}
+
 class OutputFile
 {
 public:
   WritableFile * File;
   ZLibCompress Compressor;
+  // Statistics of the records in the file and the sidecar
+  // they are written to (NULL if not collecting).
+  const RecordTypeStatistics * StatisticsType;
+  std::vector<ColumnStatistics> Statistics;
+  WritableFile * StatisticsFile;
   OutputFile(WritableFile * f) 
     :
-    File(f)
+    File(f),
+    StatisticsType(NULL),
+    StatisticsFile(NULL)
   {
   }
   ~OutputFile()
@@ -582,6 +624,12 @@ public:
     }    
     // Flush data to disk
     this->File->flush();
+    if (this->StatisticsFile != NULL) {
+      std::string buf;
+      this->StatisticsType->write(this->Statistics, buf);
+      this->StatisticsFile->write((const uint8_t *) buf.c_str(), buf.size());
+      this->StatisticsFile->flush();
+    }
   }
   bool close() {
     // Clean close of file 
@@ -591,6 +639,11 @@ public:
       delete File;
       File = NULL;
     }
+    if (StatisticsFile != NULL) {
+      ret = StatisticsFile->close() && ret;
+      delete StatisticsFile;
+      StatisticsFile = NULL;
+    }
     return ret;
   }
 };
@@ -727,6 +780,13 @@ public:
    * Create a file
    */
   OutputFile * createFile(PathPtr filePath);
+  /**
+   * Does each file get a statistics sidecar?
+   */
+  bool hasStatistics()
+  {
+    return getMyOperatorType().mStatistics != NULL;
+  }
 };
 
 MultiFileCreationPolicy::MultiFileCreationPolicy()
@@ -815,6 +875,11 @@ OutputFile * MultiFileCreation::createFile(const std::string& filePath,
   mCommitter->track(tempPath, 
 		    Path::get(mRootUri, permFile.str()), 
 		    mGenericFileSystem);
+  if (factory->hasStatistics()) {
+    mCommitter->track(getStatisticsPath(tempPath),
+		      getStatisticsPath(Path::get(mRootUri, permFile.str())),
+		      mGenericFileSystem);
+  }
   // Call back to the factory to actually create the file
   OutputFile * of = factory->createFile(tempPath);
   add(filePath, of);
@@ -987,6 +1052,7 @@ void StreamingFileCreation::close(bool flush)
     if (flush) {
       mCurrentFile->flush();
     }
+    bool hasStatistics = mCurrentFile->StatisticsType != NULL;
     mCurrentFile->close();
     delete mCurrentFile;
     mCurrentFile = NULL;
@@ -994,6 +1060,10 @@ void StreamingFileCreation::close(bool flush)
     if (flush && NULL != mTempPath.get() && 
 	NULL != mFinalPath.get()) {
       // Put the file in its final place; don't wait for commit
+      if (hasStatistics) {
+	mGenericFileSystem->rename(getStatisticsPath(mTempPath), 
+				   getStatisticsPath(mFinalPath));
+      }
       mGenericFileSystem->rename(mTempPath, mFinalPath);
       // TODO: Error!!!!  Queue this up for a retry.
       mTempPath = mFinalPath = PathPtr();
@@ -1043,6 +1113,12 @@ OutputFile * RuntimeHdfsWriteOperator::createFile(PathPtr filePath)
   // TODO: Make sure file is cleaned up in case of failure.
   WritableFile * f = getMyOperatorType().mFileFactory->openForWrite(filePath);
   OutputFile * of = new OutputFile(f);
+  if (hasStatistics()) {
+    of->StatisticsType = getMyOperatorType().mStatistics;
+    of->StatisticsType->init(of->Statistics);
+    of->StatisticsFile = 
+      getMyOperatorType().mFileFactory->openForWrite(getStatisticsPath(filePath));
+  }
   if (hasInlineHeader()) {
     // We write in-file header for every partition
     of->Compressor.put((const uint8_t *) getMyOperatorType().mHeader.c_str(), 
@@ -1111,6 +1187,9 @@ void RuntimeHdfsWriteOperator::writeToHdfs(RecordBuffer input, bool isEOS)
   if (!isEOS) {
     OutputFile * of = mCreationPolicy->onRecord(input, this);
     mPrinter.print(input);
+    if (of->StatisticsType) {
+      of->StatisticsType->add(input, of->Statistics);
+    }
     getMyOperatorType().mFree.free(input);
     of->Compressor.put((const uint8_t *) mPrinter.c_str(), mPrinter.size(), false);
     while(!of->Compressor.run()) {
@@ -1186,7 +1265,8 @@ RuntimeHdfsWriteOperatorType::RuntimeHdfsWriteOperatorType(const std::string& op
 							   WritableFileFactory * fileFactory,
 							   const std::string& header,
 							   const std::string& headerFile,
-							   FileCreationPolicy * creationPolicy)
+							   FileCreationPolicy * creationPolicy,
+							   bool writeStatistics)
   :
   RuntimeOperatorType(opName.c_str()),
   mPrint(ty->getPrint()),
@@ -1194,7 +1274,8 @@ RuntimeHdfsWriteOperatorType::RuntimeHdfsWriteOperatorType(const std::string& op
   mFileFactory(fileFactory),
   mHeader(header),
   mHeaderFile(headerFile),
-  mCreationPolicy(creationPolicy)
+  mCreationPolicy(creationPolicy),
+  mStatistics(writeStatistics ? new RecordTypeStatistics(ty) : NULL)
 {
 }
 
@@ -1202,6 +1283,7 @@ RuntimeHdfsWriteOperatorType::~RuntimeHdfsWriteOperatorType()
 {
   delete mFileFactory;
   delete mCreationPolicy;
+  delete mStatistics;
 }
 
 int32_t RuntimeHdfsWriteOperatorType::numServiceCompletionPorts() const
@@ -46,6 +46,7 @@
 #include "RuntimePort.hh"
 #include "RuntimePlan.hh"
 #include "RuntimeOperator.hh"
+#include "ZoneMap.hh"
 
 // Threading to make async writes to HDFS
 template <class _Op>
@@ -215,6 +216,8 @@ private:
   std::string mFile;
   std::string mHeader;
   std::string mHeaderFile;
+  // If not NULL write a statistics sidecar for the file.
+  RecordTypeStatistics * mStatistics;
   // Serialization
   friend class boost::serialization::access;
   template <class Archive>
@@ -226,8 +229,11 @@ private:
     ar & BOOST_SERIALIZATION_NVP(mFile);
     ar & BOOST_SERIALIZATION_NVP(mHeader);
     ar & BOOST_SERIALIZATION_NVP(mHeaderFile);
+    ar & BOOST_SERIALIZATION_NVP(mStatistics);
   }
   RuntimeWriteOperatorType()
+    :
+    mStatistics(NULL)
   {
   }
 public:
@@ -235,15 +241,21 @@ public:
 			   const RecordType * ty, 
 			   const std::string& file,
 			   const std::string& header,
-			   const std::string& headerFile)
+			   const std::string& headerFile,
+			   bool writeStatistics=false)
     :
     RuntimeOperatorType(opName.c_str()),
     mPrint(ty->getPrint()),
     mFree(ty->getFree()),
     mFile(file),
     mHeader(header),
-    mHeaderFile(headerFile)
+    mHeaderFile(headerFile),
+    mStatistics(writeStatistics ? new RecordTypeStatistics(ty) : NULL)
+  {
+  }
+  ~RuntimeWriteOperatorType()
   {
+    delete mStatistics;
   }
   RuntimeOperator * create(RuntimeOperator::Services& services) const;
 };
@@ -353,6 +365,8 @@ private:
   std::string mHeader;
   std::string mHeaderFile;
   FileCreationPolicy * mCreationPolicy;
+  // If not NULL write a statistics sidecar for each file.
+  RecordTypeStatistics * mStatistics;
   
   // Serialization
   friend class boost::serialization::access;
@@ -366,11 +380,13 @@ private:
     ar & BOOST_SERIALIZATION_NVP(mHeader);
     ar & BOOST_SERIALIZATION_NVP(mHeaderFile);
     ar & BOOST_SERIALIZATION_NVP(mCreationPolicy);
+    ar & BOOST_SERIALIZATION_NVP(mStatistics);
   }
   RuntimeHdfsWriteOperatorType()
     :
     mFileFactory(NULL),
-    mCreationPolicy(NULL)
+    mCreationPolicy(NULL),
+    mStatistics(NULL)
   {
   }
 public:
@@ -379,7 +395,8 @@ public:
 			       WritableFileFactory * fileFactory,
 			       const std::string& header,
 			       const std::string& headerFile,
-			       FileCreationPolicy * creationPolicy);
+			       FileCreationPolicy * creationPolicy,
+			       bool writeStatistics=false);
   ~RuntimeHdfsWriteOperatorType();
   int32_t numServiceCompletionPorts() const;
   RuntimeOperator * create(RuntimeOperator::Services& services) const;
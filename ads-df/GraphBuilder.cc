@@ -49,11 +49,17 @@
 #include "QueueImport.hh"
 #include "ConstantScan.hh"
 #include "AsyncRecordParser.hh"
+#include "ColumnarFile.hh"
+#include "CompactOperator.hh"
 #include "GzipOperator.hh"
 #include "TcpOperator.hh"
 #include "HttpOperator.hh"
+#include "IndexOperator.hh"
 #include "FileWriteOperator.hh"
 #include "QueryStringOperator.hh"
+#include "TableOperator.hh"
+#include "WindowOperator.hh"
+#include "RangeJoin.hh"
 #include "GraphBuilder.hh"
 
 #if defined(TRECUL_HAS_HADOOP)
@@ -94,8 +100,12 @@ BOOST_CLASS_EXPORT(RuntimeHashGroupByOperatorType);
 BOOST_CLASS_EXPORT(RuntimeSortGroupByOperatorType);
 BOOST_CLASS_EXPORT(RuntimeSortRunningTotalOperatorType);
 BOOST_CLASS_EXPORT(RuntimeHashPartitionerOperatorType);
+BOOST_CLASS_EXPORT(RuntimeRangeSampleOperatorType);
+BOOST_CLASS_EXPORT(RuntimeRangeSplitterOperatorType);
+BOOST_CLASS_EXPORT(RuntimeRangePartitionerOperatorType);
 BOOST_CLASS_EXPORT(RuntimeBroadcastPartitionerOperatorType);
 BOOST_CLASS_EXPORT(RuntimeNondeterministicCollectorOperatorType);
+BOOST_CLASS_EXPORT(RuntimeOrderedCollectorOperatorType);
 BOOST_CLASS_EXPORT(RuntimeCopyOperatorType);
 BOOST_CLASS_EXPORT(RuntimeFilterOperatorType);
 BOOST_CLASS_EXPORT(RuntimeSortMergeOperatorType);
@@ -117,6 +127,15 @@ BOOST_CLASS_EXPORT(InternalFileWriteOperatorType);
 BOOST_CLASS_EXPORT(GenericParserOperatorType<ExplicitChunkStrategy>);
 BOOST_CLASS_EXPORT(GenericParserOperatorType<SerialChunkStrategy>);
 BOOST_CLASS_EXPORT(RuntimeConstantScanOperatorType);
+BOOST_CLASS_EXPORT(RuntimeWindowGroupByOperatorType);
+BOOST_CLASS_EXPORT(RuntimeRangeJoinOperatorType);
+BOOST_CLASS_EXPORT(RuntimeCompactEncodeOperatorType);
+BOOST_CLASS_EXPORT(RuntimeCompactDecodeOperatorType);
+BOOST_CLASS_EXPORT(RuntimeColumnarWriteOperatorType);
+BOOST_CLASS_EXPORT(RuntimeColumnarReadOperatorType);
+BOOST_CLASS_EXPORT(RuntimeIndexBuildOperatorType);
+BOOST_CLASS_EXPORT(RuntimeIndexLookupOperatorType);
+BOOST_CLASS_EXPORT(RuntimeColumnGroupZipOperatorType);
 
 #if defined(TRECUL_HAS_HADOOP)
 BOOST_CLASS_EXPORT(HdfsWritableFileFactory);
@@ -346,14 +365,20 @@ void DataflowGraphBuilder::nodeStart(const char * type,
   if (mOps.find(name) != mOps.end()) {
     throw std::runtime_error((boost::format("Operator with name %1% already defined") % name).str());
   }
-  if (boost::algorithm::iequals("constant_sink", type)) {
+  if (boost::algorithm::iequals("build_index", type)) {
+    mCurrentOp = new LogicalIndexBuild();
+  } else if (boost::algorithm::iequals("constant_sink", type)) {
     mCurrentOp = new LogicalConstantSink();
   } else if (boost::algorithm::iequals("copy", type)) {
     mCurrentOp = new CopyOp();
+  } else if (boost::algorithm::iequals("decode", type)) {
+    mCurrentOp = new LogicalCompactDecode();
   } else if (boost::algorithm::iequals("emit", type)) {
 #if defined(TRECUL_HAS_HADOOP)
     mCurrentOp = new LogicalEmit();
 #endif
+  } else if (boost::algorithm::iequals("encode", type)) {
+    mCurrentOp = new LogicalCompactEncode();
   } else if (boost::algorithm::iequals("filter", type)) {
     mCurrentOp = new LogicalFilter();
   } else if (boost::algorithm::iequals("generate", type)) {
@@ -378,6 +403,8 @@ void DataflowGraphBuilder::nodeStart(const char * type,
     mCurrentOp = new HashJoin(HashJoin::RIGHT_SEMI);
   } else if (boost::algorithm::iequals("http_read", type)) {
     mCurrentOp = new LogicalHttpRead();
+  } else if (boost::algorithm::iequals("index_lookup", type)) {
+    mCurrentOp = new LogicalIndexLookup();
   } else if (boost::algorithm::iequals("map", type)) {
     mCurrentOp = new LogicalInputQueue();
   } else if (boost::algorithm::iequals("merge_join", type)) {
@@ -392,6 +419,8 @@ void DataflowGraphBuilder::nodeStart(const char * type,
     mCurrentOp = new SortMergeJoin(SortMergeJoin::RIGHT_OUTER);
   } else if (boost::algorithm::iequals("merge_right_semi_join", type)) {
     mCurrentOp = new SortMergeJoin(SortMergeJoin::RIGHT_SEMI);
+  } else if (boost::algorithm::iequals("range_join", type)) {
+    mCurrentOp = new LogicalRangeJoin();
   } else if (boost::algorithm::iequals("read", type)) {
     mCurrentOp = new LogicalFileRead();
   } else if (boost::algorithm::iequals("read_block", type)) {
@@ -420,6 +449,8 @@ void DataflowGraphBuilder::nodeStart(const char * type,
     mCurrentOp = new LogicalUnionAll();
   } else if (boost::algorithm::iequals("unpivot", type)) {
     mCurrentOp = new LogicalUnpivot();
+  } else if (boost::algorithm::iequals("window_group_by", type)) {
+    mCurrentOp = new LogicalWindowGroupBy();
   } else if (boost::algorithm::iequals("write", type)) {
     mCurrentOp = new LogicalFileWrite();
   } else if (boost::algorithm::iequals("devNull", type)) {
@@ -503,9 +534,14 @@ boost::shared_ptr<RuntimeOperatorPlan> DataflowGraphBuilder::create(int32_t numP
   for(RuntimePlanBuilder::internal_edge_iterator it = bld.begin_internal_edges();
       it != bld.end_internal_edges();
       ++it) {
-    plan->connectStraight(it->Source.OpType, it->Source.Index, 
-			  it->Target.OpType, it->Target.Index, 
-			  it->Buffered, true);
+    if (it->CrossbarType) {
+      plan->connectCrossbar(it->Source.OpType, it->Target.OpType,
+			    it->CrossbarType, it->Buffered, true);
+    } else {
+      plan->connectStraight(it->Source.OpType, it->Source.Index, 
+			    it->Target.OpType, it->Target.Index, 
+			    it->Buffered, true);
+    }
   }
 
   return plan;
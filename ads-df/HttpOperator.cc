@@ -1,4 +1,7 @@
+#include <algorithm>
 #include <deque>
+#include <iterator>
+#include <limits>
 #include <boost/algorithm/string/trim.hpp>
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
@@ -9,6 +12,7 @@
 #include <boost/tokenizer.hpp>
 
 #include "RuntimeProcess.hh"
+#include "RuntimeMetrics.hh"
 #include "HttpOperator.hh"
 #include "QueryStringOperator.hh"
 #include "HttpParser.hh"
@@ -64,7 +68,22 @@ void HttpRequestType::appendUrl(const char * start, const char * end,
 void HttpRequestType::appendBody(const char * start, const char * end, 
 				 RecordBuffer buf) const
 {
-  // appendVarchar(start, end, mBody, buf);
+  appendVarchar(start, end, mBody, buf);
+}
+
+void HttpRequestType::setBody(char * body, int32_t sz, RecordBuffer buf) const
+{
+  Varchar * v = mBody.getVarcharPtr(buf);
+  if (sz < Varchar::MIN_LARGE_STRING_SIZE) {
+    v->assign(body, sz);
+    ::free(body);
+  } else {
+    body[sz] = 0;
+    v->Large.Size = sz;
+    v->Large.Ptr = body;
+    v->Large.Large = 1;
+  }
+  mBody.clearNull(buf);
 }
 
 bool HttpRequestType::hasField(const std::string& field) const
@@ -78,6 +97,23 @@ void HttpRequestType::setField(const std::string& field, const std::string& valu
   mNVP.find(field)->second.SetVariableLengthString(buf, value.c_str(), value.size());
 }
 
+const FieldAddress * HttpRequestType::getField(const std::string& field) const
+{
+  std::map<std::string, FieldAddress>::const_iterator it = mNVP.find(field);
+  return it == mNVP.end() ? NULL : &it->second;
+}
+
+void HttpRequestType::appendField(const FieldAddress& field, 
+				  const char * start, const char * end,
+				  bool first, RecordBuffer buf) const
+{
+  if (first) {
+    field.SetVariableLengthString(buf, start, (std::size_t) (end-start));
+  } else {
+    field.getVarcharPtr(buf)->append(start, (int32_t) (end-start));
+  }
+}
+
 void HttpRequestType::appendVarchar(const char * start, const char * end,
 				    FieldAddress field, RecordBuffer buf) const
 {
@@ -137,17 +173,28 @@ public:
 class HttpSession
 {
 private:
-  void setResponse(const char * resp);
-  void setResponseOK();
-  void setResponseBadRequest();
-  void setResponseForbidden();
-  void setResponseNotFound();
-  void setResponseMethodNotAllowed();
-  void setResponseInternalServerError();
-  void setResponseNotImplemented();
+  void appendResponse(const char * resp);
+  void appendResponseOK();
+  void appendResponseBadRequest();
+  void appendResponseNotFound();
+  void appendResponseNotImplemented();
+  void appendResponseMetrics();
   
   std::string mPostResource;
   std::string mAliveResource;
+  // Responses to send for the requests parsed so far.  Pipelined
+  // requests that arrive in a single read are answered with
+  // a single write.
+  std::string mResponse;
+  std::size_t mResponseOffset;
+
+  /**
+   * Percent decode [c, end) to out.  Decoder state is kept across
+   * calls so that an escape may span reads.
+   */
+  template <class _OutputIterator>
+  int32_t percentDecode(const char * c, const char * end, 
+			_OutputIterator & out);
 
 public:
   /**
@@ -183,6 +230,10 @@ public:
 					&HttpSession::mSessionHook> SessionQueueOption;
   typedef boost::intrusive::list<HttpSession, SessionQueueOption, boost::intrusive::constant_time_size<false> > SessionQueue;
 
+  // Bodies at least this big with a Content-Length are read
+  // directly into the memory of the body field.
+  static const std::size_t DIRECT_BODY_SIZE = 8192;
+
   boost::asio::ip::tcp::socket * mSocket;
   RecordBuffer mConstructing;
   std::deque<RecordBuffer> mCompletedBuffers;
@@ -190,19 +241,31 @@ public:
   http_parser_settings mParserSettings;
   std::size_t mIOSize;
   char * mIO;
+  // Where the last read put its data: either mIO or the
+  // body being read in place.
+  char * mReadTarget;
   const HttpRequestType& mRequestType;
   QueryStringParser<HttpSession> mQueryStringParser;
+  // Name of the header or query string field being parsed.
   std::string mField;
-  std::string mValue;
+  // Record field that header or query string values are
+  // decoded into; NULL if the value isn't wanted.
+  const FieldAddress * mValueField;
+  // Body read in place.  Ownership passes to the output record.
+  char * mBody;
+  std::size_t mBodySize;
+  std::size_t mBodyCapacity;
   int32_t mQueueIndex;
   char mDecodeChar;
   enum State { START, READ, WRITE };
   State mState : 2;
   bool mMessageComplete : 1;
-  bool mResponseComplete : 1;
-  // the mIO buffer points to an allocated region
-  // sometimes and other times points to static text.
-  bool mFreeBuffer : 1;
+  bool mKeepAlive : 1;
+  bool mCaptureBody : 1;
+  // Are we reading a header value (as opposed to its name)?
+  bool mInHeaderValue : 1;
+  // Has anything been written to mValueField for the current value?
+  bool mValueStarted : 1;
   enum UrlState { URL_UNVALIDATED=0, URL_VALID, URL_INVALID };
   UrlState mUrlState : 2;
 
@@ -213,11 +276,13 @@ public:
 
   void close();
   void validateUrl();
+  void appendValue(const char * c, const char * end);
   
   HttpSession(boost::asio::ip::tcp::socket * socket,
 	      const std::string& postResource,
 	      const std::string& aliveResource,
-	      const HttpRequestType & requestType);
+	      const HttpRequestType & requestType,
+	      bool captureBody);
   ~HttpSession();
   boost::asio::ip::tcp::socket& socket()
   {
@@ -289,21 +354,30 @@ int HttpSession::on_message_complete(http_parser * p)
 HttpSession::HttpSession(boost::asio::ip::tcp::socket * socket,
 			 const std::string& postResource,
 			 const std::string& aliveResource,
-			 const HttpRequestType& requestType)
+			 const HttpRequestType& requestType,
+			 bool captureBody)
   :
   mPostResource(postResource),
   mAliveResource(aliveResource),
+  mResponseOffset(0),
   mSocket(socket),
-  mIOSize(8192),
+  mIOSize(0),
   mIO(new char [8192]),
+  mReadTarget(NULL),
   mRequestType(requestType),
   mQueryStringParser(this),
+  mValueField(NULL),
+  mBody(NULL),
+  mBodySize(0),
+  mBodyCapacity(0),
   mQueueIndex(0),
   mDecodeChar(0),
   mState(START),
   mMessageComplete(false),
-  mResponseComplete(false),
-  mFreeBuffer(true),
+  mKeepAlive(true),
+  mCaptureBody(captureBody),
+  mInHeaderValue(false),
+  mValueStarted(false),
   mUrlState(URL_UNVALIDATED),
   mDecodeState(PERCENT_DECODE_START)
 {
@@ -317,16 +391,14 @@ HttpSession::HttpSession(boost::asio::ip::tcp::socket * socket,
   mParserSettings.on_headers_complete = on_headers_complete;
   mParserSettings.on_body = on_body;
   mParserSettings.on_message_complete = on_message_complete;
-  mConstructing = mRequestType.malloc();
 }
 
 HttpSession::~HttpSession()
 {
   close();
-  if (mFreeBuffer) {
-    delete [] mIO;
-    mIO = NULL;
-  }
+  delete [] mIO;
+  mIO = NULL;
+  ::free(mBody);
   if (mConstructing != RecordBuffer()) {
     mRequestType.free(mConstructing);
   }
@@ -361,20 +433,15 @@ void HttpSession::validateUrl()
 
 bool HttpSession::completed() const
 {
-  // Request completed and response sent
-  return mMessageComplete && mIOSize == 0;
+  // All requests answered and connection closed.
+  return mSocket == NULL;
 }
 
 bool HttpSession::error() const
 {
   // Don't return error() until we are done with the response.
-  // TODO: Perhaps we should rename this since we are calling
-  // an aliveness ping an error so that the operator doesn't output
-  // anything.
-  return (mSocket == NULL && (mParser.http_errno != HPE_OK || 
-			      mUrlState == URL_INVALID ||
-			      mParser.method == HTTP_GET)) ||
-    (mSocket != NULL && !mSocket->is_open());
+  return mSocket == NULL && (mParser.http_errno != HPE_OK || 
+			     mUrlState == URL_INVALID);
 }
 
 std::deque<RecordBuffer>& HttpSession::buffers()
@@ -387,14 +454,14 @@ void HttpSession::handleRead(HttpSession * session,
 			     const boost::system::error_code& error,
 			     size_t bytes_transferred)
 {
-  // Just enqueue for later execution.
-  RecordBuffer buf;
-  buf.Ptr = (uint8_t *) session;
-  fifo->onReadWriteCompletion(buf);
+  // Update the session before enqueueing it for later execution.
   session->mIOSize = bytes_transferred;
   if (error) {
     session->mSocket->close();
   }
+  RecordBuffer buf;
+  buf.Ptr = (uint8_t *) session;
+  fifo->onReadWriteCompletion(buf);
 }
 
 void HttpSession::handleWrite(HttpSession * session,
@@ -402,66 +469,60 @@ void HttpSession::handleWrite(HttpSession * session,
 			     const boost::system::error_code& error,
 			     size_t bytes_transferred)
 {
-  // Just enqueue for later execution.
-  RecordBuffer buf;
-  buf.Ptr = (uint8_t *) session;
-  fifo->onReadWriteCompletion(buf);
-  BOOST_ASSERT(bytes_transferred <= session->mIOSize);
-  session->mIO += bytes_transferred;
-  session->mIOSize -= bytes_transferred;
+  // Update the session before enqueueing it for later execution.
+  BOOST_ASSERT(session->mResponseOffset + bytes_transferred <= 
+	       session->mResponse.size());
+  session->mResponseOffset += bytes_transferred;
   if (error) {
     session->mSocket->close();
   }
+  RecordBuffer buf;
+  buf.Ptr = (uint8_t *) session;
+  fifo->onReadWriteCompletion(buf);
 }
 
-void HttpSession::setResponse(const char * resp)
-{
-  delete [] mIO;
-  mFreeBuffer = false;
-  mIO = const_cast<char *>(resp);
-  mIOSize = ::strlen(mIO);
-}
-
-void HttpSession::setResponseOK()
-{
-  static const char * resp = "HTTP/1.1 200 OK\r\n";
-  setResponse(resp);
-}
-
-void HttpSession::setResponseBadRequest()
+void HttpSession::appendResponse(const char * resp)
 {
-  static const char * resp = "HTTP/1.1 400 Bad Request\r\n";
-  setResponse(resp);
+  mResponse.append(resp);
+  if (!mKeepAlive) {
+    mResponse.append("Connection: close\r\n");
+  }
+  mResponse.append("Content-Length: 0\r\n\r\n");
 }
 
-void HttpSession::setResponseForbidden()
+void HttpSession::appendResponseOK()
 {
-  static const char * resp = "HTTP/1.1 403 Forbidden\r\n";
-  setResponse(resp);
+  appendResponse("HTTP/1.1 200 OK\r\n");
 }
 
-void HttpSession::setResponseNotFound()
+void HttpSession::appendResponseBadRequest()
 {
-  static const char * resp = "HTTP/1.1 404 Not Found\r\n";
-  setResponse(resp);
+  appendResponse("HTTP/1.1 400 Bad Request\r\n");
 }
 
-void HttpSession::setResponseMethodNotAllowed()
+void HttpSession::appendResponseNotFound()
 {
-  static const char * resp = "HTTP/1.1 405 Method Not Allowed\r\n";
-  setResponse(resp);
+  appendResponse("HTTP/1.1 404 Not Found\r\n");
 }
 
-void HttpSession::setResponseInternalServerError()
+void HttpSession::appendResponseNotImplemented()
 {
-  static const char * resp = "HTTP/1.1 500 Internal Server Error\r\n";
-  setResponse(resp);
+  appendResponse("HTTP/1.1 501 Not Implemented\r\n");
 }
 
-void HttpSession::setResponseNotImplemented()
-{
-  static const char * resp = "HTTP/1.1 501 Not Implemented\r\n";
-  setResponse(resp);
+void HttpSession::appendResponseMetrics()
+{
+  // Aliveness checks double as a way of retrieving runtime metrics
+  // from long running flows.
+  std::string body = RuntimeMetrics::get().getJSON();
+  mResponse += (boost::format("HTTP/1.1 200 OK\r\n"
+			      "%1%"
+			      "Content-Type: application/json\r\n"
+			      "Content-Length: %2%\r\n"
+			      "\r\n") % 
+		(mKeepAlive ? "" : "Connection: close\r\n") % 
+		body.size()).str();
+  mResponse += body;
 }
 
 void HttpSession::onEvent(HttpSessionCallback * p)
@@ -469,8 +530,16 @@ void HttpSession::onEvent(HttpSessionCallback * p)
   switch(mState) {
   case START:
     while(mSocket->is_open()) {
-      // Read and process request
-      mSocket->async_read_some(boost::asio::buffer(mIO, 8192),
+      // Read more requests; if we are in the middle of a large
+      // body read it where it will end up.
+      if (mBody != NULL && mBodySize < mBodyCapacity) {
+	mReadTarget = mBody + mBodySize;
+	mIOSize = mBodyCapacity - mBodySize;
+      } else {
+	mReadTarget = mIO;
+	mIOSize = 8192;
+      }
+      mSocket->async_read_some(boost::asio::buffer(mReadTarget, mIOSize),
 			       boost::bind(&HttpSession::handleRead, 
 					   this,
 					   p,
@@ -480,46 +549,121 @@ void HttpSession::onEvent(HttpSessionCallback * p)
       mState = READ;
       return;
     case READ:
-      {
-	size_t sz = ::http_parser_execute(&mParser, &mParserSettings, mIO,
-					  mIOSize);
-	if (mParser.http_errno != HPE_OK) {
-	  if (mUrlState == URL_INVALID) {
-	    setResponseNotFound();
-	  } else {
-	    setResponseBadRequest();
-	  }
-	  break;
-	} else if (mParser.upgrade) {
-	  setResponseNotImplemented();
-	  break;
-	} else if (mMessageComplete) {
-	  setResponseOK();
-	  break;
+      if (0 == mIOSize || !mSocket->is_open()) {
+	// Connection closed by client
+	break;
+      }
+      // There may be any number of requests in the buffer.  
+      // Each completed request appends its response.
+      ::http_parser_execute(&mParser, &mParserSettings, mReadTarget, mIOSize);
+      if (mParser.http_errno != HPE_OK && 
+	  mParser.http_errno != HPE_CLOSED_CONNECTION) {
+	mKeepAlive = false;
+	if (mUrlState == URL_INVALID) {
+	  appendResponseNotFound();
+	} else {
+	  appendResponseBadRequest();
 	}
+      } else if (mParser.upgrade) {
+	mKeepAlive = false;
+	appendResponseNotImplemented();
       }
-    }
 
-    // Send response
-    while(mIOSize > 0 && mSocket->is_open()) {
-      // Read and process request
-      mSocket->async_write_some(boost::asio::buffer(mIO, mIOSize),
-				boost::bind(&HttpSession::handleWrite, 
-					    this,
-					    p,
-					    boost::asio::placeholders::error,
-					    boost::asio::placeholders::bytes_transferred));
-      p->onReadWriteRequest();
-      mState = WRITE;
-      return;
-    case WRITE:;
+      // Send responses
+      while(mResponseOffset < mResponse.size() && mSocket->is_open()) {
+	mSocket->async_write_some(boost::asio::buffer(mResponse.c_str() + mResponseOffset, 
+						      mResponse.size() - mResponseOffset),
+				  boost::bind(&HttpSession::handleWrite, 
+					      this,
+					      p,
+					      boost::asio::placeholders::error,
+					      boost::asio::placeholders::bytes_transferred));
+	p->onReadWriteRequest();
+	mState = WRITE;
+	return;
+      case WRITE:;
+      }
+      mResponse.clear();
+      mResponseOffset = 0;
+      if (!mKeepAlive) {
+	break;
+      }
     }
     close();
   }
 }
 
+template <class _OutputIterator>
+int32_t HttpSession::percentDecode(const char * c, const char * end,
+				   _OutputIterator & out)
+{
+  for(; c != end; ++c) {
+    switch(mDecodeState) {
+    case PERCENT_DECODE_START:
+      switch(*c) {
+      case '+':
+	*out++ = ' ';
+	break;
+      case '%':
+	mDecodeState = PERCENT_DECODE_x;
+	break;
+      default:
+	*out++ = *c;
+	break;
+      }	
+      break;
+    case PERCENT_DECODE_x:
+      if (*c >= '0' && *c <= '9') {
+	mDecodeChar = (char) (*c - '0');
+      } else {
+	char lower = *c | 0x20;
+	if (lower >= 'a' && lower <= 'f') {
+	  mDecodeChar = (char) (lower - 'a' + 10);
+	} else {
+	  // TODO: bogus: try to recover
+	  return -1;
+	}
+      }
+      mDecodeState = PERCENT_DECODE_xx;
+      break;
+    case PERCENT_DECODE_xx:
+      if (*c >= '0' && *c <= '9') {
+	*out++ = (char) ((mDecodeChar<<4) + *c - '0');
+      } else {
+	char lower = *c | 0x20;
+	if (lower >= 'a' && lower <= 'f') {
+	  *out++ = (char) ((mDecodeChar<<4) + lower - 'a' + 10);
+	} else {
+	  // TODO: bogus: try to recover
+	  return -1;
+	}
+      }
+      mDecodeState = PERCENT_DECODE_START;
+      break;
+    }
+  }
+  return 0;
+}
+
+void HttpSession::appendValue(const char * c, const char * end)
+{
+  mRequestType.appendField(*mValueField, c, end, !mValueStarted, mConstructing);
+  mValueStarted = true;
+}
+
 int32_t HttpSession::onMessageBegin()
 {
+  // Reset per request state; the session may be on its
+  // umpteenth request.
+  if (mConstructing == RecordBuffer()) {
+    mConstructing = mRequestType.malloc();
+  }
+  mMessageComplete = false;
+  mUrlState = URL_UNVALIDATED;
+  mDecodeState = PERCENT_DECODE_START;
+  mInHeaderValue = false;
+  mValueField = NULL;
+  mField.clear();
   return 0;
 }
 
@@ -540,13 +684,10 @@ int32_t HttpSession::onHeaderField(const char * c, size_t length)
   if (mUrlState == URL_INVALID) {
     return -1;
   }
-  if (mValue.size() > 0) {
-    // TODO: Handle empty value
-    BOOST_ASSERT(mField.size() > 0);
-    BOOST_ASSERT(mRequestType.hasField(mField));
-    mRequestType.setField(mField, mValue, mConstructing);
+  if (mInHeaderValue) {
+    // Starting a new header.
+    mInHeaderValue = false;
     mField.clear();
-    mValue.clear();
   }
   mField.append(c, length);
   return 0;
@@ -554,12 +695,13 @@ int32_t HttpSession::onHeaderField(const char * c, size_t length)
 
 int32_t HttpSession::onHeaderValue(const char * c, size_t length)
 {
-  if (mField.size() > 0) {
-    if (mRequestType.hasField(mField)) {
-      mValue.append(c, length);
-    } else {
-      mField.clear();
-    }
+  if (!mInHeaderValue) {
+    mInHeaderValue = true;
+    mValueField = mRequestType.getField(mField);
+    mValueStarted = false;
+  }
+  if (mValueField) {
+    appendValue(c, c+length);
   }
   return 0;
 }
@@ -570,29 +712,71 @@ int32_t HttpSession::onHeadersComplete()
   if (mUrlState == URL_INVALID) {
     return -1;
   }
-  if (mField.size() > 0) {
-    mRequestType.setField(mField, mValue, mConstructing);
-    mField.clear();
-    mValue.clear();
+  mInHeaderValue = false;
+  mValueField = NULL;
+  mField.clear();
+  if (mCaptureBody && 
+      mParser.content_length >= DIRECT_BODY_SIZE &&
+      mParser.content_length < (uint64_t) std::numeric_limits<int32_t>::max()) {
+    mBodyCapacity = (std::size_t) mParser.content_length;
+    mBodySize = 0;
+    mBody = (char *) ::malloc(mBodyCapacity + 1);
   }
   return 0;
 }
 
 int32_t HttpSession::onBody(const char * c, size_t length)
 {
-  int32_t ret = mQueryStringParser.parse(c, length);
-  mRequestType.appendBody(c, c+length, mConstructing);
-  return ret;
+  if (!mCaptureBody) {
+    return mQueryStringParser.parse(c, length);
+  } else if (mBody) {
+    // Data read in place is already where it needs to be.
+    if (c != mBody + mBodySize) {
+      BOOST_ASSERT(mBodySize + length <= mBodyCapacity);
+      ::memcpy(mBody + mBodySize, c, length);
+    }
+    mBodySize += length;
+  } else {
+    mRequestType.appendBody(c, c+length, mConstructing);
+  }
+  return 0;
 }
 
 int32_t HttpSession::onMessageComplete()
 {
+  if (!mCaptureBody) {
+    // Flush a trailing value that isn't terminated by a
+    // separator and make the parser ready for the next request.
+    mQueryStringParser.parse(NULL, 0);
+  }
+  // Only POSTs to the post resource make records; aliveness
+  // checks just get a response.
+  validateUrl();
+  bool isRecord = mUrlState == URL_VALID && mParser.method == HTTP_POST;
+  if (mBody) {
+    if (isRecord && mConstructing != RecordBuffer()) {
+      mRequestType.setBody(mBody, (int32_t) mBodySize, mConstructing);
+    } else {
+      ::free(mBody);
+    }
+    mBody = NULL;
+    mBodySize = mBodyCapacity = 0;
+  }
   if (mConstructing != RecordBuffer()) {
-    mCompletedBuffers.push_back(mConstructing);
+    if (isRecord) {
+      mCompletedBuffers.push_back(mConstructing);
+    } else {
+      mRequestType.free(mConstructing);
+    }
     mConstructing = RecordBuffer();
   }
-  BOOST_ASSERT(mCompletedBuffers.size() > 0);
   mMessageComplete = true;
+  mKeepAlive = ::http_should_keep_alive(&mParser) != 0;
+  if (mParser.method == HTTP_GET && RuntimeMetrics::get().isEnabled()) {
+    appendResponseMetrics();
+  } else {
+    appendResponseOK();
+  }
   return 0;
 }
 
@@ -604,55 +788,14 @@ int32_t HttpSession::onQueryStringField(const char * c, size_t length,
   }
   // Like onHeaderField except we urldecode 
   mField.reserve(mField.size() + length);
-  const char * end = c + length;
-  for(; c != end; ++c) {
-    switch(mDecodeState) {
-    case PERCENT_DECODE_START:
-      switch(*c) {
-      case '+':
-	mField.push_back(' ');
-	break;
-      case '%':
-	mDecodeState = PERCENT_DECODE_x;
-	break;
-      default:
-	mField.push_back(*c);
-	break;
-      }	
-      break;
-    case PERCENT_DECODE_x:
-      if (*c >= '0' && *c <= '9') {
-	mDecodeChar = (char) (*c - '0');
-      } else {
-	char lower = *c | 0x20;
-	if (lower >= 'a' && lower <= 'f') {
-	  mDecodeChar = (char) (lower - 'a' + 10);
-	} else {
-	  // TODO: bogus: try to recover
-	  return -1;
-	}
-      }
-      mDecodeState = PERCENT_DECODE_xx;
-      break;
-    case PERCENT_DECODE_xx:
-      if (*c >= '0' && *c <= '9') {
-	mField.push_back((char) ((mDecodeChar<<4) + *c - '0'));
-      } else {
-	char lower = *c | 0x20;
-	if (lower >= 'a' && lower <= 'f') {
-	  mField.push_back((char) ((mDecodeChar<<4) + lower - 'a' + 10));
-	} else {
-	  // TODO: bogus: try to recover
-	  return -1;
-	}
-      }
-      mDecodeState = PERCENT_DECODE_START;
-      break;
-    }
+  std::back_insert_iterator<std::string> out(mField);
+  if (percentDecode(c, c+length, out)) {
+    return -1;
   }
-  if (done && !mRequestType.hasField(mField)) {
+  if (done) {
+    mValueField = mRequestType.getField(mField);
+    mValueStarted = false;
     mField.clear();
-    return 0;
   }
   return 0;
 }
@@ -663,63 +806,29 @@ int32_t HttpSession::onQueryStringValue(const char * c, size_t length,
   if (mConstructing == RecordBuffer()) {
     mConstructing = mRequestType.malloc();
   }
-  std::string tmp(c,length);
-  if (mField.size() == 0)
+  if (mValueField == NULL) {
     return 0;
-  // Like onHeaderField except we urldecode 
-  mValue.reserve(mValue.size() + length);
+  }
+  // Like onHeaderValue except we urldecode.  Decoding never
+  // lengthens the input so decode a chunk at a time straight into
+  // the record.
+  char buf[512];
   const char * end = c + length;
-  for(; c != end; ++c) {
-    switch(mDecodeState) {
-    case PERCENT_DECODE_START:
-      switch(*c) {
-      case '+':
-	mValue.push_back(' ');
-	break;
-      case '%':
-	mDecodeState = PERCENT_DECODE_x;
-	break;
-      default:
-	mValue.push_back(*c);
-	break;
-      }	
-      break;
-    case PERCENT_DECODE_x:
-      if (*c >= '0' && *c <= '9') {
-	mDecodeChar = (char) (*c - '0');
-      } else {
-	char lower = *c | 0x20;
-	if (lower >= 'a' && lower <= 'f') {
-	  mDecodeChar = (char) (lower - 'a' + 10);
-	} else {
-	  // TODO: bogus: try to recover
-	  return -1;
-	}
-      }
-      mDecodeState = PERCENT_DECODE_xx;
-      break;
-    case PERCENT_DECODE_xx:
-      if (*c >= '0' && *c <= '9') {
-	mValue.push_back((char) ((mDecodeChar<<4) + *c - '0'));
-      } else {
-	char lower = *c | 0x20;
-	if (lower >= 'a' && lower <= 'f') {
-	  mValue.push_back((char) ((mDecodeChar<<4) + lower - 'a' + 10));
-	} else {
-	  // TODO: bogus: try to recover
-	  return -1;
-	}
-      }
-      mDecodeState = PERCENT_DECODE_START;
-      break;
+  while(c != end) {
+    const char * chunkEnd = c + std::min((std::ptrdiff_t) sizeof(buf), end - c);
+    char * out = &buf[0];
+    if (percentDecode(c, chunkEnd, out)) {
+      return -1;
     }
+    appendValue(&buf[0], out);
+    c = chunkEnd;
   }
   if (done) {
-    BOOST_ASSERT(mField.size() > 0);
-    BOOST_ASSERT(mRequestType.hasField(mField));
-    mRequestType.setField(mField, mValue, mConstructing);
-    mField.clear();
-    mValue.clear();
+    if (!mValueStarted) {
+      // Field is present with empty value
+      appendValue(c, c);
+    }
+    mValueField = NULL;
   }
   return 0;
 }
@@ -847,7 +956,8 @@ public:
       HttpSession * session = new HttpSession(new tcp::socket(mIOService),
 					      getMyOperatorType().mPostResource,
 					      getMyOperatorType().mAliveResource,
-					      getMyOperatorType().mRequestType);
+					      getMyOperatorType().mRequestType,
+					      getMyOperatorType().mCaptureBody);
       mAcceptor->async_accept(session->socket(),
 			      boost::bind(&HttpReadOperator::handleAccept, 
 					  this,
@@ -963,6 +1073,9 @@ public:
 	    // Move session forward; if newly completed then we
 	    // must request a write
 	    HttpSession & session (getSession(mBuffer));
+	    if (session.mState == HttpSession::READ) {
+	      addBytes(session.mIOSize);
+	    }
 	    session.onEvent(this);
 	    if (session.buffers().size() > 0) {
 	      enqueueOutputReady(session);
@@ -1037,7 +1150,8 @@ LogicalHttpRead::LogicalHttpRead()
   LogicalOperator(0,0,1,1),
   mPort(0),
   mPostResource("/"),
-  mAliveResource("/alive")
+  mAliveResource("/alive"),
+  mCaptureBody(false)
 {
 }
 
@@ -1095,6 +1209,8 @@ void LogicalHttpRead::check(PlanCheckContext& ctxt)
 	mPostResource = getStringValue(ctxt, *it);
       } else if (it->equals("aliveresource")) {
 	mAliveResource = getStringValue(ctxt, *it);
+      } else if (it->equals("captureBody")) {
+	mCaptureBody = getBooleanValue(ctxt, *it);
       } else {
 	checkDefaultParam(*it);
       }
@@ -1115,7 +1231,8 @@ void LogicalHttpRead::create(class RuntimePlanBuilder& plan)
   RuntimeOperatorType * opType = new HttpReadOperatorType(mPort,
 							  mPostResource,
 							  mAliveResource,
-							  getOutput(0)->getRecordType());
+							  getOutput(0)->getRecordType(),
+							  mCaptureBody);
   plan.addOperatorType(opType);
   plan.mapOutputPort(this, 0, opType, 0);    
 }
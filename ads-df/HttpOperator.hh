@@ -10,6 +10,7 @@ private:
   unsigned short mPort;
   std::string mPostResource;
   std::string mAliveResource;
+  bool mCaptureBody;
 public:
   LogicalHttpRead();
   ~LogicalHttpRead();
@@ -65,6 +66,24 @@ public:
   bool hasField(const std::string& field) const;
   void setField(const std::string& field, const std::string& value,
 		RecordBuffer buf) const;
+  /**
+   * The address of a field to be set from a header or query string
+   * value.  NULL if there is no such field.
+   */
+  const FieldAddress * getField(const std::string& field) const;
+  /**
+   * Append a chunk of a value to a field.  If first is true
+   * any existing value is replaced.
+   */
+  void appendField(const FieldAddress& field, 
+		   const char * start, const char * end, 
+		   bool first, RecordBuffer buf) const;
+  /**
+   * Set the body from a buffer allocated with ::malloc.  The record
+   * takes ownership of the buffer which must have room for a 
+   * terminating null after sz bytes.
+   */
+  void setBody(char * body, int32_t sz, RecordBuffer buf) const;
   const char * getUrl(RecordBuffer buf) const;
   RecordBuffer malloc() const;
   void free(RecordBuffer buf) const;
@@ -90,6 +109,9 @@ private:
   std::string mPostResource;
   // A place for liveness queries
   std::string mAliveResource;
+  // Put the raw request body in the body field rather than
+  // decoding it as name-value pairs.
+  bool mCaptureBody;
 
   // Serialization
   friend class boost::serialization::access;
@@ -103,6 +125,7 @@ private:
     ar & BOOST_SERIALIZATION_NVP(mPort);
     ar & BOOST_SERIALIZATION_NVP(mPostResource);
     ar & BOOST_SERIALIZATION_NVP(mAliveResource);
+    ar & BOOST_SERIALIZATION_NVP(mCaptureBody);
   }
   HttpReadOperatorType()
   {
@@ -112,7 +135,8 @@ public:
   HttpReadOperatorType(int32_t port, 
 		       const std::string& postResource,
 		       const std::string& aliveResource,
-		       const RecordType * output)
+		       const RecordType * output,
+		       bool captureBody=false)
     :
     RuntimeOperatorType("HttpReadOperatorType"),
     mMalloc(output->getMalloc()),
@@ -120,7 +144,8 @@ public:
     mRequestType(output),
     mPort(port),
     mPostResource(postResource),
-    mAliveResource(aliveResource)
+    mAliveResource(aliveResource),
+    mCaptureBody(captureBody)
   {
   }
 
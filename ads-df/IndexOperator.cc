@@ -0,0 +1,1015 @@
+/**
+ * Copyright (c) 2012, Akamai Technologies
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * 
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ * 
+ *   Neither the name of the Akamai Technologies nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/format.hpp>
+#include "IQLInterpreter.hh"
+#include "IndexOperator.hh"
+#include "FileSystem.hh"
+#include "Hash64.h"
+#include "QueueImport.hh"
+#include "ZoneMap.hh"
+
+const char * RecordIndexFile::SUFFIX = ".idx";
+
+static void preadFully(int fd, uint8_t * buf, std::size_t sz, uint64_t offset,
+		       const std::string& file)
+{
+  while(sz > 0) {
+    ssize_t ret = ::pread(fd, buf, sz, (off_t) offset);
+    if (ret < 0 && errno == EINTR) {
+      continue;
+    } else if (ret <= 0) {
+      throw std::runtime_error((boost::format("Failed reading %1%: %2%") %
+				file % (ret < 0 ? strerror(errno) : "unexpected end of file")).str());
+    }
+    buf += ret;
+    sz -= ret;
+    offset += ret;
+  }
+}
+
+RecordIndexFile::RecordIndexFile(const std::string& file)
+  :
+  mFile(file),
+  mDataFile(-1),
+  mIndexFile(-1),
+  mNumEntries(0)
+{
+  std::string indexFile = file + SUFFIX;
+  mIndexFile = ::open(indexFile.c_str(), O_RDONLY);
+  if (mIndexFile < 0) {
+    throw std::runtime_error((boost::format("Failed opening index %1%: %2%; "
+					    "use build_index to create it") %
+			      indexFile % strerror(errno)).str());
+  }
+  mDataFile = ::open(file.c_str(), O_RDONLY);
+  if (mDataFile < 0) {
+    ::close(mIndexFile);
+    throw std::runtime_error((boost::format("Failed opening %1%: %2%") %
+			      file % strerror(errno)).str());
+  }
+  try {
+    uint8_t header[HEADER_SIZE];
+    preadFully(mIndexFile, header, HEADER_SIZE, 0, indexFile);
+    const uint8_t * it = header + 4;
+    const uint8_t * end = header + HEADER_SIZE;
+    if (0 != memcmp(header, "TRIX", 4)) {
+      throw std::runtime_error((boost::format("Invalid index file %1%") %
+				indexFile).str());
+    }
+    uint32_t version = PortableEncoding::getUInt32(it, end);
+    if (VERSION != version) {
+      throw std::runtime_error((boost::format("Index file %1% has version %2%, "
+					      "expected %3%; rebuild it with "
+					      "build_index") %
+				indexFile % version % (uint32_t) VERSION).str());
+    }
+    if (HASH64_ID != PortableEncoding::getUInt32(it, end)) {
+      throw std::runtime_error((boost::format("Index file %1% was built with "
+					      "a different hash function; "
+					      "rebuild it with build_index") %
+				indexFile).str());
+    }
+    mNumEntries = PortableEncoding::getUInt32(it, end);
+    mNumEntries |= ((uint64_t) PortableEncoding::getUInt32(it, end)) << 32;
+    uint32_t numPoints = PortableEncoding::getUInt32(it, end);
+    if (numPoints) {
+      std::vector<uint8_t> points(numPoints*POINT_SIZE);
+      uint64_t offset = HEADER_SIZE + mNumEntries*ENTRY_SIZE;
+      preadFully(mIndexFile, &points[0], points.size(), offset, indexFile);
+      offset += points.size();
+      it = &points[0];
+      end = it + points.size();
+      for(uint32_t i=0; i<numPoints; ++i) {
+	AccessPoint p;
+	p.mOut = PortableEncoding::getUInt32(it, end);
+	p.mOut |= ((uint64_t) PortableEncoding::getUInt32(it, end)) << 32;
+	p.mIn = PortableEncoding::getUInt32(it, end);
+	p.mIn |= ((uint64_t) PortableEncoding::getUInt32(it, end)) << 32;
+	p.mBits = PortableEncoding::getUInt32(it, end);
+	mPoints.push_back(p);
+	mWindowOffsets.push_back(offset);
+	offset += PortableEncoding::getUInt32(it, end);
+      }
+      mWindowOffsets.push_back(offset);
+    }
+  } catch(...) {
+    ::close(mIndexFile);
+    ::close(mDataFile);
+    throw;
+  }
+}
+
+RecordIndexFile::~RecordIndexFile()
+{
+  ::close(mIndexFile);
+  ::close(mDataFile);
+}
+
+void RecordIndexFile::readEntry(uint64_t i, Entry& e) const
+{
+  uint8_t buf[ENTRY_SIZE];
+  preadFully(mIndexFile, buf, ENTRY_SIZE, HEADER_SIZE + i*ENTRY_SIZE, 
+	     mFile + SUFFIX);
+  const uint8_t * it = buf;
+  const uint8_t * end = buf + ENTRY_SIZE;
+  e.mHash = PortableEncoding::getUInt32(it, end);
+  e.mHash |= ((uint64_t) PortableEncoding::getUInt32(it, end)) << 32;
+  e.mOffset = PortableEncoding::getUInt32(it, end);
+  e.mOffset |= ((uint64_t) PortableEncoding::getUInt32(it, end)) << 32;
+  e.mLength = PortableEncoding::getUInt32(it, end);
+}
+
+void RecordIndexFile::find(uint64_t hash, std::vector<Entry>& entries) const
+{
+  // Binary search for the first entry with the hash.
+  uint64_t lo = 0;
+  uint64_t hi = mNumEntries;
+  Entry e;
+  while(lo < hi) {
+    uint64_t mid = lo + (hi - lo)/2;
+    readEntry(mid, e);
+    if (e.mHash < hash) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  for(; lo < mNumEntries; ++lo) {
+    readEntry(lo, e);
+    if (e.mHash != hash) break;
+    entries.push_back(e);
+  }
+}
+
+void RecordIndexFile::read(const Entry& e, std::string& record) const
+{
+  record.resize(e.mLength);
+  if (0 == e.mLength) {
+    return;
+  } else if (mPoints.size()) {
+    inflate(e, record);
+  } else {
+    preadFully(mDataFile, (uint8_t *) &record[0], e.mLength, e.mOffset, mFile);
+  }
+}
+
+static bool outLessThan(uint64_t offset, const RecordIndexFile::AccessPoint& p)
+{
+  return offset < p.mOut;
+}
+
+void RecordIndexFile::inflate(const Entry& e, std::string& record) const
+{
+  // Start from the last access point at or before the record; the
+  // first point is always the start of the file.
+  std::size_t i = std::upper_bound(mPoints.begin(), mPoints.end(), e.mOffset, 
+				   outLessThan) - mPoints.begin() - 1;
+  const AccessPoint & p(mPoints[i]);
+  std::size_t windowSize = (std::size_t) (mWindowOffsets[i+1] - mWindowOffsets[i]);
+  // Only block boundaries have a window; they are in the middle
+  // of a deflate stream so there is no gzip header to read.
+  bool raw = windowSize > 0;
+  z_stream strm;
+  strm.zalloc = Z_NULL;
+  strm.zfree = Z_NULL;
+  strm.opaque = Z_NULL;
+  strm.avail_in = 0;
+  strm.next_in = Z_NULL;
+  if (Z_OK != ::inflateInit2(&strm, raw ? -15 : 31)) {
+    throw std::runtime_error("Error initializing compression library");
+  }
+  try {
+    uint64_t in = p.mIn;
+    if (raw) {
+      if (p.mBits) {
+	uint8_t c;
+	preadFully(mDataFile, &c, 1, p.mIn - 1, mFile);
+	::inflatePrime(&strm, (int) p.mBits, c >> (8 - p.mBits));
+      }
+      std::vector<uint8_t> window(windowSize);
+      preadFully(mIndexFile, &window[0], windowSize, mWindowOffsets[i], 
+		 mFile + SUFFIX);
+      ::inflateSetDictionary(&strm, &window[0], (uInt) windowSize);
+    }
+    std::vector<uint8_t> input(64*1024);
+    std::vector<uint8_t> output(64*1024);
+    uint64_t out = p.mOut;
+    std::size_t copied = 0;
+    while(copied < e.mLength) {
+      if (strm.avail_in == 0) {
+	ssize_t ret = ::pread(mDataFile, &input[0], input.size(), (off_t) in);
+	if (ret < 0 && errno == EINTR) {
+	  continue;
+	} else if (ret <= 0) {
+	  throw std::runtime_error((boost::format("Failed reading %1%: %2%") %
+				    mFile % (ret < 0 ? strerror(errno) : "unexpected end of file")).str());
+	}
+	strm.next_in = &input[0];
+	strm.avail_in = (uInt) ret;
+	in += ret;
+      }
+      strm.next_out = &output[0];
+      strm.avail_out = (uInt) output.size();
+      int ret = ::inflate(&strm, Z_NO_FLUSH);
+      if (ret != Z_OK && ret != Z_STREAM_END) {
+	throw std::runtime_error((boost::format("Error decompressing %1%: inflate returned %2%") %
+				  mFile % ret).str());
+      }
+      // Copy the part of the output that belongs to the record.
+      uint64_t produced = (uint64_t) (strm.next_out - &output[0]);
+      uint64_t begin = std::max(out, e.mOffset);
+      uint64_t end = std::min(out + produced, e.mOffset + e.mLength);
+      if (begin < end) {
+	memcpy(&record[begin - e.mOffset], &output[begin - out], end - begin);
+	copied += end - begin;
+      }
+      out += produced;
+      if (ret == Z_STREAM_END) {
+	// The record continues in the next gzip member.  A raw
+	// stream stops in front of the 8 byte trailer of its member.
+	if (raw) {
+	  in = in - strm.avail_in + 8;
+	  ::inflateEnd(&strm);
+	  strm.avail_in = 0;
+	  strm.next_in = Z_NULL;
+	  if (Z_OK != ::inflateInit2(&strm, 31)) {
+	    throw std::runtime_error("Error initializing compression library");
+	  }
+	  raw = false;
+	} else {
+	  ::inflateReset(&strm);
+	}
+      }
+    }
+  } catch(...) {
+    ::inflateEnd(&strm);
+    throw;
+  }
+  ::inflateEnd(&strm);
+}
+
+void RecordIndexFile::write(const std::string& file, std::vector<Entry>& entries,
+			    const std::vector<AccessPoint>& points)
+{
+  std::sort(entries.begin(), entries.end());
+  std::string buf("TRIX");
+  PortableEncoding::putUInt32(buf, VERSION);
+  PortableEncoding::putUInt32(buf, HASH64_ID);
+  PortableEncoding::putUInt32(buf, (uint32_t) entries.size());
+  PortableEncoding::putUInt32(buf, (uint32_t) (((uint64_t) entries.size()) >> 32));
+  PortableEncoding::putUInt32(buf, (uint32_t) points.size());
+  for(std::vector<Entry>::const_iterator it = entries.begin();
+      it != entries.end();
+      ++it) {
+    PortableEncoding::putUInt32(buf, (uint32_t) it->mHash);
+    PortableEncoding::putUInt32(buf, (uint32_t) (it->mHash >> 32));
+    PortableEncoding::putUInt32(buf, (uint32_t) it->mOffset);
+    PortableEncoding::putUInt32(buf, (uint32_t) (it->mOffset >> 32));
+    PortableEncoding::putUInt32(buf, it->mLength);
+  }
+  for(std::vector<AccessPoint>::const_iterator it = points.begin();
+      it != points.end();
+      ++it) {
+    PortableEncoding::putUInt32(buf, (uint32_t) it->mOut);
+    PortableEncoding::putUInt32(buf, (uint32_t) (it->mOut >> 32));
+    PortableEncoding::putUInt32(buf, (uint32_t) it->mIn);
+    PortableEncoding::putUInt32(buf, (uint32_t) (it->mIn >> 32));
+    PortableEncoding::putUInt32(buf, it->mBits);
+    PortableEncoding::putUInt32(buf, (uint32_t) it->mWindow.size());
+  }
+  for(std::vector<AccessPoint>::const_iterator it = points.begin();
+      it != points.end();
+      ++it) {
+    buf += it->mWindow;
+  }
+  // Write to a temporary and rename so that readers never see
+  // a partial index.
+  std::string indexFile = file + SUFFIX;
+  std::string tmpFile = indexFile + ".tmp";
+  {
+    std::ofstream out(tmpFile.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    out.write(buf.c_str(), buf.size());
+    out.close();
+    if (!out) {
+      throw std::runtime_error((boost::format("Failed writing index %1%") %
+				tmpFile).str());
+    }
+  }
+  if (0 != ::rename(tmpFile.c_str(), indexFile.c_str())) {
+    throw std::runtime_error((boost::format("Failed renaming %1% to %2%: %3%") %
+			      tmpFile % indexFile % strerror(errno)).str());
+  }
+}
+
+RecordIndexScanner::RecordIndexScanner(const std::string& file)
+  :
+  mFile(file),
+  mDataFile(-1),
+  mCompressed(boost::algorithm::ends_with(file, ".gz")),
+  mInputEOF(false),
+  mMemberEnd(false),
+  mIn(0),
+  mOut(0)
+{
+  mDataFile = ::open(file.c_str(), O_RDONLY);
+  if (mDataFile < 0) {
+    throw std::runtime_error((boost::format("Failed opening %1%: %2%") %
+			      file % strerror(errno)).str());
+  }
+  if (mCompressed) {
+    mStream.zalloc = Z_NULL;
+    mStream.zfree = Z_NULL;
+    mStream.opaque = Z_NULL;
+    mStream.avail_in = 0;
+    mStream.next_in = Z_NULL;
+    if (Z_OK != ::inflateInit2(&mStream, 31)) {
+      ::close(mDataFile);
+      throw std::runtime_error("Error initializing compression library");
+    }
+    mInput.resize(64*1024);
+    addPoint(0, std::string());
+  }
+}
+
+RecordIndexScanner::~RecordIndexScanner()
+{
+  if (mCompressed) {
+    ::inflateEnd(&mStream);
+  }
+  ::close(mDataFile);
+}
+
+std::size_t RecordIndexScanner::readSome(uint8_t * buf, std::size_t sz)
+{
+  while(true) {
+    ssize_t ret = ::read(mDataFile, buf, sz);
+    if (ret >= 0) {
+      return (std::size_t) ret;
+    } else if (errno != EINTR) {
+      throw std::runtime_error((boost::format("Failed reading %1%: %2%") %
+				mFile % strerror(errno)).str());
+    }
+  }
+}
+
+void RecordIndexScanner::addPoint(uint32_t bits, const std::string& window)
+{
+  RecordIndexFile::AccessPoint p;
+  p.mOut = mOut;
+  p.mIn = mIn;
+  p.mBits = bits;
+  p.mWindow = window;
+  mPoints.push_back(p);
+}
+
+std::size_t RecordIndexScanner::read(uint8_t * buf, std::size_t sz)
+{
+  if (!mCompressed) {
+    return readSome(buf, sz);
+  }
+  mStream.next_out = buf;
+  mStream.avail_out = (uInt) sz;
+  while(mStream.avail_out > 0) {
+    if (mStream.avail_in == 0) {
+      if (mInputEOF) 
+	break;
+      std::size_t ret = readSome(&mInput[0], mInput.size());
+      if (ret == 0) {
+	mInputEOF = true;
+	if (!mMemberEnd) {
+	  throw std::runtime_error((boost::format("Failed reading %1%: "
+						  "unexpected end of file") %
+				    mFile).str());
+	}
+	break;
+      }
+      mStream.next_in = &mInput[0];
+      mStream.avail_in = (uInt) ret;
+    }
+    if (mMemberEnd) {
+      // Another gzip member follows.
+      ::inflateReset(&mStream);
+      mMemberEnd = false;
+      if (mOut - mPoints.back().mOut >= RecordIndexFile::SPAN) {
+	addPoint(0, std::string());
+      }
+    }
+    uInt availIn = mStream.avail_in;
+    uint8_t * out = mStream.next_out;
+    // Z_BLOCK returns at every deflate block boundary so that
+    // we may take access points there.
+    int ret = ::inflate(&mStream, Z_BLOCK);
+    if (ret != Z_OK && ret != Z_STREAM_END) {
+      throw std::runtime_error((boost::format("Error decompressing %1%: inflate returned %2%") %
+			       mFile % ret).str());
+    }
+    mIn += availIn - mStream.avail_in;
+    std::size_t produced = mStream.next_out - out;
+    mOut += produced;
+    if (produced >= RecordIndexFile::WINDOW_SIZE) {
+      mWindow.assign((const char *) mStream.next_out - RecordIndexFile::WINDOW_SIZE, 
+		     RecordIndexFile::WINDOW_SIZE);
+    } else {
+      mWindow.append((const char *) out, produced);
+      if (mWindow.size() > RecordIndexFile::WINDOW_SIZE) {
+	mWindow.erase(0, mWindow.size() - RecordIndexFile::WINDOW_SIZE);
+      }
+    }
+    if (ret == Z_STREAM_END) {
+      mMemberEnd = true;
+    } else if ((mStream.data_type & 128) && !(mStream.data_type & 64) &&
+	       mOut - mPoints.back().mOut >= RecordIndexFile::SPAN) {
+      // At the end of a block that isn't the last of its member.
+      addPoint(mStream.data_type & 7, mWindow);
+    }
+  }
+  return sz - mStream.avail_out;
+}
+
+/**
+ * Expand a glob into the data files that may be indexed.
+ */
+static void expandIndexedFiles(const std::string& pattern, 
+			       std::vector<std::string>& files)
+{
+  std::vector<std::string> tmp;
+  Glob::expand(pattern, tmp);
+  for(std::vector<std::string>::const_iterator it = tmp.begin();
+      it != tmp.end();
+      ++it) {
+    if (boost::algorithm::ends_with(*it, RecordIndexFile::SUFFIX)) 
+      continue;
+    files.push_back(*it);
+  }
+}
+
+/**
+ * Parse a tab delimited record without its record separator.
+ */
+static void importRecord(const std::vector<FieldImporter>& importers,
+			 const std::string& line,
+			 RecordBuffer buf,
+			 const std::string& file)
+{
+  StringDataBlock blk;
+  blk.bindString(line);
+  for(std::vector<FieldImporter>::const_iterator it = importers.begin();
+      it != importers.end();
+      ++it) {
+    if (!it->Import(blk, buf)) {
+      throw std::runtime_error((boost::format("Invalid record in %1%:\n%2%\n") %
+				file % line).str());
+    }
+  }
+}
+
+class RuntimeIndexBuildOperator : public RuntimeOperatorBase<RuntimeIndexBuildOperatorType>
+{
+private:
+  enum State { START, WRITE, WRITE_EOF };
+  State mState;
+  std::vector<std::string> mFiles;
+  std::vector<std::string>::const_iterator mFileIt;
+  class InterpreterContext * mRuntimeContext;
+
+  /**
+   * Index a file and return the number of records in it.
+   */
+  int64_t index(const std::string& file);
+  void indexRecord(const std::string& file, const std::string& line, 
+		   uint64_t offset, std::vector<RecordIndexFile::Entry>& entries);
+public:
+  RuntimeIndexBuildOperator(RuntimeOperator::Services& services, 
+			    const RuntimeIndexBuildOperatorType& opType);
+  ~RuntimeIndexBuildOperator();
+  void start();
+  void onEvent(RuntimePort * port);
+  void shutdown();
+};
+
+RuntimeIndexBuildOperator::RuntimeIndexBuildOperator(RuntimeOperator::Services& services, 
+						     const RuntimeIndexBuildOperatorType& opType)
+  :
+  RuntimeOperatorBase<RuntimeIndexBuildOperatorType>(services, opType),
+  mState(START),
+  mRuntimeContext(new InterpreterContext())
+{
+}
+
+RuntimeIndexBuildOperator::~RuntimeIndexBuildOperator()
+{
+  delete mRuntimeContext;
+}
+
+void RuntimeIndexBuildOperator::indexRecord(const std::string& file, 
+					    const std::string& line, 
+					    uint64_t offset,
+					    std::vector<RecordIndexFile::Entry>& entries)
+{
+  RecordIndexFile::Entry e;
+  e.mOffset = offset;
+  e.mLength = (uint32_t) line.size();
+  RecordBuffer buf = getMyOperatorType().mMalloc.malloc();
+  importRecord(getMyOperatorType().mImporters, line, buf, file);
+  e.mHash = (uint64_t) getMyOperatorType().mHash->execute64(buf, RecordBuffer(), 
+							  mRuntimeContext);
+  getMyOperatorType().mFree.free(buf);
+  entries.push_back(e);
+}
+
+int64_t RuntimeIndexBuildOperator::index(const std::string& file)
+{
+  RecordIndexScanner in(file);
+  std::vector<RecordIndexFile::Entry> entries;
+  std::vector<uint8_t> chunk(64*1024);
+  std::string line;
+  uint64_t offset = 0;
+  while(true) {
+    std::size_t sz = in.read(&chunk[0], chunk.size());
+    if (sz == 0) 
+      break;
+    const char * it = (const char *) &chunk[0];
+    const char * end = it + sz;
+    while(it != end) {
+      const char * nl = (const char *) memchr(it, '\n', end - it);
+      if (nl == NULL) {
+	line.append(it, end);
+	break;
+      }
+      line.append(it, nl);
+      indexRecord(file, line, offset, entries);
+      offset += line.size() + 1;
+      line.clear();
+      it = nl + 1;
+    }
+  }
+  // The separator is only missing at the end of an 
+  // unterminated file.
+  if (line.size()) {
+    indexRecord(file, line, offset, entries);
+  }
+  RecordIndexFile::write(file, entries, in.getAccessPoints());
+  return (int64_t) entries.size();
+}
+
+void RuntimeIndexBuildOperator::start()
+{
+  // Divide the files among the partitions.
+  std::vector<std::string> files;
+  expandIndexedFiles(getMyOperatorType().mFile, files);
+  mFiles.clear();
+  for(std::size_t i=0; i<files.size(); ++i) {
+    if ((int32_t) (i % getNumPartitions()) == getPartition()) {
+      mFiles.push_back(files[i]);
+    }
+  }
+  mState = START;
+  onEvent(NULL);
+}
+
+void RuntimeIndexBuildOperator::onEvent(RuntimePort * port)
+{
+  switch(mState) {
+  case START:
+    for(mFileIt = mFiles.begin(); mFileIt != mFiles.end(); ++mFileIt) {
+      requestWrite(0);
+      mState = WRITE;
+      return;
+    case WRITE:
+      {
+	RecordBuffer out = getMyOperatorType().mOutputMalloc.malloc();
+	getMyOperatorType().mOutputFile.SetVariableLengthString(out, 
+								mFileIt->c_str(),
+								mFileIt->size());
+	getMyOperatorType().mOutputRecords.setInt64(index(*mFileIt), out);
+	write(port, out, false);
+      }
+    }
+    requestWrite(0);
+    mState = WRITE_EOF;
+    return;
+  case WRITE_EOF:
+    write(port, RecordBuffer(), true);
+    return;
+  }
+}
+
+void RuntimeIndexBuildOperator::shutdown()
+{
+}
+
+RuntimeIndexBuildOperatorType::RuntimeIndexBuildOperatorType(const std::string& file,
+							     const RecordType * format,
+							     const RecordTypeFunction * hash,
+							     const RecordType * output)
+  :
+  RuntimeOperatorType("RuntimeIndexBuildOperatorType"),
+  mFile(file),
+  mMalloc(format->getMalloc()),
+  mFree(format->getFree()),
+  mHash(hash->create()),
+  mOutputMalloc(output->getMalloc()),
+  mOutputFile(output->getFieldAddress("file")),
+  mOutputRecords(output->getFieldAddress("records"))
+{
+  // Records are read a line at a time so the last field 
+  // is terminated by the end of the string.
+  FieldImporter::createDefaultImport(format, format, '\t', (char) 0, '\\', 
+				     mImporters);
+}
+
+RuntimeIndexBuildOperatorType::~RuntimeIndexBuildOperatorType()
+{
+  delete mHash;
+}
+
+RuntimeOperator * RuntimeIndexBuildOperatorType::create(RuntimeOperator::Services & s) const
+{
+  return new RuntimeIndexBuildOperator(s, *this);
+}
+
+class RuntimeIndexLookupOperator : public RuntimeOperatorBase<RuntimeIndexLookupOperatorType>
+{
+private:
+  enum State { START, READ, WRITE, WRITE_EOF };
+  State mState;
+  RecordBuffer mInput;
+  std::vector<RecordIndexFile *> mIndexes;
+  std::vector<RecordBuffer> mMatches;
+  std::vector<RecordBuffer>::iterator mMatchIt;
+  std::vector<RecordIndexFile::Entry> mCandidates;
+  std::string mRecord;
+  class InterpreterContext * mRuntimeContext;
+
+  /**
+   * Fetch the records matching the key of mInput into mMatches.
+   */
+  void lookup();
+  void closeIndexes();
+public:
+  RuntimeIndexLookupOperator(RuntimeOperator::Services& services, 
+			     const RuntimeIndexLookupOperatorType& opType);
+  ~RuntimeIndexLookupOperator();
+  void start();
+  void onEvent(RuntimePort * port);
+  void shutdown();
+};
+
+RuntimeIndexLookupOperator::RuntimeIndexLookupOperator(RuntimeOperator::Services& services, 
+						       const RuntimeIndexLookupOperatorType& opType)
+  :
+  RuntimeOperatorBase<RuntimeIndexLookupOperatorType>(services, opType),
+  mState(START),
+  mRuntimeContext(new InterpreterContext())
+{
+}
+
+RuntimeIndexLookupOperator::~RuntimeIndexLookupOperator()
+{
+  closeIndexes();
+  delete mRuntimeContext;
+}
+
+void RuntimeIndexLookupOperator::closeIndexes()
+{
+  for(std::vector<RecordIndexFile *>::iterator it = mIndexes.begin();
+      it != mIndexes.end();
+      ++it) {
+    delete *it;
+  }
+  mIndexes.clear();
+}
+
+void RuntimeIndexLookupOperator::lookup()
+{
+  const RuntimeIndexLookupOperatorType & opType(getMyOperatorType());
+  uint64_t hash = (uint64_t) opType.mHash->execute64(mInput, RecordBuffer(), 
+						   mRuntimeContext);
+  for(std::vector<RecordIndexFile *>::const_iterator idx = mIndexes.begin();
+      idx != mIndexes.end();
+      ++idx) {
+    mCandidates.clear();
+    (*idx)->find(hash, mCandidates);
+    for(std::vector<RecordIndexFile::Entry>::const_iterator it = mCandidates.begin();
+	it != mCandidates.end();
+	++it) {
+      (*idx)->read(*it, mRecord);
+      // Strip the record separator; the importers expect 
+      // the end of the string.
+      if (mRecord.size() && mRecord[mRecord.size()-1] == '\n') {
+	mRecord.resize(mRecord.size()-1);
+      }
+      RecordBuffer buf = opType.mMalloc.malloc();
+      importRecord(opType.mImporters, mRecord, buf, (*idx)->getFile());
+      // Different keys may share a hash.
+      if (opType.mEquals->execute(mInput, buf, mRuntimeContext)) {
+	mMatches.push_back(buf);
+      } else {
+	opType.mFree.free(buf);
+      }
+    }
+  }
+}
+
+void RuntimeIndexLookupOperator::start()
+{
+  // Every partition searches every file.
+  closeIndexes();
+  std::vector<std::string> files;
+  expandIndexedFiles(getMyOperatorType().mFile, files);
+  for(std::vector<std::string>::const_iterator it = files.begin();
+      it != files.end();
+      ++it) {
+    mIndexes.push_back(new RecordIndexFile(*it));
+  }
+  mState = START;
+  onEvent(NULL);
+}
+
+void RuntimeIndexLookupOperator::onEvent(RuntimePort * port)
+{
+  switch(mState) {
+  case START:
+    while(true) {
+      requestRead(0);
+      mState = READ;
+      return;
+    case READ:
+      read(port, mInput);
+      if (RecordBuffer::isEOS(mInput)) 
+	break;
+      
+      mMatches.clear();
+      lookup();
+      for(mMatchIt = mMatches.begin(); mMatchIt != mMatches.end(); ++mMatchIt) {
+	requestWrite(0);
+	mState = WRITE;
+	return;
+      case WRITE:
+	write(port, *mMatchIt, false);
+      }
+      getMyOperatorType().mInputFree.free(mInput);
+      mInput = RecordBuffer();
+    }
+    
+    requestWrite(0);
+    mState = WRITE_EOF;
+    return;
+  case WRITE_EOF:
+    write(port, RecordBuffer(), true);
+    return;
+  }
+}
+
+void RuntimeIndexLookupOperator::shutdown()
+{
+  closeIndexes();
+}
+
+RuntimeIndexLookupOperatorType::RuntimeIndexLookupOperatorType(const std::string& file,
+							       const RecordType * input,
+							       const RecordType * format,
+							       const RecordTypeFunction * hash,
+							       const RecordTypeFunction * equals)
+  :
+  RuntimeOperatorType("RuntimeIndexLookupOperatorType"),
+  mFile(file),
+  mMalloc(format->getMalloc()),
+  mFree(format->getFree()),
+  mInputFree(input->getFree()),
+  mHash(hash->create()),
+  mEquals(equals->create())
+{
+  FieldImporter::createDefaultImport(format, format, '\t', (char) 0, '\\', 
+				     mImporters);
+}
+
+RuntimeIndexLookupOperatorType::~RuntimeIndexLookupOperatorType()
+{
+  delete mHash;
+  delete mEquals;
+}
+
+RuntimeOperator * RuntimeIndexLookupOperatorType::create(RuntimeOperator::Services & s) const
+{
+  return new RuntimeIndexLookupOperator(s, *this);
+}
+
+LogicalIndexBuild::LogicalIndexBuild()
+  :
+  LogicalOperator(0,0,1,1),
+  mFormat(NULL),
+  mHash(NULL)
+{
+}
+
+LogicalIndexBuild::~LogicalIndexBuild()
+{
+  delete mHash;
+}
+
+void LogicalIndexBuild::check(PlanCheckContext& ctxt)
+{
+  const LogicalOperatorParam * formatParam=NULL;
+  for(const_param_iterator it = begin_params();
+      it != end_params();
+      ++it) {
+    try {
+      if (it->equals("file")) {
+	mFile = getStringValue(ctxt, *it);
+      } else if (it->equals("format")) {
+	mStringFormat = getStringValue(ctxt, *it);
+	formatParam = &*it;
+      } else if (it->equals("formatfile")) {
+	std::string filename(getStringValue(ctxt, *it));
+	mStringFormat = FileSystem::readFile(filename);
+	formatParam = &*it;
+      } else if (it->equals("key")) {
+	mKeys.push_back(getStringValue(ctxt, *it));
+      } else {
+	checkDefaultParam(*it);
+      }
+    } catch(std::runtime_error& ex) {
+      ctxt.logError(*this, *it, ex.what());
+    }
+  }
+
+  if (0 == mFile.size()) {
+    ctxt.logError(*this, "Must specify file argument");
+  }
+  if (0 == mKeys.size()) {
+    ctxt.logError(*this, "Must specify at least one key argument");
+  }
+  if (NULL == formatParam || 0==mStringFormat.size()) {
+    ctxt.logError(*this, "Must specify format argument");
+  } else {
+    try {
+      IQLRecordTypeBuilder bld(ctxt, mStringFormat, false);
+      mFormat = bld.getProduct();
+      bool keysValid = true;
+      for(std::vector<std::string>::const_iterator k = mKeys.begin();
+	  k != mKeys.end();
+	  ++k) {
+	if (!mFormat->hasMember(*k)) {
+	  ctxt.logError(*this, (boost::format("key %1% not in format") % *k).str());
+	  keysValid = false;
+	}
+      }
+      if (keysValid && mKeys.size()) {
+	mHash = HashFunction::get(ctxt, mFormat, mKeys, "indexHash");
+      }
+    } catch(std::exception& ex) {
+      ctxt.logError(*this, *formatParam, ex.what());
+    }
+  }
+
+  std::vector<RecordMember> members;
+  members.push_back(RecordMember("file", VarcharType::Get(ctxt)));
+  members.push_back(RecordMember("records", Int64Type::Get(ctxt)));
+  getOutput(0)->setRecordType(RecordType::get(ctxt, members));
+}
+
+void LogicalIndexBuild::create(class RuntimePlanBuilder& plan)
+{
+  RuntimeOperatorType * opType = 
+    new RuntimeIndexBuildOperatorType(mFile, mFormat, mHash, 
+				      getOutput(0)->getRecordType());
+  plan.addOperatorType(opType);
+  plan.mapOutputPort(this, 0, opType, 0);
+}
+
+LogicalIndexLookup::LogicalIndexLookup()
+  :
+  LogicalOperator(1,1,1,1),
+  mFormat(NULL),
+  mHash(NULL),
+  mEquals(NULL)
+{
+}
+
+LogicalIndexLookup::~LogicalIndexLookup()
+{
+  delete mHash;
+  delete mEquals;
+}
+
+void LogicalIndexLookup::check(PlanCheckContext& ctxt)
+{
+  const LogicalOperatorParam * formatParam=NULL;
+  for(const_param_iterator it = begin_params();
+      it != end_params();
+      ++it) {
+    try {
+      if (it->equals("file")) {
+	mFile = getStringValue(ctxt, *it);
+      } else if (it->equals("format")) {
+	mStringFormat = getStringValue(ctxt, *it);
+	formatParam = &*it;
+      } else if (it->equals("formatfile")) {
+	std::string filename(getStringValue(ctxt, *it));
+	mStringFormat = FileSystem::readFile(filename);
+	formatParam = &*it;
+      } else if (it->equals("key")) {
+	mKeys.push_back(getStringValue(ctxt, *it));
+      } else {
+	checkDefaultParam(*it);
+      }
+    } catch(std::runtime_error& ex) {
+      ctxt.logError(*this, *it, ex.what());
+    }
+  }
+
+  if (0 == mFile.size()) {
+    ctxt.logError(*this, "Must specify file argument");
+  }
+  if (0 == mKeys.size()) {
+    ctxt.logError(*this, "Must specify at least one key argument");
+  }
+  if (NULL == formatParam || 0==mStringFormat.size()) {
+    ctxt.logError(*this, "Must specify format argument");
+    return;
+  } 
+  try {
+    IQLRecordTypeBuilder bld(ctxt, mStringFormat, false);
+    mFormat = bld.getProduct();
+  } catch(std::exception& ex) {
+    ctxt.logError(*this, *formatParam, ex.what());
+    return;
+  }
+
+  // The lookup hashes the input key so it must agree with the
+  // hash of the indexed key.
+  const RecordType * input = getInput(0)->getRecordType();
+  bool keysValid = true;
+  for(std::vector<std::string>::const_iterator k = mKeys.begin();
+      k != mKeys.end();
+      ++k) {
+    if (!mFormat->hasMember(*k)) {
+      ctxt.logError(*this, (boost::format("key %1% not in format") % *k).str());
+      keysValid = false;
+    } else if (!input->hasMember(*k)) {
+      ctxt.logError(*this, (boost::format("key %1% not in input") % *k).str());
+      keysValid = false;
+    } else if (input->getMember(*k).GetType()->GetEnum() != 
+	       mFormat->getMember(*k).GetType()->GetEnum()) {
+      ctxt.logError(*this, (boost::format("key %1% must have the same type "
+					  "in input and format") % *k).str());
+      keysValid = false;
+    }
+  }
+  if (keysValid && mKeys.size()) {
+    mHash = HashFunction::get(ctxt, input, mKeys, "indexLookupHash");
+    mEquals = EqualsFunction::get(ctxt, input, mFormat, mKeys, "indexLookupEq");
+  }
+  getOutput(0)->setRecordType(mFormat);
+}
+
+void LogicalIndexLookup::create(class RuntimePlanBuilder& plan)
+{
+  RuntimeOperatorType * opType = 
+    new RuntimeIndexLookupOperatorType(mFile, getInput(0)->getRecordType(),
+				       mFormat, mHash, mEquals);
+  plan.addOperatorType(opType);
+  plan.mapInputPort(this, 0, opType, 0);
+  plan.mapOutputPort(this, 0, opType, 0);
+}
@@ -0,0 +1,315 @@
+/**
+ * Copyright (c) 2012, Akamai Technologies
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * 
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ * 
+ *   Neither the name of the Akamai Technologies nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if !defined(__INDEXOPERATOR_HH)
+#define __INDEXOPERATOR_HH
+
+#include <string>
+#include <vector>
+#include <zlib.h>
+#include "RuntimeOperator.hh"
+#include "RecordParser.hh"
+
+/**
+ * A hash index over the records of a tab delimited text file, 
+ * stored next to the file as <file>.idx.  The index holds for 
+ * every record the hash of its key and its location in the file:
+ *
+ * ["TRIX"][uint32 version][uint32 hash id][uint64 number of entries]
+ * [uint32 number of access points]
+ * ([uint64 hash][uint64 offset][uint32 length])...
+ * ([uint64 uncompressed offset][uint64 compressed offset][uint32 bits]
+ *  [uint32 window size])...
+ * (window)...
+ *
+ * Entries are sorted on hash so a lookup is a binary search with 
+ * pread.  Integers are little endian.  The hash id is HASH64_ID of 
+ * the build; an index built with a different #() is rejected.
+ *
+ * A gzip file (such as the serials of a table) is indexed by offset 
+ * into its uncompressed data together with access points from which
+ * it may be inflated: the start of each gzip member, and the deflate
+ * block boundaries about every SPAN bytes along with the WINDOW_SIZE
+ * bytes of data preceding them.  A record is read by inflating from 
+ * the last access point before it.  Uncompressed files have no 
+ * access points.
+ */
+class RecordIndexFile
+{
+public:
+  enum { VERSION = 4, HEADER_SIZE = 24, ENTRY_SIZE = 20, POINT_SIZE = 24,
+	 WINDOW_SIZE = 32*1024, SPAN = 1024*1024 };
+  static const char * SUFFIX;
+
+  class Entry
+  {
+  public:
+    uint64_t mHash;
+    uint64_t mOffset;
+    uint32_t mLength;
+    bool operator<(const Entry& rhs) const
+    {
+      return mHash < rhs.mHash || 
+	(mHash == rhs.mHash && mOffset < rhs.mOffset);
+    }
+  };
+
+  class AccessPoint
+  {
+  public:
+    // Offset into the uncompressed data.
+    uint64_t mOut;
+    // Offset of the first compressed byte after the point.
+    uint64_t mIn;
+    // Number of bits of the byte before mIn that follow the point.
+    uint32_t mBits;
+    // Uncompressed data preceding a block boundary; empty at 
+    // the start of a gzip member.
+    std::string mWindow;
+  };
+private:
+  std::string mFile;
+  int mDataFile;
+  int mIndexFile;
+  uint64_t mNumEntries;
+  // Windows are read from the index as needed so only their
+  // offsets are kept; mWindowOffsets has one more element than
+  // mPoints.
+  std::vector<AccessPoint> mPoints;
+  std::vector<uint64_t> mWindowOffsets;
+
+  void readEntry(uint64_t i, Entry& e) const;
+  void inflate(const Entry& e, std::string& record) const;
+public:
+  /**
+   * Open a data file and its index for lookups.
+   */
+  RecordIndexFile(const std::string& file);
+  ~RecordIndexFile();
+  const std::string& getFile() const
+  {
+    return mFile;
+  }
+  uint64_t size() const
+  {
+    return mNumEntries;
+  }
+  /**
+   * Append the entries with hash to entries.
+   */
+  void find(uint64_t hash, std::vector<Entry>& entries) const;
+  /**
+   * Read the record of an entry.
+   */
+  void read(const Entry& e, std::string& record) const;
+  /**
+   * Sort entries and write them as the index of file.  Offsets of
+   * entries of a gzip file are into the uncompressed data and points
+   * are those of RecordIndexScanner.
+   */
+  static void write(const std::string& file, std::vector<Entry>& entries,
+		    const std::vector<AccessPoint>& points = std::vector<AccessPoint>());
+};
+
+/**
+ * Reads a data file from start to end for indexing.  A file ending
+ * in .gz is inflated, possibly across several gzip members, and the
+ * access points of RecordIndexFile are taken along the way.
+ */
+class RecordIndexScanner
+{
+private:
+  std::string mFile;
+  int mDataFile;
+  bool mCompressed;
+  z_stream mStream;
+  std::vector<uint8_t> mInput;
+  bool mInputEOF;
+  bool mMemberEnd;
+  // Compressed bytes consumed and uncompressed bytes produced.
+  uint64_t mIn;
+  uint64_t mOut;
+  // The last WINDOW_SIZE bytes produced.
+  std::string mWindow;
+  std::vector<RecordIndexFile::AccessPoint> mPoints;
+
+  std::size_t readSome(uint8_t * buf, std::size_t sz);
+  void addPoint(uint32_t bits, const std::string& window);
+public:
+  RecordIndexScanner(const std::string& file);
+  ~RecordIndexScanner();
+  /**
+   * Read up to sz bytes of uncompressed data.  Returns 0 at end
+   * of file.
+   */
+  std::size_t read(uint8_t * buf, std::size_t sz);
+  const std::vector<RecordIndexFile::AccessPoint>& getAccessPoints() const
+  {
+    return mPoints;
+  }
+};
+
+/**
+ * build_index[file="...", format="...", key="..."]
+ *
+ * Writes an index on the key columns next to each file matching 
+ * file, which may be gzip compressed.  Files are divided among 
+ * partitions.  Outputs the name and
+ * number of records of each file indexed.
+ */
+class LogicalIndexBuild : public LogicalOperator
+{
+private:
+  std::string mFile;
+  std::string mStringFormat;
+  const RecordType * mFormat;
+  std::vector<std::string> mKeys;
+  RecordTypeFunction * mHash;
+public:
+  LogicalIndexBuild();
+  ~LogicalIndexBuild();
+  void check(PlanCheckContext& log);
+  void create(class RuntimePlanBuilder& plan);  
+};
+
+/**
+ * index_lookup[file="...", format="...", key="..."]
+ *
+ * For each input record output the records of the indexed files 
+ * (see build_index) with the same key.  The key columns must be
+ * in the input and the format with the same types.  Only the index
+ * entries and the records with a matching hash are read.
+ */
+class LogicalIndexLookup : public LogicalOperator
+{
+private:
+  std::string mFile;
+  std::string mStringFormat;
+  const RecordType * mFormat;
+  std::vector<std::string> mKeys;
+  RecordTypeFunction * mHash;
+  RecordTypeFunction * mEquals;
+public:
+  LogicalIndexLookup();
+  ~LogicalIndexLookup();
+  void check(PlanCheckContext& log);
+  void create(class RuntimePlanBuilder& plan);  
+};
+
+class RuntimeIndexBuildOperatorType : public RuntimeOperatorType
+{
+  friend class RuntimeIndexBuildOperator;
+private:
+  std::string mFile;
+  std::vector<FieldImporter> mImporters;
+  RecordTypeMalloc mMalloc;
+  RecordTypeFree mFree;
+  IQLFunctionModule * mHash;
+  // Output
+  RecordTypeMalloc mOutputMalloc;
+  FieldAddress mOutputFile;
+  FieldAddress mOutputRecords;
+
+  // Serialization
+  friend class boost::serialization::access;
+  template <class Archive>
+  void serialize(Archive & ar, const unsigned int version)
+  {
+    ar & BOOST_SERIALIZATION_BASE_OBJECT_NVP(RuntimeOperatorType);
+    ar & BOOST_SERIALIZATION_NVP(mFile);
+    ar & BOOST_SERIALIZATION_NVP(mImporters);
+    ar & BOOST_SERIALIZATION_NVP(mMalloc);
+    ar & BOOST_SERIALIZATION_NVP(mFree);
+    ar & BOOST_SERIALIZATION_NVP(mHash);
+    ar & BOOST_SERIALIZATION_NVP(mOutputMalloc);
+    ar & BOOST_SERIALIZATION_NVP(mOutputFile);
+    ar & BOOST_SERIALIZATION_NVP(mOutputRecords);
+  }
+  RuntimeIndexBuildOperatorType()
+    :
+    mHash(NULL)
+  {
+  }
+public:
+  RuntimeIndexBuildOperatorType(const std::string& file,
+				const RecordType * format,
+				const RecordTypeFunction * hash,
+				const RecordType * output);
+  ~RuntimeIndexBuildOperatorType();
+  RuntimeOperator * create(RuntimeOperator::Services & s) const;  
+};
+
+class RuntimeIndexLookupOperatorType : public RuntimeOperatorType
+{
+  friend class RuntimeIndexLookupOperator;
+private:
+  std::string mFile;
+  std::vector<FieldImporter> mImporters;
+  RecordTypeMalloc mMalloc;
+  RecordTypeFree mFree;
+  RecordTypeFree mInputFree;
+  IQLFunctionModule * mHash;
+  IQLFunctionModule * mEquals;
+
+  // Serialization
+  friend class boost::serialization::access;
+  template <class Archive>
+  void serialize(Archive & ar, const unsigned int version)
+  {
+    ar & BOOST_SERIALIZATION_BASE_OBJECT_NVP(RuntimeOperatorType);
+    ar & BOOST_SERIALIZATION_NVP(mFile);
+    ar & BOOST_SERIALIZATION_NVP(mImporters);
+    ar & BOOST_SERIALIZATION_NVP(mMalloc);
+    ar & BOOST_SERIALIZATION_NVP(mFree);
+    ar & BOOST_SERIALIZATION_NVP(mInputFree);
+    ar & BOOST_SERIALIZATION_NVP(mHash);
+    ar & BOOST_SERIALIZATION_NVP(mEquals);
+  }
+  RuntimeIndexLookupOperatorType()
+    :
+    mHash(NULL),
+    mEquals(NULL)
+  {
+  }
+public:
+  RuntimeIndexLookupOperatorType(const std::string& file,
+				 const RecordType * input,
+				 const RecordType * format,
+				 const RecordTypeFunction * hash,
+				 const RecordTypeFunction * equals);
+  ~RuntimeIndexLookupOperatorType();
+  RuntimeOperator * create(RuntimeOperator::Services & s) const;  
+};
+
+#endif
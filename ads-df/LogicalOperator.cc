@@ -92,6 +92,12 @@ SortKey::Order SortKey::getOrder() const
   return mOrder;
 }
 
+PlanCheckContext::PlanCheckContext()
+  :
+  mPartitionsSpanProcesses(false)
+{
+}
+
 void PlanCheckContext::logError(const LogicalOperator& op,
 				const std::string& msg)
 {
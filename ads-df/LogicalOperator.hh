@@ -71,7 +71,23 @@ public:
 
 class PlanCheckContext : public DynamicRecordContext
 {
+private:
+  bool mPartitionsSpanProcesses;
 public:
+  PlanCheckContext();
+  /**
+   * Will the partitions of the plan be run by more than one
+   * process?  Crossbars are only supported between partitions
+   * of a single process.
+   */
+  bool partitionsSpanProcesses() const
+  {
+    return mPartitionsSpanProcesses;
+  }
+  void setPartitionsSpanProcesses(bool val)
+  {
+    mPartitionsSpanProcesses = val;
+  }
   /**
    * LogicalOperators should call this when they 
    * see an error that prevents them from code generating
@@ -330,6 +330,309 @@ bool LoserTree<_Data,_Compare>::isHighSentinel() const {
   return SentinelPolicy::isHighSentinel(mNodes[0].KeyPrefix);
 }
 
+/**
+ * A tournament tree of losers over normalized keys (arrays of
+ * 32-bit words whose lexicographic order is the sort order) that
+ * uses offset-value coding; see Graefe "Implementing Sorting in
+ * Database Systems" and Conner "Offset value coding".
+ *
+ * Every loser in the tree carries a code that says how it differs
+ * from the winner of the match it lost: the offset of the first
+ * word that differs and the value of that word.  All losers on the
+ * path of a new entrant are coded relative to the previous winner 
+ * and so is the entrant, so most matches are decided by a single
+ * integer comparison of codes.  Only equal codes require looking at
+ * keys and then only past the offset already known to be equal.
+ *
+ * Unlike LoserTree this is a min-priority queue.  Inputs must be 
+ * sorted on their keys and the caller must keep the key of an entry
+ * alive while the entry is in the tree (including while it is the
+ * winner at the root).
+ */
+template <class _Data>
+class OffsetValueLoserTree
+{
+public:
+  class Node 
+  {
+  public:
+    /**
+     * Player in the tournament that lost here.
+     */
+    uint32_t InputNumber;
+    /**
+     * Offset-value code relative to the winner; smaller codes win.
+     */
+    uint64_t Code;
+    /**
+     * Normalized key.
+     */
+    const uint32_t * Key;
+    uint32_t KeySize;
+    _Data Value;
+  };
+
+private:
+  class CodePolicy
+  {
+  public:
+    static const uint32_t MaxPlayers = 8192;
+    static uint32_t getMaxPlayers() {
+      return MaxPlayers;
+    }
+    /**
+     * High sentinels win against everything; they mark
+     * inputs from which we haven't read yet.  As in LoserTree
+     * sentinels of higher numbered players win (init depends on it).
+     */
+    static uint64_t getHighSentinel(uint32_t i) {
+      return MaxPlayers - 1 - i;
+    }
+    static bool isHighSentinel(uint64_t c) {
+      return c < MaxPlayers;
+    }
+    /**
+     * Low sentinels lose against everything; they mark
+     * inputs that are closed.
+     */
+    static uint64_t getLowSentinel(uint32_t i) {
+      return std::numeric_limits<uint64_t>::max() - i;
+    }
+    static bool isLowSentinel(uint64_t c) {
+      return c > std::numeric_limits<uint64_t>::max() - MaxPlayers;
+    }
+    /**
+     * Code of a key equal to the one it is relative to.
+     */
+    static uint64_t getDuplicate() {
+      return MaxPlayers;
+    }
+    /**
+     * A later offset means a longer common prefix and therefore
+     * a smaller key.
+     */
+    static uint64_t getCode(uint32_t offset, uint32_t value) {
+      return (((uint64_t) (0x7fffffffU - offset)) << 32) | value;
+    }
+    static uint32_t getOffset(uint64_t c) {
+      return 0x7fffffffU - (uint32_t) (c >> 32);
+    }
+  };
+
+  uint32_t mNumPlayers;
+  Node * mNodes;
+
+  void internalUpdate(uint32_t player, uint64_t code, 
+		      const uint32_t * key, uint32_t keySize, _Data val);
+
+public:
+  OffsetValueLoserTree();
+  OffsetValueLoserTree(uint32_t numberOfPlayers);
+  ~OffsetValueLoserTree();
+
+  /**
+   * Initialize a loser tournament tree for
+   * numberOfPlayers inputs.
+   */
+  void init(uint32_t numberOfPlayers);
+  /**
+   * Replace the winner (which must be from input player) by 
+   * the next value from the same input.
+   */
+  void update(uint32_t player, const uint32_t * key, uint32_t keySize, 
+	      _Data val);
+  /**
+   * Check if high sentinel.
+   */
+  bool isHighSentinel() const
+  {
+    return CodePolicy::isHighSentinel(mNodes[0].Code);
+  }
+  /**
+   * Check if tree is empty.
+   */
+  bool empty() const
+  {
+    return CodePolicy::isLowSentinel(mNodes[0].Code);
+  }
+  /**
+   * Close the input to the tree.
+   */
+  void close(uint32_t input)
+  {
+    internalUpdate(input, CodePolicy::getLowSentinel(input), NULL, 0, _Data());
+  }
+  /**
+   * The input/player corresponding to the top.
+   */
+  uint32_t getInput() const
+  {
+    return mNodes[0].InputNumber;
+  }
+  /**
+   * The value corresponding to the top.
+   */
+  _Data getValue() const
+  {
+    return mNodes[0].Value;
+  }
+};
+
+template <class _Data>
+OffsetValueLoserTree<_Data>::OffsetValueLoserTree()
+  :
+  mNumPlayers(0),
+  mNodes(NULL)
+{
+}
+
+template <class _Data>
+OffsetValueLoserTree<_Data>::OffsetValueLoserTree(uint32_t numberOfPlayers)
+  :
+  mNumPlayers(0),
+  mNodes(NULL)
+{
+  init(numberOfPlayers);
+}
+
+template <class _Data>
+OffsetValueLoserTree<_Data>::~OffsetValueLoserTree()
+{
+  delete [] mNodes;
+}
+
+template <class _Data>
+void OffsetValueLoserTree<_Data>::init(uint32_t numberOfPlayers)
+{
+  delete [] mNodes;
+  mNumPlayers = numberOfPlayers;
+  // Same approach as LoserTree: round up to a power of 2
+  // and close the inputs we aren't using.
+  numberOfPlayers = Bithack::roundUpPow2(mNumPlayers);
+  uint32_t numberOfPlayersLog2 = Bithack::logBase2(numberOfPlayers);
+  if (numberOfPlayers > CodePolicy::getMaxPlayers()) {
+    throw std::runtime_error((boost::format("Cannot merge more than %1% streams") %
+			      CodePolicy::getMaxPlayers()).str());
+  }
+  mNodes = new Node [numberOfPlayers];
+  for(uint32_t lev=1; lev<=numberOfPlayersLog2; lev++) {
+    uint32_t levelBegin = numberOfPlayers >> lev;
+    uint32_t numInLevel = levelBegin;
+    uint32_t levelInc = (1<<lev);
+    for(uint32_t i=0; i<numInLevel; i++) {
+      uint32_t tmp = (1 << (lev-1)) - 1 + levelInc*i;
+      BOOST_ASSERT(levelBegin+i < numberOfPlayers);
+      mNodes[levelBegin + i].InputNumber = tmp;
+      mNodes[levelBegin + i].Code = CodePolicy::getHighSentinel(tmp);
+      mNodes[levelBegin + i].Key = NULL;
+      mNodes[levelBegin + i].KeySize = 0;
+      mNodes[levelBegin + i].Value = _Data();
+    }
+  }
+  mNodes[0].InputNumber = numberOfPlayers-1;
+  mNodes[0].Code = CodePolicy::getHighSentinel(numberOfPlayers - 1);  
+  mNodes[0].Key = NULL;
+  mNodes[0].KeySize = 0;
+  mNodes[0].Value = _Data();
+
+  for(uint32_t i=mNumPlayers; i<numberOfPlayers; i++) {
+    close(i);
+  }
+}
+
+template <class _Data>
+void OffsetValueLoserTree<_Data>::update(uint32_t player, 
+					 const uint32_t * key, 
+					 uint32_t keySize, 
+					 _Data val)
+{
+  BOOST_ASSERT(player == mNodes[0].InputNumber);
+  BOOST_ASSERT(keySize > 0);
+  if (keySize > 0x7fffffffU) {
+    throw std::runtime_error("Normalized key too long");
+  }
+  // Code the new key relative to the winner it replaces.  If the
+  // winner is a high sentinel we code relative to a key smaller than
+  // any other (as are all keys in the tree at this point).
+  const Node & w(mNodes[0]);
+  uint64_t code;
+  if (CodePolicy::isHighSentinel(w.Code)) {
+    code = CodePolicy::getCode(0, key[0]);
+  } else {
+    uint32_t sz = (std::min)(keySize, w.KeySize);
+    uint32_t offset = 0;
+    while(offset < sz && key[offset] == w.Key[offset]) {
+      ++offset;
+    }
+    code = offset == keySize && offset == w.KeySize ? 
+      CodePolicy::getDuplicate() :
+      CodePolicy::getCode(offset, offset < keySize ? key[offset] : 0);
+  }
+  internalUpdate(player, code, key, keySize, val);
+}
+
+template <class _Data>
+void OffsetValueLoserTree<_Data>::internalUpdate(uint32_t player, 
+						 uint64_t code,
+						 const uint32_t * key, 
+						 uint32_t keySize, 
+						 _Data val)
+{
+  // Bottom up tournament.  Start playing in bracket player/2.
+  for(std::size_t idx = (Bithack::roundUpPow2(mNumPlayers)>>1) + (player >> 1);
+      idx>=1;
+      idx >>= 1) {
+    Node & n (mNodes[idx]);
+    bool nodeWins = n.Code < code;
+    if (n.Code == code && 
+	code != CodePolicy::getDuplicate() &&
+	!CodePolicy::isHighSentinel(code) &&
+	!CodePolicy::isLowSentinel(code)) {
+      // Same offset and value: compare the rest of the keys and 
+      // recode the loser relative to the winner.
+      uint32_t sz = (std::min)(keySize, n.KeySize);
+      uint32_t offset = CodePolicy::getOffset(code) + 1;
+      while(offset < sz && key[offset] == n.Key[offset]) {
+	++offset;
+      }
+      if (offset == keySize && offset == n.KeySize) {
+	// Equal keys; the node keeps its place.
+	n.Code = CodePolicy::getDuplicate();
+      } else if (offset == sz) {
+	// Can only happen if the encoding isn't prefix free.
+	nodeWins = n.KeySize < keySize;
+	if (nodeWins) {
+	  code = CodePolicy::getCode(offset, key[offset]);
+	} else {
+	  n.Code = CodePolicy::getCode(offset, n.Key[offset]);
+	}
+      } else {
+	nodeWins = n.Key[offset] < key[offset];
+	if (nodeWins) {
+	  code = CodePolicy::getCode(offset, key[offset]);
+	} else {
+	  n.Code = CodePolicy::getCode(offset, n.Key[offset]);
+	}
+      }
+    }
+
+    if(nodeWins) {
+      std::swap(player, n.InputNumber);
+      std::swap(code, n.Code);
+      std::swap(key, n.Key);
+      std::swap(keySize, n.KeySize);
+      std::swap(val, n.Value);
+    } 
+  }
+
+  // Update the top of the tree
+  mNodes[0].InputNumber = player;
+  mNodes[0].Code = code;
+  mNodes[0].Key = key;
+  mNodes[0].KeySize = keySize;
+  mNodes[0].Value = val;
+}
+
 
 // Extract configured number of bits from
 // normalized keys.  Make them into a N-bit
@@ -580,6 +580,8 @@ void MapReducePlanRunner::createSerialized64MapPlan(const std::string& f,
 						    std::string& p)
 {
   PlanCheckContext ctxt;
+  // Every map or reduce task is a process of its own.
+  ctxt.setPartitionsSpanProcesses(partitions > 1);
   DataflowGraphBuilder gb(ctxt);
   gb.buildGraph(f);  
   boost::shared_ptr<RuntimeOperatorPlan> plan = gb.create(partitions);
@@ -603,6 +605,8 @@ void MapReducePlanRunner::createSerialized64ReducePlan(const std::string& f,
 						       std::string& p)
 {
   PlanCheckContext ctxt;
+  // Every map or reduce task is a process of its own.
+  ctxt.setPartitionsSpanProcesses(partitions > 1);
   DataflowGraphBuilder gb(ctxt);
   gb.buildGraph(f);  
   if (defaultReduceFormat.size()) {
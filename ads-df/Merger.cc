@@ -33,16 +33,21 @@
  */
 
 #include <stdexcept>
+#include <deque>
 #include <fstream>
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/make_shared.hpp>
+#include <boost/thread.hpp>
 #include <boost/tokenizer.hpp>
 #include "Merger.hh"
+#include "ColumnarFile.hh"
+#include "IQLExpression.hh"
 #include "ConstantScan.hh"
 #include "RecordParser.hh"
 #include "RuntimeProcess.hh"
 #include "FileWriteOperator.hh"
+#include "SpillFile.hh"
 
 #if defined(TRECUL_HAS_HADOOP)
 // For HdfsWritableFileFactory : It would be good to wrap this up with the FileSystem abstraction.
@@ -52,15 +57,24 @@
 struct SortNodeLess : std::binary_function<SortNode, SortNode, bool>
 {
   RecordTypeEquals IQLCompare;
+  // Do nodes have normalized keys?
+  bool Normalized;
   bool operator() (const SortNode & lhs, const SortNode & rhs) const
   {
-    return lhs.KeyPrefix < rhs.KeyPrefix ||
-      (lhs.KeyPrefix == rhs.KeyPrefix && IQLCompare(lhs.Value, rhs.Value));
+    if (lhs.KeyPrefix != rhs.KeyPrefix) {
+      return lhs.KeyPrefix < rhs.KeyPrefix;
+    }
+    // The prefix is the first word of the normalized key.
+    return Normalized ?
+      NormalizedKey::compare(lhs.Key+1, lhs.Key[0], rhs.Key+1, rhs.Key[0], 1) < 0 :
+      IQLCompare(lhs.Value, rhs.Value);
   }    
   SortNodeLess(const class IQLFunctionModule * f = NULL,
-	       class InterpreterContext * ctxt = NULL)
+	       class InterpreterContext * ctxt = NULL,
+	       bool normalized = false)
     :
-    IQLCompare(f,ctxt)
+    IQLCompare(f,ctxt),
+    Normalized(normalized)
   {
   }
 };
@@ -72,7 +86,9 @@ SortRun::SortRun(std::size_t memoryAllowed)
   mEnd(NULL),
   mSortSz(0),
   mMemoryAllowed(memoryAllowed),
-  mReallocThreshold(1.1)
+  mReallocThreshold(1.1),
+  mKeyPtr(NULL),
+  mKeyEnd(NULL)
 {
 }
 
@@ -131,11 +147,34 @@ bool SortRun::push_back_with_realloc(const SortNode& n, std::size_t dataLen)
   return push_back(n, dataLen);
 }
 
+const uint32_t * SortRun::copyKey(const NormalizedKey & key)
+{
+  std::size_t sz = key.size() + 1;
+  if (mKeyPtr + sz > mKeyEnd) {
+    std::size_t blockSz = (std::max)(sz, std::size_t(16*1024));
+    mKeyBlocks.push_back(new uint32_t [blockSz]);
+    mKeyPtr = mKeyBlocks.back();
+    mKeyEnd = mKeyPtr + blockSz;
+  }
+  uint32_t * ret = mKeyPtr;
+  ret[0] = key.size();
+  memcpy(ret + 1, key.data(), sizeof(uint32_t)*key.size());
+  mKeyPtr += sz;
+  return ret;
+}
+
 void SortRun::clear()
 {
   delete [] mBegin;
   mFilled = mBegin = mEnd = 0;
   mSortSz = 0;
+  for(std::vector<uint32_t *>::iterator it = mKeyBlocks.begin();
+      it != mKeyBlocks.end();
+      ++it) {
+    delete [] *it;
+  }
+  mKeyBlocks.clear();
+  mKeyPtr = mKeyEnd = NULL;
 }
 
 class SortWriterContext
@@ -437,12 +476,19 @@ LogicalFileRead::LogicalFileRead()
   mFieldSeparator('\t'),
   mRecordSeparator('\n'),
   mEscapeChar('\\'),
-  mFormat(NULL)
+  mFormat(NULL),
+  mScanType(NULL),
+  mPredicate(NULL),
+  mTransfer(NULL),
+  mZoneMap(NULL)
 {
 }
 
 LogicalFileRead::~LogicalFileRead()
 {
+  delete mPredicate;
+  delete mTransfer;
+  delete mZoneMap;
 }
 
 std::string LogicalFileRead::readFormatFile(const std::string& formatFile)
@@ -524,6 +570,8 @@ void LogicalFileRead::check(PlanCheckContext& ctxt)
 	mConstantScan = getBooleanValue(ctxt, *it);
       } else if (it->equals("skipheader")) {
 	mSkipHeader = getBooleanValue(ctxt, *it);
+      } else if (it->equals("where")) {
+	mWhere = getStringValue(ctxt, *it);
       } else {
 	checkDefaultParam(*it);
       }
@@ -533,8 +581,14 @@ void LogicalFileRead::check(PlanCheckContext& ctxt)
   }
 
   if (!boost::algorithm::iequals("binary", mMode) &&
-      !boost::algorithm::iequals("text", mMode)) {
-    ctxt.logError(*this, "mode parameter must be \"text\" or \"binary\"");
+      !boost::algorithm::iequals("text", mMode) &&
+      !boost::algorithm::iequals("columnar", mMode)) {
+    ctxt.logError(*this, "mode parameter must be \"text\", \"binary\" or \"columnar\"");
+  }
+
+  if (!boost::algorithm::iequals("columnar", mMode) &&
+      mWhere.size()) {
+    ctxt.logError(*this, "where only supported when mode is \"columnar\"");
   }
 
   if (boost::algorithm::iequals("binary", mMode) &&
@@ -544,7 +598,7 @@ void LogicalFileRead::check(PlanCheckContext& ctxt)
 
   if (boost::algorithm::iequals("binary", mMode) &&
       referenced.size()) {
-    ctxt.logError(*this, "output only supported when mode is \"text\"");
+    ctxt.logError(*this, "output only supported when mode is \"text\" or \"columnar\"");
   }
 
   // We must have format parameter.
@@ -565,12 +619,55 @@ void LogicalFileRead::check(PlanCheckContext& ctxt)
       getOutput(0)->setRecordType(RecordType::get(ctxt, mFormat, 
 						  referenced.begin(), 
 						  referenced.end()));
+      if (boost::algorithm::iequals("columnar", mMode)) {
+	checkColumnar(ctxt, referenced);
+      }
     } catch(std::exception& ex) {
       ctxt.logError(*this, *formatParam, ex.what());
     }
   }
 }
 
+void LogicalFileRead::checkColumnar(PlanCheckContext& ctxt,
+				    const std::vector<std::string>& referenced)
+{
+  // Decode the output fields and any others the predicate needs.
+  std::vector<std::string> scanned(referenced);
+  if (mWhere.size()) {
+    IQLFreeVariablesRule vars(RecordTypeFunction::getAST(ctxt, mWhere));
+    for(std::set<std::string>::const_iterator it = vars.getVariables().begin();
+	it != vars.getVariables().end();
+	++it) {
+      if (mFormat->hasMember(*it) && 
+	  scanned.end() == std::find(scanned.begin(), scanned.end(), *it)) {
+	scanned.push_back(*it);
+      }
+    }
+  }
+  mScanType = RecordType::get(ctxt, mFormat, scanned.begin(), scanned.end());
+  if (mWhere.size()) {
+    std::vector<RecordMember> emptyMembers;
+    RecordType emptyTy(emptyMembers);
+    std::vector<const RecordType *> inputs;
+    inputs.push_back(mScanType);
+    inputs.push_back(&emptyTy);
+    mPredicate = new RecordTypeFunction(ctxt, "columnarWhere", inputs, mWhere);
+    // Conjuncts of the predicate that let us skip whole row groups.
+    mZoneMap = new ZoneMapPredicate(ctxt, mFormat, mWhere);
+  }
+  if (scanned.size() != referenced.size()) {
+    // Drop the fields only the predicate needed.
+    std::string xfer;
+    for(RecordType::const_member_iterator m = getOutput(0)->getRecordType()->begin_members(),
+	  e = getOutput(0)->getRecordType()->end_members(); m != e; ++m) {
+      if (xfer.size()) 
+	xfer += ", ";
+      xfer += m->GetName();
+    }
+    mTransfer = new RecordTypeTransfer(ctxt, "columnarProject", mScanType, xfer);
+  }
+}
+
 void LogicalFileRead::internalCreate(class RuntimePlanBuilder& plan)
 {
   typedef AsyncFileTraits<stdio_file_traits> file_traits;
@@ -584,6 +681,14 @@ void LogicalFileRead::internalCreate(class RuntimePlanBuilder& plan)
   if(boost::algorithm::iequals("binary", mMode)) {
     opType = new binary_op_type(getOutput(0)->getRecordType(),
 				mFile);
+  } else if(boost::algorithm::iequals("columnar", mMode)) {
+    opType = new RuntimeColumnarReadOperatorType(mFile,
+						 mFormat,
+						 mScanType,
+						 mZoneMap ? *mZoneMap : 
+						 ZoneMapPredicate(),
+						 mPredicate,
+						 mTransfer);
   } else if (mBucketed) {
     PathPtr p = Path::get(mFile);
     // Default to a local file URI.
@@ -618,7 +723,10 @@ LogicalFileWrite::LogicalFileWrite()
   mMode("binary"),
   mFileNameExpr(NULL),
   mMaxRecords(0),
-  mMaxSeconds(0)
+  mMaxSeconds(0),
+  mRowGroupSize(64*1024),
+  mCompress(false),
+  mStatistics(false)
 {
 }
 
@@ -703,7 +811,9 @@ void LogicalFileWrite::check(PlanCheckContext& ctxt)
   for(const_param_iterator it = begin_params();
       it != end_params();
       ++it) {
-    if (it->equals("connect")) {
+    if (it->equals("compress")) {
+      mCompress = getBooleanValue(ctxt, *it);
+    } else if (it->equals("connect")) {
       mConnect = getStringValue(ctxt, *it);
     } else if (it->equals("file")) {
       mFile = getStringValue(ctxt, *it);
@@ -727,13 +837,28 @@ void LogicalFileWrite::check(PlanCheckContext& ctxt)
       mMaxSeconds = getInt32Value(ctxt, *it);
     } else if (it->equals("mode")) {
       mMode = getStringValue(ctxt, *it);
+    } else if (it->equals("rowgroupsize")) {
+      mRowGroupSize = getInt32Value(ctxt, *it);
+      if (mRowGroupSize <= 0) {
+	ctxt.logError(*this, *it, "rowGroupSize must be positive");
+      }
+    } else if (it->equals("statistics")) {
+      mStatistics = getBooleanValue(ctxt, *it);
     } else {
       checkDefaultParam(*it);
     }
   }
   if (!boost::algorithm::iequals("binary", mMode) &&
-      !boost::algorithm::iequals("text", mMode)) {
-    ctxt.logError(*this, "mode parameter must be \"text\" or \"binary\"");
+      !boost::algorithm::iequals("text", mMode) &&
+      !boost::algorithm::iequals("columnar", mMode)) {
+    ctxt.logError(*this, "mode parameter must be \"text\", \"binary\" or \"columnar\"");
+  }
+  if (boost::algorithm::iequals("columnar", mMode) &&
+      (isStreamingWrite() || mConnect.size() || mHeader.size())) {
+    ctxt.logError(*this, "columnar mode does not support connect, header, format, maxRecords or maxSeconds");
+  }
+  if (mStatistics && !boost::algorithm::iequals("text", mMode)) {
+    ctxt.logError(*this, "statistics only supported when mode is \"text\"");
   }
 
   if (0==mConnect.size()) {
@@ -751,14 +876,23 @@ void LogicalFileWrite::create(class RuntimePlanBuilder& plan)
 {
   UriPtr uri = URI::get(mConnect.size() ? mConnect.c_str() : mFile.c_str());
   RuntimeOperatorType * opType = NULL;
-  if (isStreamingWrite() ||
+  if (boost::algorithm::iequals("columnar", mMode)) {
+    if (boost::algorithm::iequals(uri->getScheme(), "hdfs")) {
+      throw std::runtime_error("columnar mode only supports local files");
+    }
+    opType = new RuntimeColumnarWriteOperatorType(getInput(0)->getRecordType(),
+						  uri->getPath(),
+						  mRowGroupSize,
+						  mCompress);
+  } else if (isStreamingWrite() ||
       boost::algorithm::iequals(uri->getScheme(), "hdfs")) {
     opType = new RuntimeHdfsWriteOperatorType("write",
 					      getInput(0)->getRecordType(),
 					      getFileFactory(uri),
 					      mHeader,
 					      mHeaderFile,
-					      getCreationPolicy(uri));
+					      getCreationPolicy(uri),
+					      mStatistics);
   } else if (boost::algorithm::iequals("binary", mMode)) {
     opType = new InternalFileWriteOperatorType("write",
 					       getInput(0)->getRecordType(),
@@ -769,7 +903,8 @@ void LogicalFileWrite::create(class RuntimePlanBuilder& plan)
 					  getInput(0)->getRecordType(),
 					  uri->getPath(),
 					  mHeader,
-					  mHeaderFile);
+					  mHeaderFile,
+					  mStatistics);
   }
   plan.addOperatorType(opType);
   plan.mapInputPort(this, 0, opType, 0);  
@@ -784,8 +919,9 @@ RuntimeOperator * InternalFileWriteOperatorType::create(RuntimeOperator::Service
 LogicalSortMerge::LogicalSortMerge()
   :
   mKeyPrefix(NULL),
-  mKeyEq(NULL)
-  
+  mKeyEq(NULL),
+  mParallel(0),
+  mOrdered(true)
 {
 }
 
@@ -798,17 +934,34 @@ LogicalSortMerge::~LogicalSortMerge()
 void LogicalSortMerge::check(PlanCheckContext& ctxt)
 {
   std::vector<SortKey> sortKeys;
+  bool orderedSet = false;
   // Validate the parameters
   for(const_param_iterator it = begin_params();
       it != end_params();
       ++it) {
     if (it->equals("key")) {
       sortKeys.push_back(getSortKeyValue(ctxt, *it));
+    } else if (it->equals("ordered")) {
+      mOrdered = getBooleanValue(ctxt, *it);
+      orderedSet = true;
+    } else if (it->equals("parallel")) {
+      mParallel = getInt32Value(ctxt, *it);
+      if (mParallel < 0) {
+	ctxt.logError(*this, "parallel argument must be a non-negative integer");
+      }
     } else {
       checkDefaultParam(*it);
     }
   }
 
+  // A hash aggregation doesn't care about the order of its input
+  // so key ranges may be output as soon as they are merged.
+  if (!orderedSet && mParallel > 1) {
+    const LogicalGroupBy * consumer = 
+      dynamic_cast<const LogicalGroupBy *>(getOutput(0)->target());
+    mOrdered = consumer == NULL || !consumer->isHashAggregation();
+  }
+
   // Process arguments
   if (getInput(0)->getRecordType() == NULL) {
   }
@@ -823,13 +976,17 @@ void LogicalSortMerge::check(PlanCheckContext& ctxt)
   // for sorting.  Make sure less than has proper NULL handling.
   mKeyPrefix = SortKeyPrefixFunction::get(ctxt, input, sortKeys);
   mKeyEq = LessThanFunction::get(ctxt, input, input, sortKeys, true, "sort_merge_less");
+  mNormalizer = SortKeyNormalizer(input, sortKeys);
 }
 
 void LogicalSortMerge::create(class RuntimePlanBuilder& plan)
 {
   RuntimeOperatorType * opType = 
     new RuntimeSortMergeOperatorType(mKeyPrefix, 
-				     mKeyEq);
+				     mKeyEq,
+				     &mNormalizer,
+				     mParallel,
+				     mOrdered);
   plan.addOperatorType(opType);
   for(std::size_t i = 0; i < size_inputs(); i++) {
     plan.mapInputPort(this, i, opType, i);
@@ -858,6 +1015,13 @@ SortMerge::SortMerge(DynamicRecordContext& ctxt,
 
 
   mKeyEq = LessThanFunction::get(ctxt, mInput, sortKeys);
+  std::vector<SortKey> keys;
+  for(std::vector<std::string>::const_iterator it = sortKeys.begin();
+      it != sortKeys.end();
+      ++it) {
+    keys.push_back(SortKey(*it));
+  }
+  mNormalizer = SortKeyNormalizer(mInput, keys);
 }
 
 SortMerge::~SortMerge()
@@ -868,7 +1032,351 @@ SortMerge::~SortMerge()
 
 RuntimeOperatorType * SortMerge::create() const
 {
-  return new RuntimeSortMergeOperatorType(mKeyPrefix, mKeyEq);
+  return new RuntimeSortMergeOperatorType(mKeyPrefix, mKeyEq, &mNormalizer);
+}
+
+/**
+ * Parallel k-way merge.  Input is buffered in batches; each batch is
+ * cut at the smallest of the last keys buffered from the open inputs
+ * (everything up to that key can be merged without seeing more input),
+ * the merge-able portion is split into key ranges by splitters sampled 
+ * from the buffered records and each key range is merged by a worker 
+ * thread with its own tournament tree.  The scheduler thread
+ * writes merged ranges as they complete and reads the next batch.
+ */
+class ParallelSortMerge
+{
+private:
+  struct Input
+  {
+    // Buffered records (and normalized keys) not yet merged.
+    std::vector<SortNode> Nodes;
+    std::vector<uint32_t> Keys;
+    std::vector<std::size_t> KeyOffsets;
+    // End of each key range in Nodes.
+    std::vector<std::size_t> Splits;
+    bool EOS;
+    Input()
+      :
+      EOS(false)
+    {
+    }
+  };
+  const RuntimeSortMergeOperatorType& mOpType;
+  InterpreterContext * mRuntimeContext;
+  bool mNormalized;
+  NormalizedKey mKey;
+  std::size_t mBatchSize;
+  std::vector<Input> mInputs;
+  std::vector<std::vector<RecordBuffer> > mOutputs;
+
+  // Work queue shared with the merge threads.
+  boost::mutex mLock;
+  boost::condition_variable mWorkAvailable;
+  boost::condition_variable mWorkDone;
+  std::size_t mNextRange;
+  std::size_t mNumRanges;
+  std::vector<bool> mDone;
+  std::deque<std::size_t> mCompleted;
+  bool mShutdown;
+  boost::thread_group mThreads;
+
+  void run();
+  void merge(std::size_t range, InterpreterContext * ctxt);
+public:
+  ParallelSortMerge(const RuntimeSortMergeOperatorType& opType,
+		    std::size_t numInputs,
+		    std::size_t numThreads,
+		    std::size_t batchSize);
+  ~ParallelSortMerge();
+  /**
+   * Does input need more records before the next batch?
+   */
+  bool needsRead(std::size_t input) const
+  {
+    return !mInputs[input].EOS && mInputs[input].Nodes.size() < mBatchSize;
+  }
+  void append(std::size_t input, RecordBuffer buf);
+  void close(std::size_t input)
+  {
+    mInputs[input].EOS = true;
+  }
+  /**
+   * All inputs closed and merged?
+   */
+  bool empty() const;
+  /**
+   * Split the merge-able part of buffered input into key ranges and
+   * hand them to the merge threads.
+   */
+  void schedule();
+  std::size_t getNumRanges() const
+  {
+    return mOutputs.size();
+  }
+  /**
+   * Wait for a key range to be merged.  If ordered then range
+   * is that merged range, otherwise returns a range that completed.
+   */
+  std::size_t wait(std::size_t range, bool ordered);
+  const std::vector<RecordBuffer>& getOutput(std::size_t range) const
+  {
+    return mOutputs[range];
+  }
+  /**
+   * Discard merged records from the buffers.
+   */
+  void consume();
+};
+
+ParallelSortMerge::ParallelSortMerge(const RuntimeSortMergeOperatorType& opType,
+				     std::size_t numInputs,
+				     std::size_t numThreads,
+				     std::size_t batchSize)
+  :
+  mOpType(opType),
+  mRuntimeContext(new InterpreterContext()),
+  mNormalized(!opType.mNormalizer.empty()),
+  mBatchSize(batchSize),
+  mInputs(numInputs),
+  mOutputs(numThreads),
+  mNextRange(0),
+  mNumRanges(0),
+  mDone(numThreads, false),
+  mShutdown(false)
+{
+  for(std::size_t i=0; i<numThreads; ++i) {
+    mThreads.create_thread(boost::bind(&ParallelSortMerge::run, this));
+  }
+}
+
+ParallelSortMerge::~ParallelSortMerge()
+{
+  {
+    boost::unique_lock<boost::mutex> lock(mLock);
+    mShutdown = true;
+    mWorkAvailable.notify_all();
+  }
+  mThreads.join_all();
+  delete mRuntimeContext;
+}
+
+void ParallelSortMerge::run()
+{
+  InterpreterContext ctxt;
+  while(true) {
+    std::size_t range;
+    {
+      boost::unique_lock<boost::mutex> lock(mLock);
+      while(!mShutdown && mNextRange >= mNumRanges) {
+	mWorkAvailable.wait(lock);
+      }
+      if (mShutdown) {
+	return;
+      }
+      range = mNextRange++;
+    }
+    merge(range, &ctxt);
+    {
+      boost::unique_lock<boost::mutex> lock(mLock);
+      mDone[range] = true;
+      mCompleted.push_back(range);
+      mWorkDone.notify_all();
+    }
+  }
+}
+
+void ParallelSortMerge::merge(std::size_t range, InterpreterContext * ctxt)
+{
+  std::vector<RecordBuffer>& output(mOutputs[range]);
+  std::vector<std::size_t> pos(mInputs.size());
+  uint32_t numInputs = (uint32_t) mInputs.size();
+  for(std::size_t i=0; i<mInputs.size(); ++i) {
+    pos[i] = range ? mInputs[i].Splits[range-1] : 0;
+  }
+  if (mNormalized) {
+    OffsetValueLoserTree<RecordBuffer> tree;
+    tree.init(numInputs);
+    while(!tree.empty()) {
+      if (!tree.isHighSentinel()) {
+	output.push_back(tree.getValue());
+      }
+      uint32_t i = tree.getInput();
+      if (pos[i] < mInputs[i].Splits[range]) {
+	const SortNode& n(mInputs[i].Nodes[pos[i]++]);
+	tree.update(i, n.Key+1, n.Key[0], n.Value);
+      } else {
+	tree.close(i);
+      }
+    }
+  } else {
+    LoserTree<RecordBuffer,NotPred<RecordTypeEquals> > tree;
+    RecordTypeEquals lt(mOpType.mEqFun, ctxt);
+    tree.init(numInputs, NotPred<RecordTypeEquals>(lt));
+    while(!tree.empty()) {
+      if (!tree.isHighSentinel()) {
+	output.push_back(tree.getValue());
+      }
+      uint32_t i = tree.getInput();
+      if (pos[i] < mInputs[i].Splits[range]) {
+	const SortNode& n(mInputs[i].Nodes[pos[i]++]);
+	tree.update(i, 0x7fffffff - n.KeyPrefix, n.Value);
+      } else {
+	tree.close(i);
+      }
+    }
+  }
+}
+
+void ParallelSortMerge::append(std::size_t input, RecordBuffer buf)
+{
+  Input& in(mInputs[input]);
+  in.Nodes.push_back(SortNode());
+  SortNode& n(in.Nodes.back());
+  n.Value = buf;
+  if (mNormalized) {
+    // Key pointers are fixed up in schedule() since the key 
+    // buffer may be reallocated while reading.
+    mOpType.mNormalizer.normalize(buf, mKey);
+    in.KeyOffsets.push_back(in.Keys.size());
+    in.Keys.push_back(mKey.size());
+    in.Keys.insert(in.Keys.end(), mKey.data(), mKey.data() + mKey.size());
+    n.KeyPrefix = mKey.data()[0];
+  } else {
+    n.KeyPrefix = mOpType.mKeyPrefix->execute(buf, NULL, mRuntimeContext);
+  }
+}
+
+bool ParallelSortMerge::empty() const
+{
+  for(std::vector<Input>::const_iterator it = mInputs.begin();
+      it != mInputs.end();
+      ++it) {
+    if (!it->EOS || it->Nodes.size()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void ParallelSortMerge::schedule()
+{
+  SortNodeLess less(mOpType.mEqFun, mRuntimeContext, mNormalized);
+  std::size_t numRanges = mOutputs.size();
+  if (mNormalized) {
+    for(std::vector<Input>::iterator it = mInputs.begin();
+	it != mInputs.end();
+	++it) {
+      for(std::size_t i=0; i<it->Nodes.size(); ++i) {
+	it->Nodes[i].Key = &it->Keys[it->KeyOffsets[i]];
+      }
+    }
+  }
+
+  // Records from any input up to the smallest last key of
+  // an open input can be merged now.  Every other record
+  // (buffered or not) is at least as large.
+  const SortNode * bound = NULL;
+  for(std::vector<Input>::const_iterator it = mInputs.begin();
+      it != mInputs.end();
+      ++it) {
+    if (!it->EOS && it->Nodes.size() && 
+	(bound == NULL || less(it->Nodes.back(), *bound))) {
+      bound = &it->Nodes.back();
+    }
+  }
+  std::vector<std::size_t> ends;
+  std::size_t total = 0;
+  for(std::vector<Input>::const_iterator it = mInputs.begin();
+      it != mInputs.end();
+      ++it) {
+    ends.push_back(bound == NULL ? it->Nodes.size() :
+		   std::upper_bound(it->Nodes.begin(), it->Nodes.end(), 
+				    *bound, less) - it->Nodes.begin());
+    total += ends.back();
+  }
+
+  // Sample the merge-able records to pick range splitters.
+  static const std::size_t samplesPerRange = 64;
+  std::vector<SortNode> splitters;
+  if (numRanges > 1 && total >= numRanges*samplesPerRange) {
+    std::vector<SortNode> sample;
+    for(std::size_t i=0; i<mInputs.size(); ++i) {
+      std::size_t sz = (ends[i]*numRanges*samplesPerRange + total - 1)/total;
+      for(std::size_t j=0; j<sz; ++j) {
+	sample.push_back(mInputs[i].Nodes[(j*ends[i])/sz]);
+      }
+    }
+    std::sort(sample.begin(), sample.end(), less);
+    for(std::size_t r=1; r<numRanges; ++r) {
+      splitters.push_back(sample[(r*sample.size())/numRanges]);
+    }
+  }
+  for(std::size_t i=0; i<mInputs.size(); ++i) {
+    Input& in(mInputs[i]);
+    in.Splits.resize(numRanges);
+    std::vector<SortNode>::iterator begin = in.Nodes.begin();
+    for(std::size_t r=0; r+1<numRanges; ++r) {
+      in.Splits[r] = splitters.size() ?
+	std::upper_bound(begin, in.Nodes.begin() + ends[i], 
+			 splitters[r], less) - in.Nodes.begin() : 0;
+      begin = in.Nodes.begin() + in.Splits[r];
+    }
+    in.Splits[numRanges-1] = ends[i];
+  }
+
+  boost::unique_lock<boost::mutex> lock(mLock);
+  mCompleted.clear();
+  for(std::size_t r=0; r<numRanges; ++r) {
+    mDone[r] = false;
+    mOutputs[r].clear();
+  }
+  mNextRange = 0;
+  mNumRanges = numRanges;
+  mWorkAvailable.notify_all();
+}
+
+std::size_t ParallelSortMerge::wait(std::size_t range, bool ordered)
+{
+  boost::unique_lock<boost::mutex> lock(mLock);
+  if (ordered) {
+    while(!mDone[range]) {
+      mWorkDone.wait(lock);
+    }
+    return range;
+  } else {
+    while(mCompleted.empty()) {
+      mWorkDone.wait(lock);
+    }
+    range = mCompleted.front();
+    mCompleted.pop_front();
+    return range;
+  }
+}
+
+void ParallelSortMerge::consume()
+{
+  for(std::vector<Input>::iterator it = mInputs.begin();
+      it != mInputs.end();
+      ++it) {
+    std::size_t merged = it->Splits.back();
+    if (mNormalized) {
+      std::size_t keys = merged < it->Nodes.size() ? 
+	it->KeyOffsets[merged] : it->Keys.size();
+      it->Keys.erase(it->Keys.begin(), it->Keys.begin() + keys);
+      it->KeyOffsets.erase(it->KeyOffsets.begin(), 
+			   it->KeyOffsets.begin() + merged);
+      for(std::vector<std::size_t>::iterator k = it->KeyOffsets.begin();
+	  k != it->KeyOffsets.end();
+	  ++k) {
+	*k -= keys;
+      }
+    }
+    it->Nodes.erase(it->Nodes.begin(), it->Nodes.begin() + merged);
+    it->Splits.clear();
+  }
+  boost::unique_lock<boost::mutex> lock(mLock);
+  mNumRanges = mNextRange = 0;
 }
 
 RuntimeOperator * RuntimeSortMergeOperatorType::create(RuntimeOperator::Services & s) const
@@ -882,6 +1390,12 @@ RuntimeSortMergeOperator::RuntimeSortMergeOperator(RuntimeOperator::Services& se
   RuntimeOperatorBase<RuntimeSortMergeOperatorType>(services, opType),
   mState(START),
   mRuntimeContext(new InterpreterContext()),
+  mParallel(NULL),
+  mInputIt(0),
+  mRangeIt(0),
+  mRange(0),
+  mOutputIt(0),
+  mNormalized(!opType.mNormalizer.empty()),
   mReturnAddress(NULL),
   mReturnPort(0)
 {
@@ -889,6 +1403,7 @@ RuntimeSortMergeOperator::RuntimeSortMergeOperator(RuntimeOperator::Services& se
 
 RuntimeSortMergeOperator::~RuntimeSortMergeOperator()
 {
+  delete mParallel;
 }
 
 void RuntimeSortMergeOperator::start()
@@ -898,45 +1413,110 @@ void RuntimeSortMergeOperator::start()
     // This is never going to happen, but what the heck.
     throw std::runtime_error("Too many inputs to sort merge operator");
   }
-  RecordTypeEquals lt(getMyOperatorType().mEqFun,
-		      mRuntimeContext);
-  mMergeTree.init((uint32_t) getInputPorts().size(),
-		  NotPred<RecordTypeEquals>(lt));
+  if (getMyOperatorType().mParallel > 1) {
+    delete mParallel;
+    mParallel = new ParallelSortMerge(getMyOperatorType(),
+				      getInputPorts().size(),
+				      getMyOperatorType().mParallel,
+				      1024);
+  } else if (mNormalized) {
+    mKeyMergeTree.init((uint32_t) getInputPorts().size());
+    mKeys.resize(getInputPorts().size());
+  } else {
+    RecordTypeEquals lt(getMyOperatorType().mEqFun,
+			mRuntimeContext);
+    mMergeTree.init((uint32_t) getInputPorts().size(),
+		    NotPred<RecordTypeEquals>(lt));
+  }
 
   mState=START;
   onEvent(NULL);
 }
 
+void RuntimeSortMergeOperator::update(uint32_t input, RecordBuffer buf)
+{
+  if (mNormalized) {
+    // The tree still refers to the key of the last winner (from this
+    // input) so build the new one on the side.
+    getMyOperatorType().mNormalizer.normalize(buf, mNextKey);
+    mKeyMergeTree.update(input, mNextKey.data(), mNextKey.size(), buf);
+    mKeys[input].swap(mNextKey);
+  } else {
+    uint32_t keyPrefix = getMyOperatorType().mKeyPrefix->execute(buf, NULL, mRuntimeContext);
+    // Correct key prefix for the fact that LoserTree is a max-priority queue.
+    mMergeTree.update(input, 0x7fffffff - keyPrefix, buf);
+  }
+}
+
 void RuntimeSortMergeOperator::onEvent(RuntimePort * port)
 {
   switch(mState) {
   case START:
-    while(!mMergeTree.empty()) {
-      if (!mMergeTree.isHighSentinel()) {
-	requestWrite(0);
-	mState = WRITE;
-	return;
-      case WRITE:
-	write(port, mMergeTree.getValue(), false);
+    if (mParallel) {
+      while(true) {
+	// Fill the buffers of all open inputs
+	for(mInputIt = 0; mInputIt < getInputPorts().size(); ++mInputIt) {
+	  while(mParallel->needsRead(mInputIt)) {
+	    requestRead(mInputIt);
+	    mState = READ_BATCH;
+	    return;
+	  case READ_BATCH:
+	    {
+	      RecordBuffer buf;
+	      read(port, buf);
+	      if(RecordBuffer::isEOS(buf)) {
+		mParallel->close(mInputIt);
+	      } else {
+		mParallel->append(mInputIt, buf);
+	      }
+	    }
+	  }
+	}
+	if (mParallel->empty()) {
+	  break;
+	}
+
+	// Merge key ranges in parallel and write each one 
+	// as soon as it is done.
+	mParallel->schedule();
+	for(mRangeIt = 0; mRangeIt < mParallel->getNumRanges(); ++mRangeIt) {
+	  mRange = mParallel->wait(mRangeIt, getMyOperatorType().mOrdered);
+	  for(mOutputIt = 0; 
+	      mOutputIt < mParallel->getOutput(mRange).size(); 
+	      ++mOutputIt) {
+	    requestWrite(0);
+	    mState = WRITE_BATCH;
+	    return;
+	  case WRITE_BATCH:
+	    write(port, mParallel->getOutput(mRange)[mOutputIt], false);
+	  }
+	}
+	mParallel->consume();
       }
+    } else {
+      while(!empty()) {
+	if (!isHighSentinel()) {
+	  requestWrite(0);
+	  mState = WRITE;
+	  return;
+	case WRITE:
+	  write(port, getValue(), false);
+	}
       
-      // Get the next value
-      requestRead(mMergeTree.getInput());
-      mState = READ;
-      return;
-    case READ:
-      {
-	RecordBuffer buf;
-	read(port, buf);
-	if(RecordBuffer::isEOS(buf)) {
-	  mMergeTree.close(mMergeTree.getInput());
-	} else {
-	  uint32_t keyPrefix = getMyOperatorType().mKeyPrefix->execute(buf, NULL, mRuntimeContext);
-	  // Correct key prefix for the fact that LoserTree is a max-priority queue.
-	  mMergeTree.update(mMergeTree.getInput(), 
-			    0x7fffffff - keyPrefix, 
-			    buf);
-	}	
+	// Get the next value
+	requestRead(getInput());
+	mState = READ;
+	return;
+      case READ:
+	{
+	  RecordBuffer buf;
+	  read(port, buf);
+	  if(RecordBuffer::isEOS(buf)) {
+	    close(getInput());
+	  } else {
+	    update(getInput(), buf);
+	  }	
+	}
       }
     }
 
@@ -974,7 +1554,10 @@ LogicalSort::LogicalSort()
   mKeyPrefix(NULL),
   mKeyEq(NULL),
   mPresortedKeyEq(NULL),
-  mMemory(128*1024*1024)
+  mGather(NULL),
+  mSplitterTransfer(NULL),
+  mMemory(128*1024*1024),
+  mParallel(false)
 {
 }
 
@@ -983,6 +1566,8 @@ LogicalSort::~LogicalSort()
   delete mKeyPrefix;
   delete mKeyEq;
   delete mPresortedKeyEq;
+  delete mGather;
+  delete mSplitterTransfer;
 }
 
 void LogicalSort::check(PlanCheckContext& ctxt)
@@ -1002,6 +1587,8 @@ void LogicalSort::check(PlanCheckContext& ctxt)
       } else {
 	mMemory = (std::size_t) tmp;
       }
+    } else if (it->equals("parallel")) {
+      mParallel = getBooleanValue(ctxt, *it);
     } else if (it->equals("presorted")) {
       presortedKeys.push_back(getSortKeyValue(ctxt, *it));
     } else if (it->equals("tempdir")) {
@@ -1028,6 +1615,7 @@ void LogicalSort::check(PlanCheckContext& ctxt)
     mKeyPrefix = SortKeyPrefixFunction::get(ctxt, input, sortKeys);
     // Tell LessThan to sort NULLs properly
     mKeyEq = LessThanFunction::get(ctxt, input, input, sortKeys, true, "sort_less");
+    mNormalizer = SortKeyNormalizer(input, sortKeys);
   } else {
     ctxt.logError(*this, "must specify one or more sort keys");
   }
@@ -1035,10 +1623,85 @@ void LogicalSort::check(PlanCheckContext& ctxt)
     mPresortedKeyEq = EqualsFunction::get(ctxt, input, input, presortedKeys, 
 					  "presort_eq", true);
   }
+  if (mParallel) {
+    if (presortedKeys.size()) {
+      ctxt.logError(*this, "parallel sort does not support presorted keys");
+    }
+    if (ctxt.partitionsSpanProcesses()) {
+      ctxt.logError(*this, "parallel sort requires all partitions to run in one process");
+    }
+    // Hash function that sends every record to partition 0.
+    std::vector<const RecordType *> inputOnly;
+    inputOnly.push_back(input);
+    std::vector<RecordMember> emptyMembers;
+    RecordType emptyTy(emptyMembers);
+    inputOnly.push_back(&emptyTy);
+    mGather = new RecordTypeFunction(ctxt, "sort_gather", inputOnly, "0");
+    mSplitterTransfer = new RecordTypeTransfer(ctxt, "sort_splitters", input, "input.*");
+  }
 }
 
 void LogicalSort::create(class RuntimePlanBuilder& plan)
 {
+  if (mParallel) {
+    // Range partition the input on the sort key, sort each range
+    // independently and concatenate the sorted ranges in partition 
+    // order onto partition 0.  Splitters are computed on partition 0 
+    // from the samples of all partitions and broadcast back to the 
+    // range partitioners.
+    const RecordType * input = getInput(0)->getRecordType();
+    RuntimeOperatorType * sampler = 
+      new RuntimeRangeSampleOperatorType(16*1024);
+    plan.addOperatorType(sampler);
+    plan.mapInputPort(this, 0, sampler, 0);
+    RuntimeOperatorType * sampleGather = 
+      new RuntimeHashPartitionerOperatorType(mGather->create());
+    plan.addOperatorType(sampleGather);
+    plan.connect(sampler, RuntimeRangeSampleOperatorType::SAMPLE_PORT, 
+		 sampleGather, 0);
+    RuntimeOperatorType * sampleCollector = 
+      new RuntimeNondeterministicCollectorOperatorType();
+    plan.addOperatorType(sampleCollector);
+    plan.connectCrossbar(sampleGather, sampleCollector, input, true);
+    RuntimeOperatorType * splitter = 
+      new RuntimeRangeSplitterOperatorType(input, mKeyPrefix);
+    plan.addOperatorType(splitter);
+    plan.connect(sampleCollector, 0, splitter, 0);
+    RuntimeOperatorType * splitterBroadcast = 
+      new RuntimeBroadcastPartitionerOperatorType(mSplitterTransfer);
+    plan.addOperatorType(splitterBroadcast);
+    plan.connect(splitter, 0, splitterBroadcast, 0);
+    RuntimeOperatorType * splitterCollector = 
+      new RuntimeNondeterministicCollectorOperatorType();
+    plan.addOperatorType(splitterCollector);
+    plan.connectCrossbar(splitterBroadcast, splitterCollector, input, true);
+    RuntimeOperatorType * partitioner = 
+      new RuntimeRangePartitionerOperatorType(input, mKeyPrefix);
+    plan.addOperatorType(partitioner);
+    plan.connect(sampler, RuntimeRangeSampleOperatorType::DATA_PORT,
+		 partitioner, RuntimeRangePartitionerOperatorType::DATA_PORT);
+    plan.connect(splitterCollector, 0,
+		 partitioner, RuntimeRangePartitionerOperatorType::SPLITTER_PORT);
+    RuntimeOperatorType * collector = 
+      new RuntimeNondeterministicCollectorOperatorType();
+    plan.addOperatorType(collector);
+    plan.connectCrossbar(partitioner, collector, input, true);
+    RuntimeOperatorType * sort = 
+      new RuntimeSortOperatorType(input, mKeyPrefix, mKeyEq, NULL,
+				  mTempDir, mMemory, &mNormalizer);
+    plan.addOperatorType(sort);
+    plan.connect(collector, 0, sort, 0);
+    RuntimeOperatorType * gather = 
+      new RuntimeHashPartitionerOperatorType(mGather->create());
+    plan.addOperatorType(gather);
+    plan.connect(sort, 0, gather, 0);
+    RuntimeOperatorType * concat = 
+      new RuntimeOrderedCollectorOperatorType();
+    plan.addOperatorType(concat);
+    plan.connectCrossbar(gather, concat, input, true);
+    plan.mapOutputPort(this, 0, concat, 0);  
+    return;
+  }
   RuntimeOperatorType * opType = 
     new RuntimeSortOperatorType(getInput(0)->getRecordType(),
 				mKeyPrefix, 
@@ -1046,7 +1709,8 @@ void LogicalSort::create(class RuntimePlanBuilder& plan)
 				// TODO: Support presorted keys
 				mPresortedKeyEq,
 				mTempDir,
-				mMemory);
+				mMemory,
+				&mNormalizer);
   plan.addOperatorType(opType);
   plan.mapInputPort(this, 0, opType, 0);
   plan.mapOutputPort(this, 0, opType, 0);  
@@ -1073,6 +1737,10 @@ private:
   SortRun mSortRuns;
   SortRun::iterator mSortRunIt;
   uint64_t mSortTicks;
+  /**
+   * Normalized key of current input (if normalizing).
+   */
+  NormalizedKey mKey;
   /**
    * Current input record.
    */
@@ -1090,6 +1758,7 @@ private:
    * Add an input record to sort run.
    */
   void addSortRun();
+  void addSortRunNormalized(std::size_t sz);
   /**
    * Sort in memory buffers and write to disk.
    */
@@ -1205,7 +1874,8 @@ RuntimeSortOperator::RuntimeSortOperator(RuntimeOperator::Services& services,
   :
   RuntimeOperatorBase<RuntimeSortOperatorType>(services, opType),
   mState(START),
-  mLessFunction(opType.mLessThanFun, new InterpreterContext()),
+  mLessFunction(opType.mLessThanFun, new InterpreterContext(),
+		!opType.mNormalizer.empty()),
   mSortTicks(0),
   mSortRuns(opType.mMemoryAllowed),
   mInputDone(false),
@@ -1237,6 +1907,10 @@ return (uint64_t)hi << 32 | lo;
 void RuntimeSortOperator::addSortRun()
 {
   std::size_t sz = getMyOperatorType().mSerialize.getRecordLength(mInput);
+  if (mLessFunction.Normalized) {
+    addSortRunNormalized(sz);
+    return;
+  }
   uint32_t keyPrefix = 
     getMyOperatorType().mKeyPrefix->execute(mInput, 
 					    NULL, 
@@ -1262,6 +1936,26 @@ void RuntimeSortOperator::addSortRun()
   mInput = RecordBuffer();
 }
 
+void RuntimeSortOperator::addSortRunNormalized(std::size_t sz)
+{
+  // The full normalized key is built once here; the first word 
+  // serves as the key prefix.
+  getMyOperatorType().mNormalizer.normalize(mInput, mKey);
+  SortNode n(mKey.data()[0], mInput);
+  if(!mSortRuns.push_back(n, sz, mKey)) {
+    writeSortRun();
+    if (!mSortRuns.push_back(n, sz, mKey)) {
+      SortRun tmp(std::numeric_limits<std::size_t>::max());
+      if (!tmp.push_back(n, sz, mKey)) {
+	throw std::runtime_error("INTERNAL ERROR : "
+				 "Insufficient memory to sort");
+      }
+      writeSortRun(tmp);
+    }
+  }
+  mInput = RecordBuffer();
+}
+
 void RuntimeSortOperator::writeSortRun(SortRun & sortRuns)
 {
   // Sort in memory data.
@@ -1284,19 +1978,8 @@ void RuntimeSortOperator::writeSortRun(SortRun & sortRuns)
 
   // Create a name for new sort run.
   std::string tmpStr = FileSystem::getTempFileName();
-  std::string tmpDir = getMyOperatorType().mTempDir;
-  if(tmpDir.size() == 0) {
-    tmpDir = (boost::format("/ghostcache/hadoop/temp/%1%") %
-	      ::getenv("USER")).str();
-    if (!boost::filesystem::exists(tmpDir))
-      tmpDir = "/usr/local/akamai/tmp";
-    if (!boost::filesystem::exists(tmpDir))
-      tmpDir = "/tmp";
-  } else {
-    if (!boost::filesystem::exists(tmpDir))
-      throw std::runtime_error((boost::format("Temp directory doesn't exists: %1%") %
-				tmpDir).str());
-  }
+  std::string tmpDir = 
+    RecordSpillFile::getTempDirectory(getMyOperatorType().mTempDir);
   mWriterType->mFile = (boost::format("%1%/sort_%2%.bin") %
 			tmpDir %
 			tmpStr).str();
@@ -1362,7 +2045,8 @@ void RuntimeSortOperator::buildMergeGraph()
   }
   RuntimeSortMergeOperatorType * mergeOpType
     = new RuntimeSortMergeOperatorType (getMyOperatorType().mKeyPrefix,
-					getMyOperatorType().mLessThanFun);
+					getMyOperatorType().mLessThanFun,
+					&getMyOperatorType().mNormalizer);
   mMergeTypes.push_back(mergeOpType);
   mMergeOps.push_back(mergeOpType->create(getServices()));
   ((RuntimeSortMergeOperator *) mMergeOps.back())->setReturnAddress(this, 0);
@@ -471,7 +471,15 @@ private:
   char mEscapeChar;
   std::string mCommentLine;
   const RecordType * mFormat;
+  // Columnar mode: fields decoded, predicate and projection
+  std::string mWhere;
+  const RecordType * mScanType;
+  class RecordTypeFunction * mPredicate;
+  class RecordTypeTransfer * mTransfer;
+  class ZoneMapPredicate * mZoneMap;
 
+  void checkColumnar(PlanCheckContext& ctxt, 
+		     const std::vector<std::string>& referenced);
   void internalCreate(class RuntimePlanBuilder& plan);  
   std::string readFormatFile(const std::string& formatFile);
 public:
@@ -732,6 +740,11 @@ private:
   RecordTypeTransfer * mFileNameExpr;
   int32_t mMaxRecords;
   int32_t mMaxSeconds;
+  // Columnar mode
+  int32_t mRowGroupSize;
+  bool mCompress;
+  // Write column statistics sidecars
+  bool mStatistics;
 
   void buildHeader(bool isFormatHeader);
   void checkPath(PlanCheckContext& ctxt, const std::string& path);
@@ -794,6 +807,10 @@ class LogicalSortMerge : public LogicalOperator
 private:
   RecordTypeFunction * mKeyPrefix;
   RecordTypeFunction * mKeyEq;
+  SortKeyNormalizer mNormalizer;
+  // Number of merge threads; 0 merges on the scheduler thread.
+  int32_t mParallel;
+  bool mOrdered;
 public:
   LogicalSortMerge();
   ~LogicalSortMerge();
@@ -807,6 +824,7 @@ private:
   const RecordType * mInput;
   RecordTypeFunction * mKeyPrefix;
   RecordTypeFunction * mKeyEq;
+  SortKeyNormalizer mNormalizer;
 public:
   SortMerge(DynamicRecordContext& ctxt,
 	    const RecordType * input,
@@ -826,6 +844,7 @@ class RuntimeSortMergeOperatorType : public RuntimeOperatorType
 {
 public:
   friend class RuntimeSortMergeOperator;
+  friend class ParallelSortMerge;
 private:
   // Extract a key prefix from record
   IQLFunctionModule * mKeyPrefix;
@@ -833,6 +852,14 @@ private:
   IQLFunctionModule * mEqFun;
   // Does this instance own the modules?
   bool mOwnModules;
+  // Normalized keys for merging with offset-value codes; if
+  // empty we merge with key prefix and mEqFun.
+  SortKeyNormalizer mNormalizer;
+  // If greater than one, number of threads merging disjoint key
+  // ranges.  If mOrdered is false key ranges are output in
+  // the order they complete rather than in key order.
+  int32_t mParallel;
+  bool mOrdered;
   // Serialization
   friend class boost::serialization::access;
   template <class Archive>
@@ -842,31 +869,50 @@ private:
     ar & BOOST_SERIALIZATION_NVP(mKeyPrefix);
     ar & BOOST_SERIALIZATION_NVP(mEqFun);
     ar & BOOST_SERIALIZATION_NVP(mOwnModules);    
+    ar & BOOST_SERIALIZATION_NVP(mNormalizer);    
+    ar & BOOST_SERIALIZATION_NVP(mParallel);    
+    ar & BOOST_SERIALIZATION_NVP(mOrdered);    
   }
   RuntimeSortMergeOperatorType()
     :
     mKeyPrefix(NULL),
-    mEqFun(NULL)
+    mEqFun(NULL),
+    mParallel(0),
+    mOrdered(true)
   {
   }  
 public:
   RuntimeSortMergeOperatorType(const RecordTypeFunction * keyPrefix,
-			       const RecordTypeFunction * eqFun)
+			       const RecordTypeFunction * eqFun,
+			       const SortKeyNormalizer * normalizer = NULL,
+			       int32_t parallel = 0,
+			       bool ordered = true)
     :
     RuntimeOperatorType("RuntimeSortMergeOperatorType"),
     mKeyPrefix(keyPrefix->create()),
     mEqFun(eqFun->create()),
-    mOwnModules(true)
+    mOwnModules(true),
+    mParallel(parallel),
+    mOrdered(ordered)
   {
+    if (normalizer) {
+      mNormalizer = *normalizer;
+    }
   }
   RuntimeSortMergeOperatorType(IQLFunctionModule * keyPrefix,
-			       IQLFunctionModule * eqFun)
+			       IQLFunctionModule * eqFun,
+			       const SortKeyNormalizer * normalizer = NULL)
     :
     RuntimeOperatorType("RuntimeSortMergeOperatorType"),
     mKeyPrefix(keyPrefix),
     mEqFun(eqFun),
-    mOwnModules(false)
+    mOwnModules(false),
+    mParallel(0),
+    mOrdered(true)
   {
+    if (normalizer) {
+      mNormalizer = *normalizer;
+    }
   }
   ~RuntimeSortMergeOperatorType()
   {
@@ -875,6 +921,9 @@ public:
       delete mEqFun;
     }
   }
+  // Merging the sorted streams from all partitions keeps a
+  // repartitioned stream sorted.
+  bool isCollector() const { return true; }
 
   RuntimeOperator * create(RuntimeOperator::Services & s) const;
 };
@@ -882,12 +931,51 @@ public:
 class RuntimeSortMergeOperator : public RuntimeOperatorBase<RuntimeSortMergeOperatorType>
 {
 private:
-  enum State { START, READ, WRITE, WRITE_EOS };
+  enum State { START, READ, WRITE, READ_BATCH, WRITE_BATCH, WRITE_EOS };
   State mState;
   class InterpreterContext * mRuntimeContext;
   LoserTree<RecordBuffer,NotPred<RecordTypeEquals> > mMergeTree;
+  // Parallel merge of batches of input; NULL when merging
+  // on the scheduler thread.
+  class ParallelSortMerge * mParallel;
+  std::size_t mInputIt;
+  std::size_t mRangeIt;
+  std::size_t mRange;
+  std::size_t mOutputIt;
+  // With normalized keys we use an offset-value coded tree
+  // instead.  Each input owns the key of its record in the tree;
+  // mNextKey is scratch space for the next record.
+  bool mNormalized;
+  OffsetValueLoserTree<RecordBuffer> mKeyMergeTree;
+  std::vector<NormalizedKey> mKeys;
+  NormalizedKey mNextKey;
   RuntimeOperator * mReturnAddress;
   int32_t mReturnPort;
+  bool empty() const
+  {
+    return mNormalized ? mKeyMergeTree.empty() : mMergeTree.empty();
+  }
+  bool isHighSentinel() const
+  {
+    return mNormalized ? mKeyMergeTree.isHighSentinel() : mMergeTree.isHighSentinel();
+  }
+  uint32_t getInput() const
+  {
+    return mNormalized ? mKeyMergeTree.getInput() : mMergeTree.getInput();
+  }
+  RecordBuffer getValue() const
+  {
+    return mNormalized ? mKeyMergeTree.getValue() : mMergeTree.getValue();
+  }
+  void close(uint32_t input)
+  {
+    if (mNormalized) {
+      mKeyMergeTree.close(input);
+    } else {
+      mMergeTree.close(input);
+    }
+  }
+  void update(uint32_t input, RecordBuffer buf);
 public:
   RuntimeSortMergeOperator(RuntimeOperator::Services& services, const RuntimeSortMergeOperatorType& opType);
   ~RuntimeSortMergeOperator();
@@ -909,16 +997,21 @@ public:
   // relative to a known base (that could be squirreled
   // away in compare function's state).
   uint32_t KeyPrefix;
+  // Normalized key (if any): size in words followed by the words.
+  // KeyPrefix is then the first word.
+  const uint32_t * Key;
   RecordBuffer Value;
   SortNode()
     :
-    KeyPrefix(0)
+    KeyPrefix(0),
+    Key(NULL)
   {
   }
 
   SortNode(uint32_t keyPrefix, RecordBuffer val)
     :
     KeyPrefix(keyPrefix),
+    Key(NULL),
     Value(val)
   {
   }
@@ -937,8 +1030,13 @@ private:
   uint64_t mSortSz;
   uint64_t mMemoryAllowed;
   double mReallocThreshold;
+  // Blocks of storage for normalized keys.
+  std::vector<uint32_t *> mKeyBlocks;
+  uint32_t * mKeyPtr;
+  uint32_t * mKeyEnd;
   void capacity(std::size_t numRecords);
   bool push_back_with_realloc(const SortNode& n, std::size_t dataLen);
+  const uint32_t * copyKey(const NormalizedKey & key);
 public:
   SortRun(std::size_t memoryAllowed);
   ~SortRun();
@@ -960,6 +1058,18 @@ public:
       return push_back_with_realloc(n, dataLen);
     }
   }
+  /**
+   * Add a node along with a copy of its normalized key.
+   */
+  bool push_back(const SortNode& n, std::size_t dataLen, 
+		 const NormalizedKey & key)
+  {
+    if (!push_back(n, dataLen + sizeof(uint32_t)*(key.size() + 1))) {
+      return false;
+    }
+    (mFilled-1)->Key = copyKey(key);
+    return true;
+  }
   void clear();
   iterator begin() 
   {
@@ -993,8 +1103,14 @@ private:
   RecordTypeFunction * mKeyPrefix;
   RecordTypeFunction * mKeyEq;
   RecordTypeFunction * mPresortedKeyEq;
+  // For parallel sort: route samples and sorted ranges to partition 0
+  RecordTypeFunction * mGather;
+  // For parallel sort: broadcast splitters to all partitions
+  RecordTypeTransfer * mSplitterTransfer;
+  SortKeyNormalizer mNormalizer;
   std::string mTempDir;
   std::size_t mMemory;
+  bool mParallel;
 public:
   LogicalSort();
   ~LogicalSort();
@@ -1023,6 +1139,8 @@ private:
   std::string mTempDir;
   // Amount of memory operator can use
   std::size_t mMemoryAllowed;
+  // Normalized keys for sorting and merging (may be empty)
+  SortKeyNormalizer mNormalizer;
 
   // Serialization
   friend class boost::serialization::access;
@@ -1039,6 +1157,7 @@ private:
     ar & BOOST_SERIALIZATION_NVP(mFree);
     ar & BOOST_SERIALIZATION_NVP(mTempDir);
     ar & BOOST_SERIALIZATION_NVP(mMemoryAllowed);
+    ar & BOOST_SERIALIZATION_NVP(mNormalizer);
   }
   RuntimeSortOperatorType()
     :
@@ -1054,7 +1173,8 @@ public:
 			  const RecordTypeFunction * lessFun,
 			  const RecordTypeFunction * presortedEquals,
 			  const std::string& tempDir,
-			  std::size_t memoryAllowed)
+			  std::size_t memoryAllowed,
+			  const SortKeyNormalizer * normalizer = NULL)
     :
     RuntimeOperatorType("RuntimeSortOperatorType"),
     mKeyPrefix(keyPrefix->create()),
@@ -1067,6 +1187,9 @@ public:
     mTempDir(tempDir),
     mMemoryAllowed(memoryAllowed)
   {
+    if (normalizer) {
+      mNormalizer = *normalizer;
+    }
   }
   ~RuntimeSortOperatorType()
   {
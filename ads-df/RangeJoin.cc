@@ -0,0 +1,477 @@
+/**
+ * Copyright (c) 2012, Akamai Technologies
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * 
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ * 
+ *   Neither the name of the Akamai Technologies nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <boost/format.hpp>
+
+#include "RuntimePlan.hh"
+#include "RangeJoin.hh"
+
+LogicalRangeJoin::LogicalRangeJoin()
+  :
+  LogicalOperator(2,2,1,1),
+  mLoCompare(NULL),
+  mHiCompare(NULL),
+  mLoPointCompare(NULL),
+  mHiPointCompare(NULL),
+  mRangeIsNull(NULL),
+  mPointIsNull(NULL),
+  mResidual(NULL),
+  mMatchTransfer(NULL),
+  mPresorted(false)
+{
+}
+
+LogicalRangeJoin::~LogicalRangeJoin()
+{
+  delete mLoCompare;
+  delete mHiCompare;
+  delete mLoPointCompare;
+  delete mHiPointCompare;
+  delete mRangeIsNull;
+  delete mPointIsNull;
+  delete mResidual;
+  delete mMatchTransfer;
+}
+
+void LogicalRangeJoin::check(PlanCheckContext& log)
+{
+  std::string lo;
+  std::string hi;
+  std::string point;
+  std::string residual;
+  std::string transfer;
+  // Validate the parameters
+  for(const_param_iterator it = begin_params();
+      it != end_params();
+      ++it) {
+    if (it->equals("hi")) {
+      hi = getStringValue(log, *it);
+    } else if (it->equals("lo")) {
+      lo = getStringValue(log, *it);
+    } else if (it->equals("output")) {
+      transfer = getStringValue(log, *it);
+    } else if (it->equals("point")) {
+      point = getStringValue(log, *it);
+    } else if (it->equals("presorted")) {
+      mPresorted = getBooleanValue(log, *it);
+    } else if (it->equals("residual") ||
+	       it->equals("where")) {
+      residual = getStringValue(log, *it);
+    } else {
+      checkDefaultParam(*it);
+    }
+  }
+
+  if (0 == lo.size()) {
+    log.logError(*this, "Must specify argument 'lo'");
+  }
+  if (0 == hi.size()) {
+    log.logError(*this, "Must specify argument 'hi'");
+  }
+  if (0 == point.size()) {
+    log.logError(*this, "Must specify argument 'point'");
+  }
+  std::vector<std::string> rangeFields;
+  rangeFields.push_back(lo);
+  rangeFields.push_back(hi);
+  checkFieldsExist(log, rangeFields, 0);
+  std::vector<std::string> pointFields(1, point);
+  checkFieldsExist(log, pointFields, 1);
+
+  const RecordType * rangeInput = getInput(0)->getRecordType();
+  const RecordType * pointInput = getInput(1)->getRecordType();
+  std::vector<SortKey> loKey(1, SortKey(lo));
+  std::vector<SortKey> hiKey(1, SortKey(hi));
+  std::vector<SortKey> pointKey(1, SortKey(point));
+  mLoCompare = CompareFunction::get(log, rangeInput, rangeInput, 
+				    loKey, loKey, "compareLo");
+  mHiCompare = CompareFunction::get(log, rangeInput, rangeInput, 
+				    hiKey, hiKey, "compareHi");
+  mLoPointCompare = CompareFunction::get(log, rangeInput, pointInput, 
+					 loKey, pointKey, "compareLoPoint");
+  mHiPointCompare = CompareFunction::get(log, rangeInput, pointInput, 
+					 hiKey, pointKey, "compareHiPoint");
+
+  // Comparison functions sort NULLs rather than rejecting them
+  // so filter them out up front.
+  std::vector<RecordMember> emptyMembers;
+  RecordType emptyTy(emptyMembers);
+  if (rangeInput->getMember(lo).GetType()->isNullable() ||
+      rangeInput->getMember(hi).GetType()->isNullable()) {
+    std::vector<const RecordType *> rangeOnly;
+    rangeOnly.push_back(rangeInput);
+    rangeOnly.push_back(&emptyTy);
+    mRangeIsNull = new RecordTypeFunction(log, "rangeIsNull", rangeOnly,
+					  (boost::format("%1% IS NULL OR %2% IS NULL") %
+					   lo % hi).str());
+  }
+  if (pointInput->getMember(point).GetType()->isNullable()) {
+    std::vector<const RecordType *> pointOnly;
+    pointOnly.push_back(pointInput);
+    pointOnly.push_back(&emptyTy);
+    mPointIsNull = new RecordTypeFunction(log, "pointIsNull", pointOnly,
+					  (boost::format("%1% IS NULL") %
+					   point).str());
+  }
+
+  std::vector<AliasedRecordType> aliasedTypes;
+  aliasedTypes.push_back(AliasedRecordType("l", rangeInput));
+  aliasedTypes.push_back(AliasedRecordType("r", pointInput));
+  if (residual.size()) {
+    mResidual = new RecordTypeFunction(log, "rangepred", aliasedTypes, residual);
+  }
+  mMatchTransfer = new RecordTypeTransfer2(log, "onmatch", 
+					   aliasedTypes, 
+					   transfer.size() ?
+					   transfer :
+					   "l.*, r.*");
+
+  getOutput(0)->setRecordType(mMatchTransfer->getTarget());
+}
+
+void LogicalRangeJoin::create(class RuntimePlanBuilder& plan)
+{
+  RuntimeOperatorType * opType = 
+    new RuntimeRangeJoinOperatorType(getInput(0)->getRecordType(),
+				     getInput(1)->getRecordType(),
+				     mLoCompare,
+				     mHiCompare,
+				     mLoPointCompare,
+				     mHiPointCompare,
+				     mRangeIsNull,
+				     mPointIsNull,
+				     mResidual,
+				     mMatchTransfer,
+				     mPresorted);
+  plan.addOperatorType(opType);
+  plan.mapInputPort(this, 0, opType, 0);  
+  plan.mapInputPort(this, 1, opType, 1);  
+  plan.mapOutputPort(this, 0, opType, 0);  
+}
+
+RuntimeRangeJoinOperatorType::RuntimeRangeJoinOperatorType(const RecordType * rangeInput,
+							   const RecordType * pointInput,
+							   const RecordTypeFunction * loCompare,
+							   const RecordTypeFunction * hiCompare,
+							   const RecordTypeFunction * loPointCompare,
+							   const RecordTypeFunction * hiPointCompare,
+							   const RecordTypeFunction * rangeIsNull,
+							   const RecordTypeFunction * pointIsNull,
+							   const RecordTypeFunction * residual,
+							   const RecordTypeTransfer2 * matchTransfer,
+							   bool presorted)
+  :
+  RuntimeOperatorType("RuntimeRangeJoinOperatorType"),
+  mRangeFree(rangeInput->getFree()),
+  mPointFree(pointInput->getFree()),
+  mLoCompareFun(loCompare->create()),
+  mHiCompareFun(hiCompare->create()),
+  mLoPointCompareFun(loPointCompare->create()),
+  mHiPointCompareFun(hiPointCompare->create()),
+  mRangeIsNullFun(rangeIsNull ? rangeIsNull->create() : NULL),
+  mPointIsNullFun(pointIsNull ? pointIsNull->create() : NULL),
+  mResidualFun(residual ? residual->create() : NULL),
+  mMatchTransfer(matchTransfer->create()),
+  mPresorted(presorted)
+{
+}
+
+RuntimeRangeJoinOperatorType::~RuntimeRangeJoinOperatorType()
+{
+  delete mLoCompareFun;
+  delete mHiCompareFun;
+  delete mLoPointCompareFun;
+  delete mHiPointCompareFun;
+  delete mRangeIsNullFun;
+  delete mPointIsNullFun;
+  delete mResidualFun;
+  delete mMatchTransfer;
+}
+
+RuntimeOperator * RuntimeRangeJoinOperatorType::create(RuntimeOperator::Services & s) const
+{
+  return new RuntimeRangeJoinOperator(s, *this);
+}
+
+/**
+ * Order ranges on lo.
+ */
+class RangeLoLess
+{
+private:
+  IQLFunctionModule * mCompare;
+  InterpreterContext * mContext;
+public:
+  RangeLoLess(IQLFunctionModule * compare, InterpreterContext * ctxt)
+    :
+    mCompare(compare),
+    mContext(ctxt)
+  {
+  }
+  bool operator() (RecordBuffer lhs, RecordBuffer rhs) const
+  {
+    return mCompare->execute(lhs, rhs, mContext) < 0;
+  }
+};
+
+RuntimeRangeJoinOperator::RuntimeRangeJoinOperator(RuntimeOperator::Services& services, 
+						   const RuntimeRangeJoinOperatorType& opType)
+  :
+  RuntimeOperatorBase<RuntimeRangeJoinOperatorType>(services, opType),
+  mState(START),
+  mRuntimeContext(new InterpreterContext()),
+  mRangeEOS(false),
+  mMatchIt(0)
+{
+}
+
+RuntimeRangeJoinOperator::~RuntimeRangeJoinOperator()
+{
+  freeRanges();
+  if (mRangeInput != RecordBuffer()) {
+    getMyOperatorType().mRangeFree.free(mRangeInput);
+  }
+  if (mPoint != RecordBuffer()) {
+    getMyOperatorType().mPointFree.free(mPoint);
+  }
+  delete mRuntimeContext;
+}
+
+bool RuntimeRangeJoinOperator::isNullRange(RecordBuffer range)
+{
+  return NULL != getMyOperatorType().mRangeIsNullFun &&
+    getMyOperatorType().mRangeIsNullFun->execute(range, RecordBuffer(), 
+						 mRuntimeContext);
+}
+
+bool RuntimeRangeJoinOperator::isNullPoint()
+{
+  return NULL != getMyOperatorType().mPointIsNullFun &&
+    getMyOperatorType().mPointIsNullFun->execute(mPoint, RecordBuffer(), 
+						 mRuntimeContext);
+}
+
+void RuntimeRangeJoinOperator::buildIndex()
+{
+  const IQLFunctionModule * hiCompare = getMyOperatorType().mHiCompareFun;
+  std::sort(mRanges.begin(), mRanges.end(), 
+	    RangeLoLess(getMyOperatorType().mLoCompareFun, mRuntimeContext));
+  mMaxHi.resize(mRanges.size());
+  for(std::size_t i=0; i<mRanges.size(); ++i) {
+    mMaxHi[i] = (i == 0 || 
+		 hiCompare->execute(mRanges[i], mRanges[mMaxHi[i-1]], 
+				    mRuntimeContext) > 0) ? 
+      uint32_t(i) : mMaxHi[i-1];
+  }
+}
+
+void RuntimeRangeJoinOperator::lookup()
+{
+  mMatches.clear();
+  // Find the ranges with lo <= point.
+  std::size_t first = 0;
+  std::size_t last = mRanges.size();
+  while(first < last) {
+    std::size_t mid = first + (last - first)/2;
+    if (compareLo(mRanges[mid]) <= 0) {
+      first = mid + 1;
+    } else {
+      last = mid;
+    }
+  }
+  // Scan back while some range to the left may still reach the point.
+  for(std::size_t i = first; i > 0; --i) {
+    if (compareHi(mRanges[mMaxHi[i-1]]) < 0) {
+      break;
+    }
+    if (compareHi(mRanges[i-1]) >= 0 && isResidualMatch(mRanges[i-1])) {
+      mMatches.push_back(uint32_t(i-1));
+    }
+  }
+  // Output in order of lo.
+  std::reverse(mMatches.begin(), mMatches.end());
+}
+
+void RuntimeRangeJoinOperator::sweep()
+{
+  mMatches.clear();
+  // Points arrive in order so ranges that end before this 
+  // point can never match again.
+  std::size_t open = 0;
+  for(std::size_t i=0; i<mRanges.size(); ++i) {
+    if (compareHi(mRanges[i]) < 0) {
+      getMyOperatorType().mRangeFree.free(mRanges[i]);
+    } else {
+      mRanges[open] = mRanges[i];
+      if (isResidualMatch(mRanges[open])) {
+	mMatches.push_back(uint32_t(open));
+      }
+      open += 1;
+    }
+  }
+  mRanges.resize(open);
+}
+
+void RuntimeRangeJoinOperator::freeRanges()
+{
+  for(std::vector<RecordBuffer>::iterator it = mRanges.begin();
+      it != mRanges.end();
+      ++it) {
+    getMyOperatorType().mRangeFree.free(*it);
+  }
+  mRanges.clear();
+}
+
+void RuntimeRangeJoinOperator::start()
+{
+  mState = START;
+  onEvent(NULL);
+}
+
+void RuntimeRangeJoinOperator::onEvent(RuntimePort * port)
+{
+  switch(mState) {
+  case START:
+    if (!getMyOperatorType().mPresorted) {
+      // Load all ranges and index them.
+      while(true) {
+	requestRead(RuntimeRangeJoinOperatorType::RANGE_PORT);
+	mState = READ_RANGE;
+	return;
+      case READ_RANGE:
+	read(port, mRangeInput);
+	if (RecordBuffer::isEOS(mRangeInput)) {
+	  mRangeEOS = true;
+	  break;
+	}
+	if (isNullRange(mRangeInput)) {
+	  getMyOperatorType().mRangeFree.free(mRangeInput);
+	} else {
+	  mRanges.push_back(mRangeInput);
+	}
+	mRangeInput = RecordBuffer();
+      }
+      buildIndex();
+    }
+
+    while(true) {
+      requestRead(RuntimeRangeJoinOperatorType::POINT_PORT);
+      mState = READ_POINT;
+      return;
+    case READ_POINT:
+      read(port, mPoint);
+      if (RecordBuffer::isEOS(mPoint)) {
+	break;
+      }
+      if (!isNullPoint()) {
+	if (getMyOperatorType().mPresorted) {
+	  // Open all ranges that start at or before the point.
+	  while(!mRangeEOS) {
+	    if (mRangeInput == RecordBuffer()) {
+	      requestRead(RuntimeRangeJoinOperatorType::RANGE_PORT);
+	      mState = READ_RANGE_SWEEP;
+	      return;
+	    case READ_RANGE_SWEEP:
+	      read(port, mRangeInput);
+	      if (RecordBuffer::isEOS(mRangeInput)) {
+		mRangeEOS = true;
+		break;
+	      }
+	      if (isNullRange(mRangeInput)) {
+		getMyOperatorType().mRangeFree.free(mRangeInput);
+		mRangeInput = RecordBuffer();
+		continue;
+	      }
+	    }
+	    if (compareLo(mRangeInput) > 0) {
+	      break;
+	    }
+	    mRanges.push_back(mRangeInput);
+	    mRangeInput = RecordBuffer();
+	  }
+	  sweep();
+	} else {
+	  lookup();
+	}
+	for(mMatchIt = 0; mMatchIt < mMatches.size(); ++mMatchIt) {
+	  requestWrite(0);
+	  mState = WRITE;
+	  return;
+	case WRITE:
+	  {
+	    RecordBuffer range = mRanges[mMatches[mMatchIt]];
+	    RecordBuffer out;
+	    getMyOperatorType().mMatchTransfer->execute(range, mPoint, out, 
+							mRuntimeContext, 
+							false, false);
+	    write(port, out, false);
+	  }
+	}
+      }
+      getMyOperatorType().mPointFree.free(mPoint);
+      mPoint = RecordBuffer();
+    }
+
+    // Drain any ranges that no point will reach.
+    if (mRangeInput != RecordBuffer()) {
+      getMyOperatorType().mRangeFree.free(mRangeInput);
+      mRangeInput = RecordBuffer();
+    }
+    while(!mRangeEOS) {
+      requestRead(RuntimeRangeJoinOperatorType::RANGE_PORT);
+      mState = READ_RANGE_DRAIN;
+      return;
+    case READ_RANGE_DRAIN:
+      read(port, mRangeInput);
+      if (RecordBuffer::isEOS(mRangeInput)) {
+	mRangeEOS = true;
+      } else {
+	getMyOperatorType().mRangeFree.free(mRangeInput);
+      }
+      mRangeInput = RecordBuffer();
+    }
+    freeRanges();
+
+    requestWrite(0);
+    mState = WRITE_EOS;
+    return;
+  case WRITE_EOS:
+    write(port, RecordBuffer(), true);
+  }
+}
+
+void RuntimeRangeJoinOperator::shutdown()
+{
+}
@@ -0,0 +1,206 @@
+/**
+ * Copyright (c) 2012, Akamai Technologies
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * 
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ * 
+ *   Neither the name of the Akamai Technologies nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if !defined(__RANGE_JOIN_HH)
+#define __RANGE_JOIN_HH
+
+#include <vector>
+#include "RuntimeOperator.hh"
+
+/**
+ * Join points to the ranges that contain them: a point record from 
+ * the right input matches a range record from the left input when
+ * lo <= point AND point <= hi (plus an optional residual).  The 
+ * typical uses are IP address to ASN or geography tables and 
+ * attributing events to time windows.
+ *
+ * By default the ranges are loaded into an in memory interval
+ * index (ranges sorted on lo with a running maximum of hi) that
+ * is probed with each point; neither input needs to be sorted and
+ * ranges may overlap.  With presorted=true, ranges must arrive sorted
+ * on lo and points sorted on point; the join then runs as a sweep 
+ * that keeps only the ranges that are open at the current point.
+ *
+ * Records with a NULL point, lo or hi never match.  Output is
+ * specified as in merge_join with the left (range) input aliased 
+ * as l and the right (point) input as r.
+ */
+class LogicalRangeJoin : public LogicalOperator
+{
+private:
+  RecordTypeFunction * mLoCompare;
+  RecordTypeFunction * mHiCompare;
+  RecordTypeFunction * mLoPointCompare;
+  RecordTypeFunction * mHiPointCompare;
+  RecordTypeFunction * mRangeIsNull;
+  RecordTypeFunction * mPointIsNull;
+  RecordTypeFunction * mResidual;
+  RecordTypeTransfer2 * mMatchTransfer;
+  bool mPresorted;
+public:
+  LogicalRangeJoin();
+  ~LogicalRangeJoin();
+  void check(PlanCheckContext& log);
+  void create(class RuntimePlanBuilder& plan);  
+};
+
+class RuntimeRangeJoinOperatorType : public RuntimeOperatorType
+{
+  friend class RuntimeRangeJoinOperator;
+public:
+  enum InputPorts { RANGE_PORT=0, POINT_PORT=1 };
+private:
+  RecordTypeFree mRangeFree;
+  RecordTypeFree mPointFree;
+  // Compare lo (resp. hi) of two ranges.
+  IQLFunctionModule * mLoCompareFun;
+  IQLFunctionModule * mHiCompareFun;
+  // Compare lo (resp. hi) of a range to a point.
+  IQLFunctionModule * mLoPointCompareFun;
+  IQLFunctionModule * mHiPointCompareFun;
+  // NULL tests; NULL if the fields are not nullable.
+  IQLFunctionModule * mRangeIsNullFun;
+  IQLFunctionModule * mPointIsNullFun;
+  IQLFunctionModule * mResidualFun;
+  IQLTransferModule2 * mMatchTransfer;
+  bool mPresorted;
+
+  // Serialization
+  friend class boost::serialization::access;
+  template <class Archive>
+  void serialize(Archive & ar, const unsigned int version)
+  {
+    ar & BOOST_SERIALIZATION_BASE_OBJECT_NVP(RuntimeOperatorType);
+    ar & BOOST_SERIALIZATION_NVP(mRangeFree);
+    ar & BOOST_SERIALIZATION_NVP(mPointFree);
+    ar & BOOST_SERIALIZATION_NVP(mLoCompareFun);
+    ar & BOOST_SERIALIZATION_NVP(mHiCompareFun);
+    ar & BOOST_SERIALIZATION_NVP(mLoPointCompareFun);
+    ar & BOOST_SERIALIZATION_NVP(mHiPointCompareFun);
+    ar & BOOST_SERIALIZATION_NVP(mRangeIsNullFun);
+    ar & BOOST_SERIALIZATION_NVP(mPointIsNullFun);
+    ar & BOOST_SERIALIZATION_NVP(mResidualFun);
+    ar & BOOST_SERIALIZATION_NVP(mMatchTransfer);
+    ar & BOOST_SERIALIZATION_NVP(mPresorted);
+  }
+  RuntimeRangeJoinOperatorType()
+    :
+    mLoCompareFun(NULL),
+    mHiCompareFun(NULL),
+    mLoPointCompareFun(NULL),
+    mHiPointCompareFun(NULL),
+    mRangeIsNullFun(NULL),
+    mPointIsNullFun(NULL),
+    mResidualFun(NULL),
+    mMatchTransfer(NULL),
+    mPresorted(false)
+  {
+  }  
+public:
+  RuntimeRangeJoinOperatorType(const RecordType * rangeInput,
+			       const RecordType * pointInput,
+			       const RecordTypeFunction * loCompare,
+			       const RecordTypeFunction * hiCompare,
+			       const RecordTypeFunction * loPointCompare,
+			       const RecordTypeFunction * hiPointCompare,
+			       const RecordTypeFunction * rangeIsNull,
+			       const RecordTypeFunction * pointIsNull,
+			       const RecordTypeFunction * residual,
+			       const RecordTypeTransfer2 * matchTransfer,
+			       bool presorted);
+  ~RuntimeRangeJoinOperatorType();
+  RuntimeOperator * create(RuntimeOperator::Services & s) const;
+};
+
+class RuntimeRangeJoinOperator : public RuntimeOperatorBase<RuntimeRangeJoinOperatorType>
+{
+private:
+  enum State { START, READ_RANGE, READ_POINT, READ_RANGE_SWEEP, WRITE, 
+	       READ_RANGE_DRAIN, WRITE_EOS };
+  State mState;
+  class InterpreterContext * mRuntimeContext;
+  // Ranges sorted on lo.  When sweeping these are the open ranges.
+  std::vector<RecordBuffer> mRanges;
+  // Offset of the range with the largest hi among mRanges[0..i].
+  std::vector<uint32_t> mMaxHi;
+  // Lookahead on the range input when sweeping.
+  RecordBuffer mRangeInput;
+  bool mRangeEOS;
+  RecordBuffer mPoint;
+  // Offsets in mRanges matching the current point.
+  std::vector<uint32_t> mMatches;
+  std::size_t mMatchIt;
+
+  bool isNullRange(RecordBuffer range);
+  bool isNullPoint();
+  int32_t compareLo(RecordBuffer range)
+  {
+    return getMyOperatorType().mLoPointCompareFun->execute(range, mPoint, 
+							   mRuntimeContext);
+  }
+  int32_t compareHi(RecordBuffer range)
+  {
+    return getMyOperatorType().mHiPointCompareFun->execute(range, mPoint, 
+							   mRuntimeContext);
+  }
+  bool isResidualMatch(RecordBuffer range)
+  {
+    return NULL == getMyOperatorType().mResidualFun ||
+      getMyOperatorType().mResidualFun->execute(range, mPoint, 
+						mRuntimeContext);
+  }
+  /**
+   * Sort the ranges on lo and compute running maximum of hi.
+   */
+  void buildIndex();
+  /**
+   * Find the ranges of the index that contain the current point.
+   */
+  void lookup();
+  /**
+   * Close the open ranges that end before the current point and 
+   * match the others.
+   */
+  void sweep();
+  void freeRanges();
+public:
+  RuntimeRangeJoinOperator(RuntimeOperator::Services& services, 
+			   const RuntimeRangeJoinOperatorType& opType);
+  ~RuntimeRangeJoinOperator();
+  void start();
+  void onEvent(RuntimePort * port);
+  void shutdown();
+};
+
+#endif
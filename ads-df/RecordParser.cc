@@ -589,3 +589,34 @@ void SerialChunkStrategy::getFilesForPartition(int32_t partition,
 						std::numeric_limits<uint64_t>::max()));
 }
 
+void FileStatisticsFilter::prune(const ZoneMapPredicate& zoneMap,
+				 std::vector<boost::shared_ptr<FileChunk> >& files)
+{
+  std::vector<boost::shared_ptr<FileChunk> > result;
+  // Chunks of the same file are adjacent; only read its statistics once.
+  std::string lastFile;
+  bool lastMayMatch = true;
+  for(std::vector<boost::shared_ptr<FileChunk> >::const_iterator it = files.begin();
+      it != files.end();
+      ++it) {
+    if (lastFile != (*it)->getFilename()) {
+      lastFile = (*it)->getFilename();
+      lastMayMatch = true;
+      PathPtr statsPath = Path::get(lastFile + RecordTypeStatistics::SUFFIX);
+      AutoFileSystem fs(statsPath->getUri());
+      if (fs->exists(statsPath)) {
+	std::string buf;
+	fs->readFile(statsPath->getUri(), buf);
+	std::map<std::string, ColumnStatistics> stats;
+	const uint8_t * begin = (const uint8_t *) buf.c_str();
+	RecordTypeStatistics::read(begin, begin + buf.size(), stats);
+	lastMayMatch = zoneMap.mayMatch(stats);
+      }
+    }
+    if (lastMayMatch) {
+      result.push_back(*it);
+    }
+  }
+  files.swap(result);
+}
+
@@ -48,6 +48,7 @@
 #include "RecordType.hh"
 #include "RuntimeOperator.hh"
 #include "FileSystem.hh"
+#include "ZoneMap.hh"
 
 namespace boost {
   namespace interprocess {
@@ -1257,6 +1258,21 @@ public:
 			    std::vector<boost::shared_ptr<FileChunk> >& files) const;
 };
 
+/**
+ * Skips files using the statistics sidecars written next to them
+ * (see RecordTypeStatistics).
+ */
+class FileStatisticsFilter
+{
+public:
+  /**
+   * Remove the chunks of files whose statistics show that no 
+   * record can satisfy zoneMap.  Files without statistics are kept.
+   */
+  static void prune(const ZoneMapPredicate& zoneMap,
+		    std::vector<boost::shared_ptr<FileChunk> >& files);
+};
+
 template<class _OpType>
 class GenericParserOperator : public RuntimeOperator
 {
@@ -1352,6 +1368,9 @@ public:
     // partition.
     chunkFiles.expand(getLogParserType().mFileInput, getNumPartitions());
     chunkFiles.getFilesForPartition(getPartition(), mFiles);
+    if (!getLogParserType().mZoneMap.empty()) {
+      FileStatisticsFilter::prune(getLogParserType().mZoneMap, mFiles);
+    }
     mState = START;
     mRecordsImported = 0;
     onEvent(NULL);
@@ -1450,6 +1469,8 @@ public:
   bool mSkipHeader;
   // Skip lines starting with this.
   std::string mCommentLine;
+  // Skip files whose statistics rule this out.
+  ZoneMapPredicate mZoneMap;
   // Serialization
   friend class boost::serialization::access;
   template <class Archive>
@@ -1463,6 +1484,7 @@ public:
     ar & BOOST_SERIALIZATION_NVP(mFree);
     ar & BOOST_SERIALIZATION_NVP(mSkipHeader);
     ar & BOOST_SERIALIZATION_NVP(mCommentLine);
+    ar & BOOST_SERIALIZATION_NVP(mZoneMap);
   }
   GenericParserOperatorType()
   {
@@ -1511,6 +1533,11 @@ public:
     mSkipHeader = value;
   }
 
+  void setZoneMap(const ZoneMapPredicate& zoneMap)
+  {
+    mZoneMap = zoneMap;
+  }
+
   RuntimeOperator * create(RuntimeOperator::Services & services) const;
 };
 
@@ -0,0 +1,355 @@
+/**
+ * Copyright (c) 2012, Akamai Technologies
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * 
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ * 
+ *   Neither the name of the Akamai Technologies nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/resource.h>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+
+#include <boost/bind.hpp>
+#include <boost/format.hpp>
+#include <boost/thread.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "DataflowRuntime.hh"
+#include "RuntimeOperator.hh"
+#include "RuntimeMetrics.hh"
+
+RuntimeMetrics::RuntimeMetrics()
+  :
+  mEnabled(false),
+  mStart(boost::posix_time::microsec_clock::universal_time())
+{
+}
+
+RuntimeMetrics::~RuntimeMetrics()
+{
+}
+
+RuntimeMetrics& RuntimeMetrics::get()
+{
+  static RuntimeMetrics metrics;
+  return metrics;
+}
+
+void RuntimeMetrics::setEnabled(bool enabled)
+{
+  boost::mutex::scoped_lock sl(mLock);
+  if (enabled && !mEnabled) {
+    mStart = boost::posix_time::microsec_clock::universal_time();
+  }
+  mEnabled = enabled;
+}
+
+template <class _T>
+void RuntimeMetrics::remove(std::vector<_T *>& v, _T * val)
+{
+  for(typename std::vector<_T *>::iterator it = v.begin();
+      it != v.end();
+      ++it) {
+    if (*it == val) {
+      v.erase(it);
+      return;
+    }
+  }
+}
+
+void RuntimeMetrics::addScheduler(DataflowScheduler * s)
+{
+  boost::mutex::scoped_lock sl(mLock);
+  mSchedulers.push_back(s);
+}
+
+void RuntimeMetrics::removeScheduler(DataflowScheduler * s)
+{
+  boost::mutex::scoped_lock sl(mLock);
+  remove(mSchedulers, s);
+}
+
+void RuntimeMetrics::addOperator(RuntimeOperator * op)
+{
+  boost::mutex::scoped_lock sl(mLock);
+  mOperators.push_back(op);
+}
+
+void RuntimeMetrics::removeOperator(RuntimeOperator * op)
+{
+  boost::mutex::scoped_lock sl(mLock);
+  remove(mOperators, op);
+  mSkewedKeys.erase(op);
+}
+
+void RuntimeMetrics::addChannel(InProcessFifo * channel)
+{
+  boost::mutex::scoped_lock sl(mLock);
+  mChannels.push_back(channel);
+}
+
+void RuntimeMetrics::removeChannel(InProcessFifo * channel)
+{
+  boost::mutex::scoped_lock sl(mLock);
+  remove(mChannels, channel);
+}
+
+void RuntimeMetrics::setSkewedKey(RuntimeOperator * op, const std::string& key)
+{
+  boost::mutex::scoped_lock sl(mLock);
+  mSkewedKeys[op] = key;
+}
+
+void RuntimeMetrics::writeString(std::ostream& ostr, const std::string& str)
+{
+  ostr << '"';
+  for(std::string::const_iterator c = str.begin(); c != str.end(); ++c) {
+    switch(*c) {
+    case '"':
+      ostr << "\\\"";
+      break;
+    case '\\':
+      ostr << "\\\\";
+      break;
+    default:
+      if ((unsigned char) *c < 0x20) {
+	ostr << (boost::format("\\u%04x") % (int32_t) *c);
+      } else {
+	ostr << *c;
+      }
+      break;
+    }
+  }
+  ostr << '"';
+}
+
+void RuntimeMetrics::writeJSON(std::ostream& ostr)
+{
+  boost::mutex::scoped_lock sl(mLock);
+  boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+  struct rusage usage;
+  ::getrusage(RUSAGE_SELF, &usage);
+  ostr << "{\"elapsedMillis\":" << (now - mStart).total_milliseconds() <<
+    ",\"maxResidentKB\":" << usage.ru_maxrss;
+
+  ostr << ",\"schedulers\":[";
+  for(std::vector<DataflowScheduler *>::const_iterator it = mSchedulers.begin();
+      it != mSchedulers.end();
+      ++it) {
+    if (it != mSchedulers.begin()) ostr << ",";
+    ostr << "{\"partition\":" << (*it)->getPartition() <<
+      ",\"ioPolls\":" << (*it)->getNumIOPoll() <<
+      ",\"ioWaits\":" << (*it)->getNumIOWaits() <<
+      ",\"ioCompletions\":" << (*it)->getNumIOCompletions() <<
+      ",\"internalWriteBufferFlushes\":" << (*it)->getNumInternalWriteBufferFlush() <<
+      ",\"iterationsBeforePoll\":" << (*it)->getIterationsBeforePoll() <<
+      ",\"maxWritesBeforeYield\":" << (*it)->getMaxWritesBeforeYield() <<
+      ",\"requestsOutstanding\":" << (*it)->getRequestsOutstanding() << "}";
+  }
+
+  // Records in and out of an operator are the totals of the channels
+  // attached to its ports.
+  std::map<RuntimeOperator *, std::pair<uint64_t, uint64_t> > opRecords;
+  ostr << "],\"channels\":[";
+  for(std::vector<InProcessFifo *>::const_iterator it = mChannels.begin();
+      it != mChannels.end();
+      ++it) {
+    uint64_t recordsRead, queueSize;
+    (*it)->getStatistics(recordsRead, queueSize);
+    RuntimeOperator * source = (*it)->getSource()->getOperatorPtr();
+    RuntimeOperator * target = (*it)->getTarget()->getOperatorPtr();
+    opRecords[source].second += recordsRead;
+    opRecords[target].first += recordsRead - queueSize;
+    if (it != mChannels.begin()) ostr << ",";
+    ostr << "{\"source\":";
+    writeString(ostr, source ? source->getName() : std::string());
+    ostr << ",\"target\":";
+    writeString(ostr, target ? target->getName() : std::string());
+    ostr << ",\"records\":" << recordsRead <<
+      ",\"queueDepth\":" << queueSize << "}";
+  }
+
+  ostr << "],\"operators\":[";
+  for(std::vector<RuntimeOperator *>::const_iterator it = mOperators.begin();
+      it != mOperators.end();
+      ++it) {
+    const std::pair<uint64_t, uint64_t>& records(opRecords[*it]);
+    if (it != mOperators.begin()) ostr << ",";
+    ostr << "{\"name\":";
+    writeString(ostr, (*it)->getName());
+    ostr << ",\"partition\":" << (*it)->getPartition() <<
+      ",\"ticks\":" << (*it)->getTicks() <<
+      ",\"bytes\":" << (*it)->getBytes() <<
+      ",\"recordsIn\":" << records.first <<
+      ",\"recordsOut\":" << records.second <<
+      ",\"spilledRuns\":" << (*it)->getSpilledRuns() <<
+      ",\"spilledRecords\":" << (*it)->getSpilledRecords();
+    std::map<RuntimeOperator *, std::string>::const_iterator key = 
+      mSkewedKeys.find(*it);
+    if (key != mSkewedKeys.end()) {
+      ostr << ",\"skewedKey\":";
+      writeString(ostr, key->second);
+    }
+    ostr << "}";
+  }
+  ostr << "]}";
+}
+
+std::string RuntimeMetrics::getJSON()
+{
+  std::stringstream ostr;
+  writeJSON(ostr);
+  return ostr.str();
+}
+
+void RuntimeMetrics::writeSummary(std::ostream& ostr)
+{
+  boost::mutex::scoped_lock sl(mLock);
+  std::map<RuntimeOperator *, std::pair<uint64_t, uint64_t> > opRecords;
+  for(std::vector<InProcessFifo *>::const_iterator it = mChannels.begin();
+      it != mChannels.end();
+      ++it) {
+    uint64_t recordsRead, queueSize;
+    (*it)->getStatistics(recordsRead, queueSize);
+    opRecords[(*it)->getSource()->getOperatorPtr()].second += recordsRead;
+    opRecords[(*it)->getTarget()->getOperatorPtr()].first += recordsRead - queueSize;
+  }
+  uint64_t totalTicks=0;
+  ostr << "Partition\tTicks\tBytes\tRecordsIn\tRecordsOut\tOperator Name\n";
+  for(std::vector<RuntimeOperator *>::const_iterator it = mOperators.begin();
+      it != mOperators.end();
+      ++it) {
+    const std::pair<uint64_t, uint64_t>& records(opRecords[*it]);
+    totalTicks += (*it)->getTicks();
+    ostr << (*it)->getPartition() << "\t" << (*it)->getTicks() << "\t" <<
+      (*it)->getBytes() << "\t" << records.first << "\t" << records.second << 
+      "\t" << (*it)->getName().c_str() << "\n";
+  }
+  ostr << "Total Ticks\t" << totalTicks << "\n";
+  if (mSkewedKeys.size()) {
+    ostr << "Partition\tSpilledRuns\tSpilledRecords\tOperator Name\tSkewed Key\n";
+    for(std::vector<RuntimeOperator *>::const_iterator it = mOperators.begin();
+	it != mOperators.end();
+	++it) {
+      std::map<RuntimeOperator *, std::string>::const_iterator key = 
+	mSkewedKeys.find(*it);
+      if (key == mSkewedKeys.end()) continue;
+      ostr << (*it)->getPartition() << "\t" << (*it)->getSpilledRuns() << "\t" <<
+	(*it)->getSpilledRecords() << "\t" << (*it)->getName().c_str() << "\t" <<
+	key->second << "\n";
+    }
+  }
+  ostr << "Partition\tIOPolls\tIOWaits\tIOCompletions\tInternalWriteBufferFlushes\tIterationsBeforePoll\tMaxWritesBeforeYield\n";
+  for(std::vector<DataflowScheduler *>::const_iterator it = mSchedulers.begin();
+      it != mSchedulers.end();
+      ++it) {
+    ostr << (*it)->getPartition() << "\t" << (*it)->getNumIOPoll() << "\t" <<
+      (*it)->getNumIOWaits() << "\t" << 
+      (*it)->getNumIOCompletions() << "\t" << 
+      (*it)->getNumInternalWriteBufferFlush() << "\t" <<
+      (*it)->getIterationsBeforePoll() << "\t" <<
+      (*it)->getMaxWritesBeforeYield() << "\n";
+  }
+}
+
+RuntimeMetricsReporter::RuntimeMetricsReporter(const std::string& file,
+					       int32_t intervalSeconds)
+  :
+  mFile(file),
+  mIntervalSeconds(intervalSeconds),
+  mStopped(false),
+  mThread(NULL)
+{
+  RuntimeMetrics::get().setEnabled(true);
+  if (mFile.size() && mIntervalSeconds > 0) {
+    mThread = new boost::thread(boost::bind(&RuntimeMetricsReporter::run, this));
+  }
+}
+
+RuntimeMetricsReporter::~RuntimeMetricsReporter()
+{
+  if (mThread) {
+    {
+      boost::mutex::scoped_lock sl(mLock);
+      mStopped = true;
+    }
+    mCondVar.notify_all();
+    mThread->join();
+    delete mThread;
+  }
+  try {
+    if (mFile.size()) {
+      writeFile();
+    }
+    RuntimeMetrics::get().writeSummary(std::cerr);
+  } catch(std::exception& ex) {
+    std::cerr << "Failed writing runtime metrics: " << ex.what() << std::endl;
+  }
+}
+
+void RuntimeMetricsReporter::writeFile()
+{
+  // Write to a temporary and rename into place.
+  std::string tmp = mFile + ".tmp";
+  {
+    std::ofstream ostr(tmp.c_str());
+    if (!ostr) {
+      throw std::runtime_error((boost::format("Unable to open metrics file %1%") %
+				tmp).str());
+    }
+    RuntimeMetrics::get().writeJSON(ostr);
+    ostr << "\n";
+  }
+  if (::rename(tmp.c_str(), mFile.c_str()) != 0) {
+    throw std::runtime_error((boost::format("Unable to rename metrics file %1% to %2%") %
+			      tmp % mFile).str());
+  }
+}
+
+void RuntimeMetricsReporter::run()
+{
+  boost::mutex::scoped_lock sl(mLock);
+  while(!mStopped) {
+    boost::system_time wakeup = boost::get_system_time() + 
+      boost::posix_time::seconds(mIntervalSeconds);
+    if (mCondVar.timed_wait(sl, wakeup) || mStopped) {
+      continue;
+    }
+    try {
+      writeFile();
+    } catch(std::exception& ex) {
+      std::cerr << "Failed writing runtime metrics: " << ex.what() << std::endl;
+    }
+  }
+}
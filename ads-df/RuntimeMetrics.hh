@@ -0,0 +1,153 @@
+/**
+ * Copyright (c) 2012, Akamai Technologies
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * 
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ * 
+ *   Neither the name of the Akamai Technologies nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if !defined(__RUNTIME_METRICS_HH)
+#define __RUNTIME_METRICS_HH
+
+#include <stdint.h>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+class DataflowScheduler;
+class InProcessFifo;
+class RuntimeOperator;
+
+namespace boost {
+  class thread;
+}
+
+/**
+ * Process wide registry of the statistics that the dataflow runtime
+ * keeps about itself: CPU ticks and bytes for operators, records and
+ * queue depths for channels and IO polling behavior for schedulers.
+ *
+ * Components register with the registry when they are created and
+ * unregister when they are destroyed.  Counters remain owned by the
+ * components themselves and are only read here when a snapshot is
+ * taken, so publishing costs nothing on the record path.  Counters
+ * written by scheduler threads are read without synchronization; the 
+ * values in a snapshot are therefore approximate but never torn on the 
+ * 64-bit platforms we support.  Channel queue depths are read under 
+ * the channel lock.
+ *
+ * Collection is off by default.  When disabled, schedulers do not
+ * sample the TSC around operator events.
+ *
+ * Operators that spill report the key of their largest spilled run
+ * here.  That happens at most once per spilled run so it is done 
+ * under the registry lock.
+ */
+class RuntimeMetrics
+{
+private:
+  boost::mutex mLock;
+  bool mEnabled;
+  boost::posix_time::ptime mStart;
+  std::vector<DataflowScheduler *> mSchedulers;
+  std::vector<RuntimeOperator *> mOperators;
+  std::vector<InProcessFifo *> mChannels;
+  std::map<RuntimeOperator *, std::string> mSkewedKeys;
+
+  RuntimeMetrics();
+  ~RuntimeMetrics();
+
+  template <class _T>
+  static void remove(std::vector<_T *>& v, _T * val);
+  static void writeString(std::ostream& ostr, const std::string& str);
+public:
+  static RuntimeMetrics& get();
+
+  bool isEnabled() const
+  {
+    return mEnabled;
+  }
+  void setEnabled(bool enabled);
+
+  void addScheduler(DataflowScheduler * s);
+  void removeScheduler(DataflowScheduler * s);
+  void addOperator(RuntimeOperator * op);
+  void removeOperator(RuntimeOperator * op);
+  void addChannel(InProcessFifo * channel);
+  void removeChannel(InProcessFifo * channel);
+
+  /**
+   * Record the (printed) key of the largest run an operator 
+   * had to spill.
+   */
+  void setSkewedKey(RuntimeOperator * op, const std::string& key);
+
+  /**
+   * Write a JSON document describing the current state of
+   * all registered components.
+   */
+  void writeJSON(std::ostream& ostr);
+  std::string getJSON();
+
+  /**
+   * Write a human readable per operator summary.
+   */
+  void writeSummary(std::ostream& ostr);
+};
+
+/**
+ * Periodically dumps a metrics snapshot to a file while a dataflow
+ * is running.  The file is replaced atomically so that readers 
+ * never see a partial document.  On destruction, the reporter writes 
+ * a final snapshot and prints a summary to standard error so that it
+ * doesn't mix with dataflow output on standard output.
+ */
+class RuntimeMetricsReporter
+{
+private:
+  std::string mFile;
+  int32_t mIntervalSeconds;
+  boost::mutex mLock;
+  boost::condition_variable mCondVar;
+  bool mStopped;
+  boost::thread * mThread;
+
+  void writeFile();
+  void run();
+public:
+  RuntimeMetricsReporter(const std::string& file, int32_t intervalSeconds);
+  ~RuntimeMetricsReporter();
+};
+
+#endif
@@ -33,11 +33,15 @@
  */
 
 #include <iostream>
+#include <sstream>
 #include <boost/algorithm/string.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/regex.hpp>
+#include "RuntimeMetrics.hh"
 #include "RuntimeOperator.hh"
+#include "SpillFile.hh"
 #include "IQLInterpreter.hh"
+#include "Merger.hh"
 #include "TypeCheckContext.hh"
 
 /**
@@ -278,6 +282,173 @@ SortKeyPrefixFunction::get(DynamicRecordContext & ctxt,
   
 }
 
+SortKeyNormalizer::SortKeyNormalizer()
+  :
+  mNullsSortLow(QueryOptions::nullsSortLow()),
+  mSortNulls(true)
+{
+}
+
+SortKeyNormalizer::SortKeyNormalizer(const RecordType * input,
+				     const std::vector<SortKey>& fields)
+  :
+  mNullsSortLow(QueryOptions::nullsSortLow()),
+  mSortNulls(true)
+{
+  for(std::vector<SortKey>::const_iterator it = fields.begin();
+      it != fields.end();
+      ++it) {
+    const FieldType * ty = input->getMember(it->getName()).GetType();
+    if (!isSupported(ty)) {
+      mFields.clear();
+      return;
+    }
+    add(input, *it, ty->isNullable());
+  }
+}
+
+SortKeyNormalizer::~SortKeyNormalizer()
+{
+}
+
+bool SortKeyNormalizer::isSupported(const FieldType * ty)
+{
+  switch(ty->GetEnum()) {
+  case FieldType::VARCHAR:
+  case FieldType::CHAR:
+  case FieldType::INT32:
+  case FieldType::INT64:
+  case FieldType::DOUBLE:
+  case FieldType::DATETIME:
+  case FieldType::DATE:
+    return true;
+  default:
+    return false;
+  }
+}
+
+void SortKeyNormalizer::add(const RecordType * input, 
+			    const SortKey & key,
+			    bool nullable)
+{
+  const FieldType * ty = input->getMember(key.getName()).GetType();
+  Field f;
+  f.Address = input->getFieldAddress(key.getName());
+  f.Type = ty->GetEnum();
+  f.Size = ty->GetEnum() == FieldType::CHAR ? ty->GetSize() : 0;
+  f.Nullable = nullable;
+  f.Descending = key.getOrder() == SortKey::DESC;
+  mFields.push_back(f);
+}
+
+void SortKeyNormalizer::get(const RecordType * lhs,
+			    const std::vector<SortKey>& lhsFields,
+			    const RecordType * rhs,
+			    const std::vector<SortKey>& rhsFields,
+			    SortKeyNormalizer & lhsNormalizer,
+			    SortKeyNormalizer & rhsNormalizer)
+{
+  lhsNormalizer.mFields.clear();
+  rhsNormalizer.mFields.clear();
+  lhsNormalizer.mSortNulls = rhsNormalizer.mSortNulls = false;
+  if (lhsFields.size() != rhsFields.size()) {
+    return;
+  }
+  for(std::size_t i=0; i<lhsFields.size(); ++i) {
+    const FieldType * lhsTy = lhs->getMember(lhsFields[i].getName()).GetType();
+    const FieldType * rhsTy = rhs->getMember(rhsFields[i].getName()).GetType();
+    // Keys are only comparable if they have identical encodings.
+    if (!isSupported(lhsTy) || 
+	lhsTy->GetEnum() != rhsTy->GetEnum() ||
+	(lhsTy->GetEnum() == FieldType::CHAR && 
+	 lhsTy->GetSize() != rhsTy->GetSize()) ||
+	lhsFields[i].getOrder() != rhsFields[i].getOrder()) {
+      lhsNormalizer.mFields.clear();
+      rhsNormalizer.mFields.clear();
+      return;
+    }
+    // A NULL indicator goes into both keys if either side is nullable.
+    bool nullable = lhsTy->isNullable() || rhsTy->isNullable();
+    lhsNormalizer.add(lhs, lhsFields[i], nullable);
+    rhsNormalizer.add(rhs, rhsFields[i], nullable);
+  }
+}
+
+static void appendBigEndian(NormalizedKey & key, uint64_t val, int32_t sz)
+{
+  for(int32_t i=sz-1; i>=0; --i) {
+    key.append((uint8_t) (val >> (8*i)));
+  }
+}
+
+void SortKeyNormalizer::normalize(RecordBuffer buf, NormalizedKey & key) const
+{
+  key.clear();
+  for(std::vector<Field>::const_iterator it = mFields.begin();
+      it != mFields.end();
+      ++it) {
+    std::size_t start = key.bytes();
+    if (it->Nullable) {
+      if (it->Address.isNull(buf)) {
+	key.append(mNullsSortLow ? 0x00 : 0x01);
+	key.setNull();
+	if (it->Descending) {
+	  key.complement(start);
+	}
+	if (!mSortNulls) {
+	  // Like CompareFunction, don't look past a NULL.
+	  break;
+	}
+	continue;
+      }
+      key.append(mNullsSortLow ? 0x01 : 0x00);
+    }
+    switch(it->Type) {
+    case FieldType::INT32:
+    case FieldType::DATE:
+      // Flip the sign bit so that signed order becomes unsigned order.
+      appendBigEndian(key, ((uint32_t) it->Address.getInt32(buf)) ^ 0x80000000U, 4);
+      break;
+    case FieldType::INT64:
+    case FieldType::DATETIME:
+      appendBigEndian(key, ((uint64_t) it->Address.getInt64(buf)) ^ 0x8000000000000000ULL, 8);
+      break;
+    case FieldType::DOUBLE:
+      {
+	double d = it->Address.getDouble(buf);
+	// -0.0 and 0.0 compare equal
+	if (d == 0.0) d = 0.0;
+	uint64_t bits;
+	memcpy(&bits, &d, sizeof(bits));
+	// Negative numbers in reverse order, positive numbers
+	// after negative ones.
+	bits = (bits & 0x8000000000000000ULL) ? ~bits : bits ^ 0x8000000000000000ULL;
+	appendBigEndian(key, bits, 8);
+	break;
+      }
+    case FieldType::CHAR:
+      key.append((const uint8_t *) it->Address.getCharPtr(buf), it->Size);
+      break;
+    case FieldType::VARCHAR:
+      {
+	// Varchars compare with strcmp; terminating with a zero
+	// makes the encoding prefix free.
+	const Varchar * v = it->Address.getVarcharPtr(buf);
+	const char * s = v->c_str();
+	key.append((const uint8_t *) s, strnlen(s, v->size()));
+	key.append(0);
+	break;
+      }
+    default:
+      throw std::runtime_error("SortKeyNormalizer::normalize unsupported type");
+    }
+    if (it->Descending) {
+      key.complement(start);
+    }
+  }
+  key.finish();
+}
+
 RuntimePlanBuilder::RuntimePlanBuilder()
 {
 }
@@ -310,7 +481,11 @@ RuntimeOperator::RuntimeOperator(Services& services, const RuntimeOperatorType&
   :
   mOperatorType(opType),
   mServices(services),
-  mTicks(0)
+  mTicks(0),
+  mBytes(0),
+  mSpilledRuns(0),
+  mSpilledRecords(0),
+  mTraceName(0)
 {
 }
 
@@ -575,6 +750,7 @@ RuntimeCopyOperatorType::RuntimeCopyOperatorType(const RecordTypeFree & freeFunc
       it != transfers.end();
       ++it) {
     mTransfers.push_back((*it)->create());
+    mIdentity.push_back((*it)->isIdentity());
   }
 }
 
@@ -589,6 +765,7 @@ RuntimeCopyOperatorType::RuntimeCopyOperatorType(const RecordTypeFree & freeFunc
       it != transfers.end();
       ++it) {
     mTransfers.push_back((*it)->create(pics[it - transfers.begin()]));
+    mIdentity.push_back((*it)->isIdentity());
   }
 }
 
@@ -658,12 +835,18 @@ void RuntimeCopyOperator::onEvent(RuntimePort * port)
 	{
 	  RecordBuffer outputBuf;
 	  bool last = mOutputIt+1 == output_port_end();
-	  // TODO: The move semantics optimization seems buggy at this point.
-	  // Fix it and use move semantics when last is true.
-	  getCopyType().mTransfers[mOutputIt - output_port_begin()]->execute(mInput, 
-									     outputBuf, 
-									     mRuntimeContext, 
-									     false);
+	  std::size_t idx = mOutputIt - output_port_begin();
+	  if (getCopyType().mIdentity[idx]) {
+	    // Our reference to the input is released below.
+	    outputBuf = RecordBuffer::share(mInput);
+	  } else {
+	    // TODO: The move semantics optimization seems buggy at this point.
+	    // Fix it and use move semantics when last is true.
+	    getCopyType().mTransfers[idx]->execute(mInput, 
+						   outputBuf, 
+						   mRuntimeContext, 
+						   false);
+	  }
 	  write(port, outputBuf, false);
 	  if (last) {
 	    getCopyType().mFree.free(mInput);
@@ -1845,168 +2028,140 @@ void RuntimeSortRunningTotalOperator::shutdown()
 paged_hash_table::paged_hash_table(bool ownTableData, const IQLFunctionModule * tableHash)
   :
   mOwnTableData(ownTableData),
-  mNumBuckets(8),
-  mBuckets(NULL),
-  mTableHash(tableHash ? tableHash->getRawFunction() : NULL),
-  mLoadFactor(1.0*PageEntries),
-  mSize(0)
+  mNumGroups(0),
+  mGroupMask(0),
+  mCtrl(NULL),
+  mSlots(NULL),
+  mMarked(NULL),
+  mTableHash(tableHash ? tableHash->getRawFunction64() : NULL),
+  mSize(0),
+  mGrowthLimit(0)
 {
-  mBuckets = new bucket_page [mNumBuckets];
+  allocate(8);
 }
 
 paged_hash_table::~paged_hash_table()
 {
-  clear();
-  delete [] mBuckets;
+  deallocate();
 }
 
-void paged_hash_table::grow(double growthFactor)
+void paged_hash_table::allocate(uint32_t numGroups)
+{
+  BOOST_ASSERT((numGroups & (numGroups-1)) == 0);
+  mNumGroups = numGroups;
+  mGroupMask = numGroups - 1;
+  std::size_t sz = capacity();
+  mCtrl = new uint8_t [sz];
+  memset(mCtrl, Empty, sz);
+  mSlots = new slot [sz];
+  mMarked = new uint64_t [(sz + 63)/64];
+  memset(mMarked, 0, sizeof(uint64_t)*((sz + 63)/64));
+  // Max load factor 7/8
+  mGrowthLimit = (int64_t) (sz - sz/8);
+}
+
+void paged_hash_table::deallocate()
 {
+  delete [] mCtrl;
+  delete [] mSlots;
+  delete [] mMarked;
+  mCtrl = NULL;
+  mSlots = NULL;
+  mMarked = NULL;
+}
 
-  if (growthFactor < 1.25) {
-    growthFactor = 1.25;
+std::size_t paged_hash_table::find_empty(uint64_t h) const
+{
+  uint32_t g = first_group(h);
+  for(uint32_t probeStep = 1; true; ++probeStep) {
+    uint32_t m = match_empty(g);
+    if (m) {
+      return (g << GroupSizeLog2) + __builtin_ctz(m);
+    }
+    g = next_group(g, probeStep);
+  }
+}
+
+void paged_hash_table::grow(double growthFactor)
+{
+  if (growthFactor < 2.0) {
+    growthFactor = 2.0;
+  }
+  uint32_t newNumGroups = mNumGroups;
+  while (newNumGroups < mNumGroups*growthFactor) {
+    newNumGroups *= 2;
   }
-  int32_t newNumBuckets = (int32_t) (mNumBuckets*growthFactor);
-  bucket_page * newBuckets = new bucket_page[newNumBuckets];
 
-  // Iterate existing buckets and reinsert.
-  // Think about cache sensitivity here (batching
-  // inserts somehow).
+  uint8_t * oldCtrl = mCtrl;
+  slot * oldSlots = mSlots;
+  uint64_t * oldMarked = mMarked;
+  std::size_t oldCapacity = capacity();
+  allocate(newNumGroups);
+
+  // Reinsert using the saved hash values; the new table has no
+  // collisions with existing keys to resolve so we just find an
+  // empty slot.
   int64_t sz=0;
-  bucket_page * basePage = mBuckets;
-  bucket_page * end = mBuckets + mNumBuckets;
-  for(;
-      basePage != end;
-      ++basePage) {
-    // Walk the chain of buckets.  Free pages as necessary.
-    for(bucket_page * p = basePage; p != NULL; ) {
-      // Walk each page of the bucket list
-      uint32_t * hashPtr = &p->Hash[0];
-      for(; *hashPtr != 0; ++hashPtr) {
-	uint32_t bucket = (*hashPtr) % newNumBuckets;
-	bucket_page * newPage = newBuckets + bucket;
-	RecordBuffer val = p->Value[hashPtr - &p->Hash[0]];
-	insert(newPage, val, *hashPtr);
-	sz += 1;
-      }
-      bucket_page * nxt = hashPtr == &p->Hash[Sentinel] ? p->Next : NULL;
-      if (p != basePage) {
-	delete p;
-      }
-      p = nxt;
-    } 
+  for(std::size_t s=0; s<oldCapacity; ++s) {
+    if (oldCtrl[s] == Empty) continue;
+    std::size_t t = find_empty(oldSlots[s].Hash);
+    place(t, oldSlots[s].Hash, oldSlots[s].Value);
+    if (oldMarked[s >> 6] & (1ULL << (s & 63))) {
+      mark(t);
+    }
+    sz += 1;
   }
 
+  delete [] oldCtrl;
+  delete [] oldSlots;
+  delete [] oldMarked;
+
   if (sz != mSize) {
     throw std::runtime_error("Internal Error in paged_hash_table::grow");
   }
-  
-  delete [] mBuckets;
-  mNumBuckets = newNumBuckets;
-  mBuckets = newBuckets;
 }
 
 void paged_hash_table::clear()
 {
-  bucket_page * p = mBuckets;
-  bucket_page * end = mBuckets + mNumBuckets;
-  for(; p != end; ++p) {
-    // Mark base page as empty
-    memset(&p->Hash[0], 0, sizeof(p->Hash));
-    // Free chained pages
-    for(bucket_page * it = p->Next; 
-	it != NULL; ) {
-      bucket_page * tmp = it;
-      it = it->Next;
-      delete tmp;
-    }
-    // Clear page list
-    p->Next = NULL;
-  }  
+  std::size_t sz = capacity();
+  memset(mCtrl, Empty, sz);
+  memset(mMarked, 0, sizeof(uint64_t)*((sz + 63)/64));
   mSize = 0;
 }
 
-void paged_hash_table::insert(bucket_page * p,
-			      RecordBuffer tableInput,
-			      uint32_t h)
-{
-  while(p->Next) {
-    p = p->Next;
-  }
-  uint32_t * hashPtr=NULL;
-  for(hashPtr = &p->Hash[0]; *hashPtr != 0; ++hashPtr) {
-  }
-  
-  // We are now at the end of the page.  It is either full or not.
-  if (hashPtr == &p->Hash[Sentinel]) {
-    bucket_page * tmp = new bucket_page(h, tableInput);
-    p->Next = tmp;    
-  } else {
-    *hashPtr = h;
-    p->Value[hashPtr - &p->Hash[0]] = tableInput;
-  }
-}
-
 void paged_hash_table::insert(RecordBuffer tableInput, InterpreterContext * ctxt)
 {
   // Do we need to grow?
-  if (mSize >= mLoadFactor * mNumBuckets) {
+  if (mSize >= mGrowthLimit) {
     grow(2.0);
   }
   // Bind our functions to this input
   mTableHash.InsertThis = tableInput;
-  // Calculate full and mod hashes.
-  uint32_t h = mTableHash.hash(ctxt);
-  // Disallow 0 since it serves as sentinel.
-  if (h==0) h = 0xffffffff;
-  // Locate bucket
-  uint32_t bucket = h % mNumBuckets;
-  // Scan to the end of the last bucket.
-  // TODO: Better to have a circular list 
-  // to make this constant time?
-  // Note that this would mean an extra
-  // page read when probing (based on my
-  // current understanding) so is probably
-  // not worthwhile.
-  bucket_page * p = &mBuckets[bucket];
-  insert(p, tableInput, h);
+  uint64_t h = mTableHash.hash(ctxt);
+  place(find_empty(h), h, tableInput);
   mSize += 1;
 }
 
 void paged_hash_table::insert(RecordBuffer tableInput, 
 			      paged_hash_table::query_iterator<paged_hash_table::probe_predicate> & it)
 {
-  uint32_t h = it.mQueryHashValue;
-  
-  // We are at the end of a full page or partial page.
-  // The iterator actually lags by 1 so if we are at the
-  // end of a partial page then it.next_page() actually points
-  // to the last bucket page in the bucket.  If we wound up
-  // at the end of a full page, it.next_page() will be NULL.
-  if (it.next_page() == NULL) {
-    bucket_page * newPage = new bucket_page(h, tableInput);
-    it.link(newPage);
+  BOOST_ASSERT(it.mState == query_iterator<probe_predicate>::DONE);
+  uint64_t h = it.mQueryHashValue;
+  if (mSize >= mGrowthLimit) {
+    grow(2.0);
+    place(find_empty(h), h, tableInput);
   } else {
-    it.set(h, tableInput);
+    // The failed query stopped at a group with an empty slot.
+    place((it.mGroup << GroupSizeLog2) + __builtin_ctz(match_empty(it.mGroup)),
+	  h, tableInput);
   }
   mSize += 1;
-
-  // Do we need to grow?
-  if (mSize > mLoadFactor * mNumBuckets) {
-    grow(2.0);
-  }
 }
 
 void paged_hash_table::find(paged_hash_table::query_iterator<paged_hash_table::probe_predicate> & it,
 			    InterpreterContext * ctxt)
 {
-  uint32_t h = it.mQueryPredicate.hash(ctxt);
-  // Disallow 0 since it serves as sentinel.
-  if (h==0) h = 0xffffffff;
-  // Locate bucket
-  uint32_t bucket = h % mNumBuckets;
-  // Initialize the iterator to the first bucket
-  it.init(mBuckets+bucket, h);
+  it.init(this, it.mQueryPredicate.hash(ctxt));
 }
 
 HashJoin::HashJoin(HashJoin::JoinType joinType)
@@ -2022,7 +2177,8 @@ HashJoin::HashJoin(HashJoin::JoinType joinType)
   mProbeMakeNullableTransfer(NULL),
   mTableMakeNullableTransfer(NULL),  
   mJoinType(joinType),
-  mJoinOne(false)
+  mJoinOne(false),
+  mMemory(128*1024*1024)
 {
 }
 
@@ -2039,8 +2195,17 @@ void HashJoin::check(PlanCheckContext& ctxt)
       ++it) {
     if (boost::algorithm::iequals(it->Name, "probeKey")) {
       probeKeys.push_back(boost::get<std::string>(it->Value));
+    } else if (it->equals("memory")) {
+      int32_t tmp = getInt32Value(ctxt, *it);
+      if (tmp <= 0) {
+	ctxt.logError(*this, "memory argument must be a positive integer");
+      } else {
+	mMemory = (std::size_t) tmp;
+      }
     } else if (boost::algorithm::iequals(it->Name, "tableKey")) {
       tableKeys.push_back(boost::get<std::string>(it->Value));
+    } else if (it->equals("tempdir")) {
+      mTempDir = getStringValue(ctxt, *it);
     } else if (boost::algorithm::iequals(it->Name, "residual") ||
 	       boost::algorithm::iequals(it->Name, "where")) {
       residual = boost::get<std::string>(it->Value);
@@ -2089,7 +2254,8 @@ HashJoin::HashJoin(DynamicRecordContext & ctxt,
   mProbeMakeNullableTransfer(NULL),
   mTableMakeNullableTransfer(NULL),  
   mJoinType(INNER),
-  mJoinOne(joinOne)
+  mJoinOne(joinOne),
+  mMemory(128*1024*1024)
 {
   std::vector<std::string> tableKeys;
   std::vector<std::string> probeKeys;
@@ -2118,7 +2284,8 @@ HashJoin::HashJoin(DynamicRecordContext & ctxt,
   mProbeMakeNullableTransfer(NULL),
   mTableMakeNullableTransfer(NULL),  
   mJoinType(joinType),
-  mJoinOne(false)
+  mJoinOne(false),
+  mMemory(128*1024*1024)
 {
   std::vector<std::string> tableKeys;
   std::vector<std::string> probeKeys;
@@ -2147,7 +2314,8 @@ HashJoin::HashJoin(DynamicRecordContext & ctxt,
   mProbeMakeNullableTransfer(NULL),
   mTableMakeNullableTransfer(NULL),  
   mJoinType(INNER),
-  mJoinOne(joinOne)
+  mJoinOne(joinOne),
+  mMemory(128*1024*1024)
 {
   init(ctxt, tableKeys, probeKeys, residual, transfer);
 }
@@ -2298,10 +2466,12 @@ RuntimeOperatorType * HashJoin::create() const
 					     mJoinType);
     }
   } else {
-    return new RuntimeCrossJoinOperatorType(mTableInput->getFree(),
-					    mProbeInput->getFree(),
+    return new RuntimeCrossJoinOperatorType(mTableInput,
+					    mProbeInput,
 					    mEq,
-					    mTransfer);
+					    mTransfer,
+					    mTempDir,
+					    mMemory);
   }
 }
 
@@ -2321,6 +2491,8 @@ RuntimeOperator * RuntimeHashJoinOperatorType::create(RuntimeOperator::Services
   return new RuntimeHashJoinOperator(s, *this);
 }
 
+const std::size_t RuntimeHashJoinOperator::PROBE_BLOCK;
+
 RuntimeHashJoinOperator::RuntimeHashJoinOperator(RuntimeOperator::Services& services, 
 						       const RuntimeHashJoinOperatorType& opType)
   :
@@ -2328,8 +2500,13 @@ RuntimeHashJoinOperator::RuntimeHashJoinOperator(RuntimeOperator::Services& serv
   mState(START),
   mRuntimeContext(new InterpreterContext()),
   mTable(true, getHashJoinType().mTableHashFun),
-  mSearchIterator(paged_hash_table::probe_predicate(getHashJoinType().mProbeHashFun->getRawFunction(),
-						    getHashJoinType().mEqFun->getRawFunction()))
+  mProbeBlock(PROBE_BLOCK, 
+	      query_iterator(paged_hash_table::probe_predicate(getHashJoinType().mProbeHashFun->getRawFunction64(),
+							       getHashJoinType().mEqFun->getRawFunction()))),
+  mProbeBlockSize(0),
+  mProbeIt(0),
+  mProbeEOS(false),
+  mSearchIterator(NULL)
 {
 }
 
@@ -2370,9 +2547,9 @@ RecordBuffer RuntimeHashJoinOperator::onInner()
   RecordBuffer output;
   // Must put this in tmp variable because signature of transfer
   // wants a non-const reference (to support move semantics).
-  RecordBuffer tmp = mSearchIterator.value();
+  RecordBuffer tmp = mSearchIterator->value();
   getHashJoinType().mTransferModule->execute(tmp,
-					     mSearchIterator.mQueryPredicate.ProbeThis,
+					     mSearchIterator->mQueryPredicate.ProbeThis,
 					     output,
 					     mRuntimeContext,
 					     false,
@@ -2384,13 +2561,13 @@ RecordBuffer RuntimeHashJoinOperator::onSemi()
 {
   RecordBuffer output;
   if (getHashJoinType().mSemiJoinTransferModule) {
-    getHashJoinType().mSemiJoinTransferModule->execute(mSearchIterator.mQueryPredicate.ProbeThis,
+    getHashJoinType().mSemiJoinTransferModule->execute(mSearchIterator->mQueryPredicate.ProbeThis,
 						       output,
 						       mRuntimeContext,
 						       false);
   } else {
-    output = mSearchIterator.mQueryPredicate.ProbeThis;
-    mSearchIterator.mQueryPredicate.ProbeThis = RecordBuffer();
+    output = mSearchIterator->mQueryPredicate.ProbeThis;
+    mSearchIterator->mQueryPredicate.ProbeThis = RecordBuffer();
   }
   return output;
 }
@@ -2405,7 +2582,7 @@ RecordBuffer RuntimeHashJoinOperator::onRightOuterMatch()
   case HashJoin::RIGHT_OUTER:
     {
       // Convert to nullable properties on the table.
-      RecordBuffer tmp1 = mSearchIterator.value();
+      RecordBuffer tmp1 = mSearchIterator->value();
       RecordBuffer tmp2;
       getHashJoinType().mTableMakeNullableTransferModule->execute(tmp1,
 								  tmp2,
@@ -2413,7 +2590,7 @@ RecordBuffer RuntimeHashJoinOperator::onRightOuterMatch()
 								  false);
   
       getHashJoinType().mTransferModule->execute(tmp2,
-						 mSearchIterator.mQueryPredicate.ProbeThis,
+						 mSearchIterator->mQueryPredicate.ProbeThis,
 						 output,
 						 mRuntimeContext,
 						 false,
@@ -2424,14 +2601,14 @@ RecordBuffer RuntimeHashJoinOperator::onRightOuterMatch()
   case HashJoin::FULL_OUTER:
     {
       // Convert to nullable properties on the table.
-      RecordBuffer tmp = mSearchIterator.value();
+      RecordBuffer tmp = mSearchIterator->value();
       RecordBuffer tmp1;
       RecordBuffer tmp2;
       getHashJoinType().mTableMakeNullableTransferModule->execute(tmp,
 								  tmp1,
 								  mRuntimeContext,
 								  false);
-      tmp = mSearchIterator.mQueryPredicate.ProbeThis;
+      tmp = mSearchIterator->mQueryPredicate.ProbeThis;
       getHashJoinType().mProbeMakeNullableTransferModule->execute(tmp,
 								  tmp2,
 								  mRuntimeContext,
@@ -2450,8 +2627,8 @@ RecordBuffer RuntimeHashJoinOperator::onRightOuterMatch()
   case HashJoin::LEFT_OUTER:
     {
       // Convert to nullable properties on the probe.
-      RecordBuffer tmp = mSearchIterator.mQueryPredicate.ProbeThis;
-      RecordBuffer tmp1 = mSearchIterator.value();
+      RecordBuffer tmp = mSearchIterator->mQueryPredicate.ProbeThis;
+      RecordBuffer tmp1 = mSearchIterator->value();
       RecordBuffer tmp2;
       getHashJoinType().mProbeMakeNullableTransferModule->execute(tmp,
 								  tmp2,
@@ -2521,7 +2698,7 @@ RecordBuffer RuntimeHashJoinOperator::onRightOuterNonMatch()
   case HashJoin::RIGHT_OUTER:
     {
       getHashJoinType().mTransferModule->execute(mNullTableRecord,
-						 mSearchIterator.mQueryPredicate.ProbeThis,
+						 mSearchIterator->mQueryPredicate.ProbeThis,
 						 output,
 						 mRuntimeContext,
 						 false,
@@ -2531,7 +2708,7 @@ RecordBuffer RuntimeHashJoinOperator::onRightOuterNonMatch()
   case HashJoin::FULL_OUTER:
     {
       // Convert to nullable properties on the probe.
-      RecordBuffer tmp = mSearchIterator.mQueryPredicate.ProbeThis;
+      RecordBuffer tmp = mSearchIterator->mQueryPredicate.ProbeThis;
       RecordBuffer tmp1;
       getHashJoinType().mProbeMakeNullableTransferModule->execute(tmp,
 								  tmp1,
@@ -2575,18 +2752,29 @@ void RuntimeHashJoinOperator::onEvent(RuntimePort * port)
       }
     }
 
-    while(true) {
-      // Read the probe and lookup
-      requestRead(1);
-      mState = READ_PROBE;
-      return;
-    case READ_PROBE: 
-      {
-	read(port, mSearchIterator.mQueryPredicate.ProbeThis);
-	if (RecordBuffer::isEOS(mSearchIterator.mQueryPredicate.ProbeThis)) break;
-	// Lookup
-	mTable.find(mSearchIterator, mRuntimeContext);
-	if (mSearchIterator.next(mRuntimeContext)) {
+    mProbeEOS = false;
+    while(!mProbeEOS) {
+      // Read a block of probe records
+      for(mProbeBlockSize = 0; mProbeBlockSize < mProbeBlock.size(); ) {
+	requestRead(1);
+	mState = READ_PROBE;
+	return;
+      case READ_PROBE: 
+	{
+	  RecordBuffer & probe(mProbeBlock[mProbeBlockSize].mQueryPredicate.ProbeThis);
+	  read(port, probe);
+	  if (RecordBuffer::isEOS(probe)) {
+	    mProbeEOS = true;
+	    break;
+	  }
+	  ++mProbeBlockSize;
+	}
+      }
+      // Lookup the whole block then join each probe in turn
+      mTable.find(&mProbeBlock[0], mProbeBlockSize, mRuntimeContext);
+      for(mProbeIt = 0; mProbeIt < mProbeBlockSize; ++mProbeIt) {
+	mSearchIterator = &mProbeBlock[mProbeIt];
+	if (mSearchIterator->next(mRuntimeContext)) {
 	  if (getHashJoinType().mJoinType != HashJoin::RIGHT_ANTI_SEMI) {
 	    do {
 	      requestWrite(0);
@@ -2609,7 +2797,7 @@ void RuntimeHashJoinOperator::onEvent(RuntimePort * port)
 	      // If we are hard coded to only return 1 hit (e.g. semantic constraint) 
 	      // break outta here
 	      if (getHashJoinType().mJoinOne) break;
-	    } while(mSearchIterator.next(mRuntimeContext));
+	    } while(mSearchIterator->next(mRuntimeContext));
 	  }
 	} else if (getHashJoinType().mJoinType == HashJoin::RIGHT_ANTI_SEMI ||
 		   getHashJoinType().mJoinType == HashJoin::FULL_OUTER ||
@@ -2626,8 +2814,8 @@ void RuntimeHashJoinOperator::onEvent(RuntimePort * port)
 	    write(port, output, false);
 	  }
 	} 
-	if (mSearchIterator.mQueryPredicate.ProbeThis != RecordBuffer())
-	  getHashJoinType().mProbeFree.free(mSearchIterator.mQueryPredicate.ProbeThis);
+	if (mSearchIterator->mQueryPredicate.ProbeThis != RecordBuffer())
+	  getHashJoinType().mProbeFree.free(mSearchIterator->mQueryPredicate.ProbeThis);
       }
     }
 
@@ -2677,15 +2865,167 @@ RuntimeCrossJoinOperator::RuntimeCrossJoinOperator(RuntimeOperator::Services& se
   :
   RuntimeOperator(services, opType),
   mState(START),
-  mRuntimeContext(new InterpreterContext())
+  mRuntimeContext(new InterpreterContext()),
+  mTableSize(0),
+  mTableSpill(NULL),
+  mProbeSize(0),
+  mProbeEOS(false),
+  mTableChunk(1),
+  mProbeChunk(1),
+  mTableIt(0),
+  mProbeIt(0),
+  mMatchIt(0),
+  mJoinTable(0),
+  mJoinProbe(0)
 {
 }
 
 RuntimeCrossJoinOperator::~RuntimeCrossJoinOperator()
 {
+  const RecordTypeFree & tf(getCrossJoinType().mTableFree);
+  for(std::vector<RecordBuffer>::iterator it = mTable.begin();
+      it != mTable.end();
+      ++it) {
+    tf.free(*it);
+  }
+  freeSpillChunk();
+  const RecordTypeFree & pf(getCrossJoinType().mProbeFree);
+  for(std::vector<RecordBuffer>::iterator it = mProbes.begin();
+      it != mProbes.end();
+      ++it) {
+    pf.free(*it);
+  }
+  delete mTableSpill;
   delete mRuntimeContext;
 }
 
+const std::size_t RuntimeCrossJoinOperator::CHUNK_BYTES;
+const std::size_t RuntimeCrossJoinOperator::MATCH_BATCH;
+
+std::size_t RuntimeCrossJoinOperator::getChunkSize(std::size_t bytes,
+						   std::size_t records)
+{
+  // A table chunk and a probe chunk together should fit in L2.
+  if (records == 0) {
+    return 1;
+  }
+  std::size_t avg = (std::max)(std::size_t(1), bytes/records);
+  return (std::max)(std::size_t(1), CHUNK_BYTES/avg);
+}
+
+std::size_t RuntimeCrossJoinOperator::getProbeBlockSize()
+{
+  // Without a spill a probe block is a single cache sized
+  // chunk.  With a spill we read as large a block as the rest
+  // of the budget allows to amortize replaying the table from 
+  // disk, leaving room for a chunk of the replayed table.
+  std::size_t memoryAllowed = getCrossJoinType().mMemoryAllowed;
+  std::size_t used = mTableSize + (mTableSpill ? CHUNK_BYTES : 0);
+  std::size_t available = memoryAllowed > used ? memoryAllowed - used : 0;
+  if (!mTableSpill) {
+    available = (std::min)(available, CHUNK_BYTES);
+  }
+  // Always read at least one probe record.
+  return (std::max)(available, std::size_t(1));
+}
+
+void RuntimeCrossJoinOperator::bufferTable(RecordBuffer buf)
+{
+  const RuntimeCrossJoinOperatorType & opType(getCrossJoinType());
+  std::size_t sz = opType.mTableSerialize.getRecordLength(buf);
+  // Leave room for a probe block.
+  if (mTableSpill == NULL && 
+      mTableSize + sz + CHUNK_BYTES <= opType.mMemoryAllowed) {
+    mTable.push_back(buf);
+    mTableSize += sz;
+    return;
+  }
+  if (mTableSpill == NULL) {
+    mTableSpill = new RecordSpillFile(opType.mTableSerialize,
+				      opType.mTableDeserialize,
+				      opType.mTableMalloc,
+				      opType.mTempDir);
+    // The table doesn't fit so it is replayed once per probe
+    // block.  Give half of the budget to probe blocks so that
+    // there are few of them.
+    while(!mTable.empty() && mTableSize > opType.mMemoryAllowed/2) {
+      RecordBuffer evict = mTable.back();
+      mTable.pop_back();
+      mTableSize -= opType.mTableSerialize.getRecordLength(evict);
+      mTableSpill->write(evict);
+      opType.mTableFree.free(evict);
+    }
+  }
+  mTableSpill->write(buf);
+  opType.mTableFree.free(buf);
+}
+
+bool RuntimeCrossJoinOperator::readSpillChunk()
+{
+  BOOST_ASSERT(mSpillChunk.empty());
+  while(mSpillChunk.size() < mTableChunk) {
+    RecordBuffer buf = mTableSpill->read();
+    if (buf == RecordBuffer()) {
+      break;
+    }
+    mSpillChunk.push_back(buf);
+  }
+  return !mSpillChunk.empty();
+}
+
+void RuntimeCrossJoinOperator::freeSpillChunk()
+{
+  const RecordTypeFree & f(getCrossJoinType().mTableFree);
+  for(std::vector<RecordBuffer>::iterator it = mSpillChunk.begin();
+      it != mSpillChunk.end();
+      ++it) {
+    f.free(*it);
+  }
+  mSpillChunk.clear();
+}
+
+std::size_t RuntimeCrossJoinOperator::getProbeChunkEnd() const
+{
+  return (std::min)(mProbeIt + mProbeChunk, mProbes.size());
+}
+
+void RuntimeCrossJoinOperator::joinChunk(const RecordBuffer * table, 
+					 std::size_t tableSize)
+{
+  IQLFunctionModule * eq = getCrossJoinType().mEqFun;
+  std::size_t probeEnd = getProbeChunkEnd();
+  mMatches.clear();
+  for(; mJoinProbe < probeEnd; ++mJoinProbe, mJoinTable = 0) {
+    RecordBuffer probe = mProbes[mJoinProbe];
+    for(; mJoinTable < tableSize; ++mJoinTable) {
+      if (eq == NULL || eq->execute(table[mJoinTable], probe, mRuntimeContext)) {
+	mMatches.push_back(std::make_pair(uint32_t(mJoinTable), uint32_t(mJoinProbe)));
+	if (mMatches.size() == MATCH_BATCH) {
+	  // Write these before evaluating more pairs.
+	  ++mJoinTable;
+	  return;
+	}
+      }
+    }
+  }
+}
+
+void RuntimeCrossJoinOperator::writeMatch(RuntimePort * port, 
+					  const RecordBuffer * table)
+{
+  // Must put this in tmp variables because signature of transfer
+  // wants a non-const reference (to support move semantics).
+  RecordBuffer tableRecord = table[mMatches[mMatchIt].first];
+  RecordBuffer output;
+  getCrossJoinType().mTransferModule->execute(tableRecord,
+					      mProbes[mMatches[mMatchIt].second],
+					      output,
+					      mRuntimeContext,
+					      false,
+					      false);
+  write(port, output, false);
+}
+
 void RuntimeCrossJoinOperator::start()
 {
   mState = START;
@@ -2707,44 +3047,81 @@ void RuntimeCrossJoinOperator::onEvent(RuntimePort * port)
 	read(port, input);
 
 	if (RecordBuffer::isEOS(input)) break;
-	mTable.push_back(input);
+	bufferTable(input);
       }
     }
+    mTableChunk = mTableSpill ? 
+      getChunkSize(mTableSize + mTableSpill->getBytes(), 
+		   mTable.size() + mTableSpill->size()) :
+      getChunkSize(mTableSize, mTable.size());
+
+    while(!mProbeEOS) {
+      // Read a block of probe records.
+      mProbeSize = 0;
+      while(mProbeSize < getProbeBlockSize()) {
+	requestRead(1);
+	mState = READ_PROBE;
+	return;
+      case READ_PROBE: 
+	{
+	  RecordBuffer input;
+	  read(port, input);
+	  if (RecordBuffer::isEOS(input)) {
+	    mProbeEOS = true;
+	    break;
+	  }
+	  mProbes.push_back(input);
+	  mProbeSize += getCrossJoinType().mProbeSerialize.getRecordLength(input);
+	}
+      }
+      mProbeChunk = getChunkSize(mProbeSize, mProbes.size());
+
+      // Join the probe block with cache sized chunks of the 
+      // table in memory.
+      for(mTableIt = 0; mTableIt < mTable.size(); mTableIt += mTableChunk) {
+	for(mProbeIt = 0; mProbeIt < mProbes.size(); mProbeIt += mProbeChunk) {
+	  for(mJoinProbe = mProbeIt, mJoinTable = 0; 
+	      mJoinProbe < getProbeChunkEnd(); ) {
+	    joinChunk(&mTable[mTableIt], 
+		      (std::min)(mTableChunk, mTable.size() - mTableIt));
+	    for(mMatchIt = 0; mMatchIt < mMatches.size(); ++mMatchIt) {
+	      requestWrite(0);
+	      mState = WRITE;
+	      return;
+	    case WRITE:
+	      writeMatch(port, &mTable[mTableIt]);
+	    }
+	  }
+	}
+      }
 
-    while(true) {
-      // Read the probe and lookup
-      requestRead(1);
-      mState = READ_PROBE;
-      return;
-    case READ_PROBE: 
-      {
-	read(port, mProbe);
-	if (RecordBuffer::isEOS(mProbe)) break;
-	for(mScanIterator = mTable.begin();
-	    mScanIterator != mTable.end();
-	    ++mScanIterator) {
-	  if (getCrossJoinType().mEqFun == NULL ||
-	      getCrossJoinType().mEqFun->execute(*mScanIterator, mProbe, mRuntimeContext)) {
-	    requestWrite(0);
-	    mState = WRITE;
-	    return;
-	  case WRITE:
-	    {
-	      // Must put this in tmp variable because signature of transfer
-	      // wants a non-const reference (to support move semantics).
-	      RecordBuffer output;
-	      getCrossJoinType().mTransferModule->execute(*mScanIterator,
-							  mProbe,
-							  output,
-							  mRuntimeContext,
-							  false,
-							  false);
-	      write(port, output, false);
+      // Replay the spilled part of the table.
+      if (mTableSpill && mProbes.size()) {
+	mTableSpill->rewind();
+	while(readSpillChunk()) {
+	  for(mProbeIt = 0; mProbeIt < mProbes.size(); mProbeIt += mProbeChunk) {
+	    for(mJoinProbe = mProbeIt, mJoinTable = 0; 
+		mJoinProbe < getProbeChunkEnd(); ) {
+	      joinChunk(&mSpillChunk[0], mSpillChunk.size());
+	      for(mMatchIt = 0; mMatchIt < mMatches.size(); ++mMatchIt) {
+		requestWrite(0);
+		mState = WRITE_SPILL;
+		return;
+	      case WRITE_SPILL:
+		writeMatch(port, &mSpillChunk[0]);
+	      }
 	    }
 	  }
+	  freeSpillChunk();
 	}
-	getCrossJoinType().mProbeFree.free(mProbe);
       }
+
+      for(std::vector<RecordBuffer>::iterator it = mProbes.begin();
+	  it != mProbes.end();
+	  ++it) {
+	getCrossJoinType().mProbeFree.free(*it);
+      }
+      mProbes.clear();
     }
     
     requestWrite(0);
@@ -2755,11 +3132,12 @@ void RuntimeCrossJoinOperator::onEvent(RuntimePort * port)
     {
       const RecordTypeFree & f(getCrossJoinType().mTableFree);
       // Free records in table
-      for(mScanIterator = mTable.begin(); 
-	  mScanIterator != mTable.end();
-	  ++mScanIterator) {
-	f.free(*mScanIterator);
+      for(std::vector<RecordBuffer>::iterator it = mTable.begin(); 
+	  it != mTable.end();
+	  ++it) {
+	f.free(*it);
       }
+      mTable.clear();
     }
   }
 }
@@ -2784,7 +3162,9 @@ RuntimeHashPartitionerOperator::RuntimeHashPartitionerOperator(RuntimeOperator::
   :
   RuntimeOperatorBase<RuntimeHashPartitionerOperatorType>(services, opType),
   mState(START),
-  mRuntimeContext(new InterpreterContext())
+  mRuntimeContext(new InterpreterContext()),
+  mReplicate(false),
+  mNextSplit(0)
 {
 }
 
@@ -2811,8 +3191,29 @@ void RuntimeHashPartitionerOperator::onEvent(RuntimePort * port)
       read(port, mBuffer);
       if (RecordBuffer::isEOS(mBuffer)) break;
       {
-	int32_t h = getMyOperatorType().mHashFun->execute(mBuffer, NULL, mRuntimeContext);
-	requestWrite(h % getOutputPorts().size());
+	uint64_t h = (uint64_t) getMyOperatorType().mHashFun->execute64(mBuffer, NULL, mRuntimeContext);
+	mReplicate = false;
+	if (!getMyOperatorType().isHeavyHitter(h)) {
+	  requestWrite(h % getOutputPorts().size());
+	} else if (getMyOperatorType().mSkewPolicy == 
+		   RuntimeHashPartitionerOperatorType::SPLIT) {
+	  requestWrite(mNextSplit++ % getOutputPorts().size());
+	} else {
+	  mReplicate = true;
+	}
+      }
+      if (mReplicate) {
+	// Replicate to every partition, sharing the record.
+	for(mOutputIt = output_port_begin();
+	    mOutputIt+1 != output_port_end();
+	    ++mOutputIt) {
+	  requestWrite(**mOutputIt);
+	  mState = WRITE_REPLICA;
+	  return;
+	case WRITE_REPLICA:
+	  write(port, RecordBuffer::share(mBuffer), false);
+	}
+	requestWrite(**mOutputIt);
       }
       mState = WRITE;
       return;
@@ -2836,6 +3237,305 @@ void RuntimeHashPartitionerOperator::shutdown()
 {
 }
 
+RuntimeRangeSampleOperatorType::~RuntimeRangeSampleOperatorType()
+{
+}
+
+RuntimeOperator * RuntimeRangeSampleOperatorType::create(RuntimeOperator::Services & s) const
+{
+  return new RuntimeRangeSampleOperator(s, *this);
+}
+
+RuntimeRangeSampleOperator::RuntimeRangeSampleOperator(RuntimeOperator::Services& services, 
+						       const RuntimeRangeSampleOperatorType& opType)
+  :
+  RuntimeOperatorBase<RuntimeRangeSampleOperatorType>(services, opType),
+  mState(START),
+  mInputEOS(false),
+  mSampleIt(0)
+{
+}
+
+RuntimeRangeSampleOperator::~RuntimeRangeSampleOperator()
+{
+}
+
+void RuntimeRangeSampleOperator::start()
+{
+  mInputEOS = false;
+  mSample.clear();
+  mState = START;
+  onEvent(NULL);
+}
+
+void RuntimeRangeSampleOperator::onEvent(RuntimePort * port)
+{
+  switch(mState) {
+  case START:
+    // Buffer a sample of the input
+    while(mSample.size() < getMyOperatorType().mSampleSize) {
+      requestRead(0);
+      mState = READ_SAMPLE;
+      return;
+    case READ_SAMPLE: 
+      read(port, mBuffer);
+      if (RecordBuffer::isEOS(mBuffer)) {
+	mInputEOS = true;
+	break;
+      }
+      mSample.push_back(mBuffer);
+      mBuffer = NULL;
+    }
+    for(mSampleIt = 0; mSampleIt < mSample.size(); ++mSampleIt) {
+      requestWrite(RuntimeRangeSampleOperatorType::SAMPLE_PORT);
+      mState = WRITE_SAMPLE;
+      return;
+    case WRITE_SAMPLE:
+      write(port, RecordBuffer::share(mSample[mSampleIt]), false);
+    }
+    requestWrite(RuntimeRangeSampleOperatorType::SAMPLE_PORT);
+    mState = WRITE_SAMPLE_EOS;
+    return;
+  case WRITE_SAMPLE_EOS:
+    write(port, RecordBuffer(NULL), true);
+
+    // Now pass the sample and the remainder of the input through
+    for(mSampleIt = 0; mSampleIt < mSample.size(); ++mSampleIt) {
+      requestWrite(RuntimeRangeSampleOperatorType::DATA_PORT);
+      mState = WRITE_BUFFERED;
+      return;
+    case WRITE_BUFFERED:
+      write(port, mSample[mSampleIt], false);
+    }
+    mSample.clear();
+    while(!mInputEOS) {
+      requestRead(0);
+      mState = READ;
+      return;
+    case READ: 
+      read(port, mBuffer);
+      if (RecordBuffer::isEOS(mBuffer)) break;
+      requestWrite(RuntimeRangeSampleOperatorType::DATA_PORT);
+      mState = WRITE;
+      return;
+    case WRITE:
+      write(port, mBuffer, false);
+      mBuffer = NULL;
+    }
+    requestWrite(RuntimeRangeSampleOperatorType::DATA_PORT);
+    mState = WRITE_EOS;
+    return;
+  case WRITE_EOS:
+    write(port, RecordBuffer(NULL), true);
+  }
+}
+
+void RuntimeRangeSampleOperator::shutdown()
+{
+}
+
+RuntimeRangeSplitterOperatorType::RuntimeRangeSplitterOperatorType(const RecordType * input,
+								   const RecordTypeFunction * keyPrefix)
+  :
+  RuntimeOperatorType("RuntimeRangeSplitterOperatorType"),
+  mKeyPrefix(keyPrefix->create()),
+  mFree(input->getFree())
+{
+}
+
+RuntimeRangeSplitterOperatorType::~RuntimeRangeSplitterOperatorType()
+{
+  delete mKeyPrefix;
+}
+
+RuntimeOperator * RuntimeRangeSplitterOperatorType::create(RuntimeOperator::Services & s) const
+{
+  return new RuntimeRangeSplitterOperator(s, *this);
+}
+
+RuntimeRangeSplitterOperator::RuntimeRangeSplitterOperator(RuntimeOperator::Services& services, 
+							   const RuntimeRangeSplitterOperatorType& opType)
+  :
+  RuntimeOperatorBase<RuntimeRangeSplitterOperatorType>(services, opType),
+  mState(START),
+  mRuntimeContext(new InterpreterContext()),
+  mSplitterIt(0)
+{
+}
+
+RuntimeRangeSplitterOperator::~RuntimeRangeSplitterOperator()
+{
+  delete mRuntimeContext;
+}
+
+static bool samplePrefixLessThan(const std::pair<uint32_t, RecordBuffer>& lhs,
+				 const std::pair<uint32_t, RecordBuffer>& rhs)
+{
+  return lhs.first < rhs.first;
+}
+
+void RuntimeRangeSplitterOperator::start()
+{
+  mSample.clear();
+  mSplitters.clear();
+  mState = START;
+  onEvent(NULL);
+}
+
+void RuntimeRangeSplitterOperator::onEvent(RuntimePort * port)
+{
+  switch(mState) {
+  case START:
+    while(true) {
+      requestRead(0);
+      mState = READ;
+      return;
+    case READ: 
+      read(port, mBuffer);
+      if (RecordBuffer::isEOS(mBuffer)) break;
+      mSample.push_back(std::make_pair((uint32_t) getMyOperatorType().mKeyPrefix->execute(mBuffer, NULL, mRuntimeContext),
+				       mBuffer));
+      mBuffer = NULL;
+    }
+    {
+      // Splitters at the quantiles of the pooled sample; keep only
+      // the sample records that are splitters.
+      std::sort(mSample.begin(), mSample.end(), samplePrefixLessThan);
+      std::size_t numRanges = (std::size_t) getNumPartitions();
+      std::size_t next = 1;
+      for(std::size_t i=0; i<mSample.size(); ++i) {
+	if (next < numRanges && i == (next*mSample.size())/numRanges) {
+	  mSplitters.push_back(mSample[i].second);
+	  // A small sample may put more than one quantile on a record.
+	  while(next < numRanges && i == (next*mSample.size())/numRanges) {
+	    ++next;
+	  }
+	} else {
+	  getMyOperatorType().mFree.free(mSample[i].second);
+	}
+      }
+      mSample.clear();
+    }
+    for(mSplitterIt = 0; mSplitterIt < mSplitters.size(); ++mSplitterIt) {
+      requestWrite(0);
+      mState = WRITE;
+      return;
+    case WRITE:
+      write(port, mSplitters[mSplitterIt], false);
+    }
+    mSplitters.clear();
+    requestWrite(0);
+    mState = WRITE_EOS;
+    return;
+  case WRITE_EOS:
+    write(port, RecordBuffer(NULL), true);
+  }
+}
+
+void RuntimeRangeSplitterOperator::shutdown()
+{
+}
+
+RuntimeRangePartitionerOperatorType::RuntimeRangePartitionerOperatorType()
+  :
+  mKeyPrefix(NULL)
+{
+}
+
+RuntimeRangePartitionerOperatorType::RuntimeRangePartitionerOperatorType(const RecordType * input,
+									 const RecordTypeFunction * keyPrefix)
+  :
+  RuntimeOperatorType("RuntimeRangePartitionerOperatorType"),
+  mKeyPrefix(keyPrefix->create()),
+  mFree(input->getFree())
+{
+}
+
+RuntimeRangePartitionerOperatorType::~RuntimeRangePartitionerOperatorType()
+{
+  delete mKeyPrefix;
+}
+  
+RuntimeOperator * RuntimeRangePartitionerOperatorType::create(RuntimeOperator::Services & s) const
+{
+  return new RuntimeRangePartitionerOperator(s, *this);
+}
+
+RuntimeRangePartitionerOperator::RuntimeRangePartitionerOperator(RuntimeOperator::Services& services, 
+								 const RuntimeRangePartitionerOperatorType& opType)
+  :
+  RuntimeOperatorBase<RuntimeRangePartitionerOperatorType>(services, opType),
+  mState(START),
+  mRuntimeContext(new InterpreterContext())
+{
+}
+
+RuntimeRangePartitionerOperator::~RuntimeRangePartitionerOperator()
+{
+  delete mRuntimeContext;
+}
+
+std::size_t RuntimeRangePartitionerOperator::getRange(uint32_t prefix) const
+{
+  return std::upper_bound(mSplitters.begin(), mSplitters.end(), prefix) - 
+    mSplitters.begin();
+}
+
+void RuntimeRangePartitionerOperator::start()
+{
+  mSplitters.clear();
+  mState = START;
+  onEvent(NULL);
+}
+
+void RuntimeRangePartitionerOperator::onEvent(RuntimePort * port)
+{
+  switch(mState) {
+  case START:
+    // All splitters arrive before any data is routed.
+    while(true) {
+      requestRead(RuntimeRangePartitionerOperatorType::SPLITTER_PORT);
+      mState = READ_SPLITTER;
+      return;
+    case READ_SPLITTER: 
+      read(port, mBuffer);
+      if (RecordBuffer::isEOS(mBuffer)) break;
+      mSplitters.push_back(getMyOperatorType().mKeyPrefix->execute(mBuffer, NULL, mRuntimeContext));
+      getMyOperatorType().mFree.free(mBuffer);
+      mBuffer = NULL;
+    }
+    std::sort(mSplitters.begin(), mSplitters.end());
+
+    while(true) {
+      requestRead(RuntimeRangePartitionerOperatorType::DATA_PORT);
+      mState = READ;
+      return;
+    case READ: 
+      read(port, mBuffer);
+      if (RecordBuffer::isEOS(mBuffer)) break;
+      requestWrite(getRange(getMyOperatorType().mKeyPrefix->execute(mBuffer, NULL, mRuntimeContext)));
+      mState = WRITE;
+      return;
+    case WRITE:
+      write(port, mBuffer, false);
+      mBuffer = NULL;
+    }
+    for(mOutputIt = output_port_begin();
+	mOutputIt != output_port_end();
+	++mOutputIt) {
+      requestWrite(mOutputIt - output_port_begin());
+      mState = WRITE_EOS;
+      return;
+    case WRITE_EOS:
+      write(port, RecordBuffer(NULL), true);
+    }
+  }
+}
+
+void RuntimeRangePartitionerOperator::shutdown()
+{
+}
+
 RuntimeBroadcastPartitionerOperatorType::~RuntimeBroadcastPartitionerOperatorType()
 {
   delete mTransfer;
@@ -2887,10 +3587,14 @@ void RuntimeBroadcastPartitionerOperator::onEvent(RuntimePort * port)
       case WRITE:
 	if (mOutputIt+1 != output_port_end()) {
 	  RecordBuffer output;
-	  getMyOperatorType().mTransfer->execute(mInput, 
-						 output, 
-						 mRuntimeContext, 
-						 false);
+	  if (getMyOperatorType().mIdentity) {
+	    output = RecordBuffer::share(mInput);
+	  } else {
+	    getMyOperatorType().mTransfer->execute(mInput, 
+						   output, 
+						   mRuntimeContext, 
+						   false);
+	  }
 	  write(port, output, false);
 	} else {
 	  write(port, mInput, false);
@@ -3085,6 +3789,16 @@ RuntimeOperator * RuntimeNondeterministicCollectorOperatorType::create(RuntimeOp
   return new op_type(s, *this);
 }
 
+RuntimeOrderedCollectorOperatorType::~RuntimeOrderedCollectorOperatorType()
+{
+}
+  
+RuntimeOperator * RuntimeOrderedCollectorOperatorType::create(RuntimeOperator::Services & s) const
+{
+  typedef RuntimeConcatenationOperator<RuntimeOrderedCollectorOperatorType> op_type;
+  return new op_type(s, *this);
+}
+
 RecordTypeTransfer * 
 SortMergeJoin::makeNullableTransfer(DynamicRecordContext& ctxt,
 				    const RecordType * input)
@@ -3128,7 +3842,14 @@ SortMergeJoin::SortMergeJoin(SortMergeJoin::JoinType joinType)
   mResidual(NULL),
   mMatchTransfer(NULL),
   mLeftMakeNullableTransfer(NULL),
-  mRightMakeNullableTransfer(NULL)
+  mRightMakeNullableTransfer(NULL),
+  mMemory(128*1024*1024),
+  mLeftHash(NULL),
+  mRightHash(NULL),
+  mLeftKeyPrefix(NULL),
+  mLeftKeyLessThan(NULL),
+  mRightKeyPrefix(NULL),
+  mRightKeyLessThan(NULL)
 {
 }
 
@@ -3151,7 +3872,14 @@ SortMergeJoin::SortMergeJoin(DynamicRecordContext & ctxt,
   mResidual(NULL),
   mMatchTransfer(NULL),
   mLeftMakeNullableTransfer(NULL),
-  mRightMakeNullableTransfer(NULL)
+  mRightMakeNullableTransfer(NULL),
+  mMemory(128*1024*1024),
+  mLeftHash(NULL),
+  mRightHash(NULL),
+  mLeftKeyPrefix(NULL),
+  mLeftKeyLessThan(NULL),
+  mRightKeyPrefix(NULL),
+  mRightKeyLessThan(NULL)
 {
   init(ctxt, leftKeys, rightKeys, residual, matchTransfer);
 }
@@ -3185,6 +3913,16 @@ void SortMergeJoin::init(DynamicRecordContext & ctxt,
 					      mLeftInput, mRightInput,
 					      leftKeys, rightKeys, 
 					      "compareLeftRight");
+  SortKeyNormalizer::get(mLeftInput, leftKeys, mRightInput, rightKeys,
+			 mLeftNormalizer, mRightNormalizer);
+  std::vector<TaggedFieldAddress> leftKeyFields;
+  for(std::vector<SortKey>::const_iterator it = leftKeys.begin();
+      it != leftKeys.end();
+      ++it) {
+    leftKeyFields.push_back(TaggedFieldAddress(mLeftInput->getFieldAddress(it->getName()),
+					       mLeftInput->getMember(it->getName()).GetType()->GetEnum()));
+  }
+  mLeftKeyPrint = RecordTypePrint(leftKeyFields);
   // Create the residual predicate
   if (residual.size()) {
     std::vector<AliasedRecordType> residualTypes;
@@ -3228,6 +3966,118 @@ SortMergeJoin::~SortMergeJoin()
   delete mMatchTransfer;
   delete mLeftMakeNullableTransfer;
   delete mRightMakeNullableTransfer;
+  delete mLeftHash;
+  delete mRightHash;
+  delete mLeftKeyPrefix;
+  delete mLeftKeyLessThan;
+  delete mRightKeyPrefix;
+  delete mRightKeyLessThan;
+}
+
+static std::string castKey(const std::string& field,
+			   const FieldType * ty,
+			   const FieldType * targetTy)
+{
+  return ty->GetEnum() == targetTy->GetEnum() ? field :
+    (boost::format("CAST(%1% AS %2%)") % field % targetTy->toString()).str();
+}
+
+void SortMergeJoin::initPartitioning(PlanCheckContext & ctxt,
+				     const std::vector<SortKey>& leftKeys,
+				     const std::vector<SortKey>& rightKeys,
+				     const std::vector<std::string>& heavyHitters)
+{
+  if (mJoinType == FULL_OUTER) {
+    ctxt.logError(*this, "heavyHitter not supported with full outer join");
+    return;
+  }
+
+  // Hash both inputs on keys converted to a common type so that
+  // matching keys land on the same partition.
+  std::vector<RecordMember> emptyMembers;
+  RecordType emptyTy(emptyMembers);
+  std::vector<const FieldType *> keyTypes;
+  std::string leftHash;
+  std::string rightHash;
+  for(std::size_t i=0; i<leftKeys.size(); i++) {
+    const FieldType * leftType = mLeftInput->getMember(leftKeys[i].getName()).GetType();
+    const FieldType * rightType = mRightInput->getMember(rightKeys[i].getName()).GetType();
+    const FieldType * keyType = 
+      TypeCheckContext::leastCommonTypeNullable(leftType, rightType);
+    if (keyType == NULL) {
+      ctxt.logError(*this, (boost::format("cannot partition on join keys %1% "
+					  "and %2% with incompatible types") %
+			    leftKeys[i].getName() % 
+			    rightKeys[i].getName()).str());
+      return;
+    }
+    keyTypes.push_back(keyType);
+    if (i > 0) {
+      leftHash += ",";
+      rightHash += ",";
+    }
+    leftHash += castKey(leftKeys[i].getName(), leftType, keyType);
+    rightHash += castKey(rightKeys[i].getName(), rightType, keyType);
+  }
+  std::vector<const RecordType *> leftOnly;
+  leftOnly.push_back(mLeftInput);
+  leftOnly.push_back(&emptyTy);
+  mLeftHash = new RecordTypeFunction(ctxt, "leftHash", leftOnly, 
+				     (boost::format("#(%1%)") % leftHash).str());
+  std::vector<const RecordType *> rightOnly;
+  rightOnly.push_back(mRightInput);
+  rightOnly.push_back(&emptyTy);
+  mRightHash = new RecordTypeFunction(ctxt, "rightHash", rightOnly, 
+				      (boost::format("#(%1%)") % rightHash).str());
+  mLeftKeyPrefix = SortKeyPrefixFunction::get(ctxt, mLeftInput, leftKeys, "leftKeyPrefix");
+  mLeftKeyLessThan = LessThanFunction::get(ctxt, mLeftInput, mLeftInput, leftKeys, 
+					   true, "leftKeyLessThan");
+  mRightKeyPrefix = SortKeyPrefixFunction::get(ctxt, mRightInput, rightKeys, "rightKeyPrefix");
+  mRightKeyLessThan = LessThanFunction::get(ctxt, mRightInput, mRightInput, rightKeys, 
+					    true, "rightKeyLessThan");
+
+  // A heavy hitter is a record of left key values, e.g. 
+  // "'-' AS useragent".  Evaluate it and hash it the way the 
+  // partitioners hash the inputs.
+  InterpreterContext runtimeCtxt;
+  RecordBuffer empty = emptyTy.getMalloc().malloc();
+  for(std::vector<std::string>::const_iterator it = heavyHitters.begin();
+      it != heavyHitters.end();
+      ++it) {
+    RecordTypeTransfer hitter(ctxt, "heavyHitter", &emptyTy, *it);
+    const RecordType * hitterTy = hitter.getTarget();
+    if (hitterTy->size() != leftKeys.size()) {
+      ctxt.logError(*this, (boost::format("heavyHitter \"%1%\" must have one "
+					  "value for each left key") % *it).str());
+      continue;
+    }
+    std::string hitterHash;
+    for(std::size_t i=0; i<leftKeys.size(); i++) {
+      if (!hitterTy->hasMember(leftKeys[i].getName())) {
+	ctxt.logError(*this, (boost::format("heavyHitter \"%1%\" has no value "
+					    "for left key %2%") % *it %
+			      leftKeys[i].getName()).str());
+	hitterHash.clear();
+	break;
+      }
+      if (i > 0) hitterHash += ",";
+      hitterHash += castKey(leftKeys[i].getName(), 
+			    hitterTy->getMember(leftKeys[i].getName()).GetType(),
+			    keyTypes[i]);
+    }
+    if (hitterHash.size() == 0) continue;
+    std::vector<const RecordType *> hitterOnly;
+    hitterOnly.push_back(hitterTy);
+    hitterOnly.push_back(&emptyTy);
+    RecordTypeFunction hash(ctxt, "heavyHitterHash", hitterOnly, 
+			    (boost::format("#(%1%)") % hitterHash).str());
+    RecordBuffer buf = hitterTy->getMalloc().malloc();
+    hitter.execute(empty, buf, &runtimeCtxt, false);
+    mHeavyHitters.push_back((uint64_t) hash.execute64(buf, RecordBuffer(), 
+						      &runtimeCtxt));
+    hitterTy->getFree().free(buf);
+  }
+  emptyTy.getFree().free(empty);
 }
 
 const RecordType * SortMergeJoin::getOutputType() const
@@ -3242,13 +4092,23 @@ void SortMergeJoin::check(PlanCheckContext& ctxt)
   std::vector<SortKey> rightKeys;
   std::string residual;
   std::string transfer;
+  std::vector<std::string> heavyHitters;
 
   // Validate the parameters
   for(const_param_iterator it = begin_params();
       it != end_params();
       ++it) {
-    if (boost::algorithm::iequals(it->Name, "leftKey")) {
+    if (it->equals("heavyHitter")) {
+      heavyHitters.push_back(getStringValue(ctxt, *it));
+    } else if (boost::algorithm::iequals(it->Name, "leftKey")) {
       leftKeys.push_back(SortKey(boost::get<std::string>(it->Value)));
+    } else if (it->equals("memory")) {
+      int32_t tmp = getInt32Value(ctxt, *it);
+      if (tmp <= 0) {
+	ctxt.logError(*this, "memory argument must be a positive integer");
+      } else {
+	mMemory = (std::size_t) tmp;
+      }
     } else if (boost::algorithm::iequals(it->Name, "rightKey")) {
       rightKeys.push_back(SortKey(boost::get<std::string>(it->Value)));
     } else if (boost::algorithm::iequals(it->Name, "residual") ||
@@ -3256,6 +4116,8 @@ void SortMergeJoin::check(PlanCheckContext& ctxt)
       residual = boost::get<std::string>(it->Value);
     } else if (boost::algorithm::iequals(it->Name, "output")) {
       transfer = boost::get<std::string>(it->Value);
+    } else if (it->equals("tempdir")) {
+      mTempDir = getStringValue(ctxt, *it);
     } else {
       checkDefaultParam(*it);
     }
@@ -3264,18 +4126,59 @@ void SortMergeJoin::check(PlanCheckContext& ctxt)
   mRightInput = getInput(1)->getRecordType();
 
   init(ctxt, leftKeys, rightKeys, residual, transfer);
+  if (heavyHitters.size()) {
+    initPartitioning(ctxt, leftKeys, rightKeys, heavyHitters);
+  }
 
   getOutput(0)->setRecordType(isInnerOrOuter(mJoinType) ?
 			      mMatchTransfer->getTarget() :
 			      mLeftMakeNullableTransfer->getTarget());
 }
 
+RuntimeOperatorType * SortMergeJoin::createRepartition(class RuntimePlanBuilder& plan,
+						       std::size_t inputPort,
+						       const RecordType * input,
+						       const RecordTypeFunction * hash,
+						       const RecordTypeFunction * keyPrefix,
+						       const RecordTypeFunction * keyLessThan,
+						       const SortKeyNormalizer * normalizer,
+						       bool split)
+{
+  RuntimeOperatorType * partitioner = 
+    new RuntimeHashPartitionerOperatorType(hash->create(), mHeavyHitters,
+					   split ? 
+					   RuntimeHashPartitionerOperatorType::SPLIT :
+					   RuntimeHashPartitionerOperatorType::REPLICATE);
+  plan.addOperatorType(partitioner);
+  plan.mapInputPort(this, inputPort, partitioner, 0);
+  RuntimeOperatorType * merger = 
+    new RuntimeSortMergeOperatorType(keyPrefix, keyLessThan, normalizer);
+  plan.addOperatorType(merger);
+  plan.connectCrossbar(partitioner, merger, input, true);
+  return merger;
+}
+
 void SortMergeJoin::create(class RuntimePlanBuilder& plan)
 {
   RuntimeOperatorType * opType = create();
   plan.addOperatorType(opType);
-  plan.mapInputPort(this, 0, opType, 0);  
-  plan.mapInputPort(this, 1, opType, 1);  
+  if (mLeftHash) {
+    // Every output record comes from one record of the input that
+    // is split, so split the left unless the join outputs unmatched 
+    // (or only) right records.
+    bool splitLeft = mJoinType == INNER || mJoinType == LEFT_OUTER;
+    RuntimeOperatorType * left = 
+      createRepartition(plan, 0, mLeftInput, mLeftHash, mLeftKeyPrefix,
+			mLeftKeyLessThan, &mLeftNormalizer, splitLeft);
+    plan.connect(left, 0, opType, RuntimeSortMergeJoinOperatorType::LEFT_PORT);
+    RuntimeOperatorType * right = 
+      createRepartition(plan, 1, mRightInput, mRightHash, mRightKeyPrefix,
+			mRightKeyLessThan, &mRightNormalizer, !splitLeft);
+    plan.connect(right, 0, opType, RuntimeSortMergeJoinOperatorType::RIGHT_PORT);
+  } else {
+    plan.mapInputPort(this, 0, opType, 0);  
+    plan.mapInputPort(this, 1, opType, 1);  
+  }
   plan.mapOutputPort(this, 0, opType, 0);  
 }
 
@@ -3290,7 +4193,12 @@ RuntimeOperatorType * SortMergeJoin::create() const
 					      mResidual,
 					      mMatchTransfer,
 					      mLeftMakeNullableTransfer,
-					      mRightMakeNullableTransfer);
+					      mRightMakeNullableTransfer,
+					      &mLeftNormalizer,
+					      &mRightNormalizer,
+					      mTempDir,
+					      mMemory,
+					      &mLeftKeyPrint);
 }
 
 RuntimeSortMergeJoinOperatorType::~RuntimeSortMergeJoinOperatorType()
@@ -3315,7 +4223,12 @@ RuntimeSortMergeJoinOperator::RuntimeSortMergeJoinOperator(RuntimeOperator::Serv
   RuntimeOperatorBase<RuntimeSortMergeJoinOperatorType>(services, opType),
   mState(START),
   mRuntimeContext(NULL),
-  mMatchFound(false)
+  mMatchFound(false),
+  mNormalized(!opType.mLeftNormalizer.empty()),
+  mLeftBufferSize(0),
+  mLeftSpill(NULL),
+  mSpillIt(0),
+  mLargestSpilledRun(0)
 {
   mRuntimeContext = new InterpreterContext();
   if (getMyOperatorType().mJoinType == SortMergeJoin::FULL_OUTER ||
@@ -3331,6 +4244,7 @@ RuntimeSortMergeJoinOperator::RuntimeSortMergeJoinOperator(RuntimeOperator::Serv
 RuntimeSortMergeJoinOperator::~RuntimeSortMergeJoinOperator()
 {
   delete mRuntimeContext;
+  delete mLeftSpill;
   if (getMyOperatorType().mJoinType == SortMergeJoin::FULL_OUTER ||
       getMyOperatorType().mJoinType == SortMergeJoin::RIGHT_OUTER) {
     getMyOperatorType().mLeftNullFree.free(mLeftNulls);
@@ -3347,6 +4261,68 @@ void RuntimeSortMergeJoinOperator::start()
   onEvent(NULL);
 }
 
+int32_t RuntimeSortMergeJoinOperator::compareLeftRight(RecordBuffer left,
+						       const NormalizedKey & leftKey)
+{
+  if (mNormalized) {
+    int32_t cmp = leftKey.compare(mRightKey);
+    // NULL keys never match; CompareFunction calls them less.
+    if (cmp == 0 && (leftKey.hasNull() || mRightKey.hasNull())) {
+      return -1;
+    }
+    return cmp;
+  }
+  return getMyOperatorType().mLeftRightKeyCompareFun->execute(left,
+							      mRightInput,
+							      mRuntimeContext);
+}
+
+void RuntimeSortMergeJoinOperator::bufferLeft(RecordBuffer buf)
+{
+  const RuntimeSortMergeJoinOperatorType & opType(getMyOperatorType());
+  std::size_t sz = opType.mLeftSerialize.getRecordLength(buf);
+  // Always keep the head of the run in memory since we compare
+  // against it.
+  if (mLeftBuffer.empty() || 
+      (mSpillMatched.empty() && 
+       mLeftBufferSize + sz <= opType.mMemoryAllowed)) {
+    mLeftBuffer.push_back(buf);
+    mLeftBufferSize += sz;
+    return;
+  }
+  if (mLeftSpill == NULL) {
+    mLeftSpill = new RecordSpillFile(opType.mLeftSerialize,
+				     opType.mLeftDeserialize,
+				     opType.mLeftMalloc,
+				     opType.mTempDir);
+  }
+  mLeftSpill->write(buf);
+  mSpillMatched.push_back(false);
+  opType.mLeftFree.free(buf);
+}
+
+void RuntimeSortMergeJoinOperator::reportSkew()
+{
+  std::size_t runSize = mLeftBuffer.size() + mLeftSpill->size();
+  addSpill(mLeftSpill->size());
+  std::stringstream key;
+  getMyOperatorType().mLeftKeyPrint.print(mLeftBuffer.front().Buffer, key, false);
+  if (runSize > mLargestSpilledRun) {
+    mLargestSpilledRun = runSize;
+    RuntimeMetrics::get().setSkewedKey(this, key.str());
+  }
+  std::cerr << (boost::format("merge join partition %1%: key run of %2% "
+			      "records exceeds memory budget of %3% bytes; "
+			      "spilled %4% records (%5% bytes) to disk; "
+			      "key: %6%") %
+		getPartition() % 
+		runSize %
+		getMyOperatorType().mMemoryAllowed %
+		mLeftSpill->size() %
+		mLeftSpill->getBytes() %
+		key.str()) << std::endl;
+}
+
 void RuntimeSortMergeJoinOperator::onRightNonMatch(RuntimePort * port)
 {
   switch(getMyOperatorType().mJoinType) {
@@ -3481,19 +4457,19 @@ void RuntimeSortMergeJoinOperator::onEvent(RuntimePort * port)
     return;
   case READ_RIGHT_INIT:
     read(port, mRightInput);
+    normalizeRight();
 
     requestRead(RuntimeSortMergeJoinOperatorType::LEFT_PORT);
     mState = READ_LEFT_INIT;
     return;
   case READ_LEFT_INIT:
     read(port, mLeftInput);
+    normalizeLeft();
       
     while(!RecordBuffer::isEOS(mLeftInput) &&
 	  !RecordBuffer::isEOS(mRightInput)) {
       // Advance lagging left until catches up with right
-      while (0 > getMyOperatorType().mLeftRightKeyCompareFun->execute(mLeftInput,
-								      mRightInput,
-								      mRuntimeContext)) {
+      while (0 > compareLeftRight(mLeftInput, mLeftKey)) {
 	if (getMyOperatorType().mJoinType == SortMergeJoin::FULL_OUTER ||
 	    getMyOperatorType().mJoinType == SortMergeJoin::LEFT_OUTER) {
 	  requestWrite(0);
@@ -3510,6 +4486,7 @@ void RuntimeSortMergeJoinOperator::onEvent(RuntimePort * port)
 	return;
       case READ_LEFT_LT:
 	read(port, mLeftInput);
+	normalizeLeft();
 
 	if (RecordBuffer::isEOS(mLeftInput)) 
 	  break;
@@ -3518,26 +4495,24 @@ void RuntimeSortMergeJoinOperator::onEvent(RuntimePort * port)
       // Compare left and write if we have matches.
       if(!RecordBuffer::isEOS(mLeftInput) &&
 	    !RecordBuffer::isEOS(mRightInput) &&
-	    0==getMyOperatorType().mLeftRightKeyCompareFun->execute(mLeftInput,
-								    mRightInput,
-								    mRuntimeContext)) { // On Equality
+	    0==compareLeftRight(mLeftInput, mLeftKey)) { // On Equality
 	// Read the entire key run from left.
+	if (mNormalized) {
+	  mLeftRunKey = mLeftKey;
+	}
 	do {
-	  mLeftBuffer.push_back(mLeftInput);
+	  bufferLeft(mLeftInput);
 	  requestRead(RuntimeSortMergeJoinOperatorType::LEFT_PORT);
 	  mState = READ_LEFT_EQ;
 	  return;
 	case READ_LEFT_EQ:
 	  read(port, mLeftInput);
+	  normalizeLeft();
 	} while (!RecordBuffer::isEOS(mLeftInput) &&  
-		 0==getMyOperatorType().mLeftRightKeyCompareFun->execute(mLeftInput,
-									 mRightInput,
-									 mRuntimeContext));
+		 0==compareLeftRight(mLeftInput, mLeftKey));
 
 	while(!RecordBuffer::isEOS(mRightInput) &&
-	      0==getMyOperatorType().mLeftRightKeyCompareFun->execute(mLeftBuffer.back().Buffer,
-								      mRightInput,
-								      mRuntimeContext)){ // Scan for matches
+	      0==compareLeftRight(mLeftBuffer.back().Buffer, mLeftRunKey)){ // Scan for matches
 	  mMatchFound = false;
 	  mLastMatch = NULL;
 
@@ -3571,6 +4546,54 @@ void RuntimeSortMergeJoinOperator::onEvent(RuntimePort * port)
 	      }
 	    }
 	  }
+	  // Replay the spilled part of the key run.  Semi and anti 
+	  // semi joins can stop at the first match.
+	  if (mSpillMatched.size() &&
+	      !(mMatchFound && 
+		(getMyOperatorType().mJoinType == SortMergeJoin::RIGHT_SEMI ||
+		 getMyOperatorType().mJoinType == SortMergeJoin::RIGHT_ANTI_SEMI))) {
+	    mLeftSpill->rewind();
+	    for(mSpillIt = 0; 
+		RecordBuffer() != (mSpillInput = mLeftSpill->read());
+		++mSpillIt) {
+	      if (NULL==getMyOperatorType().mEqFun ||
+		  getMyOperatorType().mEqFun->execute(mSpillInput,
+						      mRightInput,
+						      mRuntimeContext)) {
+		mMatchFound = true;
+		mSpillMatched[mSpillIt] = true;
+		if (getMyOperatorType().mJoinType == SortMergeJoin::INNER ||
+		    getMyOperatorType().mJoinType == SortMergeJoin::FULL_OUTER ||
+		    getMyOperatorType().mJoinType == SortMergeJoin::LEFT_OUTER ||
+		    getMyOperatorType().mJoinType == SortMergeJoin::RIGHT_OUTER) {
+		  if (mLastMatch) {
+		    requestWrite(0);
+		    mState = WRITE_SPILL_MATCH;
+		    return;
+		  case WRITE_SPILL_MATCH:
+		    {
+		      onMatch(port);
+		    }
+		  }
+		  freeSpillLastMatch();
+		  mLastMatch = mSpillLastMatch = mSpillInput;
+		  mSpillInput = RecordBuffer();
+		} else if (getMyOperatorType().mJoinType == SortMergeJoin::RIGHT_SEMI) {
+		  mLastMatch = mSpillLastMatch = mSpillInput;
+		  mSpillInput = RecordBuffer();
+		  break;
+		} else if (getMyOperatorType().mJoinType == SortMergeJoin::RIGHT_ANTI_SEMI) {
+		  getMyOperatorType().mLeftFree.free(mSpillInput);
+		  mSpillInput = RecordBuffer();
+		  break;
+		}
+	      }
+	      if (mSpillInput != RecordBuffer()) {
+		getMyOperatorType().mLeftFree.free(mSpillInput);
+		mSpillInput = RecordBuffer();
+	      }
+	    }
+	  }
 	  if (mLastMatch && (getMyOperatorType().mJoinType == SortMergeJoin::INNER ||
 			     getMyOperatorType().mJoinType == SortMergeJoin::FULL_OUTER ||
 			     getMyOperatorType().mJoinType == SortMergeJoin::LEFT_OUTER ||
@@ -3592,6 +4615,7 @@ void RuntimeSortMergeJoinOperator::onEvent(RuntimePort * port)
 	  case WRITE_RIGHT_NON_MATCH:
 	    onRightNonMatch(port);
 	  } 
+	  freeSpillLastMatch();
 
 	  // Free right input unless output as part of semi join processing
 	  if (mRightInput != RecordBuffer(NULL)) {
@@ -3604,7 +4628,33 @@ void RuntimeSortMergeJoinOperator::onEvent(RuntimePort * port)
 	  return;
 	case READ_RIGHT_EQ:
 	  read(port, mRightInput);
+	  normalizeRight();
+	}
+
+	// Emit unmatched spilled records and reset the spill.
+	if (mSpillMatched.size()) {
+	  reportSkew();
+	  if (getMyOperatorType().mJoinType == SortMergeJoin::FULL_OUTER ||
+	      getMyOperatorType().mJoinType == SortMergeJoin::LEFT_OUTER) {
+	    mLeftSpill->rewind();
+	    for(mSpillIt = 0; 
+		RecordBuffer() != (mSpillInput = mLeftSpill->read());
+		++mSpillIt) {
+	      if (!mSpillMatched[mSpillIt]) {
+		requestWrite(0);
+		mState = WRITE_SPILL_LEFT_NON_MATCH;
+		return;
+	      case WRITE_SPILL_LEFT_NON_MATCH:
+		onLeftNonMatch(port, mSpillInput);
+	      }
+	      getMyOperatorType().mLeftFree.free(mSpillInput);
+	      mSpillInput = RecordBuffer();
+	    }
+	  }
+	  mLeftSpill->clear();
+	  mSpillMatched.clear();
 	}
+	mLeftBufferSize = 0;
 
 	// Free left buffers since we don't need them.
 	for(mIt = mLeftBuffer.begin();
@@ -3627,9 +4677,7 @@ void RuntimeSortMergeJoinOperator::onEvent(RuntimePort * port)
       // Advance lagging right if needed (won't have done any equality processing if we hit this).
       while(!RecordBuffer::isEOS(mLeftInput) &&
 	    !RecordBuffer::isEOS(mRightInput) &&
-	    0 < getMyOperatorType().mLeftRightKeyCompareFun->execute(mLeftInput,
-								     mRightInput,
-								     mRuntimeContext)) {
+	    0 < compareLeftRight(mLeftInput, mLeftKey)) {
 	if (getMyOperatorType().mJoinType == SortMergeJoin::RIGHT_ANTI_SEMI ||
 	    getMyOperatorType().mJoinType == SortMergeJoin::FULL_OUTER ||
 	    getMyOperatorType().mJoinType == SortMergeJoin::RIGHT_OUTER) {
@@ -3647,6 +4695,7 @@ void RuntimeSortMergeJoinOperator::onEvent(RuntimePort * port)
 	return;
       case READ_RIGHT_LT:
 	read(port, mRightInput);
+	normalizeRight();
 	if (RecordBuffer::isEOS(mRightInput))
 	  break;
       }
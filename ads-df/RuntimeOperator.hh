@@ -44,6 +44,9 @@
 #include "LogicalOperator.hh"
 
 #include <boost/unordered/unordered_map.hpp>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 class HashFunction
 {
@@ -148,6 +151,192 @@ public:
 				  const std::string& name = "keyPrefix");
 };
 
+/**
+ * A normalized key is a binary image of the sort key of a record
+ * whose lexicographic order (as a sequence of 32-bit words) is the
+ * order of the sort key.  Encodings are prefix free (no key is a
+ * proper prefix of another) so keys can be compared word by word
+ * without checking lengths first, which is what makes offset-value
+ * coding work.
+ */
+class NormalizedKey
+{
+private:
+  std::vector<uint8_t> mBytes;
+  std::vector<uint32_t> mWords;
+  bool mHasNull;
+public:
+  NormalizedKey()
+    :
+    mHasNull(false)
+  {
+  }
+  void clear()
+  {
+    mBytes.clear();
+    mHasNull = false;
+  }
+  void append(uint8_t b)
+  {
+    mBytes.push_back(b);
+  }
+  void append(const uint8_t * begin, std::size_t sz)
+  {
+    mBytes.insert(mBytes.end(), begin, begin+sz);
+  }
+  /**
+   * Complement the bytes from pos to the end (for descending keys).
+   */
+  void complement(std::size_t pos)
+  {
+    for(std::size_t i=pos; i<mBytes.size(); ++i) {
+      mBytes[i] = ~mBytes[i];
+    }
+  }
+  std::size_t bytes() const
+  {
+    return mBytes.size();
+  }
+  void setNull()
+  {
+    mHasNull = true;
+  }
+  /**
+   * Does the key have a NULL field?
+   */
+  bool hasNull() const
+  {
+    return mHasNull;
+  }
+  /**
+   * Pack bytes into big endian words (zero padded).  There is
+   * always at least one word.
+   */
+  void finish()
+  {
+    mWords.assign(mBytes.size() ? (mBytes.size()+3)/4 : 1, 0);
+    for(std::size_t i=0; i<mBytes.size(); ++i) {
+      mWords[i>>2] |= ((uint32_t) mBytes[i]) << (8*(3 - (i&3)));
+    }
+  }
+  const uint32_t * data() const
+  {
+    return &mWords[0];
+  }
+  uint32_t size() const
+  {
+    return (uint32_t) mWords.size();
+  }
+  /**
+   * Three way comparison of normalized keys starting at word start.
+   */
+  static int32_t compare(const uint32_t * lhs, uint32_t lhsSz,
+			 const uint32_t * rhs, uint32_t rhsSz,
+			 uint32_t start=0)
+  {
+    uint32_t sz = (std::min)(lhsSz, rhsSz);
+    for(uint32_t i=start; i<sz; ++i) {
+      if (lhs[i] != rhs[i]) {
+	return lhs[i] < rhs[i] ? -1 : 1;
+      }
+    }
+    return lhsSz == rhsSz ? 0 : (lhsSz < rhsSz ? -1 : 1);
+  }
+  int32_t compare(const NormalizedKey & rhs) const
+  {
+    return compare(data(), size(), rhs.data(), rhs.size());
+  }
+  /**
+   * Exchange contents without moving the words (so pointers 
+   * from data() remain valid).
+   */
+  void swap(NormalizedKey & rhs)
+  {
+    mBytes.swap(rhs.mBytes);
+    mWords.swap(rhs.mWords);
+    std::swap(mHasNull, rhs.mHasNull);
+  }
+};
+
+/**
+ * Builds normalized keys for a list of sort keys.  The encoding agrees
+ * with the LessThanFunction used for sorting: NULLs sort low or high
+ * as configured and two NULLs compare equal on that field.  The 
+ * normalizers of a merge join follow the 3 valued comparison instead 
+ * and stop at the first NULL field (such keys never match).  Not 
+ * every type has a normalized form (e.g. DECIMAL); in that case the
+ * normalizer is empty and callers fall back to key prefixes and 
+ * compiled comparisons.
+ */
+class SortKeyNormalizer
+{
+public:
+  class Field
+  {
+  public:
+    FieldAddress Address;
+    int32_t Type;
+    int32_t Size;
+    bool Nullable;
+    bool Descending;
+    Field()
+      :
+      Type(FieldType::INT32),
+      Size(0),
+      Nullable(false),
+      Descending(false)
+    {
+    }
+    template <class Archive>
+    void serialize(Archive & ar, const unsigned int version)
+    {
+      ar & BOOST_SERIALIZATION_NVP(Address);
+      ar & BOOST_SERIALIZATION_NVP(Type);
+      ar & BOOST_SERIALIZATION_NVP(Size);
+      ar & BOOST_SERIALIZATION_NVP(Nullable);
+      ar & BOOST_SERIALIZATION_NVP(Descending);
+    }
+  };
+private:
+  std::vector<Field> mFields;
+  bool mNullsSortLow;
+  // Encode the fields after a NULL (sorting) or stop at the
+  // first NULL (joining).
+  bool mSortNulls;
+  static bool isSupported(const FieldType * ty);
+  void add(const RecordType * input, const SortKey & key, bool nullable);
+  // Serialization
+  friend class boost::serialization::access;
+  template <class Archive>
+  void serialize(Archive & ar, const unsigned int version)
+  {
+    ar & BOOST_SERIALIZATION_NVP(mFields);
+    ar & BOOST_SERIALIZATION_NVP(mNullsSortLow);
+    ar & BOOST_SERIALIZATION_NVP(mSortNulls);
+  }
+public:
+  SortKeyNormalizer();
+  SortKeyNormalizer(const RecordType * input,
+		    const std::vector<SortKey>& fields);
+  ~SortKeyNormalizer();
+  /**
+   * Create normalizers for the two sides of a merge join whose 
+   * keys may be compared to each other.  Both are left empty if 
+   * that isn't possible.
+   */
+  static void get(const RecordType * lhs,
+		  const std::vector<SortKey>& lhsFields,
+		  const RecordType * rhs,
+		  const std::vector<SortKey>& rhsFields,
+		  SortKeyNormalizer & lhsNormalizer,
+		  SortKeyNormalizer & rhsNormalizer);
+  bool empty() const
+  {
+    return mFields.size() == 0;
+  }
+  void normalize(RecordBuffer buf, NormalizedKey & key) const;
+};
+
 /**
  * Stores operator types and associations between
  * logical operator ports and operator type ports
@@ -178,20 +367,25 @@ public:
     OpTypePort Source;
     OpTypePort Target;
     bool Buffered;
+    // Non NULL for a crossbar between a partitioner and a collector.
+    const RecordType * CrossbarType;
     InternalEdge()
       :
-      Buffered(true)
+      Buffered(true),
+      CrossbarType(NULL)
     {
     }
     InternalEdge(RuntimeOperatorType * sourceOpType,
 		 std::size_t sourcePort,
 		 RuntimeOperatorType * targetOpType,
 		 std::size_t targetPort,
-		 bool buffered)
+		 bool buffered,
+		 const RecordType * crossbarType=NULL)
       :
       Source(sourceOpType, sourcePort),
       Target(targetOpType, targetPort),
-      Buffered(buffered)
+      Buffered(buffered),
+      CrossbarType(crossbarType)
     {
     }
   };
@@ -244,6 +438,20 @@ public:
 					  targetType, targetPort, 
 					  buffered));
   }
+  /**
+   * Create a crossbar (all partitions to all partitions) edge
+   * that has no representation in the logical plan.  Source must
+   * be a partitioner and target a collector.
+   */
+  void connectCrossbar(RuntimeOperatorType * sourceType,
+		       RuntimeOperatorType * targetType,
+		       const RecordType * ty,
+		       bool buffered=true)
+  {
+    mInternalEdges.push_back(InternalEdge(sourceType, 0,
+					  targetType, 0, 
+					  buffered, ty));
+  }
   typedef std::vector<RuntimeOperatorType *>::iterator optype_iterator;
   optype_iterator begin_operator_types() { return mOpTypes.begin(); }
   optype_iterator end_operator_types() { return mOpTypes.end(); }
@@ -258,6 +466,7 @@ class RuntimeOperatorType;
 
 class RuntimeOperator 
 {
+  friend class RuntimeMetrics;
 public:
   // I don't yet know where Services is going to come from so typedef it here
   typedef DataflowScheduler Services;
@@ -286,6 +495,21 @@ private:
    * Time spent executing this operator.
    */
   uint64_t mTicks;
+  /**
+   * Bytes consumed from or produced to sources outside
+   * of the dataflow (e.g. sockets).
+   */
+  uint64_t mBytes;
+  /**
+   * Runs of records that exceeded the memory budget of the
+   * operator and the number of records written to disk for them.
+   */
+  uint64_t mSpilledRuns;
+  uint64_t mSpilledRecords;
+  /**
+   * Interned name used in scheduler traces (0 until first traced).
+   */
+  uint32_t mTraceName;
 
 protected:
   /**
@@ -497,6 +721,41 @@ public:
   {
     return mTicks;
   }
+  /**
+   * update external byte count
+   */
+  void addBytes(uint64_t bytes)
+  {
+    mBytes += bytes;
+  }
+  uint64_t getBytes() const
+  {
+    return mBytes;
+  }
+  /**
+   * update spill counts
+   */
+  void addSpill(uint64_t records)
+  {
+    mSpilledRuns += 1;
+    mSpilledRecords += records;
+  }
+  uint64_t getSpilledRuns() const
+  {
+    return mSpilledRuns;
+  }
+  uint64_t getSpilledRecords() const
+  {
+    return mSpilledRecords;
+  }
+  uint32_t getTraceName() const
+  {
+    return mTraceName;
+  }
+  void setTraceName(uint32_t traceName)
+  {
+    mTraceName = traceName;
+  }
 };
 
 template <class _Type>
@@ -615,6 +874,9 @@ class RuntimeCopyOperatorType : public RuntimeOperatorType
 private:
   RecordTypeFree mFree;
   std::vector<IQLTransferModule *> mTransfers;
+  // Outputs that are identical to the input get a shared
+  // reference to the input rather than a copy.
+  std::vector<bool> mIdentity;
   // Serialization
   friend class boost::serialization::access;
   template <class Archive>
@@ -623,6 +885,7 @@ private:
     ar & BOOST_SERIALIZATION_BASE_OBJECT_NVP(RuntimeOperatorType);
     ar & BOOST_SERIALIZATION_NVP(mFree);
     ar & BOOST_SERIALIZATION_NVP(mTransfers);
+    ar & BOOST_SERIALIZATION_NVP(mIdentity);
   }
   RuntimeCopyOperatorType()
   {
@@ -916,6 +1179,13 @@ private:
 public:
   LogicalGroupBy(Algorithm a);
   ~LogicalGroupBy();
+  /**
+   * Is output independent of the order of the input?
+   */
+  bool isHashAggregation() const
+  {
+    return HASH == mAlgorithm;
+  }
   void check(PlanCheckContext& log);
   void create(class RuntimePlanBuilder& plan);  
 };
@@ -1051,11 +1321,11 @@ GroupBy<_OpType>::~GroupBy()
 
 struct RecordTypeHasher : std::unary_function<RecordBuffer, std::size_t>
 {
-  IQLFunctionModule::LLVMFuncType Func;
+  IQLFunctionModule::LLVMFunc64Type Func;
   class InterpreterContext * Context;
   std::size_t operator() (const RecordBuffer & val) const
   {
-    int32_t ret;
+    int64_t ret;
     ((*Func)((char *)val.Ptr, NULL, &ret, Context));
     return (std::size_t) ret;
   }
@@ -1063,7 +1333,7 @@ struct RecordTypeHasher : std::unary_function<RecordBuffer, std::size_t>
   RecordTypeHasher(const class IQLFunctionModule * f = NULL,
 		   class InterpreterContext * ctxt = NULL)
     :
-    Func(f != NULL ? f->getRawFunction() : NULL),
+    Func(f != NULL ? f->getRawFunction64() : NULL),
     Context(ctxt)
   {
   }
@@ -1113,106 +1383,48 @@ struct RecordTypeEquals : std::binary_function<RecordBuffer, RecordBuffer, bool>
 /**
  * Interesting thing about this hash table is that it supports having different data structures
  * in the table and used as probes (which is of course necessary for database style applications).
+ *
+ * Layout is open addressing in the style of SwissTable.  Each slot has
+ * a control byte that is either Empty or the low 7 bits of the hash 
+ * value (the tag).  Slots are probed a group of GroupSize control bytes 
+ * at a time: one SSE2 compare finds all candidate slots in a group, so 
+ * we only touch the slot array (full hash and RecordBuffer) for likely 
+ * matches.  Groups are visited in triangular order which covers all groups
+ * since the number of groups is a power of 2.  Entries are never deleted
+ * so a probe sequence ends at the first group with an empty slot.
+ *
+ * A bitmap tracks which entries have been matched by a query; this is
+ * required for outer join processing.
+ *
+ * Slots keep the full 64-bit result of #(); the tag comes from the
+ * low 7 bits and the group from the bits above them.
  */
 class paged_hash_table
 {
-  friend class scan_iterator;
 public:
+  enum { GroupSizeLog2 = 4, GroupSize = 16, Empty = 0x80 };
 
-  // TODO: Make sense of this on x64
-  // We want the page of the hash table to be at least 2 cache lines since
-  // in many cases we will only need to look at hash values to know that the page doesn't match.
-  // TODO: Incorporate bitmap vectors/Bloom filters
-  enum { PageSizeLog2 = 7, PageSize=128, PageEntries=10/*PageSize/(sizeof(uint32_t) + sizeof(RecordBuffer))*/, Sentinel= PageEntries - 1 };
-
-  // This is the structure of a page of a bucket of the hash table
-  class bucket_page
+  struct slot
   {
-  public:
-    // The first PageEntries-1 bits here are used as
-    // markers for when a Value has been matched in a 
-    // join.  This is required for outer join processing.
-    // The remaining bits can be used for a Bloom filter when
-    // I take the time to get that working.
-    uint64_t Bitmap;
-    uint32_t Hash[PageEntries];
-    RecordBuffer Value[PageEntries-1];
-    bucket_page * Next;
-    bucket_page()
-      :
-      Bitmap(0),
-      Next(NULL)
-    {
-      memset(&Hash[0], 0, sizeof(Hash));
-    }
-    bucket_page(uint32_t hashValue, RecordBuffer value)
-      :
-      Bitmap(0),
-      Next(NULL)
-    {
-      memset(&Hash[0], 0, sizeof(Hash));
-      Hash[0] = hashValue;
-      Value[0] = value;
-    }
-    void mark_value(const uint32_t * hashPtr)
-    {
-      Bitmap |= (1UL << (hashPtr - &Hash[0]));
-    }
-    bool marked(const uint32_t * hashPtr) const
-    {
-      return (Bitmap & (1UL << (hashPtr - &Hash[0]))) != 0;
-    }
+    uint64_t Hash;
+    RecordBuffer Value;
   };
 
-  // class raw_bucket_iterator
-  // {
-  // private:
-  //   // Current Page
-  //   bucket_page * mPage;
-  //   // Current position within bucket_page::Hash array
-  //   uint32_t * mHashPtr;
-
-  //   void increment()
-  //   {
-  //     if (&mPage->Hash[Sentinel] == mHashPtr) {
-  //     }
-  //   }
-  // public:
-  //   raw_bucket_iterator ()
-  //     :
-  //     mPage(NULL),
-  //     mHashPtr(NULL)
-  //   {
-  //   }
-  //   // Preincrement
-  //   raw_bucket_iterator& operator++()
-  //   {
-  //     increment();
-  //     return *this;
-  //   }
-  //   // Postincrement
-  //   raw_bucket_iterator operator++(int )
-  //   {
-  //     raw_bucket_iterator tmp(mPage, mHashPtr);
-  //     increment();
-  //     return tmp;
-  //   }
-  // };
   class insert_predicate 
   {
   public:
-    IQLFunctionModule::LLVMFuncType HashFunc;
+    IQLFunctionModule::LLVMFunc64Type HashFunc;
     RecordBuffer InsertThis;
-    insert_predicate(IQLFunctionModule::LLVMFuncType hashFunc)
+    insert_predicate(IQLFunctionModule::LLVMFunc64Type hashFunc)
       :
       HashFunc(hashFunc)
     {
     }
-    uint32_t hash(InterpreterContext * ctxt)
+    uint64_t hash(InterpreterContext * ctxt)
     {
-      int32_t ret;
+      int64_t ret;
       ((*HashFunc)( (char *) InsertThis.Ptr, NULL, &ret, ctxt));
-      return (uint32_t) ret;      
+      return (uint64_t) ret;      
     }
     bool equals (RecordBuffer buf, InterpreterContext * )
     {
@@ -1222,10 +1434,10 @@ public:
   class probe_predicate 
   {
   public:
-    IQLFunctionModule::LLVMFuncType HashFunc;
+    IQLFunctionModule::LLVMFunc64Type HashFunc;
     IQLFunctionModule::LLVMFuncType EqFunc;
     RecordBuffer ProbeThis;
-    probe_predicate(IQLFunctionModule::LLVMFuncType hashFunc,
+    probe_predicate(IQLFunctionModule::LLVMFunc64Type hashFunc,
 		    IQLFunctionModule::LLVMFuncType eqFunc)
       :
       HashFunc(hashFunc),
@@ -1235,15 +1447,15 @@ public:
     probe_predicate(const IQLFunctionModule * hashFunc,
 		    const IQLFunctionModule * eqFunc)
       :
-      HashFunc(hashFunc->getRawFunction()),
+      HashFunc(hashFunc->getRawFunction64()),
       EqFunc(eqFunc->getRawFunction())
     {
     }
-    uint32_t hash(InterpreterContext * ctxt)
+    uint64_t hash(InterpreterContext * ctxt)
     {
-      int32_t ret;
+      int64_t ret;
       ((*HashFunc)( (char *) ProbeThis.Ptr, NULL, &ret, ctxt));
-      return (uint32_t) ret;      
+      return (uint64_t) ret;      
     }
     bool equals (RecordBuffer buf, InterpreterContext * ctxt)
     {
@@ -1256,7 +1468,7 @@ public:
   class scan_true_predicate
   {
   public:
-    bool test(bucket_page * , uint32_t * hashPtr) 
+    bool test(const paged_hash_table& , std::size_t ) 
     {
       return true;
     }
@@ -1265,9 +1477,9 @@ public:
   class scan_not_marked_predicate
   {
   public:
-    bool test(bucket_page * p, uint32_t * hashPtr) 
+    bool test(const paged_hash_table& table, std::size_t s) 
     {
-      return !p->marked(hashPtr);
+      return !table.marked(s);
     }
   };
 
@@ -1275,110 +1487,51 @@ public:
   class scan_iterator
   {
   public:
-    // Current page
-    bucket_page * mPage;
-    // Current bucket
-    bucket_page * mBucket;
-    // Last bucket head + 1
-    bucket_page * mBucketEnd;
-    // Current position within the bucket_page::Hash array
-    uint32_t * mHashPtr;
+    paged_hash_table * mTable;
+    // Current slot
+    std::size_t mSlot;
+    // Next slot to examine
+    std::size_t mNext;
     // Predicate for testing output
     _Pred mPredicate;
-    // State of the coroutine
-    enum State { START, NEXT, DONE };
-    State mState;
 
     scan_iterator()
       :
-      mPage(NULL),
-      mBucket(NULL),
-      mBucketEnd(NULL),
-      mHashPtr(NULL),
-      mState(START)
+      mTable(NULL),
+      mSlot(0),
+      mNext(0)
     {
     }
     scan_iterator(paged_hash_table& table)
       :
-      mPage(table.mBuckets),
-      mBucket(table.mBuckets),
-      mBucketEnd(table.mBuckets + table.mNumBuckets),
-      mHashPtr(NULL),
-      mState(START)
+      mTable(&table),
+      mSlot(0),
+      mNext(0)
     {
     }
     void init(paged_hash_table& table)
     {
-      mPage = table.mBuckets;
-      mBucket = table.mBuckets;
-      mBucketEnd = table.mBuckets + table.mNumBuckets;
-      mHashPtr = NULL;
-      mState = START;
-    }
-    bucket_page * next_page()
-    {
-      return mPage;
-    }
-    void advance_page()
-    {
-      mPage = mPage->Next;
+      mTable = &table;
+      mSlot = 0;
+      mNext = 0;
     }
     // Current value of the location
     RecordBuffer& value()
     {
-      return value(mHashPtr, next_page());
-    }
-
-    static RecordBuffer& value(uint32_t * hashPtr, bucket_page * p)
-    {
-      return p->Value[hashPtr - &(p->Hash[0])];      
+      return mTable->mSlots[mSlot].Value;
     }
 
+    // Safe to call next as many time as you want once it
+    // has returned false.
     bool next(InterpreterContext * ctxt)
     {
-      bucket_page * p = next_page();
-      switch(mState) {
-      case START:
-	while(p != NULL) {
-	  // Start of page.  Iterate over the page
-	  for(mHashPtr = &p->Hash[0]; *mHashPtr != 0; ++mHashPtr) {
-	    if (!mPredicate.test(p, mHashPtr))
-	      continue;
-	    mState = NEXT;
-	    return true;
-	  case NEXT:
-	    ;
-	  }
-
-	  // End of bucket page.  Is there another page?
-	  if(&p->Hash[Sentinel] == mHashPtr && p->Next) {
-	    // We are at the end of a full node.  Advance and continue.
-	    advance_page();
-	    p = next_page();
-	    continue;
-	  } else if (++mBucket != mBucketEnd) {
-	    // End of a partial page.  This must be the last page of bucket.
-	    // Move to next bucket
-	    p = mPage = mBucket;
-	    continue;
-	  } else {
-	    // End of a partial page.  This must be the last page of bucket.
-	    // Break outta here cause we don't have any more buckets.
-	    break;
-	  }
+      std::size_t sz = mTable->capacity();
+      for(; mNext < sz; ++mNext) {
+	if (mTable->full(mNext) && mPredicate.test(*mTable, mNext)) {
+	  mSlot = mNext++;
+	  return true;
 	}
-	 
-	// Safe to call next as many time as you want.  You just keep
-	// getting false back.
-	do {
-	  mState = DONE;
-	  return false;
-	case DONE:
-	  ;
-	} while(true);
       }
-
-      // Never get here
       return false;
     }
   };
@@ -1386,19 +1539,22 @@ public:
   typedef scan_iterator<scan_true_predicate> scan_all_iterator;
   typedef scan_iterator<scan_not_marked_predicate> scan_not_marked_iterator;
 
-  // Where am I within the bucket
   template <class _Pred>
   class query_iterator
   {
   public:
-    // Current page
-    bucket_page * mPage;
-    // Current position within the bucket_page::Hash array
-    uint32_t * mHashPtr;
-    // Am I positioned in front of the first page?
-    bool mStutter;
+    paged_hash_table * mTable;
+    // Group being probed.  Once next() returns false this 
+    // is a group with an empty slot for the query hash value.
+    uint32_t mGroup;
+    // Number of groups probed so far
+    uint32_t mProbeStep;
+    // Slots in mGroup whose tag matches that haven't been checked
+    uint32_t mTagMatches;
+    // Current slot
+    std::size_t mSlot;
     // The hash value of the record that we are looking up
-    uint32_t mQueryHashValue;
+    uint64_t mQueryHashValue;
     // Equality predicate.  May be much more than just comparing
     // the keys we hashed.
     _Pred mQueryPredicate;
@@ -1406,23 +1562,13 @@ public:
     enum State { START, NEXT, DONE };
     State mState;
 
-    // Navigation
-    // In general, mPage is lagging one behind
-    // current.  This makes it easier to do inserts
-    // of new pages.  For the first page though
-    // we "stutter" and don't advance.
-    void advance_page()
-    {
-      mPage  = next_page();
-      mStutter = false;
-    }
-
-  public:
     query_iterator()
       :
-      mPage(NULL),
-      mHashPtr(NULL),
-      mStutter(true),
+      mTable(NULL),
+      mGroup(0),
+      mProbeStep(0),
+      mTagMatches(0),
+      mSlot(0),
       mQueryHashValue(0),
       mState(START)
     {
@@ -1430,74 +1576,59 @@ public:
 
     query_iterator(const _Pred& queryPredicate)
       :
-      mPage(NULL),
-      mHashPtr(NULL),
-      mStutter(true),
+      mTable(NULL),
+      mGroup(0),
+      mProbeStep(0),
+      mTagMatches(0),
+      mSlot(0),
       mQueryHashValue(0),
       mQueryPredicate(queryPredicate),
       mState(START)
     {
     }
 
-    void init(bucket_page * page,
-	      uint32_t queryHashValue)
+    void init(paged_hash_table * table,
+	      uint64_t queryHashValue)
     {
-      mPage=page;
-      mHashPtr=NULL;
-      mStutter=true;
-      mQueryHashValue=queryHashValue;
-      mState=START;
-    }
-
-    // The value of next page.
-    bucket_page * next_page() const 
-    {
-      return mStutter ? mPage : mPage->Next; 
+      mTable = table;
+      mGroup = table->first_group(queryHashValue);
+      mProbeStep = 0;
+      mTagMatches = 0;
+      mSlot = 0;
+      mQueryHashValue = queryHashValue;
+      mState = START;
     }
 
     // Current value of the location
     RecordBuffer value()
     {
-      return value(mHashPtr, next_page());
-    }
-
-    static RecordBuffer value(uint32_t * hashPtr, bucket_page * p)
-    {
-      return p->Value[hashPtr - &(p->Hash[0])];      
+      return mTable->mSlots[mSlot].Value;
     }
 
     bool next(InterpreterContext * ctxt)
     {
-      bucket_page * p = next_page();
       switch(mState) {
       case START:
-	while(p != NULL) {
-	  // Start of page.  Iterate over the page
-	  for(mHashPtr = &p->Hash[0]; *mHashPtr != 0; ++mHashPtr) {
-	    BOOST_ASSERT(mHashPtr <= &p->Hash[Sentinel]);
-	    if(*mHashPtr == mQueryHashValue) {
-	      if(mQueryPredicate.equals(value(mHashPtr, p), ctxt)) {
+	while(true) {
+	  for(mTagMatches = mTable->match_tag(mGroup, mQueryHashValue);
+	      mTagMatches != 0;
+	      mTagMatches &= mTagMatches - 1) {
+	    mSlot = (mGroup << GroupSizeLog2) + __builtin_ctz(mTagMatches);
+	    if(mTable->mSlots[mSlot].Hash == mQueryHashValue &&
+	       mQueryPredicate.equals(mTable->mSlots[mSlot].Value, ctxt)) {
 	      // Match.  Mark as such. Return with true.
-		p->mark_value(mHashPtr);
+	      mTable->mark(mSlot);
 	      mState = NEXT;
 	      return true;
 	    case NEXT:
 	      ;
-	      }
 	    }
 	  }
-
-	  // End of bucket page.  Is there another page?
-	  if(&p->Hash[Sentinel] == mHashPtr) {
-	    // We are at the end of a full node.  Advance and continue.
-	    advance_page();
-	    p = next_page();
-	    continue;
-	  } else {
-	    // End of a partial page.  This must be the last page.
-	    // Break outta here cause we're done.
+	  // An empty slot in the group ends the probe sequence.
+	  if (mTable->match_empty(mGroup)) {
 	    break;
 	  }
+	  mGroup = mTable->next_group(mGroup, ++mProbeStep);
 	}
 	 
 	// Safe to call next as many time as you want.  You just keep
@@ -1513,45 +1644,119 @@ public:
       // Never get here
       return false;
     }
-
-    void link(bucket_page * page)
-    {
-      page->Next = mPage->Next;
-      mPage->Next = page;
-    }
-
-    void set(uint32_t hashValue, RecordBuffer value)
-    {
-      *mHashPtr = hashValue;
-      bucket_page * p = next_page();
-      p->Value[mHashPtr - &p->Hash[0]] = value;
-    }
   };
 
 private:
   bool mOwnTableData;
-  int32_t mNumBuckets;
-  bucket_page * mBuckets;
+  uint32_t mNumGroups;
+  uint32_t mGroupMask;
+  // Control bytes, one per slot.
+  uint8_t * mCtrl;
+  slot * mSlots;
+  // Bitmap of matched slots
+  uint64_t * mMarked;
   // Table hash function
   insert_predicate mTableHash;
-  double mLoadFactor;
   int64_t mSize;
+  // Grow when size reaches this.
+  int64_t mGrowthLimit;
 
-  static void insert(bucket_page * p,
-		     RecordBuffer tableInput,
-		     uint32_t h);
+  uint32_t first_group(uint64_t h) const
+  {
+    return (uint32_t) (h >> 7) & mGroupMask;
+  }
+  uint32_t next_group(uint32_t g, uint32_t probeStep) const
+  {
+    return (g + probeStep) & mGroupMask;
+  }
+  // Bitmask of slots in group g whose control byte is c.
+  uint32_t match_ctrl(uint32_t g, uint8_t c) const
+  {
+    const uint8_t * ctrl = mCtrl + (g << GroupSizeLog2);
+#if defined(__SSE2__)
+    __m128i group = _mm_loadu_si128((const __m128i *) ctrl);
+    return (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char) c)));
+#else
+    uint32_t ret = 0;
+    for(int32_t i=0; i<GroupSize; ++i) {
+      if (ctrl[i] == c) ret |= (1U << i);
+    }
+    return ret;
+#endif
+  }
+  uint32_t match_tag(uint32_t g, uint64_t h) const
+  {
+    return match_ctrl(g, (uint8_t) (h & 0x7f));
+  }
+  uint32_t match_empty(uint32_t g) const
+  {
+    return match_ctrl(g, Empty);
+  }
+  void prefetch(uint32_t g) const
+  {
+    __builtin_prefetch(mCtrl + (g << GroupSizeLog2));
+    __builtin_prefetch(mSlots + (g << GroupSizeLog2));
+  }
+  void mark(std::size_t s)
+  {
+    mMarked[s >> 6] |= (1ULL << (s & 63));
+  }
+  void place(std::size_t s, uint64_t h, RecordBuffer value)
+  {
+    mCtrl[s] = (uint8_t) (h & 0x7f);
+    mSlots[s].Hash = h;
+    mSlots[s].Value = value;
+  }
+  // First empty slot in the probe sequence of h.
+  std::size_t find_empty(uint64_t h) const;
+  void allocate(uint32_t numGroups);
+  void deallocate();
 public:
   paged_hash_table(bool ownTableData, const IQLFunctionModule * tableHash);
   ~paged_hash_table();
   void insert(RecordBuffer tableInput, InterpreterContext * ctxt);
   // TODO: Templatize on probe_predicate (this should also be used in insert with
   // and insert/table predicate).
+  /**
+   * Insert at the end of the probe sequence of a query
+   * that failed to find a match.
+   */
   void insert(RecordBuffer tableInput, 
 	      query_iterator<probe_predicate> & it);
   void find(query_iterator<probe_predicate> & it, InterpreterContext * ctxt);
-  // Increase number of buckets due to load factor
+  /**
+   * Position a batch of queries.  All probe records are hashed and
+   * the first group of each is prefetched before any comparisons happen
+   * so that the cache misses of the batch overlap.  Call next() on each
+   * iterator afterward.
+   */
+  template <class _Pred>
+  void find(query_iterator<_Pred> * its, std::size_t n, InterpreterContext * ctxt)
+  {
+    for(std::size_t i=0; i<n; ++i) {
+      its[i].init(this, its[i].mQueryPredicate.hash(ctxt));
+      prefetch(its[i].mGroup);
+    }
+  }
+  // Increase number of slots
   void grow(double growthFactor);
   void clear();
+  std::size_t capacity() const
+  {
+    return std::size_t(mNumGroups) << GroupSizeLog2;
+  }
+  int64_t size() const
+  {
+    return mSize;
+  }
+  bool full(std::size_t s) const
+  {
+    return mCtrl[s] != Empty;
+  }
+  bool marked(std::size_t s) const
+  {
+    return (mMarked[s >> 6] & (1ULL << (s & 63))) != 0;
+  }
 };
 
 class RuntimeHashGroupByOperatorType : public RuntimeOperatorType
@@ -1812,6 +2017,9 @@ private:
   RecordTypeTransfer * mTableMakeNullableTransfer;
   JoinType mJoinType;
   bool mJoinOne;
+  // Memory budget and temp directory of cross joins.
+  std::string mTempDir;
+  std::size_t mMemory;
 
   void init(DynamicRecordContext & ctxt,
 	    const std::vector<std::string>& tableKeys,
@@ -1998,7 +2206,16 @@ private:
   State mState;
   class InterpreterContext * mRuntimeContext;
   paged_hash_table mTable;
-  paged_hash_table::query_iterator<paged_hash_table::probe_predicate> mSearchIterator;
+  // Probe records are looked up a block at a time so that
+  // the cache misses of the lookups overlap.
+  typedef paged_hash_table::query_iterator<paged_hash_table::probe_predicate> query_iterator;
+  static const std::size_t PROBE_BLOCK = 64;
+  std::vector<query_iterator> mProbeBlock;
+  std::size_t mProbeBlockSize;
+  std::size_t mProbeIt;
+  bool mProbeEOS;
+  // The lookup of the probe record being joined
+  query_iterator * mSearchIterator;
   RecordBuffer mNullProbeRecord;
   RecordBuffer mNullTableRecord;
   paged_hash_table::scan_not_marked_iterator mScanIterator;
@@ -2017,6 +2234,14 @@ public:
   void shutdown();
 };
 
+/**
+ * Block nested loops join.  The table input is held in memory
+ * up to a budget with the remainder spilled to disk.  Probe records
+ * are read in blocks and joined with cache sized chunks of
+ * the table; the spilled part of the table is replayed once per
+ * probe block.  The in memory table, a probe block and a chunk of
+ * replayed spill together stay within the memory budget.
+ */
 class RuntimeCrossJoinOperatorType : public RuntimeOperatorType
 {
 public:
@@ -2026,6 +2251,12 @@ private:
   RecordTypeFree mProbeFree;
   IQLFunctionModule * mEqFun;
   IQLTransferModule2 * mTransferModule;
+  RecordTypeSerialize mTableSerialize;
+  RecordTypeDeserialize mTableDeserialize;
+  RecordTypeMalloc mTableMalloc;
+  RecordTypeSerialize mProbeSerialize;
+  std::string mTempDir;
+  std::size_t mMemoryAllowed;
   // Serialization
   friend class boost::serialization::access;
   template <class Archive>
@@ -2036,24 +2267,39 @@ private:
     ar & BOOST_SERIALIZATION_NVP(mProbeFree);
     ar & BOOST_SERIALIZATION_NVP(mEqFun);
     ar & BOOST_SERIALIZATION_NVP(mTransferModule);
+    ar & BOOST_SERIALIZATION_NVP(mTableSerialize);
+    ar & BOOST_SERIALIZATION_NVP(mTableDeserialize);
+    ar & BOOST_SERIALIZATION_NVP(mTableMalloc);
+    ar & BOOST_SERIALIZATION_NVP(mProbeSerialize);
+    ar & BOOST_SERIALIZATION_NVP(mTempDir);
+    ar & BOOST_SERIALIZATION_NVP(mMemoryAllowed);
   }
   RuntimeCrossJoinOperatorType()
     :
     mEqFun(NULL),
-    mTransferModule(NULL)
+    mTransferModule(NULL),
+    mMemoryAllowed(128*1024*1024)
   {
   }
 public:
-  RuntimeCrossJoinOperatorType(const RecordTypeFree & tableFreeFunctor, 
-			       const RecordTypeFree & probeFreeFunctor,
+  RuntimeCrossJoinOperatorType(const RecordType * tableInput, 
+			       const RecordType * probeInput,
 			       const RecordTypeFunction * eqFun,
-			       const RecordTypeTransfer2 * transferFun)
+			       const RecordTypeTransfer2 * transferFun,
+			       const std::string& tempDir = "",
+			       std::size_t memoryAllowed = 128*1024*1024)
     :
     RuntimeOperatorType("RuntimeCrossJoinOperatorType"),
-    mTableFree(tableFreeFunctor),
-    mProbeFree(probeFreeFunctor),
+    mTableFree(tableInput->getFree()),
+    mProbeFree(probeInput->getFree()),
     mEqFun(eqFun ? eqFun->create() : NULL),
-    mTransferModule(transferFun->create())
+    mTransferModule(transferFun->create()),
+    mTableSerialize(tableInput->getSerialize()),
+    mTableDeserialize(tableInput->getDeserialize()),
+    mTableMalloc(tableInput->getMalloc()),
+    mProbeSerialize(probeInput->getSerialize()),
+    mTempDir(tempDir),
+    mMemoryAllowed(memoryAllowed)
   {
   }
   
@@ -2065,13 +2311,50 @@ public:
 class RuntimeCrossJoinOperator : public RuntimeOperator
 {
 private:
-  enum State { START, READ_TABLE, READ_PROBE, WRITE, WRITE_EOS };
+  enum State { START, READ_TABLE, READ_PROBE, WRITE, WRITE_SPILL, WRITE_EOS };
   State mState;
   class InterpreterContext * mRuntimeContext;
-  RecordBuffer mProbe;
+  // Table held in memory and the bytes it occupies.
   std::vector<RecordBuffer> mTable;
-  std::vector<RecordBuffer>::iterator mScanIterator;
+  std::size_t mTableSize;
+  // Table records beyond the memory budget.
+  class RecordSpillFile * mTableSpill;
+  // A chunk of the spilled table read back from disk.
+  std::vector<RecordBuffer> mSpillChunk;
+  // The current block of probe records.
+  std::vector<RecordBuffer> mProbes;
+  std::size_t mProbeSize;
+  bool mProbeEOS;
+  // Records per cache sized chunk of table and probe.
+  std::size_t mTableChunk;
+  std::size_t mProbeChunk;
+  std::size_t mTableIt;
+  std::size_t mProbeIt;
+  // Matching (table, probe) offsets within the current chunks
+  // and the next pair to evaluate when the batch filled up.
+  std::vector<std::pair<uint32_t, uint32_t> > mMatches;
+  std::size_t mMatchIt;
+  std::size_t mJoinTable;
+  std::size_t mJoinProbe;
   const RuntimeCrossJoinOperatorType & getCrossJoinType() { return *reinterpret_cast<const RuntimeCrossJoinOperatorType *>(&getOperatorType()); }
+
+  // Bytes in a cache sized chunk of table or probe records.
+  static const std::size_t CHUNK_BYTES = 64*1024;
+  // Matches buffered before they are written.
+  static const std::size_t MATCH_BATCH = 1024;
+  static std::size_t getChunkSize(std::size_t bytes, std::size_t records);
+  std::size_t getProbeBlockSize();
+  std::size_t getProbeChunkEnd() const;
+  void bufferTable(RecordBuffer buf);
+  bool readSpillChunk();
+  void freeSpillChunk();
+  /**
+   * Evaluate the predicate on pairs of a table chunk and the
+   * current probe chunk starting at (mJoinTable, mJoinProbe),
+   * recording up to MATCH_BATCH matches.
+   */
+  void joinChunk(const RecordBuffer * table, std::size_t tableSize);
+  void writeMatch(RuntimePort * port, const RecordBuffer * table);
 public:
   RuntimeCrossJoinOperator(RuntimeOperator::Services& services, const RuntimeCrossJoinOperatorType& opType);
   ~RuntimeCrossJoinOperator();
@@ -2080,12 +2363,24 @@ public:
   void shutdown();
 };
 
+/**
+ * Partition records on a hash value.  Records whose hash is one
+ * of a known set of heavy hitters may instead be spread round robin
+ * across all partitions (SPLIT) or sent to every partition 
+ * (REPLICATE).  Splitting one input of a join on its heavy hitters
+ * while replicating the other input keeps a hot key from landing
+ * on a single partition.
+ */
 class RuntimeHashPartitionerOperatorType : public RuntimeOperatorType
 {
 public:
   friend class RuntimeHashPartitionerOperator;
+  enum SkewPolicy { HASH, SPLIT, REPLICATE };
 private:
   IQLFunctionModule * mHashFun;
+  // Sorted hash values of heavy hitters.
+  std::vector<uint64_t> mHeavyHitters;
+  SkewPolicy mSkewPolicy;
   // Serialization
   friend class boost::serialization::access;
   template <class Archive>
@@ -2093,19 +2388,39 @@ private:
   {
     ar & BOOST_SERIALIZATION_BASE_OBJECT_NVP(RuntimeOperatorType);
     ar & BOOST_SERIALIZATION_NVP(mHashFun);
+    ar & BOOST_SERIALIZATION_NVP(mHeavyHitters);
+    ar & BOOST_SERIALIZATION_NVP(mSkewPolicy);
   }
   RuntimeHashPartitionerOperatorType()
     :
-    mHashFun(NULL)
+    mHashFun(NULL),
+    mSkewPolicy(HASH)
   {
   }
 public:
   RuntimeHashPartitionerOperatorType(IQLFunctionModule * hashFun)
     :
     RuntimeOperatorType("RuntimeHashPartitionerOperatorType"),
-    mHashFun(hashFun)
+    mHashFun(hashFun),
+    mSkewPolicy(HASH)
   {
   }
+  RuntimeHashPartitionerOperatorType(IQLFunctionModule * hashFun,
+				     const std::vector<uint64_t>& heavyHitters,
+				     SkewPolicy skewPolicy)
+    :
+    RuntimeOperatorType("RuntimeHashPartitionerOperatorType"),
+    mHashFun(hashFun),
+    mHeavyHitters(heavyHitters),
+    mSkewPolicy(skewPolicy)
+  {
+    std::sort(mHeavyHitters.begin(), mHeavyHitters.end());
+  }
+  bool isHeavyHitter(uint64_t h) const
+  {
+    return mSkewPolicy != HASH &&
+      std::binary_search(mHeavyHitters.begin(), mHeavyHitters.end(), h);
+  }
   ~RuntimeHashPartitionerOperatorType();
   bool isPartitioner() const { return true; }
   RuntimeOperator * create(RuntimeOperator::Services & s) const;
@@ -2114,11 +2429,15 @@ public:
 class RuntimeHashPartitionerOperator : public RuntimeOperatorBase<RuntimeHashPartitionerOperatorType>
 {
 private:
-  enum State { START, READ, WRITE, WRITE_EOS };
+  enum State { START, READ, WRITE, WRITE_REPLICA, WRITE_EOS };
   State mState;
   class InterpreterContext * mRuntimeContext;
   RecordBuffer mBuffer;
   output_port_iterator mOutputIt;
+  // Is the current record a heavy hitter to replicate?
+  bool mReplicate;
+  // Next target for heavy hitters being split.
+  std::size_t mNextSplit;
 public:
   RuntimeHashPartitionerOperator(RuntimeOperator::Services& services, const RuntimeHashPartitionerOperatorType& opType);
   ~RuntimeHashPartitionerOperator();
@@ -2127,12 +2446,179 @@ public:
   void shutdown();
 };
 
+/**
+ * First stage of range partitioning.  Buffers a sample of its 
+ * input and writes shared references to the sample on SAMPLE_PORT
+ * followed by EOS; then passes all of its input, sample included,
+ * through to DATA_PORT.  The sample is complete before any data is
+ * written so that splitters computed from the samples of all partitions 
+ * never wait on the range partitioner that consumes DATA_PORT.
+ */
+class RuntimeRangeSampleOperatorType : public RuntimeOperatorType
+{
+public:
+  friend class RuntimeRangeSampleOperator;
+  enum Ports { SAMPLE_PORT=0, DATA_PORT=1 };
+private:
+  std::size_t mSampleSize;
+  // Serialization
+  friend class boost::serialization::access;
+  template <class Archive>
+  void serialize(Archive & ar, const unsigned int version)
+  {
+    ar & BOOST_SERIALIZATION_BASE_OBJECT_NVP(RuntimeOperatorType);
+    ar & BOOST_SERIALIZATION_NVP(mSampleSize);
+  }
+  RuntimeRangeSampleOperatorType()
+    :
+    mSampleSize(0)
+  {
+  }
+public:
+  RuntimeRangeSampleOperatorType(std::size_t sampleSize)
+    :
+    RuntimeOperatorType("RuntimeRangeSampleOperatorType"),
+    mSampleSize(sampleSize)
+  {
+  }
+  ~RuntimeRangeSampleOperatorType();
+  RuntimeOperator * create(RuntimeOperator::Services & s) const;
+};
+
+class RuntimeRangeSampleOperator : public RuntimeOperatorBase<RuntimeRangeSampleOperatorType>
+{
+private:
+  enum State { START, READ_SAMPLE, WRITE_SAMPLE, WRITE_SAMPLE_EOS, WRITE_BUFFERED, READ, WRITE, WRITE_EOS };
+  State mState;
+  RecordBuffer mBuffer;
+  bool mInputEOS;
+  std::vector<RecordBuffer> mSample;
+  std::size_t mSampleIt;
+public:
+  RuntimeRangeSampleOperator(RuntimeOperator::Services& services, const RuntimeRangeSampleOperatorType& opType);
+  ~RuntimeRangeSampleOperator();
+  void start();
+  void onEvent(RuntimePort * port);
+  void shutdown();
+};
+
+/**
+ * Reads the pooled samples of all partitions and writes the records
+ * whose key prefixes split the sample into one range per partition.
+ * Samples are gathered onto a single partition; the splitter on any
+ * other partition sees only EOS and writes only EOS.
+ */
+class RuntimeRangeSplitterOperatorType : public RuntimeOperatorType
+{
+public:
+  friend class RuntimeRangeSplitterOperator;
+private:
+  IQLFunctionModule * mKeyPrefix;
+  RecordTypeFree mFree;
+  // Serialization
+  friend class boost::serialization::access;
+  template <class Archive>
+  void serialize(Archive & ar, const unsigned int version)
+  {
+    ar & BOOST_SERIALIZATION_BASE_OBJECT_NVP(RuntimeOperatorType);
+    ar & BOOST_SERIALIZATION_NVP(mKeyPrefix);
+    ar & BOOST_SERIALIZATION_NVP(mFree);
+  }
+  RuntimeRangeSplitterOperatorType()
+    :
+    mKeyPrefix(NULL)
+  {
+  }
+public:
+  RuntimeRangeSplitterOperatorType(const RecordType * input,
+				   const RecordTypeFunction * keyPrefix);
+  ~RuntimeRangeSplitterOperatorType();
+  RuntimeOperator * create(RuntimeOperator::Services & s) const;
+};
+
+class RuntimeRangeSplitterOperator : public RuntimeOperatorBase<RuntimeRangeSplitterOperatorType>
+{
+private:
+  enum State { START, READ, WRITE, WRITE_EOS };
+  State mState;
+  class InterpreterContext * mRuntimeContext;
+  RecordBuffer mBuffer;
+  // Sample records with their key prefixes
+  std::vector<std::pair<uint32_t, RecordBuffer> > mSample;
+  std::vector<RecordBuffer> mSplitters;
+  std::size_t mSplitterIt;
+public:
+  RuntimeRangeSplitterOperator(RuntimeOperator::Services& services, const RuntimeRangeSplitterOperatorType& opType);
+  ~RuntimeRangeSplitterOperator();
+  void start();
+  void onEvent(RuntimePort * port);
+  void shutdown();
+};
+
+/**
+ * Partition records into contiguous ranges of a sort key so that 
+ * concatenating the (sorted) target partitions in partition order
+ * yields a totally ordered result.  Splitter records are read from 
+ * SPLITTER_PORT to EOS before any data is read from DATA_PORT.
+ * A record goes to the range numbered by the count of splitters whose
+ * key prefix is no greater than its own, so records with equal key
+ * prefix always land in the same range.
+ */
+class RuntimeRangePartitionerOperatorType : public RuntimeOperatorType
+{
+public:
+  friend class RuntimeRangePartitionerOperator;
+  enum Ports { DATA_PORT=0, SPLITTER_PORT=1 };
+private:
+  IQLFunctionModule * mKeyPrefix;
+  // Free splitter records
+  RecordTypeFree mFree;
+  // Serialization
+  friend class boost::serialization::access;
+  template <class Archive>
+  void serialize(Archive & ar, const unsigned int version)
+  {
+    ar & BOOST_SERIALIZATION_BASE_OBJECT_NVP(RuntimeOperatorType);
+    ar & BOOST_SERIALIZATION_NVP(mKeyPrefix);
+    ar & BOOST_SERIALIZATION_NVP(mFree);
+  }
+  RuntimeRangePartitionerOperatorType();
+public:
+  RuntimeRangePartitionerOperatorType(const RecordType * input,
+				      const RecordTypeFunction * keyPrefix);
+  ~RuntimeRangePartitionerOperatorType();
+  bool isPartitioner() const { return true; }
+  RuntimeOperator * create(RuntimeOperator::Services & s) const;
+};
+
+class RuntimeRangePartitionerOperator : public RuntimeOperatorBase<RuntimeRangePartitionerOperatorType>
+{
+private:
+  enum State { START, READ_SPLITTER, READ, WRITE, WRITE_EOS };
+  State mState;
+  class InterpreterContext * mRuntimeContext;
+  RecordBuffer mBuffer;
+  // Key prefixes of the splitters, sorted as unsigned like the
+  // prefixes of the sort operator.
+  std::vector<uint32_t> mSplitters;
+  output_port_iterator mOutputIt;
+  std::size_t getRange(uint32_t prefix) const;
+public:
+  RuntimeRangePartitionerOperator(RuntimeOperator::Services& services, const RuntimeRangePartitionerOperatorType& opType);
+  ~RuntimeRangePartitionerOperator();
+  void start();
+  void onEvent(RuntimePort * port);
+  void shutdown();
+};
+
 class RuntimeBroadcastPartitionerOperatorType : public RuntimeOperatorType
 {
 public:
   friend class RuntimeBroadcastPartitionerOperator;
 private:
   IQLTransferModule * mTransfer;
+  // Identity transfer: broadcast shared references to the input.
+  bool mIdentity;
   // Serialization
   friend class boost::serialization::access;
   template <class Archive>
@@ -2140,15 +2626,20 @@ private:
   {
     ar & BOOST_SERIALIZATION_BASE_OBJECT_NVP(RuntimeOperatorType);
     ar & BOOST_SERIALIZATION_NVP(mTransfer);
+    ar & BOOST_SERIALIZATION_NVP(mIdentity);
   }
   RuntimeBroadcastPartitionerOperatorType()
+    :
+    mTransfer(NULL),
+    mIdentity(false)
   {
   }
 public:
   RuntimeBroadcastPartitionerOperatorType(const RecordTypeTransfer * xfer)
     :
     RuntimeOperatorType("RuntimeBroadcastPartitionerOperatorType"),
-    mTransfer(xfer->create())
+    mTransfer(xfer->create()),
+    mIdentity(xfer->isIdentity())
   {
   }
   ~RuntimeBroadcastPartitionerOperatorType();
@@ -2198,6 +2689,32 @@ public:
   RuntimeOperator * create(RuntimeOperator::Services & s) const;
 };
 
+/**
+ * Collector that reads each source partition to exhaustion in 
+ * partition order.  Paired with a range partitioner this preserves
+ * a global sort order.
+ */
+class RuntimeOrderedCollectorOperatorType : public RuntimeOperatorType
+{
+private:
+  // Serialization
+  friend class boost::serialization::access;
+  template <class Archive>
+  void serialize(Archive & ar, const unsigned int version)
+  {
+    ar & BOOST_SERIALIZATION_BASE_OBJECT_NVP(RuntimeOperatorType);
+  }
+public:
+  RuntimeOrderedCollectorOperatorType()
+    :
+    RuntimeOperatorType("RuntimeOrderedCollectorOperatorType")
+  {
+  }
+  ~RuntimeOrderedCollectorOperatorType();
+  bool isCollector() const { return true; }
+  RuntimeOperator * create(RuntimeOperator::Services & s) const;
+};
+
 class SortMergeJoin : public LogicalOperator
 {
 public:
@@ -2217,12 +2734,40 @@ private:
   RecordTypeTransfer2 * mMatchTransfer;
   RecordTypeTransfer * mLeftMakeNullableTransfer;
   RecordTypeTransfer * mRightMakeNullableTransfer;
+  SortKeyNormalizer mLeftNormalizer;
+  SortKeyNormalizer mRightNormalizer;
+  RecordTypePrint mLeftKeyPrint;
+  std::string mTempDir;
+  std::size_t mMemory;
+  // Hashes of heavy hitter keys.  If not empty, both inputs are
+  // hash partitioned on the join key; heavy hitters of one input
+  // are split across partitions and those of the other replicated.
+  std::vector<uint64_t> mHeavyHitters;
+  RecordTypeFunction * mLeftHash;
+  RecordTypeFunction * mRightHash;
+  // Merge the partitioned streams of each input back into key order.
+  RecordTypeFunction * mLeftKeyPrefix;
+  RecordTypeFunction * mLeftKeyLessThan;
+  RecordTypeFunction * mRightKeyPrefix;
+  RecordTypeFunction * mRightKeyLessThan;
 
   void init(DynamicRecordContext & ctxt,
 	    const std::vector<SortKey>& leftKeys,
 	    const std::vector<SortKey>& rightKeys,
 	    const std::string& residual,
 	    const std::string& matchTransfer);
+  void initPartitioning(PlanCheckContext & ctxt,
+			const std::vector<SortKey>& leftKeys,
+			const std::vector<SortKey>& rightKeys,
+			const std::vector<std::string>& heavyHitters);
+  RuntimeOperatorType * createRepartition(class RuntimePlanBuilder& plan,
+					  std::size_t inputPort,
+					  const RecordType * input,
+					  const RecordTypeFunction * hash,
+					  const RecordTypeFunction * keyPrefix,
+					  const RecordTypeFunction * keyLessThan,
+					  const SortKeyNormalizer * normalizer,
+					  bool split);
 public:
   SortMergeJoin(JoinType joinType);
   SortMergeJoin(DynamicRecordContext & ctxt,
@@ -2282,6 +2827,18 @@ private:
   // for outer joins.
   RecordTypeMalloc mRightNullMalloc;
   RecordTypeFree mRightNullFree;
+  // Normalized keys for comparing left and right.  Empty
+  // if the keys have no normalized form.
+  SortKeyNormalizer mLeftNormalizer;
+  SortKeyNormalizer mRightNormalizer;
+  // Spilling of left key runs that exceed the memory budget.
+  RecordTypeSerialize mLeftSerialize;
+  RecordTypeDeserialize mLeftDeserialize;
+  RecordTypeMalloc mLeftMalloc;
+  // Print the key of a skewed run.
+  RecordTypePrint mLeftKeyPrint;
+  std::string mTempDir;
+  std::size_t mMemoryAllowed;
 
   // Serialization
   friend class boost::serialization::access;
@@ -2303,6 +2860,14 @@ private:
     ar & BOOST_SERIALIZATION_NVP(mLeftNullFree);    
     ar & BOOST_SERIALIZATION_NVP(mRightNullMalloc);    
     ar & BOOST_SERIALIZATION_NVP(mRightNullFree);    
+    ar & BOOST_SERIALIZATION_NVP(mLeftNormalizer);    
+    ar & BOOST_SERIALIZATION_NVP(mRightNormalizer);    
+    ar & BOOST_SERIALIZATION_NVP(mLeftSerialize);    
+    ar & BOOST_SERIALIZATION_NVP(mLeftDeserialize);    
+    ar & BOOST_SERIALIZATION_NVP(mLeftMalloc);    
+    ar & BOOST_SERIALIZATION_NVP(mLeftKeyPrint);    
+    ar & BOOST_SERIALIZATION_NVP(mTempDir);    
+    ar & BOOST_SERIALIZATION_NVP(mMemoryAllowed);    
   }
   RuntimeSortMergeJoinOperatorType()
     :
@@ -2314,7 +2879,8 @@ private:
     mEqFun(NULL),
     mMatchTransfer(NULL),
     mLeftMakeNullableTransfer(NULL),
-    mRightMakeNullableTransfer(NULL)
+    mRightMakeNullableTransfer(NULL),
+    mMemoryAllowed(128*1024*1024)
   {
   }
 public:
@@ -2327,7 +2893,12 @@ public:
 				   const RecordTypeFunction * eqFun,
 				   const RecordTypeTransfer2 * matchTransfer,
 				   const RecordTypeTransfer * leftMakeNullableTransfer,
-				   const RecordTypeTransfer * rightMakeNullableTransfer)
+				   const RecordTypeTransfer * rightMakeNullableTransfer,
+				   const SortKeyNormalizer * leftNormalizer = NULL,
+				   const SortKeyNormalizer * rightNormalizer = NULL,
+				   const std::string& tempDir = "",
+				   std::size_t memoryAllowed = 128*1024*1024,
+				   const RecordTypePrint * leftKeyPrint = NULL)
     :
     RuntimeOperatorType("RuntimeSortMergeJoinOperatorType"),
     mJoinType(joinType),
@@ -2350,8 +2921,18 @@ public:
     mLeftNullMalloc(leftMakeNullableTransfer->getTarget()->getMalloc()),
     mLeftNullFree(leftMakeNullableTransfer->getTarget()->getFree()),
     mRightNullMalloc(rightMakeNullableTransfer->getTarget()->getMalloc()),
-    mRightNullFree(rightMakeNullableTransfer->getTarget()->getFree())
-  {
+    mRightNullFree(rightMakeNullableTransfer->getTarget()->getFree()),
+    mLeftSerialize(leftInput->getSerialize()),
+    mLeftDeserialize(leftInput->getDeserialize()),
+    mLeftMalloc(leftInput->getMalloc()),
+    mLeftKeyPrint(leftKeyPrint ? *leftKeyPrint : leftInput->getPrint()),
+    mTempDir(tempDir),
+    mMemoryAllowed(memoryAllowed)
+  {
+    if (leftNormalizer && rightNormalizer) {
+      mLeftNormalizer = *leftNormalizer;
+      mRightNormalizer = *rightNormalizer;
+    }
   }
   ~RuntimeSortMergeJoinOperatorType();
   RuntimeOperator * create(RuntimeOperator::Services & s) const;
@@ -2377,9 +2958,12 @@ private:
 	       WRITE_RIGHT_NON_MATCH_LT, 
 	       WRITE_LEFT_NON_MATCH_DRAIN, 
 	       WRITE_RIGHT_NON_MATCH_DRAIN, 
+	       WRITE_SPILL_MATCH, 
+	       WRITE_SPILL_LEFT_NON_MATCH, 
 	       WRITE_EOS };
   State mState;
-  // Stores a sort run; assume fits in memory for now.
+  // Stores the head of a left key run; records beyond the 
+  // memory budget go to mLeftSpill.
   class RunEntry
   {
   public:
@@ -2415,7 +2999,63 @@ private:
   // NULLs for left,right input in outer join processing
   RecordBuffer mLeftNulls;
   RecordBuffer mRightNulls;
-
+  // Normalized keys of current inputs and of the buffered
+  // left key run.
+  bool mNormalized;
+  NormalizedKey mLeftKey;
+  NormalizedKey mRightKey;
+  NormalizedKey mLeftRunKey;
+  // Bytes of left key run held in mLeftBuffer.
+  std::size_t mLeftBufferSize;
+  // Overflow of a left key run that exceeds the memory budget
+  // along with match flags of the spilled records.  Spilled
+  // records are replayed from disk for each matching right record.
+  class RecordSpillFile * mLeftSpill;
+  std::vector<bool> mSpillMatched;
+  uint64_t mSpillIt;
+  RecordBuffer mSpillInput;
+  // A spilled record that mLastMatch refers to.
+  RecordBuffer mSpillLastMatch;
+  // Size of the largest spilled run.
+  std::size_t mLargestSpilledRun;
+
+  void normalizeLeft()
+  {
+    if (mNormalized && !RecordBuffer::isEOS(mLeftInput)) {
+      getMyOperatorType().mLeftNormalizer.normalize(mLeftInput, mLeftKey);
+    }
+  }
+  void normalizeRight()
+  {
+    if (mNormalized && !RecordBuffer::isEOS(mRightInput)) {
+      getMyOperatorType().mRightNormalizer.normalize(mRightInput, mRightKey);
+    }
+  }
+  /**
+   * Compare a left record (with normalized key leftKey) to the
+   * current right input.
+   */
+  int32_t compareLeftRight(RecordBuffer left, const NormalizedKey & leftKey);
+  /**
+   * Add a record to the left key run, spilling if the run
+   * has exhausted the memory budget.
+   */
+  void bufferLeft(RecordBuffer buf);
+  /**
+   * Report a left key run that had to be spilled to the
+   * runtime metrics and on stderr.
+   */
+  void reportSkew();
+  void freeSpillLastMatch()
+  {
+    if (mSpillLastMatch != RecordBuffer()) {
+      if (mLastMatch == mSpillLastMatch) {
+	mLastMatch = RecordBuffer();
+      }
+      getMyOperatorType().mLeftFree.free(mSpillLastMatch);
+      mSpillLastMatch = RecordBuffer();
+    }
+  }
   void onMatch(RuntimePort * port);
   void onRightNonMatch(RuntimePort * port);
   void onLeftNonMatch(RuntimePort * port, RecordBuffer buf);
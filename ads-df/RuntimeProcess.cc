@@ -32,14 +32,23 @@
  * OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <stdio.h>
 #include <unistd.h>
 #include <fcntl.h>
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#endif
 
 #include "RuntimeProcess.hh"
 #include "RuntimeOperator.hh"
 #include "RuntimePlan.hh"
 #include "DataflowRuntime.hh"
-#include "SuperFastHash.h"
+#include "RuntimeMetrics.hh"
+#include "RuntimeTrace.hh"
+#include "Hash64.h"
 #include "GraphBuilder.hh"
 
 #if defined(TRECUL_HAS_HADOOP)
@@ -47,7 +56,7 @@
 #endif
 
 #include <fstream>
-#include <boost/algorithm/string/predicate.hpp>
+#include <boost/algorithm/string.hpp>
 #include <boost/program_options.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/bind.hpp>
@@ -216,6 +225,7 @@ void RuntimeProcess::init(int32_t partitionStart,
     throw std::runtime_error("Invalid partition allocation to process");
   for(int32_t i=partitionStart; i<=partitionEnd; i++) {
     mSchedulers[i] = new DataflowScheduler(i, numPartitions);
+    RuntimeMetrics::get().addScheduler(mSchedulers[i]);
   }
 
   for(RuntimeOperatorPlan::operator_const_iterator it = plan.operator_begin();
@@ -247,16 +257,19 @@ RuntimeProcess::~RuntimeProcess()
   for(std::map<int32_t, DataflowScheduler*>::iterator it = mSchedulers.begin();
       it != mSchedulers.end();
       ++it) {
+    RuntimeMetrics::get().removeScheduler(it->second);
     delete it->second;
   }
   for(std::vector<RuntimeOperator * >::iterator opit = mAllOperators.begin();
       opit != mAllOperators.end();
       ++opit) {
+    RuntimeMetrics::get().removeOperator(*opit);
     delete *opit;
   }  
   for(std::vector<InProcessFifo *>::iterator chit = mChannels.begin();
       chit != mChannels.end();
       ++chit) {
+    RuntimeMetrics::get().removeChannel(*chit);
     delete *chit;
   }
   for(std::vector<ServiceCompletionFifo *>::iterator chit = mServiceChannels.begin();
@@ -287,6 +300,7 @@ void RuntimeProcess::connectInProcess(RuntimeOperator & source,
   mChannels.back()->getSource()->setOperator(source);
   target.setInputPort(mChannels.back()->getTarget(), inputPort);
   mChannels.back()->getTarget()->setOperator(target);    
+  RuntimeMetrics::get().addChannel(mChannels.back());
   
 }
 
@@ -314,6 +328,30 @@ void RuntimeProcess::connectStraightLine(const IntraProcessFifoSpec& spec)
   }  
 }
 
+void RuntimeProcess::connectCrossbarInProcess(const InterProcessFifoSpec& spec,
+					      const std::vector<int32_t>& spartitions,
+					      const std::vector<int32_t>& tpartitions)
+{
+  // Output port of a partitioner and input port of a collector are the 
+  // position of the partition at the other end of the channel.
+  for(std::vector<int32_t>::const_iterator s=spartitions.begin();
+      s != spartitions.end();
+      ++s) {
+    RuntimeOperator * sourceOp = getOperator(spec.getSourceOperator()->Operator, *s);
+    if (sourceOp==NULL) throw std::runtime_error("Operator not created");
+    int32_t sourcePos = spec.getSourceOperator()->getPartitionPosition(*s);
+    for(std::vector<int32_t>::const_iterator t=tpartitions.begin();
+	t != tpartitions.end();
+	++t) {
+      RuntimeOperator * targetOp = getOperator(spec.getTargetOperator()->Operator, *t);
+      if (targetOp==NULL) throw std::runtime_error("Operator not created");
+      int32_t targetPos = spec.getTargetOperator()->getPartitionPosition(*t);
+      connectInProcess(*sourceOp, targetPos, *s,
+		       *targetOp, sourcePos, *t, spec.getBuffered());
+    }
+  }
+}
+
 void RuntimeProcess::connectCrossbar(const InterProcessFifoSpec& spec)
 {
   // Get the partitions within this process for each operator.
@@ -322,6 +360,17 @@ void RuntimeProcess::connectCrossbar(const InterProcessFifoSpec& spec)
   std::vector<int32_t> tpartitions;
   spec.getTargetOperator()->getPartitions(mPartitionStart, mPartitionEnd, tpartitions);
 
+  // If every partition of both operators lives in this process then
+  // the crossbar doesn't need remoting.
+  std::vector<int32_t> allSource;
+  spec.getSourceOperator()->getPartitions(0, mNumPartitions-1, allSource);
+  std::vector<int32_t> allTarget;
+  spec.getTargetOperator()->getPartitions(0, mNumPartitions-1, allTarget);
+  if (spartitions == allSource && tpartitions == allTarget) {
+    connectCrossbarInProcess(spec, spartitions, tpartitions);
+    return;
+  }
+
   // To calculate MPI tags in crossbars, we need to know the index/position
   // of a partition within the vector of partitions the operator lives on.
   for(std::vector<int32_t>::const_iterator i=spartitions.begin();
@@ -345,6 +394,7 @@ RuntimeOperator * RuntimeProcess::createOperator(const RuntimeOperatorType * ty,
     throw std::runtime_error((boost::format("Internal Error: failed to create scheduler for data partition %1%") % partition).str());
   RuntimeOperator * op = ty->create(*sit->second);
   mAllOperators.push_back(op);
+  RuntimeMetrics::get().addOperator(op);
   mPartitionIndex[partition].push_back(op);
   mTypePartitionIndex[ty][partition] = op;
   for(int32_t i=0; i<ty->numServiceCompletionPorts(); ++i) {
@@ -404,29 +454,202 @@ void RuntimeProcess::run(DataflowScheduler& s)
   }
 }
 
+SchedulerPlacement::SchedulerPlacement()
+  :
+  mPolicy(NONE),
+  mPartitionsPerHost(0)
+{
+  readTopology();
+}
+
+SchedulerPlacement& SchedulerPlacement::get()
+{
+  static SchedulerPlacement placement;
+  return placement;
+}
+
+void SchedulerPlacement::readTopology()
+{
+#if defined(__linux__)
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (0 != ::sched_getaffinity(0, sizeof(allowed), &allowed)) {
+    CPU_ZERO(&allowed);
+  }
+  // Nodes and their cpu lists (e.g. 0-7,16-23) from sysfs.
+  for(int32_t node=0; true; ++node) {
+    std::ifstream istr((boost::format("/sys/devices/system/node/node%1%/cpulist") % 
+			node).str().c_str());
+    if (!istr) {
+      break;
+    }
+    std::string cpuList;
+    std::getline(istr, cpuList);
+    std::vector<int32_t> cpus;
+    std::vector<std::string> ranges;
+    boost::algorithm::split(ranges, cpuList, boost::algorithm::is_any_of(","));
+    for(std::vector<std::string>::const_iterator it = ranges.begin();
+	it != ranges.end();
+	++it) {
+      int32_t first, last;
+      int n = ::sscanf(it->c_str(), "%d-%d", &first, &last);
+      if (n == 1) {
+	last = first;
+      }
+      if (n >= 1) {
+	for(int32_t cpu=first; cpu<=last; ++cpu) {
+	  if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) {
+	    cpus.push_back(cpu);
+	  }
+	}
+      }
+    }
+    if (cpus.size()) {
+      mNodeCpus.push_back(cpus);
+    }
+  }
+  if (0 == mNodeCpus.size()) {
+    // No NUMA information; treat the machine as a single node.
+    std::vector<int32_t> cpus;
+    for(int32_t cpu=0; cpu<CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &allowed)) {
+	cpus.push_back(cpu);
+      }
+    }
+    mNodeCpus.push_back(cpus);
+  }
+#endif
+}
+
+bool SchedulerPlacement::setPolicy(const std::string& policy)
+{
+  if (boost::algorithm::iequals(policy, "none")) {
+    mPolicy = NONE;
+  } else if (boost::algorithm::iequals(policy, "node")) {
+    mPolicy = NODE;
+  } else if (boost::algorithm::iequals(policy, "core")) {
+    mPolicy = CORE;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool SchedulerPlacement::getPosition(int32_t partition, 
+				     int32_t partitionStart,
+				     int32_t partitionEnd,
+				     int32_t numPartitions,
+				     int32_t& position,
+				     int32_t& numPositions) const
+{
+  if (mPartitionsPerHost > 0) {
+    position = partition % mPartitionsPerHost;
+    numPositions = mPartitionsPerHost;
+    return true;
+  } else if (partitionStart == 0 && partitionEnd+1 == numPartitions) {
+    position = partition;
+    numPositions = numPartitions;
+    return true;
+  } 
+  // Other processes on this host run partitions we know nothing
+  // about; placing ours would pile every process onto the same CPUs.
+  position = numPositions = 0;
+  return false;
+}
+
+int32_t SchedulerPlacement::getNode(int32_t position, int32_t numPositions) const
+{
+  if (mNodeCpus.size() < 2 || numPositions <= 0) {
+    return 0;
+  }
+  return (int32_t) ((position * mNodeCpus.size()) / numPositions);
+}
+
+int32_t SchedulerPlacement::getCpu(int32_t position, int32_t numPositions) const
+{
+  int32_t node = getNode(position, numPositions);
+  if (mNodeCpus.size() == 0 || mNodeCpus[node].size() == 0) {
+    return -1;
+  }
+  // Rank of the position among those on the node; the first position
+  // on node is the smallest p with p*numNodes/numPositions == node.
+  int32_t numNodes = (int32_t) mNodeCpus.size();
+  int32_t first = numNodes < 2 ? 0 : (node*numPositions + numNodes - 1)/numNodes;
+  return mNodeCpus[node][(position - first) % mNodeCpus[node].size()];
+}
+
+void SchedulerPlacement::bind(int32_t position, int32_t numPositions) const
+{
+#if defined(__linux__)
+  if (NONE == mPolicy || numPositions <= 0 || 
+      0 == mNodeCpus.size() || 0 == mNodeCpus[0].size()) {
+    return;
+  }
+  int32_t node = getNode(position, numPositions);
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  if (CORE == mPolicy) {
+    CPU_SET(getCpu(position, numPositions), &cpus);
+  } else {
+    for(std::vector<int32_t>::const_iterator it = mNodeCpus[node].begin();
+	it != mNodeCpus[node].end();
+	++it) {
+      CPU_SET(*it, &cpus);
+    }
+  }
+  if (0 != ::pthread_setaffinity_np(::pthread_self(), sizeof(cpus), &cpus)) {
+    std::cerr << (boost::format("Failed to set CPU affinity of partition %1%") %
+		  position).str().c_str() << std::endl;
+  }
+  // First touch would place most of our memory locally, but prefer
+  // the node explicitly so that pages faulted in by the kernel
+  // on our behalf also land here.  Preferred rather than bound so we
+  // spill to other nodes rather than fail.
+  if (mNodeCpus.size() > 1 && node < (int32_t) (8*sizeof(unsigned long))) {
+    unsigned long nodeMask = 1UL << node;
+    if (0 != ::syscall(SYS_set_mempolicy, MPOL_PREFERRED, &nodeMask, 
+		       8*sizeof(nodeMask))) {
+      std::cerr << (boost::format("Failed to set memory policy of partition %1%") %
+		    position).str().c_str() << std::endl;
+    }
+  }
+#endif
+}
+
 class DataflowSchedulerThreadRunner 
 {
 private:
   bool mFailed;
   std::string mMessage;
   DataflowScheduler& mScheduler;
+  int32_t mPosition;
+  int32_t mNumPositions;
 public:
-  DataflowSchedulerThreadRunner(DataflowScheduler& s);
+  DataflowSchedulerThreadRunner(DataflowScheduler& s,
+				int32_t position=0,
+				int32_t numPositions=1);
   bool isFailed() const { return mFailed; }
   const std::string& getMessage() const { return mMessage; }
   void run();
 };
 
-DataflowSchedulerThreadRunner::DataflowSchedulerThreadRunner(DataflowScheduler & s)
+DataflowSchedulerThreadRunner::DataflowSchedulerThreadRunner(DataflowScheduler & s,
+							     int32_t position,
+							     int32_t numPositions)
   :
   mFailed(false),
-  mScheduler(s)
+  mScheduler(s),
+  mPosition(position),
+  mNumPositions(numPositions)
 {
 }
 
 void DataflowSchedulerThreadRunner::run()
 {
   try {
+    // Pin before the scheduler starts so that records and fifo 
+    // pages are allocated on our node.
+    SchedulerPlacement::get().bind(mPosition, mNumPositions);
     // TODO: genericize to accept a functor argument.
     mScheduler.run();
     mScheduler.cleanup();
@@ -501,11 +724,22 @@ void RuntimeProcess::run()
   mRemoteExecution->runRemote(threads);
 
   // Now start schedulers for each partition.
+  SchedulerPlacement& placement(SchedulerPlacement::get());
   for(std::map<int32_t, DataflowScheduler*>::iterator it = mSchedulers.begin();
       it != mSchedulers.end();
       ++it) {
     it->second->setOperators(mPartitionIndex[it->first]);
-    runners.push_back(boost::shared_ptr<DataflowSchedulerThreadRunner>(new DataflowSchedulerThreadRunner(*it->second)));
+    int32_t position, numPositions;
+    if (!placement.getPosition(it->first, mPartitionStart, mPartitionEnd, 
+			       mNumPartitions, position, numPositions) &&
+	placement.getPolicy() != SchedulerPlacement::NONE &&
+	it == mSchedulers.begin()) {
+      std::cerr << "Ignoring placement: process does not run all partitions and "
+	"\"partitions-per-host\" was not specified" << std::endl;
+    }
+    runners.push_back(boost::shared_ptr<DataflowSchedulerThreadRunner>(new DataflowSchedulerThreadRunner(*it->second, 
+														 position,
+														 numPositions)));
     threads.push_back(boost::shared_ptr<boost::thread>(new boost::thread(boost::bind(&DataflowSchedulerThreadRunner::run, runners.back()))));
   }
 
@@ -573,6 +807,8 @@ void PlanRunner::createSerialized64PlanFromFile(const std::string& f,
 						std::string& p)
 {
   PlanCheckContext ctxt;
+  // Each partition of a compiled plan is run by its own process.
+  ctxt.setPartitionsSpanProcesses(partitions > 1);
   DataflowGraphBuilder gb(ctxt);
   gb.buildGraphFromFile(f);  
   boost::shared_ptr<RuntimeOperatorPlan> plan = gb.create(partitions);
@@ -596,6 +832,72 @@ static bool checkRequiredArgs(const po::variables_map& vm,
   return ok;
 }
 
+static RuntimeTraceReporter * createTraceReporter(const po::variables_map& vm)
+{
+  if (0 == vm.count("trace-file")) {
+    return NULL;
+  }
+  int32_t sz = vm.count("trace-buffer-size") ? 
+    vm["trace-buffer-size"].as<int32_t>() : 65536;
+  if (sz <= 0) {
+    throw std::runtime_error((boost::format("Invalid trace buffer size %1%") % 
+			      sz).str());
+  }
+  return new RuntimeTraceReporter(vm["trace-file"].as<std::string>(), 
+				  (std::size_t) sz);
+}
+
+static bool configureScheduler(const po::variables_map& vm)
+{
+  DataflowSchedulerPolicy& policy(DataflowSchedulerPolicy::get());
+  if (vm.count("scheduler-target") && 
+      !policy.setTarget(vm["scheduler-target"].as<std::string>())) {
+    std::cerr << (boost::format("Invalid scheduler target \"%1%\"") %
+		  vm["scheduler-target"].as<std::string>()).str().c_str() << "\n";
+    return false;
+  }
+  if (vm.count("placement") &&
+      !SchedulerPlacement::get().setPolicy(vm["placement"].as<std::string>())) {
+    std::cerr << (boost::format("Invalid placement \"%1%\"") %
+		  vm["placement"].as<std::string>()).str().c_str() << "\n";
+    return false;
+  }
+  if (vm.count("partitions-per-host")) {
+    int32_t partitionsPerHost = vm["partitions-per-host"].as<int32_t>();
+    if (partitionsPerHost <= 0) {
+      std::cerr << (boost::format("Invalid partitions per host %1%") %
+		    partitionsPerHost).str().c_str() << "\n";
+      return false;
+    }
+    SchedulerPlacement::get().setPartitionsPerHost(partitionsPerHost);
+  }
+  if (vm.count("scheduler-poll-interval")) {
+    int32_t interval = vm["scheduler-poll-interval"].as<int32_t>();
+    if (interval <= 0) {
+      std::cerr << (boost::format("Invalid scheduler poll interval %1%") %
+		    interval).str().c_str() << "\n";
+      return false;
+    }
+    if (policy.getTarget() == DataflowSchedulerPolicy::FIXED) {
+      std::cerr << "Cannot use \"scheduler-poll-interval\" option with a fixed scheduler target; set \"scheduler-target\" to latency or throughput\n";
+      return false;
+    }
+    policy.setPollIntervalMicros((uint64_t) interval);
+  }
+  return true;
+}
+
+static RuntimeMetricsReporter * createMetricsReporter(const po::variables_map& vm)
+{
+  if (0 == vm.count("metrics") && 0 == vm.count("metrics-file")) {
+    return NULL;
+  }
+  return new RuntimeMetricsReporter(vm.count("metrics-file") ? 
+				    vm["metrics-file"].as<std::string>() : "",
+				    vm.count("metrics-interval") ?
+				    vm["metrics-interval"].as<int32_t>() : 10);
+}
+
 GdbStackTrace::GdbStackTrace()
 {
 }
@@ -669,7 +971,7 @@ int PlanRunner::run(int argc, char ** argv)
   // TODO: I think a better way to do this is to export a pointer to the function
   // from the module.
   int dummy=9923;
-  SuperFastHash((char *) &dummy, sizeof(int), sizeof(int));
+  Hash64Bytes((char *) &dummy, sizeof(int), HASH64_SEED);
   
 #if defined(TRECUL_HAS_HADOOP)
   // If a Hadoop installation is present, then setup appropriate env.
@@ -685,6 +987,15 @@ int PlanRunner::run(int argc, char ** argv)
     ("partitions", po::value<int32_t>(), "number of partitions for the flow")
     ("plan", "run dataflow from a compiled plan")
     ("file", po::value<std::string>(), "input script file to be run in process")
+    ("metrics", "collect runtime metrics and print a summary to stderr at exit")
+    ("metrics-file", po::value<std::string>(), "file to which runtime metrics are periodically written as JSON")
+    ("metrics-interval", po::value<int32_t>(), "seconds between writes of the metrics file (default 10)")
+    ("trace-file", po::value<std::string>(), "record scheduler events and write them in Chrome trace format at exit or on SIGUSR2")
+    ("trace-buffer-size", po::value<int32_t>(), "number of trace events kept per partition (default 65536)")
+    ("scheduler-target", po::value<std::string>(), "what schedulers tune for: latency, throughput or fixed (default; no adaptive tuning)")
+    ("placement", po::value<std::string>(), "pin partition scheduler threads and their memory: none (default), node (to the CPUs and memory of a NUMA node) or core (to a single CPU and its node's memory)")
+    ("partitions-per-host", po::value<int32_t>(), "number of partitions run on each host; placement needs this when a process runs only some of the partitions (e.g. with --serial)")
+    ("scheduler-poll-interval", po::value<int32_t>(), "microseconds between IO polls that an adaptive scheduler aims for (default 200 for latency, 5000 for throughput)")
 #if defined(TRECUL_HAS_HADOOP)
     ("map", po::value<std::string>(), "input mapper script file for jobs run through Hadoop pipes")
     ("reduce", po::value<std::string>(), "input reducer script file for jobs run through Hadoop pipes")
@@ -720,6 +1031,8 @@ int PlanRunner::run(int argc, char ** argv)
   std::vector<std::pair<std::string,std::string> > pairs;
   pairs.push_back(std::make_pair("file", "compile"));
   pairs.push_back(std::make_pair("file", "plan"));
+  pairs.push_back(std::make_pair("metrics-file", "metrics-interval"));
+  pairs.push_back(std::make_pair("trace-file", "trace-buffer-size"));
 #if (TRECUL_HAS_HADOOP)
   pairs.push_back(std::make_pair("map", "reduce"));
   pairs.push_back(std::make_pair("map", "input"));
@@ -738,6 +1051,10 @@ int PlanRunner::run(int argc, char ** argv)
   if (vm.count("case-insensitive")) {
     TypeCheckConfiguration::get().caseInsensitive(true);
   }
+  if (!configureScheduler(vm)) {
+    std::cerr << desc << std::endl;
+    return 1;    
+  }
   
   if (vm.count("compile")) {
     std::string inputFile(vm["file"].as<std::string>());
@@ -768,7 +1085,12 @@ int PlanRunner::run(int argc, char ** argv)
 
     boost::shared_ptr<RuntimeOperatorPlan> tmp = PlanGenerator::deserialize64(&encoded[0] ,
 									      encoded.size());
+    // Tracing must be enabled before schedulers are created.
+    boost::shared_ptr<RuntimeTraceReporter> trace(createTraceReporter(vm));
     RuntimeProcess p(partition,partition,partitions,*tmp.get());
+    // Declared after the process so the final report is made
+    // while its operators are still registered.
+    boost::shared_ptr<RuntimeMetricsReporter> metrics(createMetricsReporter(vm));
     p.run();
     return 0;
   } else if (vm.count("map")) {    
@@ -845,10 +1167,14 @@ int PlanRunner::run(int argc, char ** argv)
     if (partition >= partitions)
       partitions = partition+1;
     PlanCheckContext ctxt;
+    // This process runs only one of the partitions.
+    ctxt.setPartitionsSpanProcesses(partitions > 1);
     DataflowGraphBuilder gb(ctxt);
     gb.buildGraphFromFile(inputFile);
     boost::shared_ptr<RuntimeOperatorPlan> plan = gb.create(partitions);
+    boost::shared_ptr<RuntimeTraceReporter> trace(createTraceReporter(vm));
     RuntimeProcess p(partition,partition,partitions,*plan.get());
+    boost::shared_ptr<RuntimeMetricsReporter> metrics(createMetricsReporter(vm));
     p.run();
     return 0;
   }
@@ -232,6 +232,79 @@ public:
   }
 };
 
+/**
+ * Placement of scheduler threads on the CPUs and NUMA nodes of the
+ * machine.  The partitions on a host are assigned to nodes in 
+ * contiguous blocks by partition number.  A scheduler thread is pinned
+ * to the CPUs of its node (NODE) or to a single CPU of its node (CORE)
+ * and prefers memory from its node.  Records and fifo pages the 
+ * scheduler thread allocates while running are therefore node-local.
+ * Operators are constructed on the main thread before placement, so 
+ * state built in their constructors may live on another node.
+ * Configured once per process before the dataflow runs.
+ */
+class SchedulerPlacement
+{
+public:
+  enum Policy { NONE, NODE, CORE };
+private:
+  Policy mPolicy;
+  // Number of partitions run on this host; 0 if unknown.
+  int32_t mPartitionsPerHost;
+  // CPUs available to the process on each node.
+  std::vector<std::vector<int32_t> > mNodeCpus;
+  SchedulerPlacement();
+  void readTopology();
+public:
+  static SchedulerPlacement& get();
+  /**
+   * Set the policy; returns false if the name isn't one of 
+   * none, node or core.
+   */
+  bool setPolicy(const std::string& policy);
+  void setPolicy(Policy policy)
+  {
+    mPolicy = policy;
+  }
+  Policy getPolicy() const
+  {
+    return mPolicy;
+  }
+  std::size_t getNumNodes() const
+  {
+    return mNodeCpus.size();
+  }
+  void setPartitionsPerHost(int32_t partitionsPerHost)
+  {
+    mPartitionsPerHost = partitionsPerHost;
+  }
+  /**
+   * Position of partition among the partitions on this host.  Returns 
+   * false if this isn't known: the process doesn't run all partitions 
+   * [0, numPartitions) and the number of partitions per host wasn't set.
+   */
+  bool getPosition(int32_t partition, 
+		   int32_t partitionStart,
+		   int32_t partitionEnd,
+		   int32_t numPartitions,
+		   int32_t& position,
+		   int32_t& numPositions) const;
+  /**
+   * Node of partition at position among numPositions partitions
+   * on this host.
+   */
+  int32_t getNode(int32_t position, int32_t numPositions) const;
+  /**
+   * CPU for partition at position in CORE placement.
+   */
+  int32_t getCpu(int32_t position, int32_t numPositions) const;
+  /**
+   * Pin the calling thread and its memory allocations according
+   * to the policy.  Does nothing if numPositions isn't positive.
+   */
+  void bind(int32_t position, int32_t numPositions) const;
+};
+
 /**
  * A runtime operator process contains a collection of partitions that
  * are executed by one or more threads.  
@@ -268,6 +341,13 @@ private:
 
   void connectStraightLine(const IntraProcessFifoSpec& spec);
   void connectCrossbar(const InterProcessFifoSpec& spec);
+  /**
+   * Build a crossbar whose source and target partitions all live 
+   * in this process out of in process fifos.
+   */
+  void connectCrossbarInProcess(const InterProcessFifoSpec& spec,
+				const std::vector<int32_t>& spartitions,
+				const std::vector<int32_t>& tpartitions);
 
   void init(int32_t partitionStart, 
 	    int32_t partitionEnd,
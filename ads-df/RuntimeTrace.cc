@@ -0,0 +1,273 @@
+/**
+ * Copyright (c) 2012, Akamai Technologies
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * 
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ * 
+ *   Neither the name of the Akamai Technologies nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <signal.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+#include <boost/bind.hpp>
+#include <boost/format.hpp>
+#include <boost/thread.hpp>
+
+#include "RuntimeTrace.hh"
+
+RuntimeTraceBuffer::RuntimeTraceBuffer(int32_t partition, std::size_t capacity)
+  :
+  mPartition(partition),
+  mNext(0)
+{
+  std::size_t sz = 1;
+  while(sz < capacity) {
+    sz <<= 1;
+  }
+  Event e;
+  memset(&e, 0, sizeof(Event));
+  mEvents.resize(sz, e);
+}
+
+RuntimeTraceBuffer::~RuntimeTraceBuffer()
+{
+}
+
+void RuntimeTraceBuffer::getEvents(std::vector<Event>& events) const
+{
+  uint64_t end = mNext;
+  uint64_t begin = end > mEvents.size() ? end - mEvents.size() : 0;
+  for(uint64_t i=begin; i<end; ++i) {
+    events.push_back(mEvents[i & (mEvents.size()-1)]);
+  }
+}
+
+RuntimeTrace::RuntimeTrace()
+  :
+  mEnabled(false),
+  mCapacity(0),
+  mStart(RuntimeTraceBuffer::now())
+{
+  // Reserve id 0.
+  mNames.push_back("");
+}
+
+RuntimeTrace::~RuntimeTrace()
+{
+}
+
+RuntimeTrace& RuntimeTrace::get()
+{
+  static RuntimeTrace trace;
+  return trace;
+}
+
+void RuntimeTrace::enable(std::size_t eventsPerScheduler)
+{
+  boost::mutex::scoped_lock sl(mLock);
+  mEnabled = true;
+  mCapacity = eventsPerScheduler;
+  mStart = RuntimeTraceBuffer::now();
+}
+
+RuntimeTraceBuffer * RuntimeTrace::createBuffer(int32_t partition)
+{
+  boost::mutex::scoped_lock sl(mLock);
+  if (!mEnabled) {
+    return NULL;
+  }
+  mBuffers.push_back(boost::shared_ptr<RuntimeTraceBuffer>(new RuntimeTraceBuffer(partition, mCapacity)));
+  return mBuffers.back().get();
+}
+
+uint32_t RuntimeTrace::intern(const std::string& name)
+{
+  boost::mutex::scoped_lock sl(mLock);
+  std::map<std::string, uint32_t>::const_iterator it = mNameIndex.find(name);
+  if (it != mNameIndex.end()) {
+    return it->second;
+  }
+  uint32_t id = (uint32_t) mNames.size();
+  mNames.push_back(name);
+  mNameIndex[name] = id;
+  return id;
+}
+
+const char * RuntimeTrace::getReasonName(uint16_t reason)
+{
+  switch(reason) {
+  case RuntimeTraceBuffer::READ:
+    return "read";
+  case RuntimeTraceBuffer::WRITE:
+    return "write";
+  case RuntimeTraceBuffer::COMPLETION:
+    return "completion";
+  case RuntimeTraceBuffer::READ_WRITE:
+    return "read_write";
+  default:
+    return "none";
+  }
+}
+
+void RuntimeTrace::writeString(std::ostream& ostr, const std::string& str)
+{
+  ostr << '"';
+  for(std::string::const_iterator c = str.begin(); c != str.end(); ++c) {
+    if (*c == '"' || *c == '\\') {
+      ostr << '\\' << *c;
+    } else if ((unsigned char) *c < 0x20) {
+      ostr << (boost::format("\\u%04x") % (int32_t) *c);
+    } else {
+      ostr << *c;
+    }
+  }
+  ostr << '"';
+}
+
+void RuntimeTrace::writeChromeTrace(std::ostream& ostr)
+{
+  static const char * categories [] = { "operator", "request", "flush", 
+					"complete", "wait" };
+  boost::mutex::scoped_lock sl(mLock);
+  int32_t pid = (int32_t) ::getpid();
+  bool first = true;
+  ostr << "{\"traceEvents\":[";
+  for(std::vector<boost::shared_ptr<RuntimeTraceBuffer> >::const_iterator b = mBuffers.begin();
+      b != mBuffers.end();
+      ++b) {
+    std::vector<RuntimeTraceBuffer::Event> events;
+    (*b)->getEvents(events);
+    for(std::vector<RuntimeTraceBuffer::Event>::const_iterator e = events.begin();
+	e != events.end();
+	++e) {
+      if (!first) ostr << ",\n";
+      first = false;
+      // Timestamps are microseconds since tracing was enabled.
+      double ts = e->mStart >= mStart ? double(e->mStart - mStart)/1000.0 : 0.0;
+      ostr << "{\"name\":";
+      writeString(ostr, e->mName < mNames.size() ? mNames[e->mName] : std::string());
+      ostr << ",\"cat\":\"" << categories[e->mType] << "\"";
+      if (e->mType == RuntimeTraceBuffer::REQUEST_IO || 
+	  e->mType == RuntimeTraceBuffer::IO_COMPLETE) {
+	ostr << ",\"ph\":\"i\",\"s\":\"t\"";
+      } else {
+	ostr << ",\"ph\":\"X\",\"dur\":" << (boost::format("%.3f") % (double(e->mDuration)/1000.0));
+      }
+      ostr << ",\"ts\":" << (boost::format("%.3f") % ts) <<
+	",\"pid\":" << pid << ",\"tid\":" << (*b)->getPartition() <<
+	",\"args\":{\"reason\":\"" << getReasonName(e->mReason) << "\"}}";
+    }
+  }
+  ostr << "],\"displayTimeUnit\":\"ns\"}\n";
+}
+
+void RuntimeTrace::writeChromeTrace(const std::string& file)
+{
+  std::string tmp = file + ".tmp";
+  {
+    std::ofstream ostr(tmp.c_str());
+    if (!ostr) {
+      throw std::runtime_error((boost::format("Unable to open trace file %1%") %
+				tmp).str());
+    }
+    writeChromeTrace(ostr);
+  }
+  if (::rename(tmp.c_str(), file.c_str()) != 0) {
+    throw std::runtime_error((boost::format("Unable to rename trace file %1% to %2%") %
+			      tmp % file).str());
+  }
+}
+
+static volatile sig_atomic_t sTraceDumpRequested = 0;
+static void onSigusr2(int )
+{
+  sTraceDumpRequested = 1;
+}
+
+RuntimeTraceReporter::RuntimeTraceReporter(const std::string& file,
+					   std::size_t eventsPerScheduler)
+  :
+  mFile(file),
+  mStopped(false),
+  mThread(NULL)
+{
+  RuntimeTrace::get().enable(eventsPerScheduler);
+  struct sigaction action;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  action.sa_handler = &onSigusr2;
+  if (sigaction(SIGUSR2, &action, NULL) < 0) {
+    std::cerr << "Sigaction: " << strerror(errno) << ". Trace will only be written at exit." << std::endl;
+  } else {
+    mThread = new boost::thread(boost::bind(&RuntimeTraceReporter::run, this));
+  }
+}
+
+RuntimeTraceReporter::~RuntimeTraceReporter()
+{
+  if (mThread) {
+    {
+      boost::mutex::scoped_lock sl(mLock);
+      mStopped = true;
+    }
+    mThread->join();
+    delete mThread;
+  }
+  try {
+    RuntimeTrace::get().writeChromeTrace(mFile);
+  } catch(std::exception& ex) {
+    std::cerr << "Failed writing trace: " << ex.what() << std::endl;
+  }
+}
+
+void RuntimeTraceReporter::run()
+{
+  // Signal handlers can't safely do IO so poll for requests.
+  while(true) {
+    {
+      boost::mutex::scoped_lock sl(mLock);
+      if (mStopped) break;
+    }
+    if (sTraceDumpRequested) {
+      sTraceDumpRequested = 0;
+      try {
+	RuntimeTrace::get().writeChromeTrace(mFile);
+      } catch(std::exception& ex) {
+	std::cerr << "Failed writing trace: " << ex.what() << std::endl;
+      }
+    }
+    boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+  }
+}
@@ -0,0 +1,192 @@
+/**
+ * Copyright (c) 2012, Akamai Technologies
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * 
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ * 
+ *   Neither the name of the Akamai Technologies nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if !defined(__RUNTIME_TRACE_HH)
+#define __RUNTIME_TRACE_HH
+
+#include <stdint.h>
+#include <time.h>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace boost {
+  class thread;
+}
+
+/**
+ * A fixed size ring of scheduler events.  Each scheduler owns one
+ * buffer and is the primary writer; other schedulers may append 
+ * IO completion events for ports owned by this scheduler so slots are
+ * claimed with an atomic increment.  When the ring wraps the oldest 
+ * events are overwritten.
+ */
+class RuntimeTraceBuffer
+{
+public:
+  enum EventType { RUN_OPERATOR, REQUEST_IO, FLUSH, IO_COMPLETE, IO_WAIT };
+  enum Reason { NONE, READ, WRITE, COMPLETION, READ_WRITE };
+
+  struct Event
+  {
+    uint64_t mStart;
+    uint64_t mDuration;
+    uint32_t mName;
+    uint16_t mType;
+    uint16_t mReason;
+  };
+
+private:
+  int32_t mPartition;
+  std::vector<Event> mEvents;
+  uint64_t mNext;
+
+public:
+  RuntimeTraceBuffer(int32_t partition, std::size_t capacity);
+  ~RuntimeTraceBuffer();
+
+  /**
+   * Monotonic clock in nanoseconds.
+   */
+  static uint64_t now()
+  {
+    struct timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec)*1000000000ULL + uint64_t(ts.tv_nsec);
+  }
+
+  void record(EventType ty, uint32_t name, uint64_t start, 
+	      uint64_t duration, Reason reason)
+  {
+    uint64_t idx = __sync_fetch_and_add(&mNext, 1);
+    Event & e(mEvents[idx & (mEvents.size()-1)]);
+    e.mStart = start;
+    e.mDuration = duration;
+    e.mName = name;
+    e.mType = (uint16_t) ty;
+    e.mReason = (uint16_t) reason;
+  }
+
+  int32_t getPartition() const
+  {
+    return mPartition;
+  }
+
+  /**
+   * Copy out events in the order they were recorded.
+   */
+  void getEvents(std::vector<Event>& events) const;
+};
+
+/**
+ * Process wide tracing configuration.  Tracing is opt-in; when it is off
+ * schedulers get no trace buffer and each trace point costs a single
+ * test of a NULL pointer.
+ *
+ * Operator names are interned so that events are small, fixed size 
+ * records and so that traces can be written after the operators that
+ * generated them have been destroyed.
+ */
+class RuntimeTrace
+{
+private:
+  boost::mutex mLock;
+  bool mEnabled;
+  std::size_t mCapacity;
+  uint64_t mStart;
+  std::vector<boost::shared_ptr<RuntimeTraceBuffer> > mBuffers;
+  std::vector<std::string> mNames;
+  std::map<std::string, uint32_t> mNameIndex;
+
+  RuntimeTrace();
+  ~RuntimeTrace();
+
+  static const char * getReasonName(uint16_t reason);
+  static void writeString(std::ostream& ostr, const std::string& str);
+public:
+  static RuntimeTrace& get();
+
+  /**
+   * Turn on tracing with a ring of eventsPerScheduler (rounded up to
+   * a power of two) in each subsequently created scheduler.
+   */
+  void enable(std::size_t eventsPerScheduler);
+  bool isEnabled() const
+  {
+    return mEnabled;
+  }
+
+  /**
+   * Get a buffer for a scheduler.  Returns NULL if tracing is disabled.
+   * The buffer is owned by the trace.
+   */
+  RuntimeTraceBuffer * createBuffer(int32_t partition);
+
+  /**
+   * Get a small integer id for a name.  Id 0 is reserved
+   * to mean "not yet interned".
+   */
+  uint32_t intern(const std::string& name);
+
+  /**
+   * Write all buffers in Chrome trace event format (readable
+   * by chrome://tracing and Perfetto).
+   */
+  void writeChromeTrace(std::ostream& ostr);
+  void writeChromeTrace(const std::string& file);
+};
+
+/**
+ * Writes the trace to a file when destroyed and whenever the process
+ * receives SIGUSR2 in the meantime.
+ */
+class RuntimeTraceReporter
+{
+private:
+  std::string mFile;
+  boost::mutex mLock;
+  bool mStopped;
+  boost::thread * mThread;
+
+  void run();
+public:
+  RuntimeTraceReporter(const std::string& file, std::size_t eventsPerScheduler);
+  ~RuntimeTraceReporter();
+};
+
+#endif
@@ -0,0 +1,175 @@
+/**
+ * Copyright (c) 2012, Akamai Technologies
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * 
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ * 
+ *   Neither the name of the Akamai Technologies nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <unistd.h>
+#include <cstdlib>
+#include <stdexcept>
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+#include "FileSystem.hh"
+#include "SpillFile.hh"
+
+std::string RecordSpillFile::getTempDirectory(const std::string& configured)
+{
+  std::string tmpDir = configured;
+  if(tmpDir.size() == 0) {
+    const char * user = ::getenv("USER");
+    tmpDir = (boost::format("/ghostcache/hadoop/temp/%1%") %
+	      (user ? user : "")).str();
+    if (!boost::filesystem::exists(tmpDir))
+      tmpDir = "/usr/local/akamai/tmp";
+    if (!boost::filesystem::exists(tmpDir))
+      tmpDir = "/tmp";
+  } else {
+    if (!boost::filesystem::exists(tmpDir))
+      throw std::runtime_error((boost::format("Temp directory doesn't exists: %1%") %
+				tmpDir).str());
+  }
+  return tmpDir;
+}
+
+RecordSpillFile::RecordSpillFile(const RecordTypeSerialize & serialize,
+				 const RecordTypeDeserialize & deserialize,
+				 const RecordTypeMalloc & malloc,
+				 const std::string& tempDir)
+  :
+  mSerialize(serialize),
+  mDeserialize(deserialize),
+  mMalloc(malloc),
+  mStream(NULL),
+  mBuffer(64*1024),
+  mPtr(&mBuffer[0]),
+  mEnd(&mBuffer[0] + mBuffer.size()),
+  mReading(false),
+  mRecords(0),
+  mBytes(0)
+{
+  mFile = (boost::format("%1%/spill_%2%.bin") %
+	   getTempDirectory(tempDir) %
+	   FileSystem::getTempFileName()).str();
+  mStream = ::fopen(mFile.c_str(), "w+b");
+  if (mStream == NULL) {
+    throw std::runtime_error((boost::format("Failed to create spill file: %1%") %
+			      mFile).str());
+  }
+  ::unlink(mFile.c_str());
+}
+
+RecordSpillFile::~RecordSpillFile()
+{
+  if (mStream) {
+    ::fclose(mStream);
+  }
+}
+
+void RecordSpillFile::flush()
+{
+  std::size_t sz = std::size_t(mPtr - &mBuffer[0]);
+  if (sz && sz != ::fwrite(&mBuffer[0], 1, sz, mStream)) {
+    throw std::runtime_error((boost::format("Failed writing spill file: %1%") %
+			      mFile).str());
+  }
+  mBytes += sz;
+  mPtr = &mBuffer[0];
+}
+
+bool RecordSpillFile::fill()
+{
+  std::size_t sz = ::fread(&mBuffer[0], 1, mBuffer.size(), mStream);
+  if (sz == 0 && ::ferror(mStream)) {
+    throw std::runtime_error((boost::format("Failed reading spill file: %1%") %
+			      mFile).str());
+  }
+  mPtr = &mBuffer[0];
+  mEnd = mPtr + sz;
+  return sz > 0;
+}
+
+void RecordSpillFile::write(RecordBuffer buf)
+{
+  if (mReading) {
+    throw std::runtime_error("INTERNAL ERROR: "
+			     "RecordSpillFile::write called during replay");
+  }
+  RecordBufferIterator it;
+  it.init(buf);
+  while(!mSerialize.doit(mPtr, mEnd, it, buf)) {
+    flush();
+  }
+  mRecords += 1;
+}
+
+void RecordSpillFile::rewind()
+{
+  if (!mReading) {
+    flush();
+    mReading = true;
+  }
+  if (0 != ::fseek(mStream, 0, SEEK_SET)) {
+    throw std::runtime_error((boost::format("Failed seeking spill file: %1%") %
+			      mFile).str());
+  }
+  mPtr = mEnd = &mBuffer[0];
+}
+
+RecordBuffer RecordSpillFile::read()
+{
+  if (mPtr == mEnd && !fill()) {
+    return RecordBuffer();
+  }
+  RecordBuffer buf = mMalloc.malloc();
+  RecordBufferIterator it;
+  it.init(buf);
+  while(!mDeserialize.Do(mPtr, mEnd, it, buf)) {
+    if (!fill()) {
+      throw std::runtime_error((boost::format("Truncated spill file: %1%") %
+				mFile).str());
+    }
+  }
+  return buf;
+}
+
+void RecordSpillFile::clear()
+{
+  if (0 != ::fseek(mStream, 0, SEEK_SET) ||
+      0 != ::ftruncate(::fileno(mStream), 0)) {
+    throw std::runtime_error((boost::format("Failed truncating spill file: %1%") %
+			      mFile).str());
+  }
+  mReading = false;
+  mPtr = &mBuffer[0];
+  mEnd = &mBuffer[0] + mBuffer.size();
+  mRecords = 0;
+  mBytes = 0;
+}
@@ -0,0 +1,116 @@
+/**
+ * Copyright (c) 2012, Akamai Technologies
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * 
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ * 
+ *   Neither the name of the Akamai Technologies nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if !defined(__SPILLFILE_HH)
+#define __SPILLFILE_HH
+
+#include <stdint.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "RecordType.hh"
+
+/**
+ * A temporary file of serialized records that operators use to
+ * hold state that does not fit in their memory budget.  Records
+ * are appended, then the file may be replayed from the beginning 
+ * any number of times.  Appending after a replay has started 
+ * requires a clear().  The file is unlinked as soon as it is
+ * created so it never outlives the process.
+ */
+class RecordSpillFile
+{
+private:
+  const RecordTypeSerialize & mSerialize;
+  const RecordTypeDeserialize & mDeserialize;
+  const RecordTypeMalloc & mMalloc;
+  std::string mFile;
+  FILE * mStream;
+  std::vector<uint8_t> mBuffer;
+  uint8_t * mPtr;
+  uint8_t * mEnd;
+  bool mReading;
+  uint64_t mRecords;
+  uint64_t mBytes;
+
+  void flush();
+  bool fill();
+public:
+  /**
+   * Resolve the directory in which to create temporary files.
+   * An empty configured directory picks the first existing 
+   * of the usual scratch locations; a configured directory
+   * must exist.
+   */
+  static std::string getTempDirectory(const std::string& configured);
+
+  RecordSpillFile(const RecordTypeSerialize & serialize,
+		  const RecordTypeDeserialize & deserialize,
+		  const RecordTypeMalloc & malloc,
+		  const std::string& tempDir);
+  ~RecordSpillFile();
+
+  /**
+   * Append a copy of a record.  The caller keeps ownership of buf.
+   */
+  void write(RecordBuffer buf);
+  /**
+   * Position at the first record.
+   */
+  void rewind();
+  /**
+   * Return the next record or NULL when all records have been 
+   * read.  The caller owns the returned record.
+   */
+  RecordBuffer read();
+  /**
+   * Discard all records.
+   */
+  void clear();
+
+  uint64_t size() const
+  {
+    return mRecords;
+  }
+  uint64_t getBytes() const
+  {
+    return mBytes;
+  }
+  const std::string& getFileName() const
+  {
+    return mFile;
+  }
+};
+
+#endif
@@ -36,6 +36,7 @@
 #include <boost/algorithm/string/trim.hpp>
 #include <boost/format.hpp>
 #include <boost/make_shared.hpp>
+#include <boost/thread.hpp>
 #include <boost/tokenizer.hpp>
 
 #include "Merger.hh"
@@ -213,7 +214,12 @@ private:
 public:
   std::vector<ColumnGroupOutput*> mColumnGroups;
   std::map<TableColumnGroup*, ColumnGroupOutput*> mColumnGroupIndex;
-  std::vector<RuntimeOperatorType *> mJoins;
+  // When the table has multiple column groups these are zipped
+  // together on the primary key.
+  std::vector<RecordTypeTransfer *> mNullableTransfers;
+  std::vector<RecordTypeTransfer *> mKeyTransfers;
+  RecordTypeFunction * mKeyCompare;
+  RecordTypeTransfer2 * mZipTransfer;
   const TableMetadata * Metadata;
   // The actual format of the operator (e.g. including 
   // column selection).
@@ -225,8 +231,19 @@ public:
   ColumnGroupOutput * create(DynamicRecordContext& ctxt, 
 			     TableColumnGroup* cg,
 			     const std::set<std::string>& referenced);
+  /**
+   * The output of column group or NULL if it is not read.
+   */
   ColumnGroupOutput * find(TableColumnGroup* cg);
   void check(PlanCheckContext & ctxt);
+  /**
+   * The operator zipping together the column groups.
+   */
+  RuntimeOperatorType * create();
+  bool hasZip() const 
+  {
+    return mZipTransfer != NULL;
+  }
 };
 
 TableColumnGroupVersionOutput::TableColumnGroupVersionOutput(DynamicRecordContext & ctxt,
@@ -471,6 +488,8 @@ RuntimeOperatorType * ColumnGroupOutput::create(class RuntimePlanBuilder& plan,
 TableOutput::TableOutput(const TableMetadata * metadata,
 			 const RecordType * tableFormat)
   :
+  mKeyCompare(NULL),
+  mZipTransfer(NULL),
   Metadata(metadata),
   TableType(tableFormat)
 {
@@ -478,6 +497,14 @@ TableOutput::TableOutput(const TableMetadata * metadata,
 
 TableOutput::~TableOutput()
 {
+  for(std::size_t i=0; i<mKeyTransfers.size(); ++i) {
+    delete mKeyTransfers[i];
+  }
+  for(std::size_t i=0; i<mNullableTransfers.size(); ++i) {
+    delete mNullableTransfers[i];
+  }
+  delete mKeyCompare;
+  delete mZipTransfer;
 }
 
 ColumnGroupOutput * TableOutput::create(DynamicRecordContext& ctxt,
@@ -491,19 +518,19 @@ ColumnGroupOutput * TableOutput::create(DynamicRecordContext& ctxt,
 
 ColumnGroupOutput * TableOutput::find(TableColumnGroup* cg)
 {
-  return mColumnGroupIndex.find(cg)->second;
+  std::map<TableColumnGroup*, ColumnGroupOutput*>::iterator it = 
+    mColumnGroupIndex.find(cg);
+  return it == mColumnGroupIndex.end() ? NULL : it->second;
 }
 
 void TableOutput::check(PlanCheckContext & ctxt)
 {
-  std::vector<SortMergeJoin *> smjs;
-
   for(std::vector<ColumnGroupOutput*>::iterator cg = mColumnGroups.begin(),
 	cgEnd = mColumnGroups.end(); cg != cgEnd; ++cg) {
     (*cg)->check(ctxt);
   }
 
-  if (mColumnGroups.size() > 1) {
+  if (Metadata->endColumnGroups() - Metadata->beginColumnGroups() > 1) {
     const std::vector<std::string>& pk(Metadata->getPrimaryKey());
     std::set<std::string> pks(pk.begin(), pk.end());
     if (Metadata->getVersion().size()) {
@@ -515,14 +542,8 @@ void TableOutput::check(PlanCheckContext & ctxt)
     // in the output.
     // TODO: Coerce the primary key to non nullable with an ISNULL.
     // TODO: Handle non nullable non-key columns.
-    // TODO: If we have a column group that we know contains all valid
-    // primary key values, then we can make these full outer joins into
-    // right/left outer.  If we know other column groups contain all valid
-    // primary key values then we can make inner joins.
     
     // Map each non-key member of the output to the column group that contains it.
-    // We need this information in order to create the output of each
-    // full outer join.
     std::map<std::string, std::size_t> outputToColumnGroup;
     for(std::size_t i = 0; i<mColumnGroups.size(); ++i) {
       const RecordType * cgType = mColumnGroups[i]->ColumnGroupType;
@@ -541,23 +562,52 @@ void TableOutput::check(PlanCheckContext & ctxt)
       }
     }
 
+    // Every column group may be missing a key so make all inputs 
+    // nullable and extract the primary key of each into a common
+    // format for the merge.
+    std::vector<AliasedRecordType> zipInputs;
+    std::vector<SortKey> pkSort;
+    for(std::vector<std::string>::const_iterator k = pk.begin();
+	k != pk.end(); ++k) {
+      pkSort.push_back(SortKey(*k, SortKey::ASC));
+    }
+    for(std::size_t i = 0; i<mColumnGroups.size(); ++i) {
+      mNullableTransfers.push_back(SortMergeJoin::makeNullableTransfer(ctxt, 
+								       mColumnGroups[i]->getColumnGroupTypeWithSuffix()));
+      const RecordType * nullable = mNullableTransfers.back()->getTarget();
+      zipInputs.push_back(AliasedRecordType((boost::format("cg%1%") % i).str(), 
+					    nullable));
+      std::string keyXfer;
+      for(std::vector<std::string>::const_iterator k = pk.begin();
+	  k != pk.end(); ++k) {
+	if (keyXfer.size()) {
+	  keyXfer += ",";
+	}
+	keyXfer += (boost::format("%1% AS %2%") % 
+		    mColumnGroups[i]->appendSuffix(*k) % *k).str();
+      }
+      mKeyTransfers.push_back(new RecordTypeTransfer(ctxt, "columnGroupKey",
+						     nullable, keyXfer));
+    }
+    const RecordType * keyType = mKeyTransfers[0]->getTarget();
+    mKeyCompare = CompareFunction::get(ctxt, keyType, keyType, pkSort, pkSort,
+				       "columnGroupKeyCompare");
+
     std::string xfer;
-    boost::format pkFmt("CASE WHEN %1% IS NULL THEN %1% ELSE %2% END AS %3%");
     for(RecordType::const_member_iterator m = TableType->begin_members(),
 	  mEnd = TableType->end_members(); m != mEnd; ++m) {
-      // Only include non-key columns from the inputs.
-      if (pks.find(m->GetName()) == pks.end() &&
-	  outputToColumnGroup.find(m->GetName())->second >= 2)
+      std::set<std::string>::iterator k = pks.find(m->GetName());
+      if (k == pks.end() && 
+	  outputToColumnGroup.find(m->GetName()) == outputToColumnGroup.end())
 	continue;
       if (xfer.size()) {
 	xfer += ",";
       }
-      std::set<std::string>::iterator k = pks.find(m->GetName());
       if (k != pks.end()) {
 	xfer += "CASE ";
-	for(std::size_t j=0; j<2; ++j) {
-	  xfer += (boost::format("WHEN %1% IS NOT NULL THEN %1% ") % 
-			mColumnGroups[j]->appendSuffix(*k)).str();
+	for(std::size_t j=0; j<mColumnGroups.size(); ++j) {
+	  xfer += (boost::format("WHEN cg%1%.%2% IS NOT NULL THEN cg%1%.%2% ") % 
+		   j % mColumnGroups[j]->appendSuffix(*k)).str();
 	}
 	xfer += "END AS ";
 	xfer += *k;
@@ -565,63 +615,415 @@ void TableOutput::check(PlanCheckContext & ctxt)
 	xfer += m->GetName();
       }
     }
-    // create full outer join of column group inputs
-    smjs.push_back(new SortMergeJoin(ctxt, SortMergeJoin::FULL_OUTER, 
-				     mColumnGroups[0]->getColumnGroupTypeWithSuffix(),
-				     mColumnGroups[1]->getColumnGroupTypeWithSuffix(), 
-				     mColumnGroups[0]->getPrimaryKeyWithSuffix(), 
-				     mColumnGroups[1]->getPrimaryKeyWithSuffix(), 
-				     "", xfer));
-    mJoins.push_back(smjs.back()->create());
-    boost::format pkFmt2("CASE WHEN %2% IS NOT NULL THEN %2% "
-			 "WHEN %1% IS NOT NULL THEN %1% END AS %2%");
-    for(std::size_t i=2; i<mColumnGroups.size(); ++i) {
-      xfer = "";
-      for(RecordType::const_member_iterator m = TableType->begin_members(),
-	    mEnd = TableType->end_members(); m != mEnd; ++m) {
-
-	// Only include non-key columns from the inputs.
-	if (pks.find(m->GetName()) == pks.end() &&
-	    outputToColumnGroup.find(m->GetName())->second >= (i+1))
-	  continue;
+    mZipTransfer = new RecordTypeTransfer2(ctxt, "columnGroupZip", zipInputs, xfer);
+  }
+}
 
-	if (xfer.size()) {
-	  xfer += ",";
-	}
-	std::set<std::string>::iterator k = pks.find(m->GetName());
-	if (k != pks.end()) {
-	  xfer += (pkFmt2 % mColumnGroups[i]->appendSuffix(*k) % (*k)).str();
-	} else {
-	  xfer += m->GetName();
-	}
+RuntimeOperatorType * TableOutput::create()
+{
+  std::vector<const RecordType *> inputs;
+  for(std::vector<ColumnGroupOutput*>::iterator cg = mColumnGroups.begin(),
+	cgEnd = mColumnGroups.end(); cg != cgEnd; ++cg) {
+    inputs.push_back((*cg)->getColumnGroupTypeWithSuffix());
+  }
+  return new RuntimeColumnGroupZipOperatorType(inputs, mNullableTransfers,
+					       mKeyTransfers, mKeyCompare,
+					       mZipTransfer);
+}
+
+RuntimeColumnGroupZipOperatorType::RuntimeColumnGroupZipOperatorType(const std::vector<const RecordType *>& inputs,
+								     const std::vector<RecordTypeTransfer *>& nullableTransfers,
+								     const std::vector<RecordTypeTransfer *>& keyTransfers,
+								     const RecordTypeFunction * keyCompare,
+								     const RecordTypeTransfer2 * zipTransfer)
+  :
+  RuntimeOperatorType("RuntimeColumnGroupZipOperatorType"),
+  mKeyFree(keyTransfers[0]->getTarget()->getFree()),
+  mKeyCompare(keyCompare->create()),
+  mZipTransfer(zipTransfer->create())
+{
+  for(std::size_t i=0; i<inputs.size(); ++i) {
+    mInputFree.push_back(inputs[i]->getFree());
+    mNullableTransfers.push_back(nullableTransfers[i]->isIdentity() ? 
+				 NULL : nullableTransfers[i]->create());
+    mNullableMalloc.push_back(nullableTransfers[i]->getTarget()->getMalloc());
+    mNullableFree.push_back(nullableTransfers[i]->getTarget()->getFree());
+    mKeyTransfers.push_back(keyTransfers[i]->create());
+  }
+}
+
+RuntimeColumnGroupZipOperatorType::~RuntimeColumnGroupZipOperatorType()
+{
+  for(std::size_t i=0; i<mKeyTransfers.size(); ++i) {
+    delete mNullableTransfers[i];
+    delete mKeyTransfers[i];
+  }
+  delete mKeyCompare;
+  delete mZipTransfer;
+}
+
+/**
+ * Batches of the column groups being zipped.  The records of a batch
+ * are made nullable and have their primary key extracted by a pool
+ * of threads, one column group per task, so the scheduler thread 
+ * only reads and zips.  Column group files are still parsed by their
+ * own operators, since only the scheduler thread may read a port.
+ */
+class ColumnGroupBatches
+{
+public:
+  struct Input
+  {
+    // Records read and, once transferred, their keys.
+    std::vector<RecordBuffer> Records;
+    std::vector<RecordBuffer> Keys;
+    // Next record to zip.
+    std::size_t Next;
+    bool EOS;
+    Input()
+      :
+      Next(0),
+      EOS(false)
+    {
+    }
+  };
+private:
+  const RuntimeColumnGroupZipOperatorType& mOpType;
+  InterpreterContext * mRuntimeContext;
+  std::vector<Input> mInputs;
+
+  // Work queue shared with the transfer threads.
+  boost::mutex mLock;
+  boost::condition_variable mWorkAvailable;
+  boost::condition_variable mWorkDone;
+  std::vector<std::size_t> mTasks;
+  std::size_t mNextTask;
+  std::size_t mPending;
+  bool mShutdown;
+  boost::thread_group mThreads;
+
+  void run();
+  void transfer(std::size_t input, InterpreterContext * ctxt);
+public:
+  ColumnGroupBatches(const RuntimeColumnGroupZipOperatorType& opType,
+		     std::size_t numThreads);
+  ~ColumnGroupBatches();
+  std::size_t size() const
+  {
+    return mInputs.size();
+  }
+  Input& operator[](std::size_t input)
+  {
+    return mInputs[input];
+  }
+  /**
+   * Has input been zipped up to the end of its batch?
+   */
+  bool needsRead(std::size_t input) const
+  {
+    return !mInputs[input].EOS && 
+      mInputs[input].Next == mInputs[input].Records.size();
+  }
+  /**
+   * All inputs closed and zipped?
+   */
+  bool empty() const;
+  /**
+   * Transfer the records read since the last call and wait for them.
+   */
+  void transfer();
+};
+
+ColumnGroupBatches::ColumnGroupBatches(const RuntimeColumnGroupZipOperatorType& opType,
+				       std::size_t numThreads)
+  :
+  mOpType(opType),
+  mRuntimeContext(new InterpreterContext()),
+  mInputs(opType.mInputFree.size()),
+  mNextTask(0),
+  mPending(0),
+  mShutdown(false)
+{
+  for(std::size_t i=0; i<numThreads; ++i) {
+    mThreads.create_thread(boost::bind(&ColumnGroupBatches::run, this));
+  }
+}
+
+ColumnGroupBatches::~ColumnGroupBatches()
+{
+  {
+    boost::unique_lock<boost::mutex> lock(mLock);
+    mShutdown = true;
+    mWorkAvailable.notify_all();
+  }
+  mThreads.join_all();
+  // Free what wasn't zipped.
+  for(std::size_t i=0; i<mInputs.size(); ++i) {
+    Input& in(mInputs[i]);
+    for(std::size_t j=in.Next; j<in.Records.size(); ++j) {
+      if (j < in.Keys.size()) {
+	mOpType.mNullableFree[i].free(in.Records[j]);
+	mOpType.mKeyFree.free(in.Keys[j]);
+      } else {
+	mOpType.mInputFree[i].free(in.Records[j]);
       }
+    }
+  }
+  delete mRuntimeContext;
+}
 
-      // TODO: Convert all metadata to use SortKey rather than string.
-      std::vector<SortKey> pkMerge;
-      for(std::vector<std::string>::const_iterator k = pk.begin();
-	  k != pk.end(); ++k) {
-	pkMerge.push_back(SortKey(*k, SortKey::ASC));
+void ColumnGroupBatches::run()
+{
+  InterpreterContext ctxt;
+  while(true) {
+    std::size_t input;
+    {
+      boost::unique_lock<boost::mutex> lock(mLock);
+      while(!mShutdown && mNextTask >= mTasks.size()) {
+	mWorkAvailable.wait(lock);
+      }
+      if (mShutdown) {
+	return;
+      }
+      input = mTasks[mNextTask++];
+    }
+    transfer(input, &ctxt);
+    {
+      boost::unique_lock<boost::mutex> lock(mLock);
+      if (0 == --mPending) {
+	mWorkDone.notify_all();
       }
-      smjs.push_back(new SortMergeJoin(ctxt, SortMergeJoin::FULL_OUTER, 
-				       smjs.back()->getOutputType(),
-				       mColumnGroups[i]->getColumnGroupTypeWithSuffix(), 
-				       pkMerge, 
-				       mColumnGroups[i]->getPrimaryKeyWithSuffix(), 
-				       "", xfer));
-      mJoins.push_back(smjs.back()->create());
-    }	
+    }
+  }
+}
+
+void ColumnGroupBatches::transfer(std::size_t input, InterpreterContext * ctxt)
+{
+  Input& in(mInputs[input]);
+  for(std::size_t j=in.Keys.size(); j<in.Records.size(); ++j) {
+    if (mOpType.mNullableTransfers[input]) {
+      RecordBuffer buf;
+      mOpType.mNullableTransfers[input]->execute(in.Records[j], buf, ctxt, false);
+      mOpType.mInputFree[input].free(in.Records[j]);
+      in.Records[j] = buf;
+    }
+    in.Keys.push_back(RecordBuffer());
+    mOpType.mKeyTransfers[input]->execute(in.Records[j], in.Keys.back(), ctxt, false);
+  }
+}
+
+bool ColumnGroupBatches::empty() const
+{
+  for(std::vector<Input>::const_iterator it = mInputs.begin();
+      it != mInputs.end();
+      ++it) {
+    if (!it->EOS || it->Next < it->Records.size()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void ColumnGroupBatches::transfer()
+{
+  std::vector<std::size_t> tasks;
+  for(std::size_t i=0; i<mInputs.size(); ++i) {
+    if (mInputs[i].Keys.size() < mInputs[i].Records.size()) {
+      tasks.push_back(i);
+    }
+  }
+  // Don't bother handing off a single batch.
+  if (tasks.size() == 1) {
+    transfer(tasks[0], mRuntimeContext);
+    return;
+  }
+  boost::unique_lock<boost::mutex> lock(mLock);
+  mTasks.swap(tasks);
+  mNextTask = 0;
+  mPending = mTasks.size();
+  mWorkAvailable.notify_all();
+  while(mPending > 0) {
+    mWorkDone.wait(lock);
+  }
+}
+
+class RuntimeColumnGroupZipOperator : public RuntimeOperatorBase<RuntimeColumnGroupZipOperatorType>
+{
+private:
+  enum State { START, READ, WRITE, WRITE_EOF };
+  enum { BATCH_SIZE = 1024 };
+  State mState;
+  ColumnGroupBatches * mBatches;
+  // All NULL records for inputs without the current key.
+  std::vector<RecordBuffer> mNulls;
+  std::vector<RecordBuffer> mSources;
+  bool * mIsSourceMove;
+  // Inputs with the current key.
+  std::vector<std::size_t> mMatched;
+  std::size_t mNext;
+  RecordBuffer mOutput;
+  class InterpreterContext * mRuntimeContext;
+
+  bool zip();
+public:
+  RuntimeColumnGroupZipOperator(RuntimeOperator::Services& services, 
+				const RuntimeColumnGroupZipOperatorType& opType);
+  ~RuntimeColumnGroupZipOperator();
+  void start();
+  void onEvent(RuntimePort * port);
+  void shutdown();
+};
+
+RuntimeColumnGroupZipOperator::RuntimeColumnGroupZipOperator(RuntimeOperator::Services& services, 
+							     const RuntimeColumnGroupZipOperatorType& opType)
+  :
+  RuntimeOperatorBase<RuntimeColumnGroupZipOperatorType>(services, opType),
+  mState(START),
+  mBatches(NULL),
+  mIsSourceMove(new bool [opType.mInputFree.size()]),
+  mNext(0),
+  mRuntimeContext(new InterpreterContext())
+{
+  std::size_t sz = opType.mInputFree.size();
+  mSources.resize(sz);
+  for(std::size_t i=0; i<sz; ++i) {
+    mNulls.push_back(opType.mNullableMalloc[i].malloc());
+    mIsSourceMove[i] = false;
+  }
+}
+
+RuntimeColumnGroupZipOperator::~RuntimeColumnGroupZipOperator()
+{
+  delete mBatches;
+  for(std::size_t i=0; i<mNulls.size(); ++i) {
+    getMyOperatorType().mNullableFree[i].free(mNulls[i]);
+  }
+  delete [] mIsSourceMove;
+  delete mRuntimeContext;
+}
+
+bool RuntimeColumnGroupZipOperator::zip()
+{
+  const RuntimeColumnGroupZipOperatorType & opType(getMyOperatorType());
+  // Find the inputs with the smallest key.  The next key of an
+  // input that has zipped its batch isn't known until it is read.
+  mMatched.clear();
+  for(std::size_t i=0; i<mBatches->size(); ++i) {
+    ColumnGroupBatches::Input& in((*mBatches)[i]);
+    if (in.Next == in.Records.size()) {
+      if (!in.EOS) 
+	return false;
+      continue;
+    }
+    int32_t cmp = mMatched.size() ? 
+      opType.mKeyCompare->execute(in.Keys[in.Next], 
+				  (*mBatches)[mMatched[0]].Keys[(*mBatches)[mMatched[0]].Next], 
+				  mRuntimeContext) : -1;
+    if (cmp < 0) {
+      mMatched.clear();
+    }
+    if (cmp <= 0) {
+      mMatched.push_back(i);
+    }
+  }
+  if (0 == mMatched.size()) 
+    return false;
+
+  mSources = mNulls;
+  for(std::vector<std::size_t>::const_iterator it = mMatched.begin();
+      it != mMatched.end(); ++it) {
+    ColumnGroupBatches::Input& in((*mBatches)[*it]);
+    mSources[*it] = in.Records[in.Next];
   }
-  for(std::vector<SortMergeJoin *>::iterator smj= smjs.begin(),
-	smjEnd = smjs.end(); smj != smjEnd; ++smj) {
-    delete *smj;
+  mOutput = RecordBuffer();
+  opType.mZipTransfer->execute(&mSources[0], mIsSourceMove, (int32_t) mSources.size(),
+			       mOutput, mRuntimeContext);
+  for(std::vector<std::size_t>::const_iterator it = mMatched.begin();
+      it != mMatched.end(); ++it) {
+    ColumnGroupBatches::Input& in((*mBatches)[*it]);
+    opType.mNullableFree[*it].free(in.Records[in.Next]);
+    opType.mKeyFree.free(in.Keys[in.Next]);
+    in.Records[in.Next] = in.Keys[in.Next] = RecordBuffer();
+    in.Next += 1;
+  }
+  return true;
+}
+
+void RuntimeColumnGroupZipOperator::start()
+{
+  delete mBatches;
+  mBatches = new ColumnGroupBatches(getMyOperatorType(), 
+				    getInputPorts().size());
+  mState = START;
+  onEvent(NULL);
+}
+
+void RuntimeColumnGroupZipOperator::onEvent(RuntimePort * port)
+{
+  switch(mState) {
+  case START:
+    while(true) {
+      // Read a batch from the inputs that have zipped theirs.
+      for(mNext=0; mNext<mBatches->size(); ++mNext) {
+	if (!mBatches->needsRead(mNext)) 
+	  continue;
+	(*mBatches)[mNext].Records.clear();
+	(*mBatches)[mNext].Keys.clear();
+	(*mBatches)[mNext].Next = 0;
+	while((*mBatches)[mNext].Records.size() < BATCH_SIZE) {
+	  requestRead(mNext);
+	  mState = READ;
+	  return;
+	case READ:
+	  {
+	    RecordBuffer buf;
+	    read(port, buf);
+	    if (RecordBuffer::isEOS(buf)) {
+	      (*mBatches)[mNext].EOS = true;
+	      break;
+	    }
+	    (*mBatches)[mNext].Records.push_back(buf);
+	  }
+	}
+      }
+      mBatches->transfer();
+      while(zip()) {
+	requestWrite(0);
+	mState = WRITE;
+	return;
+      case WRITE:
+	write(port, mOutput, false);
+	mOutput = RecordBuffer();
+      }
+      if (mBatches->empty()) 
+	break;
+    }
+    requestWrite(0);
+    mState = WRITE_EOF;
+    return;
+  case WRITE_EOF:
+    write(port, RecordBuffer(), true);
+    return;
   }
 }
 
+void RuntimeColumnGroupZipOperator::shutdown()
+{
+}
+
+RuntimeOperator * RuntimeColumnGroupZipOperatorType::create(RuntimeOperator::Services & s) const
+{
+  return new RuntimeColumnGroupZipOperator(s, *this);
+}
+
 LogicalTableParser::LogicalTableParser(const std::string& table)
   :
   mTable(table),
   mCommonVersion(1),
   mMajorVersion(1),
+  mFilterFun(NULL),
+  mZoneMap(NULL),
+  mProjectColumnGroups(false),
   mTableFormat(NULL),
   mTableOutput(NULL),
   mSOT(NULL)
@@ -634,6 +1036,9 @@ LogicalTableParser::LogicalTableParser(const std::string& table,
   mTable(table),
   mCommonVersion(1),
   mMajorVersion(1),
+  mFilterFun(NULL),
+  mZoneMap(NULL),
+  mProjectColumnGroups(false),
   mTableFormat(NULL),
   mTableMetadata(tableMetadata),
   mTableOutput(NULL),
@@ -645,6 +1050,24 @@ LogicalTableParser::~LogicalTableParser()
 {
   delete mSOT;
   delete mTableOutput;
+  delete mFilterFun;
+  delete mZoneMap;
+}
+
+bool LogicalTableParser::isColumnGroupReferenced(DynamicRecordContext& ctxt,
+						 TableColumnGroup * cg) const
+{
+  std::set<std::string> keys(mTableMetadata->getPrimaryKey().begin(),
+			     mTableMetadata->getPrimaryKey().end());
+  keys.insert(mTableMetadata->getVersion());
+  const RecordType * cgType = cg->getRecordType(ctxt);
+  for(std::vector<std::string>::const_iterator it = mReferenced.begin();
+      it != mReferenced.end(); ++it) {
+    if (keys.end() == keys.find(*it) && cgType->hasMember(*it)) {
+      return true;
+    }
+  }
+  return false;
 }
 
 void LogicalTableParser::check(PlanCheckContext& ctxt)
@@ -659,6 +1082,10 @@ void LogicalTableParser::check(PlanCheckContext& ctxt)
       mFileSystem = boost::get<std::string>(it->Value);
     } else if (boost::algorithm::iequals(it->Name, "where")) {
       mPredicate = boost::get<std::string>(it->Value);
+    } else if (boost::algorithm::iequals(it->Name, "filter")) {
+      mFilter = boost::get<std::string>(it->Value);
+    } else if (boost::algorithm::iequals(it->Name, "projectcolumngroups")) {
+      mProjectColumnGroups = getBooleanValue(ctxt, *it);
     } else if (boost::algorithm::iequals(it->Name, "commonversion")) {
       mCommonVersion = boost::get<int32_t>(it->Value);
     } else if (boost::algorithm::iequals(it->Name, "majorversion")) {
@@ -709,6 +1136,19 @@ void LogicalTableParser::check(PlanCheckContext& ctxt)
   getOutput(0)->setRecordType(RecordType::get(ctxt, mTableFormat, 
 					      mReferenced.begin(), mReferenced.end()));
 
+  if (mFilter.size()) {
+    try {
+      std::vector<RecordMember> emptyMembers;
+      RecordType emptyTy(emptyMembers);
+      std::vector<const RecordType *> inputs;
+      inputs.push_back(getOutput(0)->getRecordType());
+      inputs.push_back(&emptyTy);
+      mFilterFun = new RecordTypeFunction(ctxt, "tableFilter", inputs, mFilter);
+      mZoneMap = new ZoneMapPredicate(ctxt, mTableFormat, mFilter);
+    } catch(std::exception& ex) {
+      ctxt.logError(*this, ex.what());
+    }
+  }
 
   // In addition to the columns that the operators output,
   // there may be other keys for processing column groups (e.g.
@@ -719,8 +1159,20 @@ void LogicalTableParser::check(PlanCheckContext& ctxt)
   mTableOutput = new TableOutput(mTableMetadata.get(), mTableFormat);
   if (0 == mFile.size()) {
     if (mTableMetadata->getSortKeys().size() != 0) {
+      // Unless told otherwise we must read every column group since
+      // any one of them may have primary keys that the others don't.
+      std::vector<TableColumnGroup *> columnGroups;
       for(TableMetadata::column_group_const_iterator cg = mTableMetadata->beginColumnGroups(),
 	    endCg = mTableMetadata->endColumnGroups(); cg != endCg; ++cg) {
+	if (mProjectColumnGroups && !isColumnGroupReferenced(ctxt, *cg)) 
+	  continue;
+	columnGroups.push_back(*cg);
+      }
+      if (0 == columnGroups.size()) {
+	columnGroups.push_back(*mTableMetadata->beginColumnGroups());
+      }
+      for(std::vector<TableColumnGroup *>::const_iterator cg = columnGroups.begin(),
+	    endCg = columnGroups.end(); cg != endCg; ++cg) {
 	ColumnGroupOutput * cgo = mTableOutput->create(ctxt, *cg, referencedAndRequired);
 	const RecordType * ty = cgo->ColumnGroupType;
 
@@ -785,6 +1237,8 @@ void LogicalTableParser::check(PlanCheckContext& ctxt)
       TableColumnGroup * cg = NULL;
       mTableMetadata->resolveMetadata(*it, cg, fileMetadata);
       ColumnGroupOutput * cgo = mTableOutput->find(cg);
+      if (NULL == cgo) 
+	continue;
       cgo->addPath(ctxt, fileMetadata, *it);
     } 
     // Check all table and column group outputs
@@ -797,16 +1251,19 @@ void LogicalTableParser::create(class RuntimePlanBuilder& plan)
 {
   typedef GenericParserOperatorType<> file_op;
   typedef GenericParserOperatorType<SerialChunkStrategy> table_op;
+  RuntimeOperatorType * outputOp = NULL;
   if (mFile.size()) {
-    RuntimeOperatorType * opType = NULL;
-    opType = new file_op(mFile,
-			 '\t',
-			 '\n',
-			 '\\',
-			 getOutput(0)->getRecordType(),
-			 mTableFormat);
+    file_op * opType = new file_op(mFile,
+				   '\t',
+				   '\n',
+				   '\\',
+				   getOutput(0)->getRecordType(),
+				   mTableFormat);
+    if (mZoneMap) {
+      opType->setZoneMap(*mZoneMap);
+    }
     plan.addOperatorType(opType);
-    plan.mapOutputPort(this, 0, opType, 0);
+    outputOp = opType;
   } else {
     for(std::vector<ColumnGroupOutput*>::iterator cg = mTableOutput->mColumnGroups.begin(),
 	  cgEnd = mTableOutput->mColumnGroups.end(); cg != cgEnd; ++cg) {
@@ -824,12 +1281,16 @@ void LogicalTableParser::create(class RuntimePlanBuilder& plan)
 	TableColumnGroupVersionOutput * po = v->second;
 	for(TableColumnGroupVersionOutput::path_iterator p = po->beginPaths(),
 	      pEnd = po->endPaths(); p != pEnd; ++p) {
-	  RuntimeOperatorType * opType = new table_op((*p)->getPath(),
-						      '\t',
-						      '\n',
-						      '\\',
-						      po->FileOutput,
-						      po->FileType);
+	  table_op * tableOp = new table_op((*p)->getPath(),
+					    '\t',
+					    '\n',
+					    '\\',
+					    po->FileOutput,
+					    po->FileType);
+	  if (mZoneMap) {
+	    tableOp->setZoneMap(*mZoneMap);
+	  }
+	  RuntimeOperatorType * opType = tableOp;
 	  plan.addOperatorType(opType);
 	  if (!po->Transfer->isIdentity()) {
 	    // Resolve version discrepancies 
@@ -860,29 +1321,30 @@ void LogicalTableParser::create(class RuntimePlanBuilder& plan)
       (*cg)->OutputOperator = mergeType;
     }
 
-    if (mTableOutput->mColumnGroups.size() > 1) {
-      BOOST_ASSERT(mTableOutput->mJoins.size()+1 == 
-		   mTableOutput->mColumnGroups.size());
-      plan.addOperatorType(mTableOutput->mColumnGroups[0]->OutputOperator);
-      plan.addOperatorType(mTableOutput->mColumnGroups[1]->OutputOperator);
-      plan.addOperatorType(mTableOutput->mJoins[0]);
-      plan.connect(mTableOutput->mColumnGroups[0]->OutputOperator, 0, 
-		   mTableOutput->mJoins[0], 0, false);
-      plan.connect(mTableOutput->mColumnGroups[1]->OutputOperator, 0, 
-		   mTableOutput->mJoins[0], 1, false);
-      for(std::size_t i=1; i<mTableOutput->mJoins.size(); ++i) {
-	plan.addOperatorType(mTableOutput->mColumnGroups[i+1]->OutputOperator);
-	plan.addOperatorType(mTableOutput->mJoins[i]);
-	plan.connect(mTableOutput->mColumnGroups[i+1]->OutputOperator, 0, 
-		     mTableOutput->mJoins[i], 1, false);
-	plan.connect(mTableOutput->mJoins[i-1], 0, 
-		     mTableOutput->mJoins[i], 0, false);
+    if (mTableOutput->hasZip()) {
+      // Merge all of the column groups at once.
+      RuntimeOperatorType * zipTy = mTableOutput->create();
+      plan.addOperatorType(zipTy);
+      for(std::size_t i=0; i<mTableOutput->mColumnGroups.size(); ++i) {
+	plan.addOperatorType(mTableOutput->mColumnGroups[i]->OutputOperator);
+	plan.connect(mTableOutput->mColumnGroups[i]->OutputOperator, 0, 
+		     zipTy, i, false);
       }
-      plan.mapOutputPort(this, 0, mTableOutput->mJoins.back(), 0);
+      outputOp = zipTy;
     } else {
       plan.addOperatorType(mTableOutput->mColumnGroups[0]->OutputOperator);
-      plan.mapOutputPort(this, 0, mTableOutput->mColumnGroups[0]->OutputOperator, 0);
+      outputOp = mTableOutput->mColumnGroups[0]->OutputOperator;
     }
   }
+  if (mFilterFun) {
+    RuntimeOperatorType * filterTy = 
+      new RuntimeFilterOperatorType(getOutput(0)->getRecordType(),
+				    mFilterFun,
+				    std::numeric_limits<int64_t>::max());
+    plan.addOperatorType(filterTy);
+    plan.connect(outputOp, 0, filterTy, 0);
+    outputOp = filterTy;
+  }
+  plan.mapOutputPort(this, 0, outputOp, 0);
 }
 
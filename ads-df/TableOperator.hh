@@ -36,6 +36,7 @@
 #define __TABLEOPERATOR_HH__
 
 #include "LogicalOperator.hh"
+#include "RuntimeOperator.hh"
 
 class SerialOrganizedTable;
 
@@ -62,6 +63,15 @@ private:
   // When reading from file system this is an optional predicate
   // that will prune the directories we read from.
   std::string mPredicate;
+  // Optional predicate on the columns of the table.  In addition
+  // to filtering the output, it skips files whose statistics show 
+  // they have no matching records.
+  std::string mFilter;
+  class RecordTypeFunction * mFilterFun;
+  class ZoneMapPredicate * mZoneMap;
+  // Only read the column groups with referenced non key columns.
+  // Only valid when every column group contains every primary key.
+  bool mProjectColumnGroups;
 
   boost::shared_ptr<const class TableMetadata> mTableMetadata;
   class TableOutput * mTableOutput;
@@ -81,6 +91,8 @@ private:
   // path and the metadata (assuming that the information is encoded
   // in the path somehow.
 
+  bool isColumnGroupReferenced(DynamicRecordContext& ctxt,
+			       class TableColumnGroup * cg) const;
 public:
   LogicalTableParser(const std::string& table);
   LogicalTableParser(const std::string& table,
@@ -90,4 +102,61 @@ public:
   void create(class RuntimePlanBuilder& plan);  
 };
 
+/**
+ * Stitch together the column groups of a table.  Each input is
+ * one column group sorted on and unique in the primary key.  All 
+ * inputs are merged at once, outputting one record per key with 
+ * NULLs for the column groups that don't have the key.  This
+ * replaces a chain of full outer sort merge joins that copied
+ * each record once per column group.  Inputs are read in batches
+ * whose records are made nullable and keyed on a thread per column
+ * group.
+ */
+class RuntimeColumnGroupZipOperatorType : public RuntimeOperatorType
+{
+  friend class RuntimeColumnGroupZipOperator;
+  friend class ColumnGroupBatches;
+private:
+  std::vector<RecordTypeFree> mInputFree;
+  // Coerce inputs to nullable (NULL if already nullable).
+  std::vector<IQLTransferModule *> mNullableTransfers;
+  std::vector<RecordTypeMalloc> mNullableMalloc;
+  std::vector<RecordTypeFree> mNullableFree;
+  // Extract the primary key of each input into a common format.
+  std::vector<IQLTransferModule *> mKeyTransfers;
+  RecordTypeFree mKeyFree;
+  IQLFunctionModule * mKeyCompare;
+  IQLTransferModule2 * mZipTransfer;
+
+  // Serialization
+  friend class boost::serialization::access;
+  template <class Archive>
+  void serialize(Archive & ar, const unsigned int version)
+  {
+    ar & BOOST_SERIALIZATION_BASE_OBJECT_NVP(RuntimeOperatorType);
+    ar & BOOST_SERIALIZATION_NVP(mInputFree);
+    ar & BOOST_SERIALIZATION_NVP(mNullableTransfers);
+    ar & BOOST_SERIALIZATION_NVP(mNullableMalloc);
+    ar & BOOST_SERIALIZATION_NVP(mNullableFree);
+    ar & BOOST_SERIALIZATION_NVP(mKeyTransfers);
+    ar & BOOST_SERIALIZATION_NVP(mKeyFree);
+    ar & BOOST_SERIALIZATION_NVP(mKeyCompare);
+    ar & BOOST_SERIALIZATION_NVP(mZipTransfer);
+  }
+  RuntimeColumnGroupZipOperatorType()
+    :
+    mKeyCompare(NULL),
+    mZipTransfer(NULL)
+  {
+  }
+public:
+  RuntimeColumnGroupZipOperatorType(const std::vector<const RecordType *>& inputs,
+				    const std::vector<RecordTypeTransfer *>& nullableTransfers,
+				    const std::vector<RecordTypeTransfer *>& keyTransfers,
+				    const RecordTypeFunction * keyCompare,
+				    const RecordTypeTransfer2 * zipTransfer);
+  ~RuntimeColumnGroupZipOperatorType();
+  RuntimeOperator * create(RuntimeOperator::Services & s) const;
+};
+
 #endif
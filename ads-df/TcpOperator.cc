@@ -1,62 +1,338 @@
+#include <algorithm>
+#include <deque>
+#include <iostream>
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
 #include <boost/format.hpp>
+#include <boost/intrusive/list.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/make_shared.hpp>
 
 #include "RuntimeProcess.hh"
 #include "TcpOperator.hh"
 
+/**
+ * A connection accepted by tcp_read.  Reads go into a stream 
+ * block and when a record delimiter is configured only whole records
+ * are released to the output; the tail of a read is carried forward
+ * into the next block of the session.
+ */
+class TcpReadSession
+{
+public:
+  /**
+   * Doubly linked list so that session can be managed on queues.
+   */
+  typedef boost::intrusive::list_member_hook<boost::intrusive::link_mode<boost::intrusive::normal_link> > link_type;
+  link_type mSessionHook;
+  typedef boost::intrusive::member_hook<TcpReadSession, 
+					link_type, 
+					&TcpReadSession::mSessionHook> SessionQueueOption;
+  typedef boost::intrusive::list<TcpReadSession, SessionQueueOption, boost::intrusive::constant_time_size<false> > SessionQueue;
+
+  boost::asio::ip::tcp::socket mSocket;
+  // Block being filled by reads.
+  RecordBuffer mReading;
+  // Blocks ready for output.
+  std::deque<RecordBuffer> mCompletedBuffers;
+  // Result of the last read.
+  std::size_t mIOSize;
+  boost::system::error_code mError;
+  bool mEOF;
+  
+  TcpReadSession(boost::asio::io_service& ios)
+    :
+    mSocket(ios),
+    mIOSize(0),
+    mEOF(false)
+  {
+  }
+};
+
 class TcpReadOperator : public RuntimeOperatorBase<TcpReadOperatorType>
 {
 private:
-  enum State { START, ACCEPT, READ_BLOCK, WRITE_BLOCK, WRITE_EOF };
+  enum State { START, WAIT, WRITE_EOF };
   State mState;  
   boost::asio::ip::tcp::acceptor * mAcceptor;
-  boost::asio::ip::tcp::socket * mSocket;
+  TcpReadSession * mAcceptingSession;
+  // Sessions with a read outstanding.
+  TcpReadSession::SessionQueue mReadingSessions;
+  // Sessions with blocks to output.  We don't read more from these
+  // until their blocks have been written.
+  TcpReadSession::SessionQueue mOutputReadySessions;
   RecordBuffer mBuffer;
+  int32_t mNumAsyncRequests;
+  int32_t mNumAccepted;
+  bool mListening;
+  // Backoff before re-arming accept after a transient error such
+  // as running out of file descriptors.
+  boost::asio::deadline_timer mAcceptTimer;
+  int32_t mAcceptBackoffMillis;
+  bool mAcceptDelayed;
+  static const int32_t MIN_ACCEPT_BACKOFF_MILLIS = 10;
+  static const int32_t MAX_ACCEPT_BACKOFF_MILLIS = 1000;
+
+  ServiceCompletionFifo * getServiceCompletionFifo()
+  {
+    return &(dynamic_cast<ServiceCompletionPort*>(getCompletionPorts()[0])->getFifo());
+  }
+
+  const StreamBufferBlock & getBlock() 
+  {
+    return getMyOperatorType().mStreamBufferBlock;
+  }
 
 public:
   TcpReadOperator(RuntimeOperator::Services& services, 
 		  const TcpReadOperatorType& opType)
     :
-    RuntimeOperatorBase<TcpReadOperatorType>(services, opType)
+    RuntimeOperatorBase<TcpReadOperatorType>(services, opType),
+    mAcceptingSession(NULL),
+    mNumAsyncRequests(0),
+    mNumAccepted(0),
+    mListening(true),
+    mAcceptTimer(services.getIOService()),
+    mAcceptBackoffMillis(MIN_ACCEPT_BACKOFF_MILLIS),
+    mAcceptDelayed(false)
   {
     using boost::asio::ip::tcp;
-    mAcceptor = new tcp::acceptor(services.getIOService(),
-				  tcp::endpoint(tcp::v4(), 
-						opType.mPort));
-    mSocket = new tcp::socket(services.getIOService());
+    typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port;
+    tcp::endpoint endpoint(tcp::v4(), opType.mPort);
+    mAcceptor = new tcp::acceptor(services.getIOService());
+    mAcceptor->open(endpoint.protocol());
+    mAcceptor->set_option(tcp::acceptor::reuse_address(true));
+    if (opType.mReusePort) {
+      mAcceptor->set_option(reuse_port(true));
+    }
+    mAcceptor->bind(endpoint);
+    mAcceptor->listen();
   }
   
   ~TcpReadOperator()
   {
-    delete mSocket;
+    delete mAcceptingSession;
+    deleteSessions(mReadingSessions);
+    deleteSessions(mOutputReadySessions);
     delete mAcceptor;
   }
 
   static void handleAccept(ServiceCompletionFifo * fifo,
+			   TcpReadSession * session,
 			   const boost::system::error_code& error)
   {
-    // Post the response into the scheduler
+    // Post the response into the scheduler; accept completions
+    // are distinguished from reads by a NULL buffer.
+    if (error) {
+      std::cerr << "tcp_read: received error in asynchronous accept: " << error << std::endl;
+    }
+    session->mError = error;
     RecordBuffer buf;
-    // TODO: Error handling...
     fifo->write(buf);
   }
 
+  static void handleAcceptTimer(ServiceCompletionFifo * fifo,
+				const boost::system::error_code& error)
+  {
+    // Timer completions also post a NULL buffer; mAcceptDelayed
+    // tells them apart from accepts.
+    RecordBuffer buf;
+    fifo->write(buf);
+  }
+
+  /**
+   * Errors that may clear up on their own (resource exhaustion or a
+   * peer that went away before we accepted).  Anything else stops
+   * the listener.
+   */
+  static bool isTransientAcceptError(const boost::system::error_code& error)
+  {
+    return error == boost::asio::error::no_descriptors ||
+      error == boost::system::errc::too_many_files_open_in_system ||
+      error == boost::asio::error::no_buffer_space ||
+      error == boost::asio::error::no_memory ||
+      error == boost::asio::error::connection_aborted ||
+      error == boost::asio::error::interrupted ||
+      error == boost::asio::error::try_again;
+  }
+
   static void handleRead(ServiceCompletionFifo * fifo,
-			 const StreamBufferBlock * block,
-			 RecordBuffer buf,
+			 TcpReadSession * session,
 			 const boost::system::error_code& error,
 			 size_t bytes_transferred)
   {
-    if (!error) {
-      block->setSize((int32_t) bytes_transferred, buf);
-      fifo->write(buf);
+    // Record the result before the completion is visible to
+    // the operator.
+    session->mIOSize = bytes_transferred;
+    session->mError = error;
+    RecordBuffer buf;
+    buf.Ptr = (uint8_t *) session;
+    fifo->write(buf);
+  }
+
+  void deleteSessions(TcpReadSession::SessionQueue & q)
+  {
+    while(!q.empty()) {
+      TcpReadSession * session = &q.front();
+      q.pop_front();
+      deleteSession(session);
+    }
+  }
+
+  void deleteSession(TcpReadSession * session)
+  {
+    if (session->mReading != RecordBuffer()) {
+      getMyOperatorType().mFree.free(session->mReading);
+    }
+    for(std::deque<RecordBuffer>::iterator b = session->mCompletedBuffers.begin(),
+	  e = session->mCompletedBuffers.end(); b != e; ++b) {
+      getMyOperatorType().mFree.free(*b);
+    }
+    delete session;
+  }
+
+  void accept()
+  {
+    if (!mListening) {
+      return;
+    }
+    mAcceptingSession = new TcpReadSession(getIOService());
+    mAcceptor->async_accept(mAcceptingSession->mSocket,
+			    boost::bind(&TcpReadOperator::handleAccept, 
+					getServiceCompletionFifo(),
+					mAcceptingSession,
+					boost::asio::placeholders::error));
+    mNumAsyncRequests += 1;
+  }
+
+  void delayAccept()
+  {
+    mAcceptDelayed = true;
+    mAcceptTimer.expires_from_now(boost::posix_time::milliseconds(mAcceptBackoffMillis));
+    mAcceptTimer.async_wait(boost::bind(&TcpReadOperator::handleAcceptTimer,
+					getServiceCompletionFifo(),
+					boost::asio::placeholders::error));
+    mNumAsyncRequests += 1;
+    mAcceptBackoffMillis = std::min(2*mAcceptBackoffMillis, 
+				    MAX_ACCEPT_BACKOFF_MILLIS);
+  }
+
+  void startRead(TcpReadSession * session)
+  {
+    if (session->mReading == RecordBuffer()) {
+      session->mReading = getMyOperatorType().mMalloc.malloc();
+      getBlock().setSize(0, session->mReading);
+    }
+    int32_t sz = getBlock().getSize(session->mReading);
+    session->mSocket.async_read_some(boost::asio::buffer(getBlock().begin(session->mReading) + sz,
+							 getBlock().capacity() - sz),
+				     boost::bind(&TcpReadOperator::handleRead, 
+						 getServiceCompletionFifo(),
+						 session,
+						 boost::asio::placeholders::error,
+						 boost::asio::placeholders::bytes_transferred));
+    mNumAsyncRequests += 1;
+    mReadingSessions.push_back(*session);
+  }
+
+  /**
+   * Account for a completed read, moving any blocks that are ready 
+   * to the session output queue.
+   */
+  void onRead(TcpReadSession * session)
+  {
+    const StreamBufferBlock & block(getBlock());
+    const std::string & delim(getMyOperatorType().mRecordDelimiter);
+    RecordBuffer buf = session->mReading;
+    int32_t sz = block.getSize(buf);
+    if (session->mError || 0 == session->mIOSize) {
+      session->mEOF = true;
+      session->mSocket.close();
+      if (0 == sz) {
+	getMyOperatorType().mFree.free(buf);
+      } else {
+	// Terminate a final record that is missing its delimiter 
+	// so it can't run into a block from another connection.
+	if (delim.size() && 
+	    (sz < (int32_t) delim.size() || 
+	     0 != ::memcmp(block.begin(buf) + sz - delim.size(), 
+			   delim.c_str(), delim.size()))) {
+	  if (sz + delim.size() > (std::size_t) block.capacity()) {
+	    session->mCompletedBuffers.push_back(buf);
+	    buf = getMyOperatorType().mMalloc.malloc();
+	    sz = 0;
+	  }
+	  ::memcpy(block.begin(buf) + sz, delim.c_str(), delim.size());
+	  sz += (int32_t) delim.size();
+	  block.setSize(sz, buf);
+	}
+	session->mCompletedBuffers.push_back(buf);
+      }
+      session->mReading = RecordBuffer();
+      return;
+    }
+
+    addBytes(session->mIOSize);
+    sz += (int32_t) session->mIOSize;
+    block.setSize(sz, buf);
+    if (0 == delim.size()) {
+      session->mCompletedBuffers.push_back(buf);
+      session->mReading = RecordBuffer();
+      return;
+    }
+    int32_t framed = TcpReadOperatorType::getFramedSize(block.begin(buf),
+							block.begin(buf) + sz,
+							delim);
+    if (0 == framed) {
+      if (sz == block.capacity()) {
+	// Drop only this connection; records already framed on it
+	// are still output.
+	boost::system::error_code ec;
+	std::cerr << (boost::format("tcp_read: closing connection from %1%; "
+				    "record exceeds block size of %2% bytes") %
+		      session->mSocket.remote_endpoint(ec) %
+		      block.capacity()).str() << std::endl;
+	session->mEOF = true;
+	session->mSocket.close(ec);
+	getMyOperatorType().mFree.free(buf);
+	session->mReading = RecordBuffer();
+      }
+      // Keep reading into the block.
+      return;
+    }
+    // Move the partial record at the end into a new block.
+    RecordBuffer tail = getMyOperatorType().mMalloc.malloc();
+    ::memcpy(block.begin(tail), block.begin(buf) + framed, sz - framed);
+    block.setSize(sz - framed, tail);
+    block.setSize(framed, buf);
+    session->mCompletedBuffers.push_back(buf);
+    session->mReading = tail;
+  }
+
+  bool requestIOs()
+  {
+    // See HttpReadOperator::requestIOs on unlinking here.
+    getCompletionPorts()[0]->request_unlink();
+    uint32_t requestState(0);
+    if (mNumAsyncRequests > 0) {
+      requestState |= 1;
     }
-    else {
-      block->setSize(0, buf);
-      fifo->write(buf);
+    if (!mOutputReadySessions.empty()) {
+      requestState |= 2;
+    }
+    switch(requestState) {
+    case 0:
+      return false;
+    case 1:
+      requestCompletion(0);
+      return true;
+    case 2:
+      requestWrite(0);
+      return true;
+    case 3:
+    default:
+      requestIO(*getCompletionPorts()[0], *getOutputPorts()[0]);
+      return true;
     }
   }
 
@@ -73,46 +349,77 @@ public:
   {
     switch(mState) {
     case START:
-      // accept a connection
-      requestCompletion(0);
-      mState = ACCEPT;
-      mAcceptor->async_accept(*mSocket,
-			      boost::bind(&TcpReadOperator::handleAccept, 
-					  &(dynamic_cast<ServiceCompletionPort*>(getCompletionPorts()[0])->getFifo()),
-					  boost::asio::placeholders::error));
-      return;
-    case ACCEPT:
-      read(port, mBuffer);
-      // TODO: Handle error....
-      mBuffer = RecordBuffer();
-
-      while(true) {
-	requestCompletion(0);
-	mState = READ_BLOCK;
-	mBuffer = getMyOperatorType().mMalloc.malloc();
-	mSocket->async_read_some(boost::asio::buffer(getMyOperatorType().mStreamBufferBlock.begin(mBuffer), 
-						     getMyOperatorType().mStreamBufferBlock.capacity()),
-				 boost::bind(&TcpReadOperator::handleRead, 
-					     &dynamic_cast<ServiceCompletionPort*>(getCompletionPorts()[0])->getFifo(),
-					     &getMyOperatorType().mStreamBufferBlock,
-					     mBuffer,
-					     boost::asio::placeholders::error,
-					     boost::asio::placeholders::bytes_transferred));
+      accept();
+      while(requestIOs()) {
+	mState = WAIT;
 	return;
-      case READ_BLOCK:
-	read(port, mBuffer);
-	// TODO: Is this the right way to determine when we are
-	// done?
-	if (0 == getMyOperatorType().mStreamBufferBlock.getSize(mBuffer)) {
-	  getMyOperatorType().mFree.free(mBuffer);
+      case WAIT:
+	if (port == getCompletionPorts()[0]) {
+	  read(port, mBuffer);
+	  mNumAsyncRequests -= 1;
+	  if (mBuffer == RecordBuffer() && mAcceptDelayed) {
+	    // Backoff after an accept error is over.
+	    mAcceptDelayed = false;
+	    accept();
+	  } else if (mBuffer == RecordBuffer()) {
+	    // New connection.  An accept error closes the socket;
+	    // transient errors are retried after a backoff and any
+	    // other error stops the listener.
+	    boost::system::error_code error = mAcceptingSession->mError;
+	    if (mAcceptingSession->mSocket.is_open()) {
+	      mNumAccepted += 1;
+	      mAcceptBackoffMillis = MIN_ACCEPT_BACKOFF_MILLIS;
+	      startRead(mAcceptingSession);
+	    } else {
+	      delete mAcceptingSession;
+	    }
+	    mAcceptingSession = NULL;
+	    if (getMyOperatorType().mMaxConnections > 0 &&
+		mNumAccepted >= getMyOperatorType().mMaxConnections) {
+	      mListening = false;
+	      mAcceptor->close();
+	    }
+	    if (error && mListening && !isTransientAcceptError(error)) {
+	      std::cerr << "tcp_read: no longer accepting connections after error: " 
+			<< error.message() << std::endl;
+	      mListening = false;
+	      mAcceptor->close();
+	    }
+	    if (error && mListening) {
+	      delayAccept();
+	    } else {
+	      accept();
+	    }
+	  } else {
+	    TcpReadSession * session = (TcpReadSession *) mBuffer.Ptr;
+	    mReadingSessions.erase(mReadingSessions.iterator_to(*session));
+	    onRead(session);
+	    if (session->mCompletedBuffers.size()) {
+	      mOutputReadySessions.push_back(*session);
+	    } else if (session->mEOF) {
+	      deleteSession(session);
+	    } else {
+	      startRead(session);
+	    }
+	  }
 	  mBuffer = RecordBuffer();
-	  break;
+	} else {
+	  TcpReadSession * session = &mOutputReadySessions.front();
+	  write(port, session->mCompletedBuffers.front(), false);
+	  session->mCompletedBuffers.pop_front();
+	  if (0 == session->mCompletedBuffers.size()) {
+	    mOutputReadySessions.pop_front();
+	    if (session->mEOF) {
+	      deleteSession(session);
+	    } else {
+	      startRead(session);
+	    }
+	  } else {
+	    // Round robin among connections a block at a time.
+	    mOutputReadySessions.pop_front();
+	    mOutputReadySessions.push_back(*session);
+	  }
 	}
-	requestWriteThrough(0);
-	mState = WRITE_BLOCK;
-	return;
-      case WRITE_BLOCK:
-	write(port, mBuffer, false);
       }
 
       requestWrite(0);
@@ -125,15 +432,32 @@ public:
 
   void shutdown()
   {
-    mSocket->close();
     mAcceptor->close();
+    mAcceptTimer.cancel();
+    for(TcpReadSession::SessionQueue::iterator it = mReadingSessions.begin();
+	it != mReadingSessions.end();
+	++it) {
+      it->mSocket.close();
+    }
   }  
 };
 
+int32_t TcpReadOperatorType::getFramedSize(const uint8_t * begin, 
+					   const uint8_t * end,
+					   const std::string& delimiter)
+{
+  const uint8_t * delimBegin = (const uint8_t *) delimiter.c_str();
+  const uint8_t * delimEnd = delimBegin + delimiter.size();
+  const uint8_t * it = std::find_end(begin, end, delimBegin, delimEnd);
+  return it == end ? 0 : (int32_t) (it + delimiter.size() - begin);
+}
+
 LogicalTcpRead::LogicalTcpRead()
   :
   LogicalOperator(0,0,1,1),
-  mPort(0)
+  mPort(0),
+  mMaxConnections(1),
+  mReusePort(false)
 {
 }
 
@@ -144,6 +468,7 @@ LogicalTcpRead::~LogicalTcpRead()
 void LogicalTcpRead::check(PlanCheckContext& ctxt)
 {
   std::size_t cap = 8192;
+  bool hasDelimiter = false;
   // Validate the parameters
   for(const_param_iterator it = begin_params();
       it != end_params();
@@ -153,7 +478,7 @@ void LogicalTcpRead::check(PlanCheckContext& ctxt)
 	int32_t tmp = getInt32Value(ctxt, *it);
 	if (tmp < 0) {
 	  ctxt.logError(*this, *it, (boost::format("Invalid block size "
-						   "specified: ") 
+						   "specified: %1%") 
 				     % tmp).str());
 	} else {
 	  cap = (std::size_t) tmp;
@@ -161,11 +486,25 @@ void LogicalTcpRead::check(PlanCheckContext& ctxt)
       } else if (it->equals("port")) {
 	int32_t tmp = getInt32Value(ctxt, *it);
 	if (tmp < 0 || tmp > std::numeric_limits<unsigned short>::max()) {
-	  ctxt.logError(*this, *it, (boost::format("Invalid port specified: ") 
+	  ctxt.logError(*this, *it, (boost::format("Invalid port specified: %1%") 
 				     % tmp).str());
 	} else {
 	  mPort = (unsigned short) tmp;
 	}
+      } else if (it->equals("connections")) {
+	int32_t tmp = getInt32Value(ctxt, *it);
+	if (tmp < 0) {
+	  ctxt.logError(*this, *it, (boost::format("Invalid number of "
+						   "connections specified: %1%") 
+				     % tmp).str());
+	} else {
+	  mMaxConnections = tmp;
+	}
+      } else if (it->equals("recordDelimiter")) {
+	mRecordDelimiter = getStringValue(ctxt, *it);
+	hasDelimiter = true;
+      } else if (it->equals("reusePort")) {
+	mReusePort = getBooleanValue(ctxt, *it);
       } else {
 	checkDefaultParam(*it);
       }
@@ -174,13 +513,26 @@ void LogicalTcpRead::check(PlanCheckContext& ctxt)
     }
   }
 
+  // Blocks from more than one connection are interleaved so
+  // unless told otherwise assume newline terminated records.
+  if (!hasDelimiter && 
+      (mMaxConnections != 1 || mReusePort)) {
+    mRecordDelimiter = "\n";
+  }
+  if (mRecordDelimiter.size() >= cap) {
+    ctxt.logError(*this, "recordDelimiter must be shorter than blockSize");
+  }
+
   getOutput(0)->setRecordType(StreamBufferBlock::getStreamBufferType(ctxt, cap));
 }
 
 void LogicalTcpRead::create(class RuntimePlanBuilder& plan)
 {
   RuntimeOperatorType * opType = new TcpReadOperatorType(mPort, 
-							 getOutput(0)->getRecordType());
+							 getOutput(0)->getRecordType(),
+							 mMaxConnections,
+							 mRecordDelimiter,
+							 mReusePort);
   plan.addOperatorType(opType);
   plan.mapOutputPort(this, 0, opType, 0);    
 }
@@ -348,7 +700,7 @@ void LogicalTcpWrite::check(PlanCheckContext& ctxt)
       if (it->equals("blockSize")) {
 	int32_t tmp = getInt32Value(ctxt, *it);
 	if (tmp < 0) {
-	  ctxt.logError(*this, *it, (boost::format("Invalid block size specified: ") 
+	  ctxt.logError(*this, *it, (boost::format("Invalid block size specified: %1%") 
 				     % tmp).str());
 	} else {
 	  cap = (std::size_t) tmp;
@@ -358,7 +710,7 @@ void LogicalTcpWrite::check(PlanCheckContext& ctxt)
       } else if (it->equals("port")) {
 	int32_t tmp = getInt32Value(ctxt, *it);
 	if (tmp < 0 || tmp > std::numeric_limits<unsigned short>::max()) {
-	  ctxt.logError(*this, *it, (boost::format("Invalid port specified: ") 
+	  ctxt.logError(*this, *it, (boost::format("Invalid port specified: %1%") 
 				     % tmp).str());
 	} else {
 	  mPort = (unsigned short) tmp;
@@ -25,6 +25,9 @@ class LogicalTcpRead : public LogicalOperator
 {
 private:
   unsigned short mPort;
+  int32_t mMaxConnections;
+  std::string mRecordDelimiter;
+  bool mReusePort;
 public:
   LogicalTcpRead();
   ~LogicalTcpRead();
@@ -47,6 +50,18 @@ private:
   // OK: it's time to admit it; the motivation for building this
   // operator in the parallel execution case is pretty weak!!!!
   unsigned short mPort;
+  // Number of connections to accept before we stop listening.
+  // The operator sends EOS once all of them have closed.  Zero
+  // means listen forever.
+  int32_t mMaxConnections;
+  // Blocks from different connections are interleaved on the
+  // output so, when set, every block ends on a record delimiter and
+  // any partial record is held back for the connection's next block.
+  std::string mRecordDelimiter;
+  // Set SO_REUSEPORT on the listening socket so that every partition
+  // can listen on the same port and have the kernel spread 
+  // connections among them.
+  bool mReusePort;
   // Serialization
   friend class boost::serialization::access;
   template <class Archive>
@@ -57,6 +72,9 @@ private:
     ar & BOOST_SERIALIZATION_NVP(mFree);
     ar & BOOST_SERIALIZATION_NVP(mStreamBufferBlock);
     ar & BOOST_SERIALIZATION_NVP(mPort);
+    ar & BOOST_SERIALIZATION_NVP(mMaxConnections);
+    ar & BOOST_SERIALIZATION_NVP(mRecordDelimiter);
+    ar & BOOST_SERIALIZATION_NVP(mReusePort);
   }
   TcpReadOperatorType()
   {
@@ -64,16 +82,30 @@ private:
 
 public:
   TcpReadOperatorType(int32_t port, 
-		      const RecordType * streamBlockType)
+		      const RecordType * streamBlockType,
+		      int32_t maxConnections=1,
+		      const std::string& recordDelimiter="",
+		      bool reusePort=false)
     :
     RuntimeOperatorType("TcpReadOperatorType"),
     mMalloc(streamBlockType->getMalloc()),
     mFree(streamBlockType->getFree()),
     mStreamBufferBlock(streamBlockType),
-    mPort(port)
+    mPort(port),
+    mMaxConnections(maxConnections),
+    mRecordDelimiter(recordDelimiter),
+    mReusePort(reusePort)
   {
   }
 
+  /**
+   * The number of bytes in [begin, end) up to and including the
+   * last occurrence of delimiter.  Zero if there is no delimiter.
+   */
+  static int32_t getFramedSize(const uint8_t * begin, 
+			       const uint8_t * end,
+			       const std::string& delimiter);
+
   ~TcpReadOperatorType()
   {
   }
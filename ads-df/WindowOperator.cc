@@ -0,0 +1,393 @@
+/**
+ * Copyright (c) 2012, Akamai Technologies
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * 
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ * 
+ *   Neither the name of the Akamai Technologies nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <iostream>
+#include <limits>
+#include <boost/format.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "RuntimePlan.hh"
+#include "WindowOperator.hh"
+
+LogicalWindowGroupBy::LogicalWindowGroupBy()
+  :
+  LogicalOperator(1,1,1,1),
+  mSize(0),
+  mSlide(0),
+  mLateness(0),
+  mWindowTransfer(NULL),
+  mAggregate(NULL),
+  mHash(NULL),
+  mHashEq(NULL)
+{
+}
+
+LogicalWindowGroupBy::~LogicalWindowGroupBy()
+{
+  delete mWindowTransfer;
+  delete mAggregate;
+  delete mHash;
+  delete mHashEq;
+}
+
+void LogicalWindowGroupBy::check(PlanCheckContext& log)
+{
+  // Validate the parameters
+  for(const_param_iterator it = begin_params();
+      it != end_params();
+      ++it) {
+    if (it->equals("key")) {
+      mGroupKeys.push_back(getStringValue(log, *it));
+    } else if (it->equals("lateness")) {
+      mLateness = getInt32Value(log, *it);
+      if (mLateness < 0) {
+	log.logError(*this, *it, "lateness must be non-negative");
+      }
+    } else if (it->equals("output")) {
+      mProgram = getStringValue(log, *it);
+    } else if (it->equals("size")) {
+      mSize = getInt32Value(log, *it);
+      if (mSize <= 0) {
+	log.logError(*this, *it, "size must be positive");
+      }
+    } else if (it->equals("slide")) {
+      mSlide = getInt32Value(log, *it);
+      if (mSlide <= 0) {
+	log.logError(*this, *it, "slide must be positive");
+      }
+    } else if (it->equals("time")) {
+      mTime = getStringValue(log, *it);
+    } else {
+      checkDefaultParam(*it);
+    }
+  }
+
+  if (0 == mTime.size()) {
+    log.logError(*this, "Must specify argument 'time'");
+  }
+  if (0 == mSize) {
+    log.logError(*this, "Must specify argument 'size'");
+  }
+  if (0 == mProgram.size()) {
+    log.logError(*this, "Must specify argument 'output'");
+  }
+  // Tumbling windows by default
+  if (0 == mSlide) {
+    mSlide = mSize;
+  } else if (mSlide > mSize) {
+    log.logError(*this, "slide must not be greater than size");
+  }
+
+  // Extend the input with the bounds of the window so that the
+  // aggregate can treat them as ordinary group keys.  Both are
+  // initialized to the event time; the operator overwrites them for
+  // each window that a record falls into.
+  const RecordType * input = getInput(0)->getRecordType();
+  mWindowTransfer = 
+    new RecordTypeTransfer(log, "window", input,
+			   (boost::format("input.*, %1% AS window_start"
+					  ", %1% AS window_end") % 
+			    mTime).str());
+  const RecordType * windowed = mWindowTransfer->getTarget();
+  if (windowed->getMember("window_start").GetType()->GetEnum() != 
+      FieldType::DATETIME) {
+    log.logError(*this, "time must be a DATETIME expression");
+  }
+
+  std::vector<std::string> allGroupKeys;
+  allGroupKeys.push_back("window_start");
+  allGroupKeys.push_back("window_end");
+  allGroupKeys.insert(allGroupKeys.end(), mGroupKeys.begin(), mGroupKeys.end());
+  mAggregate = new RecordTypeAggregate(log,
+				       "windowAgg",
+				       windowed,
+				       mProgram,
+				       allGroupKeys,
+				       false);
+
+  // Each window has its own hash table but the window start is part
+  // of the hash key so that we always have at least one key.
+  std::vector<std::string> hashKeys;
+  hashKeys.push_back("window_start");
+  hashKeys.insert(hashKeys.end(), mGroupKeys.begin(), mGroupKeys.end());
+  mHash = HashFunction::get(log, windowed, hashKeys);
+  mHashEq = EqualsFunction::get(log, 
+				mAggregate->getAggregate(),
+				windowed,
+				hashKeys,
+				"window_group_by_key_equals",
+				true);
+
+  getOutput(0)->setRecordType(mAggregate->getTarget());
+}
+
+void LogicalWindowGroupBy::create(class RuntimePlanBuilder& plan)
+{
+  RuntimeOperatorType * opType = 
+    new RuntimeWindowGroupByOperatorType(getInput(0)->getRecordType()->getFree(),
+					 mWindowTransfer,
+					 mHash,
+					 mHashEq,
+					 mAggregate,
+					 mSize,
+					 mSlide,
+					 mLateness);
+  plan.addOperatorType(opType);
+  plan.mapInputPort(this, 0, opType, 0);  
+  plan.mapOutputPort(this, 0, opType, 0);  
+}
+
+RuntimeWindowGroupByOperatorType::RuntimeWindowGroupByOperatorType(const RecordTypeFree & freeFunctor, 
+								   const RecordTypeTransfer * windowTransfer,
+								   const RecordTypeFunction * hashFun,
+								   const RecordTypeFunction * hashEqFun,
+								   const RecordTypeAggregate * agg,
+								   int32_t sizeSeconds,
+								   int32_t slideSeconds,
+								   int32_t latenessSeconds)
+  :
+  RuntimeOperatorType("RuntimeWindowGroupByOperatorType"),
+  mFree(freeFunctor),
+  mWindowFree(windowTransfer->getTarget()->getFree()),
+  mAggregateFree(agg->getAggregate()->getFree()),
+  mWindowTransfer(windowTransfer->create()),
+  mWindowStart(windowTransfer->getTarget()->getFieldAddress("window_start")),
+  mWindowEnd(windowTransfer->getTarget()->getFieldAddress("window_end")),
+  mAggregate(agg->create()),
+  mHashFun(hashFun->create()),
+  mHashKeyEqFun(hashEqFun->create()),
+  mSize(1000000LL*sizeSeconds),
+  mSlide(1000000LL*slideSeconds),
+  mLateness(1000000LL*latenessSeconds)
+{
+}
+
+RuntimeWindowGroupByOperatorType::~RuntimeWindowGroupByOperatorType()
+{
+  delete mWindowTransfer;
+  delete mAggregate;
+  delete mHashFun;
+  delete mHashKeyEqFun;
+}
+
+RuntimeOperator * RuntimeWindowGroupByOperatorType::create(RuntimeOperator::Services & s) const
+{
+  return new RuntimeWindowGroupByOperator(s, *this);
+}
+
+RuntimeWindowGroupByOperator::RuntimeWindowGroupByOperator(RuntimeOperator::Services& services, 
+							   const RuntimeWindowGroupByOperatorType& opType)
+  :
+  RuntimeOperatorBase<RuntimeWindowGroupByOperatorType>(services, opType),
+  mState(START),
+  mRuntimeContext(new InterpreterContext()),
+  mSearchIterator(paged_hash_table::probe_predicate(opType.mHashFun,
+						    opType.mHashKeyEqFun)),
+  mWatermark(std::numeric_limits<int64_t>::min()),
+  mEOS(false),
+  mLateRecords(0)
+{
+}
+
+RuntimeWindowGroupByOperator::~RuntimeWindowGroupByOperator()
+{
+  for(window_map::iterator it = mWindows.begin();
+      it != mWindows.end();
+      ++it) {
+    delete it->second;
+  }
+  delete mRuntimeContext;
+}
+
+int64_t RuntimeWindowGroupByOperator::toMicros(boost::posix_time::ptime t)
+{
+  static const boost::posix_time::ptime epoch(boost::gregorian::date(1970,1,1));
+  return (t - epoch).total_microseconds();
+}
+
+boost::posix_time::ptime RuntimeWindowGroupByOperator::fromMicros(int64_t t)
+{
+  static const boost::posix_time::ptime epoch(boost::gregorian::date(1970,1,1));
+  return epoch + boost::posix_time::microseconds(t);
+}
+
+paged_hash_table & RuntimeWindowGroupByOperator::getWindow(int64_t start)
+{
+  window_map::iterator it = mWindows.find(start);
+  if (it == mWindows.end()) {
+    it = mWindows.insert(std::make_pair(start, new paged_hash_table(false, NULL))).first;
+  }
+  return *it->second;
+}
+
+void RuntimeWindowGroupByOperator::update(paged_hash_table & table,
+					  RecordBuffer windowed)
+{
+  mSearchIterator.mQueryPredicate.ProbeThis = windowed;
+  RecordBuffer agg;
+  table.find(mSearchIterator, mRuntimeContext);
+  if(!mSearchIterator.next(mRuntimeContext)) {
+    getMyOperatorType().mAggregate->executeInit(windowed, 
+						agg, 
+						mRuntimeContext);
+    table.insert(agg, mSearchIterator);
+  } else {
+    agg = mSearchIterator.value();
+  }
+  // In place update agg using input.
+  getMyOperatorType().mAggregate->executeUpdate(windowed, 
+						agg, 
+						mRuntimeContext);
+  mSearchIterator.mQueryPredicate.ProbeThis = RecordBuffer();
+}
+
+void RuntimeWindowGroupByOperator::assign(RecordBuffer input)
+{
+  const RuntimeWindowGroupByOperatorType & opType(getMyOperatorType());
+  RecordBuffer windowed;
+  opType.mWindowTransfer->execute(input, windowed, mRuntimeContext, false);
+  opType.mFree.free(input);
+
+  if (opType.mWindowStart.isNull(windowed)) {
+    // No event time, no window.
+    mLateRecords += 1;
+    opType.mWindowFree.free(windowed);
+    return;
+  }
+
+  int64_t t = toMicros(opType.mWindowStart.getDatetime(windowed));
+  if (mWatermark == std::numeric_limits<int64_t>::min() || 
+      t - opType.mLateness > mWatermark) {
+    mWatermark = t - opType.mLateness;
+  }
+
+  // Latest window containing t; earlier ones start every slide
+  // until the window no longer covers t.
+  int64_t start = t - (t % opType.mSlide);
+  if (t < 0 && start != t) {
+    start -= opType.mSlide;
+  }
+  bool assigned = false;
+  for(; start > t - opType.mSize; start -= opType.mSlide) {
+    if (start + opType.mSize <= mWatermark) {
+      // This window and all earlier ones are closed.
+      break;
+    }
+    opType.mWindowStart.setDatetime(fromMicros(start), windowed);
+    opType.mWindowEnd.setDatetime(fromMicros(start + opType.mSize), windowed);
+    update(getWindow(start), windowed);
+    assigned = true;
+  }
+  if (!assigned) {
+    mLateRecords += 1;
+  }
+  opType.mWindowFree.free(windowed);
+}
+
+bool RuntimeWindowGroupByOperator::canEmit()
+{
+  return !mWindows.empty() && 
+    (mEOS || 
+     mWindows.begin()->first + getMyOperatorType().mSize <= mWatermark);
+}
+
+void RuntimeWindowGroupByOperator::start()
+{
+  mWatermark = std::numeric_limits<int64_t>::min();
+  mEOS = false;
+  mLateRecords = 0;
+  mState = START;
+  onEvent(NULL);
+}
+
+void RuntimeWindowGroupByOperator::onEvent(RuntimePort * port)
+{
+  switch(mState) {
+  case START:
+    while(true) {
+      requestRead(0);
+      mState = READ;
+      return;
+    case READ: 
+      read(port, mInput);
+      if (RecordBuffer::isEOS(mInput)) {
+	mEOS = true;
+      } else {
+	assign(mInput);
+	mInput = RecordBuffer();
+      }
+
+      // Emit every window the watermark has passed (or everything
+      // at end of stream).
+      while(canEmit()) {
+	mScanIterator.init(*mWindows.begin()->second);
+	while(mScanIterator.next(mRuntimeContext)) {
+	  requestWrite(0);
+	  mState = WRITE;
+	  return;
+	case WRITE: 
+	  if (getMyOperatorType().mAggregate->getIsTransferIdentity()) {
+	    write(port, mScanIterator.value(), false);
+	  } else {
+	    RecordBuffer out;
+	    getMyOperatorType().mAggregate->executeTransfer(mScanIterator.value(),
+							    out, 
+							    mRuntimeContext);
+	    getMyOperatorType().mAggregateFree.free(mScanIterator.value());
+	    write(port, out, false);
+	  }
+	}
+	delete mWindows.begin()->second;
+	mWindows.erase(mWindows.begin());
+      }
+
+      if (mEOS) {
+	break;
+      }
+    }
+    requestWrite(0);
+    mState = WRITE_EOS;
+    return;
+  case WRITE_EOS:
+    write(port, RecordBuffer(NULL), true);
+  }
+}
+
+void RuntimeWindowGroupByOperator::shutdown()
+{
+  if (mLateRecords > 0) {
+    std::cerr << "window_group_by dropped " << mLateRecords 
+	      << " late records" << std::endl;
+  }
+}
@@ -0,0 +1,170 @@
+/**
+ * Copyright (c) 2012, Akamai Technologies
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * 
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ * 
+ *   Neither the name of the Akamai Technologies nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if !defined(__WINDOW_OPERATOR_HH)
+#define __WINDOW_OPERATOR_HH
+
+#include <map>
+#include "RuntimeOperator.hh"
+
+/**
+ * Group by over event time windows.  Each input record is assigned
+ * to the windows that contain the value of the time expression; 
+ * windows are aligned to the epoch, are size seconds long and start 
+ * every slide seconds (tumbling windows when slide equals size).
+ * 
+ * A window is closed and its aggregates emitted once the watermark, the
+ * largest event time seen less the allowed lateness, passes its end.  
+ * Records arriving for closed windows are dropped.  Memory is bounded
+ * by the number of open windows rather than by the size of the input.
+ *
+ * The group keys and the output program may refer to the bounds of
+ * the window as window_start and window_end.
+ */
+class LogicalWindowGroupBy : public LogicalOperator
+{
+private:
+  std::vector<std::string> mGroupKeys;
+  std::string mProgram;
+  std::string mTime;
+  int32_t mSize;
+  int32_t mSlide;
+  int32_t mLateness;
+  RecordTypeTransfer * mWindowTransfer;
+  RecordTypeAggregate * mAggregate;
+  RecordTypeFunction * mHash;
+  RecordTypeFunction * mHashEq;
+public:
+  LogicalWindowGroupBy();
+  ~LogicalWindowGroupBy();
+  void check(PlanCheckContext& log);
+  void create(class RuntimePlanBuilder& plan);  
+};
+
+class RuntimeWindowGroupByOperatorType : public RuntimeOperatorType
+{
+  friend class RuntimeWindowGroupByOperator;
+private:
+  RecordTypeFree mFree;
+  RecordTypeFree mWindowFree;
+  RecordTypeFree mAggregateFree;
+  // Copies input and evaluates event time into window_start
+  // and window_end.
+  IQLTransferModule * mWindowTransfer;
+  FieldAddress mWindowStart;
+  FieldAddress mWindowEnd;
+  IQLAggregateModule * mAggregate;
+  IQLFunctionModule * mHashFun;
+  IQLFunctionModule * mHashKeyEqFun;
+  // Window geometry in microseconds
+  int64_t mSize;
+  int64_t mSlide;
+  int64_t mLateness;
+
+  // Serialization
+  friend class boost::serialization::access;
+  template <class Archive>
+  void serialize(Archive & ar, const unsigned int version)
+  {
+    ar & BOOST_SERIALIZATION_BASE_OBJECT_NVP(RuntimeOperatorType);
+    ar & BOOST_SERIALIZATION_NVP(mFree);
+    ar & BOOST_SERIALIZATION_NVP(mWindowFree);
+    ar & BOOST_SERIALIZATION_NVP(mAggregateFree);
+    ar & BOOST_SERIALIZATION_NVP(mWindowTransfer);
+    ar & BOOST_SERIALIZATION_NVP(mWindowStart);
+    ar & BOOST_SERIALIZATION_NVP(mWindowEnd);
+    ar & BOOST_SERIALIZATION_NVP(mAggregate);
+    ar & BOOST_SERIALIZATION_NVP(mHashFun);
+    ar & BOOST_SERIALIZATION_NVP(mHashKeyEqFun);
+    ar & BOOST_SERIALIZATION_NVP(mSize);
+    ar & BOOST_SERIALIZATION_NVP(mSlide);
+    ar & BOOST_SERIALIZATION_NVP(mLateness);
+  }
+  RuntimeWindowGroupByOperatorType()
+    :
+    mWindowTransfer(NULL),
+    mAggregate(NULL),
+    mHashFun(NULL),
+    mHashKeyEqFun(NULL),
+    mSize(0),
+    mSlide(0),
+    mLateness(0)
+  {
+  }  
+public:
+  RuntimeWindowGroupByOperatorType(const RecordTypeFree & freeFunctor, 
+				   const RecordTypeTransfer * windowTransfer,
+				   const RecordTypeFunction * hashFun,
+				   const RecordTypeFunction * hashEqFun,
+				   const RecordTypeAggregate * agg,
+				   int32_t sizeSeconds,
+				   int32_t slideSeconds,
+				   int32_t latenessSeconds);
+  ~RuntimeWindowGroupByOperatorType();
+  RuntimeOperator * create(RuntimeOperator::Services & s) const;
+};
+
+class RuntimeWindowGroupByOperator : public RuntimeOperatorBase<RuntimeWindowGroupByOperatorType>
+{
+private:
+  enum State { START, READ, WRITE, WRITE_EOS };
+  // Open windows by start time; ordered so that they close
+  // from the front.
+  typedef std::map<int64_t, paged_hash_table *> window_map;
+  State mState;
+  class InterpreterContext * mRuntimeContext;
+  window_map mWindows;
+  paged_hash_table::query_iterator<paged_hash_table::probe_predicate> mSearchIterator;
+  paged_hash_table::scan_all_iterator mScanIterator;
+  RecordBuffer mInput;
+  int64_t mWatermark;
+  bool mEOS;
+  int64_t mLateRecords;
+
+  static int64_t toMicros(boost::posix_time::ptime t);
+  static boost::posix_time::ptime fromMicros(int64_t t);
+  paged_hash_table & getWindow(int64_t start);
+  void update(paged_hash_table & table, RecordBuffer windowed);
+  void assign(RecordBuffer input);
+  bool canEmit();
+public:
+  RuntimeWindowGroupByOperator(RuntimeOperator::Services& services, 
+			       const RuntimeWindowGroupByOperatorType& opType);
+  ~RuntimeWindowGroupByOperator();
+  void start();
+  void onEvent(RuntimePort * port);
+  void shutdown();
+};
+
+#endif
@@ -0,0 +1,529 @@
+/**
+ * Copyright (c) 2012, Akamai Technologies
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * 
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ * 
+ *   Neither the name of the Akamai Technologies nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <boost/date_time/gregorian/gregorian.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "IQLInterpreter.hh"
+#include "IQLExpression.hh"
+#include "ZoneMap.hh"
+
+uint64_t PortableEncoding::getVarint(const uint8_t * & in, const uint8_t * end)
+{
+  uint64_t val = 0;
+  for(int32_t shift = 0; shift < 64 && in != end; shift += 7) {
+    uint8_t b = *in++;
+    val |= ((uint64_t) (b & 0x7f)) << shift;
+    if (0 == (b & 0x80)) {
+      return val;
+    }
+  }
+  throw std::runtime_error("Corrupt or truncated varint");
+}
+
+uint32_t PortableEncoding::getUInt32(const uint8_t * & in, const uint8_t * end)
+{
+  const uint8_t * p = getBytes(in, end, 4);
+  return ((uint32_t) p[0]) | (((uint32_t) p[1]) << 8) |
+    (((uint32_t) p[2]) << 16) | (((uint32_t) p[3]) << 24);
+}
+
+double PortableEncoding::getDouble(const uint8_t * & in, const uint8_t * end)
+{
+  double val;
+  memcpy(&val, getBytes(in, end, sizeof(double)), sizeof(double));
+  return val;
+}
+
+const uint8_t * PortableEncoding::getBytes(const uint8_t * & in, 
+					   const uint8_t * end, 
+					   std::size_t sz)
+{
+  if ((std::size_t) (end - in) < sz) {
+    throw std::runtime_error("Corrupt or truncated data");
+  }
+  const uint8_t * ret = in;
+  in += sz;
+  return ret;
+}
+
+ColumnStatistics::Domain ColumnStatistics::getDomain(FieldType::FieldTypeEnum ty)
+{
+  switch(ty) {
+  case FieldType::INT32:
+  case FieldType::INT64:
+  case FieldType::INTERVAL:
+  case FieldType::DATE:
+  case FieldType::DATETIME:
+    return INTEGER;
+  case FieldType::DOUBLE:
+    return REAL;
+  case FieldType::VARCHAR:
+  case FieldType::CHAR:
+    return STRING;
+  default:
+    return NONE;
+  }
+}
+
+int64_t ColumnStatistics::getInteger(const FieldAddress& field, 
+				     FieldType::FieldTypeEnum ty,
+				     RecordBuffer buf)
+{
+  switch(ty) {
+  case FieldType::INT32:
+  case FieldType::INTERVAL:
+    return field.getInt32(buf);
+  case FieldType::INT64:
+    return field.getInt64(buf);
+  case FieldType::DATE:
+    {
+      int32_t tmp;
+      memcpy(&tmp, field.getCharPtr(buf), sizeof(tmp));
+      return tmp;
+    }
+  case FieldType::DATETIME:
+    {
+      int64_t tmp;
+      memcpy(&tmp, field.getCharPtr(buf), sizeof(tmp));
+      return tmp;
+    }
+  default:
+    throw std::runtime_error("Not an integer column");
+  }
+}
+
+ColumnStatistics::ColumnStatistics(Domain domain)
+  :
+  mDomain(domain),
+  mHasValues(false),
+  mNullCount(0),
+  mMinInteger(0),
+  mMaxInteger(0),
+  mMinReal(0),
+  mMaxReal(0)
+{
+}
+
+void ColumnStatistics::add(const FieldAddress& field, 
+			   FieldType::FieldTypeEnum ty,
+			   uint32_t sz,
+			   RecordBuffer buf)
+{
+  if (field.isNull(buf)) {
+    addNull();
+    return;
+  }
+  switch(getDomain()) {
+  case INTEGER:
+    add(getInteger(field, ty, buf));
+    break;
+  case REAL:
+    add(field.getDouble(buf));
+    break;
+  case STRING:
+    if (ty == FieldType::VARCHAR) {
+      const Varchar * v = field.getVarcharPtr(buf);
+      add(v->c_str(), v->size());
+    } else {
+      // Don't include the terminator
+      add(field.getCharPtr(buf), sz-1);
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+void ColumnStatistics::merge(const ColumnStatistics& rhs)
+{
+  mNullCount += rhs.mNullCount;
+  if (!rhs.mHasValues) {
+    return;
+  }
+  switch(getDomain()) {
+  case INTEGER:
+    add(rhs.mMinInteger);
+    add(rhs.mMaxInteger);
+    break;
+  case REAL:
+    add(rhs.mMinReal);
+    add(rhs.mMaxReal);
+    break;
+  case STRING:
+    add(rhs.mMinString.c_str(), rhs.mMinString.size());
+    add(rhs.mMaxString.c_str(), rhs.mMaxString.size());
+    break;
+  default:
+    break;
+  }
+}
+
+void ColumnStatistics::write(std::string& out) const
+{
+  out.push_back((char) mDomain);
+  PortableEncoding::putVarint(out, mNullCount);
+  out.push_back(mHasValues ? 1 : 0);
+  if (!mHasValues) {
+    return;
+  }
+  switch(getDomain()) {
+  case INTEGER:
+    PortableEncoding::putZigZag(out, mMinInteger);
+    PortableEncoding::putZigZag(out, mMaxInteger);
+    break;
+  case REAL:
+    PortableEncoding::putDouble(out, mMinReal);
+    PortableEncoding::putDouble(out, mMaxReal);
+    break;
+  case STRING:
+    PortableEncoding::putString(out, mMinString.c_str(), mMinString.size());
+    PortableEncoding::putString(out, mMaxString.c_str(), mMaxString.size());
+    break;
+  default:
+    break;
+  }
+}
+
+void ColumnStatistics::read(const uint8_t * & in, const uint8_t * end)
+{
+  mDomain = *PortableEncoding::getBytes(in, end, 1);
+  if (mDomain < NONE || mDomain > STRING) {
+    throw std::runtime_error("Corrupt column statistics");
+  }
+  mNullCount = PortableEncoding::getVarint(in, end);
+  mHasValues = 0 != *PortableEncoding::getBytes(in, end, 1);
+  if (!mHasValues) {
+    return;
+  }
+  switch(getDomain()) {
+  case INTEGER:
+    mMinInteger = PortableEncoding::getZigZag(in, end);
+    mMaxInteger = PortableEncoding::getZigZag(in, end);
+    break;
+  case REAL:
+    mMinReal = PortableEncoding::getDouble(in, end);
+    mMaxReal = PortableEncoding::getDouble(in, end);
+    break;
+  case STRING:
+    {
+      std::size_t sz = (std::size_t) PortableEncoding::getVarint(in, end);
+      mMinString.assign((const char *) PortableEncoding::getBytes(in, end, sz), sz);
+      sz = (std::size_t) PortableEncoding::getVarint(in, end);
+      mMaxString.assign((const char *) PortableEncoding::getBytes(in, end, sz), sz);
+      break;
+    }
+  default:
+    break;
+  }
+}
+
+ZoneMapPredicate::ZoneMapPredicate()
+{
+}
+
+ZoneMapPredicate::ZoneMapPredicate(DynamicRecordContext & ctxt,
+				   const RecordType * ty,
+				   const std::string& predicate)
+{
+  onExpr(ty, RecordTypeFunction::getAST(ctxt, predicate));
+}
+
+ZoneMapPredicate::~ZoneMapPredicate()
+{
+}
+
+void ZoneMapPredicate::onExpr(const RecordType * ty, IQLExpression * expr)
+{
+  IQLExpression::arg_const_iterator args = expr->begin_args();
+  switch(expr->getNodeType()) {
+  case IQLExpression::LAND:
+    onExpr(ty, args[0]);
+    onExpr(ty, args[1]);
+    break;
+  case IQLExpression::EQ:
+    onCompare(ty, EQ, args[0], args[1]);
+    break;
+  case IQLExpression::LTN:
+    onCompare(ty, LT, args[0], args[1]);
+    break;
+  case IQLExpression::LTEQ:
+    onCompare(ty, LTEQ, args[0], args[1]);
+    break;
+  case IQLExpression::GTN:
+    onCompare(ty, GT, args[0], args[1]);
+    break;
+  case IQLExpression::GTEQ:
+    onCompare(ty, GTEQ, args[0], args[1]);
+    break;
+  default:
+    // Can't say anything about other clauses.
+    break;
+  }
+}
+
+void ZoneMapPredicate::onCompare(const RecordType * ty, int32_t op,
+				 IQLExpression * lhs, IQLExpression * rhs)
+{
+  if (rhs->getNodeType() == IQLExpression::VARIABLE &&
+      lhs->getNodeType() != IQLExpression::VARIABLE) {
+    // Put the column on the left: c < x becomes x > c
+    std::swap(lhs, rhs);
+    switch(op) {
+    case LT: op = GT; break;
+    case LTEQ: op = GTEQ; break;
+    case GT: op = LT; break;
+    case GTEQ: op = LTEQ; break;
+    default: break;
+    }
+  }
+  if (lhs->getNodeType() != IQLExpression::VARIABLE ||
+      !ty->hasMember(lhs->getStringData())) {
+    return;
+  }
+  // Typed literals like CAST('2012-01-01' AS DATE) are casts of strings.
+  if (rhs->getNodeType() == IQLExpression::CAST &&
+      rhs->args_size() == 1 &&
+      (*rhs->begin_args())->getNodeType() == IQLExpression::STRING) {
+    rhs = *rhs->begin_args();
+  }
+
+  const RecordMember & member(ty->getMember(lhs->getStringData()));
+  FieldType::FieldTypeEnum colTy = member.GetType()->GetEnum();
+  Clause c;
+  c.mColumn = 0;
+  for(RecordType::const_member_iterator m = ty->begin_members();
+      m->GetName() != member.GetName(); ++m) {
+    c.mColumn += 1;
+  }
+  c.mName = member.GetName();
+  c.mOp = op;
+  c.mValue = ColumnStatistics(ColumnStatistics::getDomain(colTy));
+  IQLExpression::NodeType lit = rhs->getNodeType();
+  try {
+    switch(colTy) {
+    case FieldType::INT32:
+    case FieldType::INT64:
+      if (lit != IQLExpression::INT32 && lit != IQLExpression::INT64) return;
+      c.mValue.add((int64_t) strtoll(rhs->getStringData().c_str(), NULL, 10));
+      break;
+    case FieldType::DOUBLE:
+      if (lit != IQLExpression::INT32 && lit != IQLExpression::INT64 &&
+	  lit != IQLExpression::DOUBLE) return;
+      c.mValue.add(strtod(rhs->getStringData().c_str(), NULL));
+      break;
+    case FieldType::DATE:
+      {
+	if (lit != IQLExpression::STRING) return;
+	boost::gregorian::date d = boost::gregorian::from_string(rhs->getStringData());
+	if (d.is_special()) return;
+	int32_t tmp;
+	BOOST_STATIC_ASSERT(sizeof(d) == sizeof(tmp));
+	memcpy(&tmp, &d, sizeof(tmp));
+	c.mValue.add((int64_t) tmp);
+	break;
+      }
+    case FieldType::DATETIME:
+      {
+	if (lit != IQLExpression::STRING) return;
+	boost::posix_time::ptime t = boost::posix_time::time_from_string(rhs->getStringData());
+	if (t.is_special()) return;
+	int64_t tmp;
+	BOOST_STATIC_ASSERT(sizeof(t) == sizeof(tmp));
+	memcpy(&tmp, &t, sizeof(tmp));
+	c.mValue.add(tmp);
+	break;
+      }
+    case FieldType::VARCHAR:
+      if (lit != IQLExpression::STRING) return;
+      c.mValue.add(rhs->getStringData().c_str(), rhs->getStringData().size());
+      break;
+    default:
+      // CHAR comparisons depend on padding, the rest have
+      // no statistics.
+      return;
+    }
+  } catch(std::exception& ) {
+    // Leave anything we can't interpret to the predicate.
+    return;
+  }
+  mClauses.push_back(c);
+}
+
+template <typename _T>
+static bool zoneMapMayMatch(int32_t op, const _T& val, 
+			    const _T& minVal, const _T& maxVal)
+{
+  switch(op) {
+  case ZoneMapPredicate::EQ:
+    return !(val < minVal) && !(maxVal < val);
+  case ZoneMapPredicate::LT:
+    return minVal < val;
+  case ZoneMapPredicate::LTEQ:
+    return !(val < minVal);
+  case ZoneMapPredicate::GT:
+    return val < maxVal;
+  case ZoneMapPredicate::GTEQ:
+    return !(maxVal < val);
+  default:
+    return true;
+  }
+}
+
+bool ZoneMapPredicate::mayMatch(const Clause& c, const ColumnStatistics& s)
+{
+  if (s.getDomain() != c.mValue.getDomain()) {
+    // No statistics
+    return true;
+  }
+  if (!s.hasValues()) {
+    // Comparisons with NULL are never true.
+    return false;
+  }
+  switch(s.getDomain()) {
+  case ColumnStatistics::INTEGER:
+    return zoneMapMayMatch(c.mOp, c.mValue.getMinInteger(),
+			   s.getMinInteger(), s.getMaxInteger());
+  case ColumnStatistics::REAL:
+    return zoneMapMayMatch(c.mOp, c.mValue.getMinReal(),
+			   s.getMinReal(), s.getMaxReal());
+  case ColumnStatistics::STRING:
+    return zoneMapMayMatch(c.mOp, c.mValue.getMinString(),
+			   s.getMinString(), s.getMaxString());
+  default:
+    return true;
+  }
+}
+
+bool ZoneMapPredicate::mayMatch(const std::vector<ColumnStatistics>& stats) const
+{
+  for(std::vector<Clause>::const_iterator it = mClauses.begin();
+      it != mClauses.end();
+      ++it) {
+    if ((std::size_t) it->mColumn < stats.size() &&
+	!mayMatch(*it, stats[it->mColumn])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ZoneMapPredicate::mayMatch(const std::map<std::string, ColumnStatistics>& stats) const
+{
+  for(std::vector<Clause>::const_iterator it = mClauses.begin();
+      it != mClauses.end();
+      ++it) {
+    std::map<std::string, ColumnStatistics>::const_iterator s = 
+      stats.find(it->mName);
+    if (s != stats.end() && !mayMatch(*it, s->second)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+const char * RecordTypeStatistics::SUFFIX = ".stats";
+
+RecordTypeStatistics::RecordTypeStatistics()
+{
+}
+
+RecordTypeStatistics::RecordTypeStatistics(const RecordType * ty)
+{
+  for(RecordType::const_member_iterator m = ty->begin_members(),
+	e = ty->end_members(); m != e; ++m) {
+    FieldType::FieldTypeEnum fty = m->GetType()->GetEnum();
+    if (ColumnStatistics::NONE == ColumnStatistics::getDomain(fty)) {
+      continue;
+    }
+    Field f;
+    f.mName = m->GetName();
+    f.mAddress = ty->getMemberOffset(m->GetName());
+    f.mType = fty;
+    f.mSize = (uint32_t) m->GetType()->GetAllocSize();
+    mFields.push_back(f);
+  }
+}
+
+RecordTypeStatistics::~RecordTypeStatistics()
+{
+}
+
+void RecordTypeStatistics::init(std::vector<ColumnStatistics>& stats) const
+{
+  stats.clear();
+  for(std::vector<Field>::const_iterator f = mFields.begin();
+      f != mFields.end(); ++f) {
+    FieldType::FieldTypeEnum ty = (FieldType::FieldTypeEnum) f->mType;
+    stats.push_back(ColumnStatistics(ColumnStatistics::getDomain(ty)));
+  }
+}
+
+void RecordTypeStatistics::add(RecordBuffer buf, 
+			       std::vector<ColumnStatistics>& stats) const
+{
+  for(std::size_t i=0; i<mFields.size(); ++i) {
+    stats[i].add(mFields[i].mAddress, 
+		 (FieldType::FieldTypeEnum) mFields[i].mType,
+		 mFields[i].mSize, buf);
+  }
+}
+
+void RecordTypeStatistics::write(const std::vector<ColumnStatistics>& stats,
+				 std::string& out) const
+{
+  out.append("TRZM", 4);
+  PortableEncoding::putVarint(out, mFields.size());
+  for(std::size_t i=0; i<mFields.size(); ++i) {
+    PortableEncoding::putString(out, mFields[i].mName.c_str(), 
+				mFields[i].mName.size());
+    stats[i].write(out);
+  }
+}
+
+void RecordTypeStatistics::read(const uint8_t * in, const uint8_t * end,
+				std::map<std::string, ColumnStatistics>& stats)
+{
+  if (0 != memcmp(PortableEncoding::getBytes(in, end, 4), "TRZM", 4)) {
+    throw std::runtime_error("Invalid statistics file");
+  }
+  uint64_t numColumns = PortableEncoding::getVarint(in, end);
+  for(uint64_t i=0; i<numColumns; ++i) {
+    std::size_t sz = (std::size_t) PortableEncoding::getVarint(in, end);
+    std::string name((const char *) PortableEncoding::getBytes(in, end, sz), sz);
+    stats[name].read(in, end);
+  }
+}
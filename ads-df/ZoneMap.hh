@@ -0,0 +1,356 @@
+/**
+ * Copyright (c) 2012, Akamai Technologies
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * 
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ * 
+ *   Neither the name of the Akamai Technologies nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if !defined(__ZONEMAP_HH)
+#define __ZONEMAP_HH
+
+#include <stdint.h>
+#include <cmath>
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/serialization/serialization.hpp>
+#include <boost/serialization/string.hpp>
+#include <boost/serialization/vector.hpp>
+#include "RecordType.hh"
+
+/**
+ * Byte level helpers for the portable encodings used by 
+ * zone maps and columnar files.  Unsigned integers are
+ * LEB128 varints, signed integers are zigzag encoded first.
+ * Readers throw on truncated input.
+ */
+class PortableEncoding
+{
+public:
+  static void putVarint(std::string& out, uint64_t val)
+  {
+    while(val >= 0x80) {
+      out.push_back((char) (val | 0x80));
+      val >>= 7;
+    }
+    out.push_back((char) val);
+  }
+  static void putZigZag(std::string& out, int64_t val)
+  {
+    putVarint(out, (((uint64_t) val) << 1) ^ (uint64_t) (val >> 63));
+  }
+  static void putUInt32(std::string& out, uint32_t val)
+  {
+    for(int32_t i=0; i<4; ++i) {
+      out.push_back((char) (val >> (8*i)));
+    }
+  }
+  static void putDouble(std::string& out, double val)
+  {
+    out.append((const char *) &val, sizeof(double));
+  }
+  static void putString(std::string& out, const char * val, std::size_t sz)
+  {
+    putVarint(out, sz);
+    out.append(val, sz);
+  }
+  static uint64_t getVarint(const uint8_t * & in, const uint8_t * end);
+  static int64_t getZigZag(const uint8_t * & in, const uint8_t * end)
+  {
+    uint64_t val = getVarint(in, end);
+    return (int64_t) (val >> 1) ^ -(int64_t) (val & 1);
+  }
+  static uint32_t getUInt32(const uint8_t * & in, const uint8_t * end);
+  static double getDouble(const uint8_t * & in, const uint8_t * end);
+  /**
+   * Return a pointer to the next sz bytes and skip over them.
+   */
+  static const uint8_t * getBytes(const uint8_t * & in, const uint8_t * end, 
+				  std::size_t sz);
+};
+
+/**
+ * Minimum, maximum and number of NULLs of a column over a 
+ * set of records (a row group, a file...).  Integers, intervals,
+ * dates and datetimes are compared as integers (dates and 
+ * datetimes through their internal day and tick counts), doubles
+ * as doubles and VARCHAR/CHAR bytewise.  Other types only count 
+ * NULLs.
+ */
+class ColumnStatistics
+{
+public:
+  enum Domain { NONE, INTEGER, REAL, STRING };
+private:
+  int32_t mDomain;
+  bool mHasValues;
+  uint64_t mNullCount;
+  int64_t mMinInteger;
+  int64_t mMaxInteger;
+  double mMinReal;
+  double mMaxReal;
+  std::string mMinString;
+  std::string mMaxString;
+
+  // Serialization
+  friend class boost::serialization::access;
+  template <class Archive>
+  void serialize(Archive & ar, const unsigned int version)
+  {
+    ar & BOOST_SERIALIZATION_NVP(mDomain);
+    ar & BOOST_SERIALIZATION_NVP(mHasValues);
+    ar & BOOST_SERIALIZATION_NVP(mNullCount);
+    ar & BOOST_SERIALIZATION_NVP(mMinInteger);
+    ar & BOOST_SERIALIZATION_NVP(mMaxInteger);
+    ar & BOOST_SERIALIZATION_NVP(mMinReal);
+    ar & BOOST_SERIALIZATION_NVP(mMaxReal);
+    ar & BOOST_SERIALIZATION_NVP(mMinString);
+    ar & BOOST_SERIALIZATION_NVP(mMaxString);
+  }
+public:
+  static Domain getDomain(FieldType::FieldTypeEnum ty);
+  /**
+   * Integer representation of a field in the INTEGER domain.
+   */
+  static int64_t getInteger(const FieldAddress& field, 
+			    FieldType::FieldTypeEnum ty,
+			    RecordBuffer buf);
+
+  ColumnStatistics(Domain domain = NONE);
+
+  Domain getDomain() const 
+  {
+    return (Domain) mDomain;
+  }
+  bool hasValues() const 
+  {
+    return mHasValues;
+  }
+  uint64_t getNullCount() const
+  {
+    return mNullCount;
+  }
+  int64_t getMinInteger() const { return mMinInteger; }
+  int64_t getMaxInteger() const { return mMaxInteger; }
+  double getMinReal() const { return mMinReal; }
+  double getMaxReal() const { return mMaxReal; }
+  const std::string& getMinString() const { return mMinString; }
+  const std::string& getMaxString() const { return mMaxString; }
+
+  void addNull()
+  {
+    mNullCount += 1;
+  }
+  void add(int64_t val)
+  {
+    if (!mHasValues || val < mMinInteger) mMinInteger = val;
+    if (!mHasValues || val > mMaxInteger) mMaxInteger = val;
+    mHasValues = true;
+  }
+  void add(double val)
+  {
+    // NaN fails every comparison so it can't match a clause; 
+    // letting it into min/max would make them NaN and prune 
+    // everything after.
+    if (std::isnan(val)) return;
+    if (!mHasValues || val < mMinReal) mMinReal = val;
+    if (!mHasValues || val > mMaxReal) mMaxReal = val;
+    mHasValues = true;
+  }
+  void add(const char * val, std::size_t sz)
+  {
+    if (!mHasValues || mMinString.compare(0, std::string::npos, val, sz) > 0) 
+      mMinString.assign(val, sz);
+    if (!mHasValues || mMaxString.compare(0, std::string::npos, val, sz) < 0) 
+      mMaxString.assign(val, sz);
+    mHasValues = true;
+  }
+  /**
+   * Add the value of a field of the given type.
+   */
+  void add(const FieldAddress& field, FieldType::FieldTypeEnum ty, 
+	   uint32_t sz, RecordBuffer buf);
+  /**
+   * Combine with statistics of the same column over other records.
+   */
+  void merge(const ColumnStatistics& rhs);
+  /**
+   * Append the portable encoding to out.
+   */
+  void write(std::string& out) const;
+  /**
+   * Initialize from the portable encoding.
+   */
+  void read(const uint8_t * & in, const uint8_t * end);
+};
+
+/**
+ * The part of a predicate that may be checked against column
+ * statistics.  Top level conjuncts that compare a column with a 
+ * literal (=, <, <=, >, >=) are kept; everything else is ignored.
+ * The result is a necessary condition for the predicate, so a set 
+ * of records whose statistics fail it cannot contain a match and
+ * may be skipped.
+ */
+class ZoneMapPredicate
+{
+public:
+  enum Op { EQ, LT, LTEQ, GT, GTEQ };
+private:
+  class Clause
+  {
+  public:
+    int32_t mColumn;
+    std::string mName;
+    int32_t mOp;
+    // Constant is the single value in here.
+    ColumnStatistics mValue;
+    // Serialization
+    friend class boost::serialization::access;
+    template <class Archive>
+    void serialize(Archive & ar, const unsigned int version)
+    {
+      ar & BOOST_SERIALIZATION_NVP(mColumn);
+      ar & BOOST_SERIALIZATION_NVP(mName);
+      ar & BOOST_SERIALIZATION_NVP(mOp);
+      ar & BOOST_SERIALIZATION_NVP(mValue);
+    }
+  };
+  std::vector<Clause> mClauses;
+
+  // Serialization
+  friend class boost::serialization::access;
+  template <class Archive>
+  void serialize(Archive & ar, const unsigned int version)
+  {
+    ar & BOOST_SERIALIZATION_NVP(mClauses);
+  }
+
+  static bool mayMatch(const Clause& c, const ColumnStatistics& s);
+  void onExpr(const RecordType * ty, class IQLExpression * expr);
+  void onCompare(const RecordType * ty, int32_t op,
+		 class IQLExpression * lhs, class IQLExpression * rhs);
+public:
+  ZoneMapPredicate();
+  /**
+   * Extract the clauses of predicate that refer to columns of ty.
+   */
+  ZoneMapPredicate(DynamicRecordContext & ctxt,
+		   const RecordType * ty,
+		   const std::string& predicate);
+  ~ZoneMapPredicate();
+  /**
+   * Is there nothing to check?
+   */
+  bool empty() const
+  {
+    return mClauses.size() == 0;
+  }
+  /**
+   * stats are indexed by position of the column in the record 
+   * type.  Returns false only if no record summarized by stats 
+   * can satisfy the predicate.
+   */
+  bool mayMatch(const std::vector<ColumnStatistics>& stats) const;
+  /**
+   * As above with stats indexed by column name.  Columns without
+   * statistics are not checked.
+   */
+  bool mayMatch(const std::map<std::string, ColumnStatistics>& stats) const;
+};
+
+/**
+ * Gathers the ColumnStatistics of all columns of a record type.
+ * File writers use this to store statistics next to each file 
+ * they create, in a sidecar named by appending SUFFIX to the file 
+ * name:
+ *
+ * ["TRZM"][varint number of columns]([name][ColumnStatistics])...
+ *
+ * Readers match statistics to columns by name so that a sidecar 
+ * remains usable when the file is read with a different format.
+ */
+class RecordTypeStatistics
+{
+private:
+  class Field
+  {
+  public:
+    std::string mName;
+    FieldAddress mAddress;
+    int32_t mType;
+    uint32_t mSize;
+    // Serialization
+    friend class boost::serialization::access;
+    template <class Archive>
+    void serialize(Archive & ar, const unsigned int version)
+    {
+      ar & BOOST_SERIALIZATION_NVP(mName);
+      ar & BOOST_SERIALIZATION_NVP(mAddress);
+      ar & BOOST_SERIALIZATION_NVP(mType);
+      ar & BOOST_SERIALIZATION_NVP(mSize);
+    }
+  };
+  std::vector<Field> mFields;
+
+  // Serialization
+  friend class boost::serialization::access;
+  template <class Archive>
+  void serialize(Archive & ar, const unsigned int version)
+  {
+    ar & BOOST_SERIALIZATION_NVP(mFields);
+  }
+public:
+  static const char * SUFFIX;
+
+  RecordTypeStatistics();
+  RecordTypeStatistics(const RecordType * ty);
+  ~RecordTypeStatistics();
+  /**
+   * Reset stats to cover no records.
+   */
+  void init(std::vector<ColumnStatistics>& stats) const;
+  /**
+   * Add the fields of a record to stats.
+   */
+  void add(RecordBuffer buf, std::vector<ColumnStatistics>& stats) const;
+  /**
+   * Write stats as a sidecar.
+   */
+  void write(const std::vector<ColumnStatistics>& stats, 
+	     std::string& out) const;
+  /**
+   * Read a sidecar.  Throws if it is corrupt.
+   */
+  static void read(const uint8_t * in, const uint8_t * end,
+		   std::map<std::string, ColumnStatistics>& stats);
+};
+
+#endif
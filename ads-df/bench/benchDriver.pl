@@ -0,0 +1,287 @@
+#
+# Copyright (c) 2012, Akamai Technologies
+# All rights reserved.
+# 
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions
+# are met:
+# 
+#   Redistributions of source code must retain the above copyright
+#   notice, this list of conditions and the following disclaimer.
+# 
+#   Redistributions in binary form must reproduce the above
+#   copyright notice, this list of conditions and the following
+#   disclaimer in the documentation and/or other materials provided
+#   with the distribution.
+# 
+#   Neither the name of the Akamai Technologies nor the names of its
+#   contributors may be used to endorse or promote products derived
+#   from this software without specific prior written permission.
+# 
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+# "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+# LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+# FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+# COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+# INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+# (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+# SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+# HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+# STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+# ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+# OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#
+# Throughput and memory benchmarks for the core dataflow operators.
+#
+# Each benchmark is a small IQL script fed by generate operators that
+# produce reproducible synthetic data: keys are derived from a hash of
+# the record count and partition, so every run at the same settings sees
+# the same data.  Each script runs once per partition count as one 
+# ads-df process per partition, with runtime metrics turned on so that 
+# we can pick up the peak resident set.
+# One JSON object per run is written to standard output (or to --output),
+# which makes results easy to diff between builds.
+#
+# Usage:
+#   perl benchDriver.pl --ads-df PATH [--records N] [--cardinality C]
+#        [--skew S] [--string-length L] [--partitions 1,2,4]
+#        [--benchmarks sort,hash_join,...] [--output FILE]
+#
+# --records is per partition.  --skew 0 gives uniformly distributed keys;
+# larger values follow a power law that concentrates records on
+# the smallest keys.
+#
+
+use strict;
+
+use File::Temp qw(tempdir);
+use Getopt::Long;
+use IO::File;
+use JSON::PP;
+use Time::HiRes qw(time);
+
+my $AdsDf = "";
+my $Records = 1000000;
+my $Cardinality = 10000;
+my $Skew = 0;
+my $StringLength = 16;
+my $Partitions = "1";
+my $Benchmarks = "";
+my $Output = "";
+
+#
+# A number in [0, 2^32) that is uniformly distributed and depends only
+# on the record position and a salt that decorrelates columns.
+#
+sub uniformExpr {
+    my $salt = shift;
+    return "(CAST(#(RECORDCOUNT, PARTITION, $salt) AS BIGINT) + 2147483648LL)";
+}
+
+#
+# An unsorted BIGINT key with the configured cardinality and skew.
+#
+sub keyExpr {
+    my $salt = shift;
+    my $u = uniformExpr($salt);
+    if ($Skew == 0) {
+	return "$u % ${Cardinality}LL";
+    }
+    # x^(1+skew) for x uniform on (0,1) piles up near zero.
+    my $e = sprintf("%.6fe0", 1.0 + $Skew);
+    return "CAST(floor(${Cardinality}.0e0*exp($e*log((CAST($u AS DOUBLE PRECISION)+1.0e0)/4294967297.0e0))) AS BIGINT)";
+}
+
+#
+# A non-decreasing BIGINT key with the configured cardinality; for
+# operators that require sorted input.  Skew is not applied.
+#
+sub sortedKeyExpr {
+    return "(RECORDCOUNT*${Cardinality}LL)/${Records}LL";
+}
+
+#
+# A VARCHAR payload of the configured length.
+#
+sub stringExpr {
+    my $salt = shift;
+    my @parts;
+    for (my $i = 0; $i*32 < $StringLength; ++$i) {
+	push(@parts, "CAST(md5(CAST(RECORDCOUNT+$salt+$i AS VARCHAR)) AS VARCHAR)");
+    }
+    return "substr(" . join(" + ", @parts) . ", 0, $StringLength)";
+}
+
+sub generator {
+    my ($name, $key, $salt) = @_;
+    my $s = stringExpr($salt);
+    return "$name = generate[output=\"$key AS k, RECORDCOUNT AS v, $s AS s\", numRecords=$Records];\n";
+}
+
+#
+# Benchmark scripts.  Each returns the script text; scripts run in a
+# scratch directory that contains input.txt written by the "write" 
+# benchmark.  Benchmarks that need a single output file only run
+# on one partition.
+#
+my %Scripts = (
+    "write" => sub {
+	return generator("g", keyExpr(1), 1) .
+	    "w = write[file=\"input.txt\", mode=\"text\"];\ng -> w;\n";
+    },
+    "parse" => sub {
+	return "r = read[file=\"input.txt\", format=\"k BIGINT, v BIGINT, s VARCHAR\", mode=\"text\"];\n" .
+	    "d = devNull[];\nr -> d;\n";
+    },
+    "filter" => sub {
+	my $half = int($Cardinality/2);
+	return generator("g", keyExpr(1), 1) .
+	    "f = filter[where=\"k < ${half}LL\"];\nd = devNull[];\ng -> f;\nf -> d;\n";
+    },
+    "sort" => sub {
+	return generator("g", keyExpr(1), 1) .
+	    "s = sort[key=\"k\"];\nd = devNull[];\ng -> s;\ns -> d;\n";
+    },
+    "sort_merge" => sub {
+	return generator("g1", "2*" . sortedKeyExpr(), 1) .
+	    generator("g2", "2*" . sortedKeyExpr() . "+1", 2) .
+	    "m = sort_merge[key=\"k\"];\nd = devNull[];\ng1 -> m;\ng2 -> m;\nm -> d;\n";
+    },
+    "hash_group_by" => sub {
+	return generator("g", keyExpr(1), 1) .
+	    "a = hash_group_by[key=\"k\", output=\"k, SUM(v) AS total, MAX(s) AS s\"];\n" .
+	    "d = devNull[];\ng -> a;\na -> d;\n";
+    },
+    "sort_group_by" => sub {
+	return generator("g", sortedKeyExpr(), 1) .
+	    "a = sort_group_by[key=\"k\", output=\"k, SUM(v) AS total, MAX(s) AS s\"];\n" .
+	    "d = devNull[];\ng -> a;\na -> d;\n";
+    },
+    "hash_join" => sub {
+	return generator("g1", keyExpr(1), 1) .
+	    generator("g2", keyExpr(2), 2) .
+	    "p = copy[output=\"k AS pk, v AS pv\"];\n" .
+	    "j = hash_join[tableKey=\"k\", probeKey=\"pk\", output=\"k, v, s, pv\"];\n" .
+	    "d = devNull[];\ng1 -> j;\ng2 -> p;\np -> j;\nj -> d;\n";
+    },
+    "merge_join" => sub {
+	return generator("g1", sortedKeyExpr(), 1) .
+	    generator("g2", sortedKeyExpr(), 2) .
+	    "p = copy[output=\"k AS pk, v AS pv\"];\n" .
+	    "j = merge_join[leftKey=\"k\", rightKey=\"pk\"];\n" .
+	    "d = devNull[];\ng1 -> j;\ng2 -> p;\np -> j;\nj -> d;\n";
+    },
+    );
+
+# Order matters: parse reads the file that write produces.
+my @AllBenchmarks = ("write", "parse", "filter", "sort", "sort_merge",
+		     "hash_group_by", "sort_group_by", "hash_join", 
+		     "merge_join");
+my %SinglePartition = ("write" => 1);
+
+#
+# Run one script with one ads-df process per partition (each started
+# with --serial) and return (seconds, metrics of each partition).  The
+# scripts don't move data between partitions so the processes are 
+# independent; elapsed time is until the last of them finishes.
+#
+sub runScript {
+    my ($dir, $name, $script, $partitions) = @_;
+    my $scriptFile = "$dir/$name.iql";
+    my $fh = IO::File->new($scriptFile, "w") or die "Cannot write $scriptFile";
+    print $fh $script;
+    $fh->close();
+    my $start = time();
+    my %pids;
+    for (my $i = 0; $i < $partitions; ++$i) {
+	my @args = ("$AdsDf", "--file", "$scriptFile", 
+		    "--partitions", "$partitions",
+		    "--serial", "$i",
+		    "--metrics-file", "$dir/$name.$i.metrics.json");
+	my $pid = fork();
+	defined $pid or die "Cannot fork: $!";
+	if ($pid == 0) {
+	    exec(@args) or die "Cannot run @args";
+	}
+	$pids{$pid} = "@args";
+    }
+    my $failed = "";
+    while ((my $pid = wait()) > 0) {
+	if ($? != 0 && exists $pids{$pid}) {
+	    $failed = $pids{$pid};
+	}
+    }
+    $failed and die "Benchmark $name failed: $failed";
+    my $elapsed = time() - $start;
+    my @metrics;
+    for (my $i = 0; $i < $partitions; ++$i) {
+	my $metricsFile = "$dir/$name.$i.metrics.json";
+	$fh = IO::File->new($metricsFile, "r") or die "Cannot read $metricsFile";
+	local $/;
+	push(@metrics, decode_json(<$fh>));
+	$fh->close();
+    }
+    return ($elapsed, \@metrics);
+}
+
+GetOptions("ads-df=s" => \$AdsDf,
+	   "records=i" => \$Records,
+	   "cardinality=i" => \$Cardinality,
+	   "skew=f" => \$Skew,
+	   "string-length=i" => \$StringLength,
+	   "partitions=s" => \$Partitions,
+	   "benchmarks=s" => \$Benchmarks,
+	   "output=s" => \$Output) or die "Invalid arguments";
+$AdsDf or die "Must specify --ads-df";
+$Cardinality > 0 or die "Cardinality must be positive";
+$Records > 0 or die "Records must be positive";
+
+my @benchmarks = $Benchmarks ? split(/,/, $Benchmarks) : @AllBenchmarks;
+foreach my $b (@benchmarks) {
+    exists $Scripts{$b} or die "Unknown benchmark $b";
+}
+# parse needs the file from write.
+if (grep(/^parse$/, @benchmarks) && !grep(/^write$/, @benchmarks)) {
+    unshift(@benchmarks, "write");
+}
+
+my $out = \*STDOUT;
+if ($Output) {
+    $out = IO::File->new($Output, "w") or die "Cannot write $Output";
+}
+
+my $dir = tempdir(CLEANUP => 1);
+chdir $dir;
+my $json = JSON::PP->new->canonical(1);
+foreach my $partitions (split(/,/, $Partitions)) {
+    foreach my $b (@benchmarks) {
+	my $p = exists $SinglePartition{$b} ? 1 : $partitions;
+	my ($elapsed, $metrics) = runScript($dir, $b, $Scripts{$b}->(), $p);
+	# Input records is what the sources of all partitions produced 
+	# (the write benchmark's file for parse).
+	my $records = $b eq "parse" ? $Records : $Records * $p;
+	if ($b eq "sort_merge" || $b eq "hash_join" || $b eq "merge_join") {
+	    $records = 2 * $records;
+	}
+	# Peak of any one process and total over all of them.
+	my $maxResident = 0;
+	my $totalResident = 0;
+	foreach my $m (@$metrics) {
+	    $maxResident = $m->{maxResidentKB} if $m->{maxResidentKB} > $maxResident;
+	    $totalResident += $m->{maxResidentKB};
+	}
+	my %result = (benchmark => $b,
+		      partitions => $p + 0,
+		      records => $records,
+		      cardinality => $Cardinality,
+		      skew => $Skew,
+		      stringLength => $StringLength,
+		      seconds => $elapsed,
+		      recordsPerSecond => $elapsed > 0 ? $records/$elapsed : 0,
+		      maxResidentKB => $maxResident,
+		      totalResidentKB => $totalResident);
+	print $out $json->encode(\%result) . "\n";
+    }
+}
+chdir "/";
@@ -33,8 +33,10 @@
  */
 
 #include <cmath>
+#include <fstream>
 #include <iostream>
 
+#include <boost/filesystem.hpp>
 #include <boost/format.hpp>
 #include <boost/progress.hpp>
 #include <boost/algorithm/string.hpp>
@@ -48,6 +50,7 @@
 #include "IQLInterpreter.hh"
 #include "RecordParser.hh"
 #include "DataflowRuntime.hh"
+#include "RuntimeMetrics.hh"
 #include "RuntimeOperator.hh"
 #include "RuntimeProcess.hh"
 #include "RuntimePlan.hh"
@@ -56,7 +59,13 @@
 #include "LoserTree.hh"
 #include "AsynchronousFileSystem.hh"
 #include "Merger.hh"
+#include "FileWriteOperator.hh"
 #include "GraphBuilder.hh"
+#include "TcpOperator.hh"
+#include "ColumnarFile.hh"
+#include "IndexOperator.hh"
+#include "TableMetadata.hh"
+#include "TableOperator.hh"
 
 #define BOOST_TEST_MODULE MyTest
 #include <boost/test/unit_test.hpp>
@@ -895,6 +904,133 @@ BOOST_AUTO_TEST_CASE(testPagedHashTable)
     // Pretty weak check, at least we have
     // the right number of records.
     BOOST_CHECK_EQUAL(cnt, 100002);
+
+    // Only the two matches have been marked
+    paged_hash_table::scan_not_marked_iterator nit(table);
+    cnt=0;
+    while(nit.next(&runtimeCtxt)) {
+      cnt += 1;
+    }
+    BOOST_CHECK_EQUAL(cnt, 100000);
+
+    // Batch probe
+    std::vector<paged_hash_table::query_iterator<paged_hash_table::probe_predicate> > batch(2, qit);
+    batch[0].mQueryPredicate.ProbeThis = rhs1;
+    batch[1].mQueryPredicate.ProbeThis = rhs2;
+    table.find(&batch[0], batch.size(), &runtimeCtxt);
+    BOOST_CHECK_EQUAL(false, batch[0].next(&runtimeCtxt));
+    BOOST_CHECK_EQUAL(true, batch[1].next(&runtimeCtxt));
+    BOOST_CHECK_EQUAL(true, batch[1].next(&runtimeCtxt));
+    BOOST_CHECK_EQUAL(false, batch[1].next(&runtimeCtxt));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(testPagedHashTableBatchProbe)
+{
+  // A batch of lookups finds the same matches and marks the same
+  // table records (for outer joins) as looking up one at a time.
+  typedef paged_hash_table::query_iterator<paged_hash_table::probe_predicate> query_iterator;
+  DynamicRecordContext ctxt;
+  InterpreterContext runtimeCtxt;
+  std::vector<RecordMember> members;
+  members.push_back(RecordMember("a", Int32Type::Get(ctxt)));
+  members.push_back(RecordMember("id", Int32Type::Get(ctxt)));
+  RecordType recTy(members);
+  std::vector<RecordMember> rhsMembers;
+  rhsMembers.push_back(RecordMember("b", Int32Type::Get(ctxt)));
+  RecordType rhsTy(rhsMembers);
+  std::vector<RecordMember> emptyMembers;
+  RecordType emptyTy(emptyMembers);
+  std::vector<const RecordType *> types;
+  types.push_back(&recTy);
+  types.push_back(&rhsTy);
+  std::vector<const RecordType *> probeOnly;
+  probeOnly.push_back(&rhsTy);
+  probeOnly.push_back(&emptyTy);
+  std::vector<const RecordType *> tableOnly;
+  tableOnly.push_back(&recTy);
+  tableOnly.push_back(&emptyTy);
+
+  RecordTypeFunction tableHash(ctxt, "batchtablehash", tableOnly, "#(a)");
+  RecordTypeFunction probeHash(ctxt, "batchprobehash", probeOnly, "#(b)");
+  RecordTypeFunction equals(ctxt, "batcheq", types, "a = b");
+  boost::shared_ptr<IQLFunctionModule> tableHashFun(tableHash.create());
+  boost::shared_ptr<IQLFunctionModule> probeHashFun(probeHash.create());
+  boost::shared_ptr<IQLFunctionModule> equalsFun(equals.create());
+  paged_hash_table single(true, tableHashFun.get());
+  paged_hash_table batch(true, tableHashFun.get());
+  // 50 keys with 10 records each; enough to make the tables grow.
+  for(int32_t i=0; i<500; ++i) {
+    for(int32_t t=0; t<2; ++t) {
+      RecordBuffer buf = recTy.GetMalloc()->malloc();
+      recTy.setInt32("a", i % 50, buf);
+      recTy.setInt32("id", i, buf);
+      (t ? batch : single).insert(buf, &runtimeCtxt);
+    }
+  }
+
+  // Probe keys -20 .. 29 so that half of the probes match and 
+  // table keys 30 .. 49 are never matched.
+  std::vector<RecordBuffer> probes;
+  for(int32_t i=-20; i<30; ++i) {
+    RecordBuffer buf = rhsTy.GetMalloc()->malloc();
+    rhsTy.setInt32("b", i, buf);
+    probes.push_back(buf);
+  }
+  paged_hash_table::probe_predicate pred(probeHashFun.get(), equalsFun.get());
+  std::vector<std::vector<int32_t> > singleMatches(probes.size());
+  query_iterator qit(pred);
+  for(std::size_t p=0; p<probes.size(); ++p) {
+    qit.mQueryPredicate.ProbeThis = probes[p];
+    single.find(qit, &runtimeCtxt);
+    while(qit.next(&runtimeCtxt)) {
+      singleMatches[p].push_back(recTy.getInt32("id", qit.value()));
+    }
+  }
+  std::vector<std::vector<int32_t> > batchMatches(probes.size());
+  // Uneven block size so the last block is partial.
+  const std::size_t blockSize = 16;
+  std::vector<query_iterator> block(blockSize, query_iterator(pred));
+  for(std::size_t p=0; p<probes.size(); p += blockSize) {
+    std::size_t n = (std::min)(blockSize, probes.size() - p);
+    for(std::size_t i=0; i<n; ++i) {
+      block[i].mQueryPredicate.ProbeThis = probes[p+i];
+    }
+    batch.find(&block[0], n, &runtimeCtxt);
+    for(std::size_t i=0; i<n; ++i) {
+      while(block[i].next(&runtimeCtxt)) {
+	batchMatches[p+i].push_back(recTy.getInt32("id", block[i].value()));
+      }
+    }
+  }
+  for(std::size_t p=0; p<probes.size(); ++p) {
+    std::sort(singleMatches[p].begin(), singleMatches[p].end());
+    std::sort(batchMatches[p].begin(), batchMatches[p].end());
+    BOOST_CHECK_EQUAL(p < 20 ? 0U : 10U, singleMatches[p].size());
+    BOOST_CHECK(singleMatches[p] == batchMatches[p]);
+  }
+
+  // Same records are left unmarked
+  std::vector<int32_t> singleUnmarked;
+  paged_hash_table::scan_not_marked_iterator sit(single);
+  while(sit.next(&runtimeCtxt)) {
+    singleUnmarked.push_back(recTy.getInt32("id", sit.value()));
+  }
+  std::vector<int32_t> batchUnmarked;
+  paged_hash_table::scan_not_marked_iterator bit(batch);
+  while(bit.next(&runtimeCtxt)) {
+    batchUnmarked.push_back(recTy.getInt32("id", bit.value()));
+  }
+  std::sort(singleUnmarked.begin(), singleUnmarked.end());
+  std::sort(batchUnmarked.begin(), batchUnmarked.end());
+  BOOST_CHECK_EQUAL(200U, singleUnmarked.size());
+  BOOST_CHECK(singleUnmarked == batchUnmarked);
+  for(std::size_t i=0; i<singleUnmarked.size(); ++i) {
+    BOOST_CHECK(singleUnmarked[i] % 50 >= 30);
+  }
+
+  for(std::size_t p=0; p<probes.size(); ++p) {
+    rhsTy.GetFree()->free(probes[p]);
   }
 }
 
@@ -1417,6 +1553,135 @@ BOOST_AUTO_TEST_CASE(testSchedulerWritePriority)
   BOOST_CHECK_EQUAL(0, DataflowScheduler::getWritePriority(std::numeric_limits<uint64_t>::max()));
 }
 
+BOOST_AUTO_TEST_CASE(testSchedulerPolicy)
+{
+  DataflowSchedulerPolicy& policy(DataflowSchedulerPolicy::get());
+  BOOST_CHECK_EQUAL(DataflowSchedulerPolicy::FIXED, policy.getTarget());
+  {
+    // Adaptive tuning is opt in.
+    DataflowScheduler s;
+    BOOST_CHECK_EQUAL(10000, s.getIterationsBeforePoll());
+    BOOST_CHECK_EQUAL(140U, s.getMaxWritesBeforeYield());
+  }
+  BOOST_CHECK(!policy.setTarget("fastest"));
+  BOOST_CHECK(policy.setTarget("Latency"));
+  BOOST_CHECK_EQUAL(DataflowSchedulerPolicy::LATENCY, policy.getTarget());
+  BOOST_CHECK_EQUAL(200000U, policy.getPollIntervalNanos());
+  BOOST_CHECK(policy.getMinIterations() < policy.getMaxIterations());
+  BOOST_CHECK(policy.getMinWritesBeforeYield() < policy.getMaxWritesBeforeYield());
+  policy.setPollIntervalMicros(50);
+  BOOST_CHECK_EQUAL(50000U, policy.getPollIntervalNanos());
+  {
+    // An adaptive scheduler starts within the bounds of the policy.
+    DataflowScheduler s;
+    BOOST_CHECK(policy.getMinIterations() <= s.getIterationsBeforePoll());
+    BOOST_CHECK(s.getIterationsBeforePoll() <= policy.getMaxIterations());
+    BOOST_CHECK(policy.getMinWritesBeforeYield() <= s.getMaxWritesBeforeYield());
+    BOOST_CHECK(s.getMaxWritesBeforeYield() <= policy.getMaxWritesBeforeYield());
+  }
+  BOOST_CHECK(policy.setTarget("fixed"));
+  {
+    DataflowScheduler s;
+    BOOST_CHECK_EQUAL(10000, s.getIterationsBeforePoll());
+    BOOST_CHECK_EQUAL(140U, s.getMaxWritesBeforeYield());
+  }
+  policy.setPollIntervalMicros(0);
+  policy.setTarget(DataflowSchedulerPolicy::FIXED);
+}
+
+class DataflowSchedulerTest
+{
+public:
+  static void adaptToPoll(DataflowScheduler& s, uint64_t elapsed, 
+			  std::size_t ioBacklog)
+  {
+    s.adaptToPoll(elapsed, ioBacklog);
+  }
+  static void adaptToFlush(DataflowScheduler& s)
+  {
+    s.adaptToFlush();
+  }
+};
+
+BOOST_AUTO_TEST_CASE(testSchedulerAdaptation)
+{
+  DataflowSchedulerPolicy& policy(DataflowSchedulerPolicy::get());
+  policy.setTarget(DataflowSchedulerPolicy::THROUGHPUT);
+  policy.setPollIntervalMicros(1000);
+  {
+    DataflowScheduler s;
+    BOOST_CHECK_EQUAL(10000, s.getIterationsBeforePoll());
+    BOOST_CHECK_EQUAL(140U, s.getMaxWritesBeforeYield());
+    // Idle at half the interval: run twice as long and write 
+    // bigger batches.
+    DataflowSchedulerTest::adaptToPoll(s, 500000, 0);
+    BOOST_CHECK_EQUAL(20000, s.getIterationsBeforePoll());
+    BOOST_CHECK_EQUAL(280U, s.getMaxWritesBeforeYield());
+    // Idle but already at the interval: don't run past it.
+    DataflowSchedulerTest::adaptToPoll(s, 1000000, 0);
+    BOOST_CHECK_EQUAL(20000, s.getIterationsBeforePoll());
+    BOOST_CHECK_EQUAL(560U, s.getMaxWritesBeforeYield());
+    // Overshot the interval by 4x: scale the run down.
+    DataflowSchedulerTest::adaptToPoll(s, 4000000, 3);
+    BOOST_CHECK_EQUAL(5000, s.getIterationsBeforePoll());
+    BOOST_CHECK_EQUAL(560U, s.getMaxWritesBeforeYield());
+    // IO waiting but serviced within the interval: no change.
+    DataflowSchedulerTest::adaptToPoll(s, 500000, 2);
+    BOOST_CHECK_EQUAL(5000, s.getIterationsBeforePoll());
+    BOOST_CHECK_EQUAL(560U, s.getMaxWritesBeforeYield());
+    // Bounded below and above by the policy.
+    DataflowSchedulerTest::adaptToPoll(s, 1000000000, 1);
+    BOOST_CHECK_EQUAL(policy.getMinIterations(), s.getIterationsBeforePoll());
+    for(int32_t i=0; i<32; ++i) {
+      DataflowSchedulerTest::adaptToPoll(s, 0, 0);
+    }
+    BOOST_CHECK_EQUAL(policy.getMaxIterations(), s.getIterationsBeforePoll());
+    BOOST_CHECK_EQUAL(policy.getMaxWritesBeforeYield(), s.getMaxWritesBeforeYield());
+    // Flushing halves the write batch down to the policy minimum.
+    DataflowSchedulerTest::adaptToFlush(s);
+    BOOST_CHECK_EQUAL(policy.getMaxWritesBeforeYield()/2, s.getMaxWritesBeforeYield());
+    for(int32_t i=0; i<32; ++i) {
+      DataflowSchedulerTest::adaptToFlush(s);
+    }
+    BOOST_CHECK_EQUAL(policy.getMinWritesBeforeYield(), s.getMaxWritesBeforeYield());
+  }
+  policy.setPollIntervalMicros(0);
+  policy.setTarget(DataflowSchedulerPolicy::FIXED);
+}
+
+BOOST_AUTO_TEST_CASE(testSchedulerPlacement)
+{
+  SchedulerPlacement& placement(SchedulerPlacement::get());
+  BOOST_CHECK_EQUAL(SchedulerPlacement::NONE, placement.getPolicy());
+  BOOST_CHECK(!placement.setPolicy("socket"));
+  BOOST_CHECK(placement.setPolicy("Core"));
+  BOOST_CHECK_EQUAL(SchedulerPlacement::CORE, placement.getPolicy());
+  BOOST_CHECK(placement.getNumNodes() >= 1);
+  // Partitions fill nodes in contiguous blocks.
+  int32_t numPositions = 13;
+  for(int32_t i=1; i<numPositions; ++i) {
+    int32_t prev = placement.getNode(i-1, numPositions);
+    int32_t node = placement.getNode(i, numPositions);
+    BOOST_CHECK(prev == node || prev+1 == node);
+    BOOST_CHECK(node < (int32_t) placement.getNumNodes());
+    BOOST_CHECK(placement.getCpu(i, numPositions) >= 0);
+  }
+  // Positions come from partition numbers, not process local indexes.
+  int32_t position, positions;
+  BOOST_CHECK(placement.getPosition(5, 0, 7, 8, position, positions));
+  BOOST_CHECK_EQUAL(5, position);
+  BOOST_CHECK_EQUAL(8, positions);
+  // A process running a single partition doesn't know its neighbours.
+  BOOST_CHECK(!placement.getPosition(5, 5, 5, 8, position, positions));
+  BOOST_CHECK_EQUAL(0, positions);
+  placement.setPartitionsPerHost(4);
+  BOOST_CHECK(placement.getPosition(5, 5, 5, 8, position, positions));
+  BOOST_CHECK_EQUAL(1, position);
+  BOOST_CHECK_EQUAL(4, positions);
+  placement.setPartitionsPerHost(0);
+  placement.setPolicy(SchedulerPlacement::NONE);
+}
+
 // 31-bit byte array prefix (assuming byte array length >=4).
 uint32_t byteArrayPrefix(uint8_t * a)
 {
@@ -2228,6 +2493,102 @@ BOOST_AUTO_TEST_CASE(testLoserTree2)
   }
 }
 
+BOOST_AUTO_TEST_CASE(testOffsetValueLoserTree)
+{
+  // Short keys over a small alphabet so that most matches tie on
+  // offset-value code and have to be resolved by looking at the keys.
+  // Keys are zero terminated so they are prefix free.
+  typedef std::vector<uint32_t> key_type;
+  uint32_t state = 1;
+  for(uint32_t numInputs = 1; numInputs < 70; numInputs += 7) {
+    std::vector<std::vector<key_type> > inputs(numInputs);
+    std::vector<key_type> expected;
+    for(uint32_t i=0; i<numInputs; i++) {
+      for(uint32_t j=0; j<50; j++) {
+	state = state*1103515245 + 12345;
+	key_type k((state >> 16) % 5, 0);
+	for(std::size_t w=0; w<k.size(); w++) {
+	  state = state*1103515245 + 12345;
+	  k[w] = 1 + ((state >> 16) % 3);
+	}
+	k.push_back(0);
+	inputs[i].push_back(k);
+      }
+      std::sort(inputs[i].begin(), inputs[i].end());
+      expected.insert(expected.end(), inputs[i].begin(), inputs[i].end());
+    }
+    std::sort(expected.begin(), expected.end());
+
+    OffsetValueLoserTree<void*> t(numInputs);
+    std::vector<std::size_t> iters(numInputs, 0);
+    std::vector<key_type> actual;
+    while(!t.empty()) {
+      uint32_t idx = t.getInput();
+      if (!t.isHighSentinel()) {
+	actual.push_back(inputs[idx][iters[idx]-1]);
+      }
+      if (iters[idx] == inputs[idx].size()) {
+	t.close(idx);
+      } else {
+	const key_type & k(inputs[idx][iters[idx]++]);
+	t.update(idx, &k[0], (uint32_t) k.size(), NULL);
+      }
+    }
+    BOOST_CHECK(expected == actual);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(testSortKeyNormalizer)
+{
+  DynamicRecordContext ctxt;
+  std::vector<RecordMember> members;
+  members.push_back(RecordMember("a", Int32Type::Get(ctxt, true)));
+  members.push_back(RecordMember("b", VarcharType::Get(ctxt)));
+  const RecordType * recordType = RecordType::get(ctxt, members);
+  std::vector<SortKey> keys;
+  keys.push_back(SortKey("a"));
+  keys.push_back(SortKey("b DESC"));
+  SortKeyNormalizer normalizer(recordType, keys);
+  BOOST_REQUIRE(!normalizer.empty());
+
+  // Records in expected order: NULLs low, b descending.
+  const char * b[] = { "z", "a", "x", "abd", "abc", "ab", "" };
+  int32_t a[] = { 0, 0, -5, 3, 3, 3, 3 };
+  std::vector<RecordBuffer> bufs;
+  std::vector<NormalizedKey> normalized(7);
+  for(int i=0; i<7; i++) {
+    bufs.push_back(recordType->getMalloc().malloc());
+    recordType->setVarchar("b", b[i], bufs.back());
+    if (i < 2) {
+      recordType->getFieldAddress("a").setNull(bufs.back());
+    } else {
+      recordType->setInt32("a", a[i], bufs.back());
+    }
+    normalizer.normalize(bufs.back(), normalized[i]);
+  }
+  // Sorting compares the keys after a NULL.
+  BOOST_CHECK(normalized[0].hasNull());
+  BOOST_CHECK(!normalized[2].hasNull());
+  for(int i=0; i<6; i++) {
+    BOOST_CHECK_EQUAL(-1, normalized[i].compare(normalized[i+1]));
+    BOOST_CHECK_EQUAL(1, normalized[i+1].compare(normalized[i]));
+  }
+  // Joining stops at the first NULL.
+  SortKeyNormalizer joinLeft, joinRight;
+  SortKeyNormalizer::get(recordType, keys, recordType, keys, joinLeft, joinRight);
+  BOOST_REQUIRE(!joinLeft.empty());
+  NormalizedKey lhs, rhs;
+  joinLeft.normalize(bufs[0], lhs);
+  joinRight.normalize(bufs[1], rhs);
+  BOOST_CHECK(lhs.hasNull());
+  BOOST_CHECK_EQUAL(0, lhs.compare(rhs));
+  joinRight.normalize(bufs[2], rhs);
+  BOOST_CHECK_EQUAL(-1, lhs.compare(rhs));
+  for(int i=0; i<7; i++) {
+    recordType->getFree().free(bufs[i]);
+  }
+}
+
 BOOST_AUTO_TEST_CASE(testDynamicBitsetSerialization)
 {
   boost::dynamic_bitset<> a;
@@ -2660,6 +3021,112 @@ BOOST_AUTO_TEST_CASE(testSortMergeJoin)
   p.run();
 }
 
+/**
+ * Join an input with a hot key over four partitions.  Splitting the 
+ * hot key gives every partition a quarter of its run (which spills) 
+ * and the spills are published to the runtime metrics.
+ */
+BOOST_AUTO_TEST_CASE(testSortMergeJoinHeavyHitter)
+{
+  std::cout << "testSortMergeJoinHeavyHitter" << std::endl;
+  PlanCheckContext ctxt;
+  DataflowGraphBuilder gb(ctxt);
+  // The first 400 records of every partition have key 7, the rest
+  // have keys unique across partitions.
+  gb.buildGraph("l = generate[output=\"7 + (RECORDCOUNT/400)*(1000 + 4*RECORDCOUNT + PARTITION) "
+		"AS a\", numRecords=500];\n"
+		"r = generate[output=\"RECORDCOUNT AS b\", numRecords=10];\n"
+		"j = merge_join[leftKey=\"a\", rightKey=\"b\", heavyHitter=\"7 AS a\", memory=16];\n"
+		"d = devNull[];\n"
+		"l -> j;\n"
+		"r -> j;\n"
+		"j -> d;\n"
+		);
+  boost::shared_ptr<RuntimeOperatorPlan> plan = gb.create(4);
+  RuntimeProcess p(0,3,4,*plan.get());
+  p.run();
+  std::vector<RuntimeSortMergeJoinOperator*> joins;
+  p.getOperatorOfType<>(joins);
+  BOOST_CHECK_EQUAL(4U, joins.size());
+  for(std::vector<RuntimeSortMergeJoinOperator*>::const_iterator it = joins.begin();
+      it != joins.end();
+      ++it) {
+    // Two 8 byte keys fit in memory.
+    BOOST_CHECK_EQUAL(1U, (*it)->getSpilledRuns());
+    BOOST_CHECK_EQUAL(398U, (*it)->getSpilledRecords());
+  }
+  std::string json = RuntimeMetrics::get().getJSON();
+  BOOST_CHECK(std::string::npos != 
+	      json.find("\"spilledRuns\":1,\"spilledRecords\":398,\"skewedKey\":\"7\""));
+}
+
+/**
+ * Repartition four partitions of one process through a crossbar, 
+ * merge what each partition receives and gather the partitions back
+ * onto partition 0 in partition order.  Every value must land on the
+ * partition its hash names.
+ */
+BOOST_AUTO_TEST_CASE(testInProcessCrossbar)
+{
+  std::cout << "testInProcessCrossbar" << std::endl;
+  boost::filesystem::path outPath = boost::filesystem::temp_directory_path() / 
+    boost::filesystem::unique_path("trecul-crossbar-%%%%-%%%%.txt");
+  {
+    DynamicRecordContext ctxt;
+    RuntimeGenerateOperatorType * genType = 
+      new RuntimeGenerateOperatorType(ctxt, "25*PARTITION + RECORDCOUNT AS a", 25);
+    const RecordType * input = genType->getOutputType();
+    std::vector<const RecordType *> inputOnly;
+    inputOnly.push_back(input);
+    std::vector<RecordMember> emptyMembers;
+    RecordType emptyTy(emptyMembers);
+    inputOnly.push_back(&emptyTy);
+    RecordTypeFunction hash(ctxt, "crossbar_hash", inputOnly, "a");
+    RecordTypeFunction gather(ctxt, "crossbar_gather", inputOnly, "0");
+    std::vector<std::string> keys;
+    keys.push_back("a");
+    SortMerge sm(ctxt, input, keys);
+    RuntimeOperatorType * partitionType = 
+      new RuntimeHashPartitionerOperatorType(hash.create());
+    RuntimeOperatorType * mergeType = sm.create();
+    RuntimeOperatorType * gatherType = 
+      new RuntimeHashPartitionerOperatorType(gather.create());
+    RuntimeOperatorType * concatType = new RuntimeOrderedCollectorOperatorType();
+    RuntimeOperatorType * writeType = 
+      new RuntimeWriteOperatorType("write", input, outPath.string(), "", "");
+    RuntimeOperatorPlan plan(4,true);
+    plan.addOperatorType(genType);
+    plan.addOperatorType(partitionType);
+    plan.addOperatorType(mergeType);
+    plan.addOperatorType(gatherType);
+    plan.addOperatorType(concatType);
+    plan.addOperatorType(writeType);
+    plan.connectStraight(genType, 0, partitionType, 0, true, true);
+    plan.connectCrossbar(partitionType, mergeType, input, true, true);
+    plan.connectStraight(mergeType, 0, gatherType, 0, true, true);
+    plan.connectCrossbar(gatherType, concatType, input, true, true);
+    plan.connectStraight(concatType, 0, writeType, 0, true, true);
+    RuntimeProcess p(0,3,4,plan);
+    p.run();
+  }
+  std::vector<std::string> expected;
+  for(int32_t partition=0; partition<4; ++partition) {
+    for(int32_t a=partition; a<100; a+=4) {
+      expected.push_back((boost::format("%1%") % a).str());
+    }
+  }
+  std::vector<std::string> lines;
+  {
+    std::ifstream in(outPath.string().c_str());
+    std::string line;
+    while(std::getline(in, line)) {
+      lines.push_back(line);
+    }
+  }
+  boost::filesystem::remove(outPath);
+  BOOST_CHECK(expected == lines);
+}
+
 BOOST_AUTO_TEST_CASE(testSortMerge)
 {
   std::cout << "testSortMerge" << std::endl;
@@ -2689,6 +3156,390 @@ BOOST_AUTO_TEST_CASE(testSortMerge)
   p.run();
 }
 
+/**
+ * Run a parallel sort_merge over three sorted inputs of more than one
+ * batch each whose keys interleave and repeat within and across inputs.
+ * Check that the output is complete and, when ordered, globally sorted.
+ */
+static void checkParallelSortMerge(const std::string& keyFormat, bool ordered)
+{
+  boost::filesystem::path outPath = boost::filesystem::temp_directory_path() / 
+    boost::filesystem::unique_path("trecul-sort-merge-%%%%-%%%%.txt");
+  const char * keys[] = { "RECORDCOUNT - RECORDCOUNT % 2", "RECORDCOUNT", "3*RECORDCOUNT" };
+  int64_t numRecords[] = { 5000, 3000, 2000 };
+  std::vector<int64_t> expected;
+  for(int64_t i=0; i<numRecords[0]; ++i) expected.push_back(i - i%2);
+  for(int64_t i=0; i<numRecords[1]; ++i) expected.push_back(i);
+  for(int64_t i=0; i<numRecords[2]; ++i) expected.push_back(3*i);
+  std::sort(expected.begin(), expected.end());
+
+  std::string graph;
+  for(std::size_t i=0; i<3; ++i) {
+    graph += (boost::format("g%1% = generate[output=\"%2% AS a\", numRecords=%3%];\n"
+			    "g%1% -> m;\n") % i %
+	      (boost::format(keyFormat) % keys[i]).str() % numRecords[i]).str();
+  }
+  graph += (boost::format("m = sort_merge[key=\"a\", parallel=4, ordered=%1%];\n"
+			  "w = write[file=\"%2%\", mode=\"text\"];\n"
+			  "m -> w;\n") % (ordered ? "true" : "false") % 
+	    outPath.string()).str();
+  {
+    PlanCheckContext ctxt;
+    DataflowGraphBuilder gb(ctxt);
+    gb.buildGraph(graph);
+    boost::shared_ptr<RuntimeOperatorPlan> plan = gb.create(1);
+    RuntimeProcess p(0,0,1,*plan.get());
+    p.run();
+  }
+
+  std::vector<int64_t> actual;
+  std::ifstream in(outPath.string().c_str());
+  std::string line;
+  while(std::getline(in, line)) {
+    actual.push_back((int64_t) ::strtod(line.c_str(), NULL));
+  }
+  boost::filesystem::remove(outPath);
+  BOOST_CHECK_EQUAL(expected.size(), actual.size());
+  if (ordered) {
+    BOOST_CHECK(std::is_sorted(actual.begin(), actual.end()));
+  } else {
+    std::sort(actual.begin(), actual.end());
+  }
+  BOOST_CHECK(expected == actual);
+}
+
+BOOST_AUTO_TEST_CASE(testParallelSortMerge)
+{
+  std::cout << "testParallelSortMerge" << std::endl;
+  // BIGINT keys take the normalized key path, DECIMAL keys don't.
+  checkParallelSortMerge("%1%", true);
+  checkParallelSortMerge("%1%", false);
+  checkParallelSortMerge("(%1%) + 0.0", true);
+  checkParallelSortMerge("(%1%) + 0.0", false);
+}
+
+/**
+ * Sort the output of graph, whose last operator is named last, with
+ * a parallel sort over four partitions of one process.  Returns the
+ * lines written from partition 0.
+ */
+static std::vector<std::string> runParallelSort(const std::string& graph,
+						const std::string& last)
+{
+  boost::filesystem::path outPath = boost::filesystem::temp_directory_path() / 
+    boost::filesystem::unique_path("trecul-sort-%%%%-%%%%.txt");
+  {
+    PlanCheckContext ctxt;
+    DataflowGraphBuilder gb(ctxt);
+    gb.buildGraph(graph + 
+		  (boost::format("w = write[file=\"%1%\", mode=\"text\"];\n"
+				 "%2% -> w;\n") % outPath.string() % last).str());
+    boost::shared_ptr<RuntimeOperatorPlan> plan = gb.create(4);
+    RuntimeProcess p(0,3,4,*plan.get());
+    p.run();
+  }
+  std::vector<std::string> lines;
+  {
+    std::ifstream in(outPath.string().c_str());
+    std::string line;
+    while(std::getline(in, line)) {
+      lines.push_back(line);
+    }
+  }
+  boost::filesystem::remove(outPath);
+  return lines;
+}
+
+// Each of four partitions generates 20000 records, more than the 
+// sample a parallel sort takes.  The key is a permutation of the 
+// record number across all partitions.
+static const char * parallelSortKey = 
+  "(7919*(RECORDCOUNT + 20000*PARTITION)) % 100003";
+
+static std::string parallelSortInput(const std::string& output)
+{
+  return (boost::format("g = generate[output=\"%1%\", numRecords=20000];\n") % 
+	  output).str();
+}
+
+/**
+ * Expected output of a parallel sort on parallelSortKey; when 
+ * nulls is true every fifth key is NULL.  NULLs sort low.
+ */
+static std::vector<std::string> parallelSortExpected(bool desc, bool nulls)
+{
+  std::vector<int64_t> keys;
+  std::size_t numNulls = 0;
+  for(int64_t x=0; x<80000; ++x) {
+    if (nulls && x % 5 == 0) {
+      ++numNulls;
+    } else {
+      keys.push_back((7919*x) % 100003);
+    }
+  }
+  std::sort(keys.begin(), keys.end());
+  if (desc) {
+    std::reverse(keys.begin(), keys.end());
+  }
+  std::vector<std::string> lines;
+  if (!desc) {
+    lines.insert(lines.end(), numNulls, "\\N");
+  }
+  for(std::vector<int64_t>::const_iterator it = keys.begin();
+      it != keys.end();
+      ++it) {
+    lines.push_back((boost::format("%1%") % *it).str());
+  }
+  if (desc) {
+    lines.insert(lines.end(), numNulls, "\\N");
+  }
+  return lines;
+}
+
+BOOST_AUTO_TEST_CASE(testParallelSort)
+{
+  std::cout << "testParallelSort" << std::endl;
+  std::string intKey = (boost::format("CAST(%1% AS INTEGER)") % parallelSortKey).str();
+  std::string nullableKey = (boost::format("CASE WHEN RECORDCOUNT %% 5 <> 0 THEN %1% END") % 
+			     intKey).str();
+  for(int32_t desc=0; desc<2; ++desc) {
+    for(int32_t nulls=0; nulls<2; ++nulls) {
+      std::string graph = 
+	parallelSortInput((nulls ? nullableKey : intKey) + " AS a") +
+	(boost::format("s = sort[key=\"a%1%\", parallel=true];\n"
+		       "g -> s;\n") % (desc ? " DESC" : "")).str();
+      BOOST_CHECK(parallelSortExpected(desc!=0, nulls!=0) == 
+		  runParallelSort(graph, "s"));
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(testParallelSortDuplicatePrefixes)
+{
+  std::cout << "testParallelSortDuplicatePrefixes" << std::endl;
+  // Every BIGINT key below 2^33 has the same key prefix so all 
+  // records land in one range.
+  {
+    std::string graph = 
+      parallelSortInput((boost::format("%1% AS a") % parallelSortKey).str()) +
+      "s = sort[key=\"a\", parallel=true];\n"
+      "g -> s;\n";
+    BOOST_CHECK(parallelSortExpected(false, false) == runParallelSort(graph, "s"));
+  }
+  // Three distinct keys; the sample has repeated splitters.
+  {
+    std::string graph = 
+      parallelSortInput("CAST((RECORDCOUNT + 20000*PARTITION) % 3 AS INTEGER) AS a") +
+      "s = sort[key=\"a\", parallel=true];\n"
+      "g -> s;\n";
+    std::vector<std::string> expected;
+    for(int32_t a=0; a<3; ++a) {
+      expected.insert(expected.end(), (80000 - a + 2)/3, 
+		      (boost::format("%1%") % a).str());
+    }
+    BOOST_CHECK(expected == runParallelSort(graph, "s"));
+  }
+}
+
+/**
+ * The input of the second sort arrives through the crossbar that 
+ * gathers the first sort onto partition 0, so the other partitions 
+ * of the second sort see empty input.
+ */
+BOOST_AUTO_TEST_CASE(testParallelSortAfterPartitioner)
+{
+  std::cout << "testParallelSortAfterPartitioner" << std::endl;
+  std::string graph = 
+    parallelSortInput((boost::format("CAST((%1%) %% 97 AS INTEGER) AS a, "
+				     "CAST(%1% AS INTEGER) AS b") % 
+		       parallelSortKey).str()) +
+    "s1 = sort[key=\"a\", parallel=true];\n"
+    "s2 = sort[key=\"b\", parallel=true];\n"
+    "g -> s1;\n"
+    "s1 -> s2;\n";
+  std::vector<std::string> keys = parallelSortExpected(false, false);
+  std::vector<std::string> expected;
+  for(std::vector<std::string>::const_iterator it = keys.begin();
+      it != keys.end();
+      ++it) {
+    int64_t b = (int64_t) ::strtoll(it->c_str(), NULL, 10);
+    expected.push_back((boost::format("%1%\t%2%") % (b % 97) % b).str());
+  }
+  BOOST_CHECK(expected == runParallelSort(graph, "s2"));
+}
+
+BOOST_AUTO_TEST_CASE(testParallelSortRejectsMultipleProcesses)
+{
+  std::cout << "testParallelSortRejectsMultipleProcesses" << std::endl;
+  PlanCheckContext ctxt;
+  ctxt.setPartitionsSpanProcesses(true);
+  DataflowGraphBuilder gb(ctxt);
+  gb.buildGraph(parallelSortInput("RECORDCOUNT AS a") +
+		"s = sort[key=\"a\", parallel=true];\n"
+		"d = devNull[];\n"
+		"g -> s;\n"
+		"s -> d;\n");
+  BOOST_CHECK_THROW(gb.create(4), std::runtime_error);
+}
+
+/**
+ * Write serial 0 of a column group of table t (common, major and 
+ * minor version 1) under root.
+ */
+static void writeColumnGroupSerial(const boost::filesystem::path& root,
+				   const std::string& columnGroup,
+				   const std::string& contents)
+{
+  boost::filesystem::path dir = root / "1_1" / "t" / "1" / "1" / columnGroup / "0";
+  boost::filesystem::create_directories(dir);
+  gzFile out = ::gzopen((dir / "serial_00000.gz").string().c_str(), "wb");
+  BOOST_REQUIRE(out != NULL);
+  ::gzwrite(out, contents.c_str(), (unsigned) contents.size());
+  ::gzclose(out);
+}
+
+/**
+ * Create table t with primary key k and column groups g1, g2...
+ * Column group gi holds the keys that are multiples of moduli[i-1]
+ * below numKeys, with vi = 10*k + i.  Returns the table and the 
+ * lines of the table sorted on k.
+ */
+static boost::shared_ptr<TableMetadata> 
+createColumnGroupTable(const boost::filesystem::path& root,
+		       const std::vector<int32_t>& moduli,
+		       int32_t numKeys,
+		       std::vector<std::string>& expected)
+{
+  std::string tableType("k INTEGER");
+  for(std::size_t i=1; i<=moduli.size(); ++i) {
+    tableType += (boost::format(", v%1% INTEGER") % i).str();
+  }
+  std::vector<std::string> keys(1, "k");
+  boost::shared_ptr<TableMetadata> table(new TableMetadata("t", tableType, keys, keys, ""));
+  for(std::size_t i=1; i<=moduli.size(); ++i) {
+    std::string cgType = (boost::format("k INTEGER, v%1% INTEGER") % i).str();
+    std::string cgName = (boost::format("g%1%") % i).str();
+    table->addColumnGroup(cgName, cgType)->add(1, new TableFileMetadata(cgType, 
+									std::map<std::string, std::string>()));
+    std::string contents;
+    for(int32_t k=0; k<numKeys; k += moduli[i-1]) {
+      contents += (boost::format("%1%\t%2%\n") % k % (10*k + i)).str();
+    }
+    writeColumnGroupSerial(root, cgName, contents);
+  }
+  for(int32_t k=0; k<numKeys; ++k) {
+    std::string line = (boost::format("%1%") % k).str();
+    bool found = false;
+    for(std::size_t i=1; i<=moduli.size(); ++i) {
+      if (k % moduli[i-1] == 0) {
+	line += (boost::format("\t%1%") % (10*k + i)).str();
+	found = true;
+      } else {
+	line += "\t\\N";
+      }
+    }
+    if (found) {
+      expected.push_back(line);
+    }
+  }
+  return table;
+}
+
+/**
+ * Read table t under root and return the lines of the output.
+ */
+static std::vector<std::string> readColumnGroupTable(const boost::filesystem::path& root,
+						     boost::shared_ptr<TableMetadata> metadata,
+						     const std::string& output,
+						     bool projectColumnGroups)
+{
+  boost::filesystem::path outPath = root / "output.txt";
+  {
+    PlanCheckContext ctxt;
+    DataflowGraphBuilder gb(ctxt);
+    gb.buildGraph((boost::format("w = write[file=\"%1%\", mode=\"text\"];\n") % 
+		   outPath.string()).str());
+    LogicalOperator * writer = *gb.getPlan().begin_operators();
+    LogicalTableParser * table = new LogicalTableParser("t", metadata);
+    table->setName("t");
+    table->addParam("connect", LogicalOperator::param_type("file://" + root.string() + "/"));
+    if (output.size()) {
+      table->addParam("output", LogicalOperator::param_type(output));
+    }
+    if (projectColumnGroups) {
+      table->addParam("projectcolumngroups", LogicalOperator::param_type(std::string("true")));
+    }
+    gb.getPlan().addOperator(table);
+    gb.getPlan().addEdge(table, writer);
+    boost::shared_ptr<RuntimeOperatorPlan> plan = gb.create(1);
+    RuntimeProcess p(0,0,1,*plan.get());
+    p.run();
+  }
+  std::vector<std::string> lines;
+  std::ifstream in(outPath.string().c_str());
+  std::string line;
+  while(std::getline(in, line)) {
+    lines.push_back(line);
+  }
+  boost::filesystem::remove(outPath);
+  return lines;
+}
+
+BOOST_AUTO_TEST_CASE(testColumnGroupZip)
+{
+  std::cout << "testColumnGroupZip" << std::endl;
+  boost::filesystem::path root = boost::filesystem::temp_directory_path() / 
+    boost::filesystem::unique_path("trecul-table-%%%%-%%%%");
+  // Two column groups, each missing keys of the other and some
+  // keys in neither.
+  {
+    std::vector<int32_t> moduli;
+    moduli.push_back(2);
+    moduli.push_back(3);
+    std::vector<std::string> expected;
+    boost::shared_ptr<TableMetadata> table = 
+      createColumnGroupTable(root, moduli, 20, expected);
+    BOOST_CHECK(expected == readColumnGroupTable(root, table, "", false));
+    boost::filesystem::remove_all(root);
+  }
+  // Three column groups of several batches each.
+  {
+    std::vector<int32_t> moduli;
+    moduli.push_back(2);
+    moduli.push_back(3);
+    moduli.push_back(5);
+    std::vector<std::string> expected;
+    boost::shared_ptr<TableMetadata> table = 
+      createColumnGroupTable(root, moduli, 10000, expected);
+    BOOST_CHECK(expected == readColumnGroupTable(root, table, "", false));
+
+    // Without projectcolumngroups every column group is read for
+    // its keys.
+    std::vector<std::string> projected;
+    for(int32_t k=0; k<10000; ++k) {
+      if (k%2 == 0 || k%3 == 0 || k%5 == 0) {
+	projected.push_back(k%3 == 0 ? (boost::format("%1%\t%2%") % k % (10*k+2)).str() :
+			    (boost::format("%1%\t\\N") % k).str());
+      }
+    }
+    BOOST_CHECK(projected == readColumnGroupTable(root, table, "k,v2", false));
+
+    // With it only g2 is read; the others aren't even opened.
+    projected.clear();
+    for(int32_t k=0; k<10000; k += 3) {
+      projected.push_back((boost::format("%1%\t%2%") % k % (10*k+2)).str());
+    }
+    const char * unread[] = { "g1", "g3" };
+    for(std::size_t i=0; i<2; ++i) {
+      std::ofstream out((root / "1_1" / "t" / "1" / "1" / unread[i] / "0" / 
+			 "serial_00000.gz").string().c_str(), std::ios::trunc);
+      out << "not gzip";
+    }
+    BOOST_CHECK(projected == readColumnGroupTable(root, table, "k,v2", true));
+    boost::filesystem::remove_all(root);
+  }
+}
+
 BOOST_AUTO_TEST_CASE(testSort)
 {
   std::cout << "testSort" << std::endl;
@@ -2866,3 +3717,420 @@ BOOST_AUTO_TEST_CASE(testSimpleExecWithEnvAndStdout)
 }
 
 
+
+BOOST_AUTO_TEST_CASE(testTcpReadFraming)
+{
+  std::string delim("\n");
+  std::string data("abc\ndef\ngh");
+  const uint8_t * b = (const uint8_t *) data.c_str();
+  BOOST_CHECK_EQUAL(8, TcpReadOperatorType::getFramedSize(b, b + data.size(), delim));
+  BOOST_CHECK_EQUAL(4, TcpReadOperatorType::getFramedSize(b, b + 7, delim));
+  BOOST_CHECK_EQUAL(0, TcpReadOperatorType::getFramedSize(b, b + 3, delim));
+  BOOST_CHECK_EQUAL(0, TcpReadOperatorType::getFramedSize(b, b, delim));
+  std::string crlf("\r\n");
+  std::string data2("ab\r\ncd\r");
+  const uint8_t * b2 = (const uint8_t *) data2.c_str();
+  BOOST_CHECK_EQUAL(4, TcpReadOperatorType::getFramedSize(b2, b2 + data2.size(), crlf));
+}
+
+BOOST_AUTO_TEST_CASE(testTcpReadInvalidParams)
+{
+  const char * params[] = { "connections=-1", "port=70000", "blockSize=-1" };
+  const char * values[] = { "-1", "70000", "-1" };
+  for(std::size_t i=0; i<sizeof(params)/sizeof(params[0]); ++i) {
+    PlanCheckContext ctxt;
+    DataflowGraphBuilder gb(ctxt);
+    gb.buildGraph((boost::format("a = tcp_read[%1%];\n"
+				 "b = devNull[];\n"
+				 "a -> b;\n") % params[i]).str());
+    std::string msg;
+    try {
+      gb.create(1);
+    } catch(std::runtime_error & ex) {
+      msg = ex.what();
+    }
+    BOOST_CHECK(std::string::npos != msg.find(values[i]));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(testColumnarChunkRoundTrip)
+{
+  DynamicRecordContext ctxt;
+  std::vector<RecordMember> members;
+  members.push_back(RecordMember("a", Int32Type::Get(ctxt)));
+  members.push_back(RecordMember("b", Int64Type::Get(ctxt, true)));
+  members.push_back(RecordMember("c", VarcharType::Get(ctxt)));
+  RecordType recTy(members);
+  // Sorted a should delta encode, runs of b run length encode and
+  // the few values of c dictionary encode.
+  std::vector<RecordBuffer> input;
+  for(int32_t i=0; i<1000; ++i) {
+    RecordBuffer buf = recTy.GetMalloc()->malloc();
+    recTy.setInt32("a", 3*i - 100, buf);
+    if (i % 7 == 0) {
+      recTy.getFieldAddress("b").setNull(buf);
+    } else {
+      recTy.setInt64("b", i/100, buf);
+    }
+    recTy.setVarchar("c", (boost::format("value%1%") % (i%5)).str().c_str(), buf);
+    input.push_back(buf);
+  }
+  std::vector<RecordBuffer> output;
+  for(std::size_t i=0; i<input.size(); ++i) {
+    output.push_back(recTy.GetMalloc()->malloc());
+  }
+  const char * names [] = {"a", "b", "c"};
+  std::vector<ColumnStatistics> stats(3);
+  for(int32_t c=0; c<3; ++c) {
+    for(int32_t compress=0; compress<2; ++compress) {
+      ColumnarFile::Field f(&recTy, names[c], c);
+      std::string chunk;
+      stats[c] = ColumnStatistics();
+      ColumnarFile::encode(f, input, compress==1, chunk, stats[c]);
+      ColumnarFile::decode(f, (const uint8_t *) chunk.c_str(), 
+			   (const uint8_t *) chunk.c_str() + chunk.size(), output);
+      // A flipped bit fails the checksum.
+      chunk[chunk.size()-1] ^= 0x01;
+      BOOST_CHECK_THROW(ColumnarFile::decode(f, (const uint8_t *) chunk.c_str(), 
+					     (const uint8_t *) chunk.c_str() + chunk.size(), 
+					     output), 
+			std::runtime_error);
+    }
+  }
+  for(std::size_t i=0; i<input.size(); ++i) {
+    BOOST_CHECK_EQUAL(recTy.getFieldAddress("a").getInt32(input[i]),
+		      recTy.getFieldAddress("a").getInt32(output[i]));
+    BOOST_CHECK_EQUAL(recTy.getFieldAddress("b").isNull(input[i]),
+		      recTy.getFieldAddress("b").isNull(output[i]));
+    if (!recTy.getFieldAddress("b").isNull(input[i])) {
+      BOOST_CHECK_EQUAL(recTy.getFieldAddress("b").getInt64(input[i]),
+			recTy.getFieldAddress("b").getInt64(output[i]));
+    }
+    BOOST_CHECK(boost::algorithm::equals(recTy.getFieldAddress("c").getVarcharPtr(input[i])->c_str(),
+					 recTy.getFieldAddress("c").getVarcharPtr(output[i])->c_str()));
+  }
+  BOOST_CHECK_EQUAL(-100, stats[0].getMinInteger());
+  BOOST_CHECK_EQUAL(2897, stats[0].getMaxInteger());
+  BOOST_CHECK_EQUAL(143U, stats[1].getNullCount());
+  BOOST_CHECK_EQUAL(9, stats[1].getMaxInteger());
+  BOOST_CHECK_EQUAL("value0", stats[2].getMinString());
+  BOOST_CHECK_EQUAL("value4", stats[2].getMaxString());
+
+  // Row group skipping
+  BOOST_CHECK(ZoneMapPredicate(ctxt, &recTy, "a > 2000 AND c = 'value3'").mayMatch(stats));
+  BOOST_CHECK(!ZoneMapPredicate(ctxt, &recTy, "a > 3000").mayMatch(stats));
+  BOOST_CHECK(!ZoneMapPredicate(ctxt, &recTy, "-200 >= a").mayMatch(stats));
+  BOOST_CHECK(!ZoneMapPredicate(ctxt, &recTy, "a < 0 AND c > 'value5'").mayMatch(stats));
+  // String literals equal to the bounds of the row group
+  BOOST_CHECK(ZoneMapPredicate(ctxt, &recTy, "c = 'value0'").mayMatch(stats));
+  BOOST_CHECK(ZoneMapPredicate(ctxt, &recTy, "c = 'value4'").mayMatch(stats));
+  BOOST_CHECK(ZoneMapPredicate(ctxt, &recTy, "c <= 'value0'").mayMatch(stats));
+  BOOST_CHECK(ZoneMapPredicate(ctxt, &recTy, "c >= 'value4'").mayMatch(stats));
+  BOOST_CHECK(!ZoneMapPredicate(ctxt, &recTy, "c < 'value0'").mayMatch(stats));
+  BOOST_CHECK(!ZoneMapPredicate(ctxt, &recTy, "c > 'value4'").mayMatch(stats));
+  BOOST_CHECK(!ZoneMapPredicate(ctxt, &recTy, "c = 'value5'").mayMatch(stats));
+  BOOST_CHECK(!ZoneMapPredicate(ctxt, &recTy, "c = 'value'").mayMatch(stats));
+  // Disjunctions are never used to skip.
+  BOOST_CHECK(ZoneMapPredicate(ctxt, &recTy, "a > 3000 OR b = 2").empty());
+
+  for(std::size_t i=0; i<input.size(); ++i) {
+    recTy.getFree().free(input[i]);
+    recTy.getFree().free(output[i]);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(testRecordTypeStatistics)
+{
+  DynamicRecordContext ctxt;
+  std::vector<RecordMember> members;
+  members.push_back(RecordMember("a", Int32Type::Get(ctxt)));
+  members.push_back(RecordMember("b", VarcharType::Get(ctxt, true)));
+  members.push_back(RecordMember("c", DoubleType::Get(ctxt)));
+  RecordType recTy(members);
+  RecordTypeStatistics recStats(&recTy);
+  std::vector<ColumnStatistics> stats;
+  recStats.init(stats);
+  for(int32_t i=0; i<100; ++i) {
+    RecordBuffer buf = recTy.GetMalloc()->malloc();
+    recTy.setInt32("a", i+10, buf);
+    if (i % 2) {
+      recTy.getFieldAddress("b").setNull(buf);
+    } else {
+      recTy.setVarchar("b", (boost::format("k%1%") % (i%10)).str().c_str(), buf);
+    }
+    recTy.setDouble("c", 0.5*i, buf);
+    recStats.add(buf, stats);
+    recTy.getFree().free(buf);
+  }
+  std::string sidecar;
+  recStats.write(stats, sidecar);
+  std::map<std::string, ColumnStatistics> byName;
+  const uint8_t * begin = (const uint8_t *) sidecar.c_str();
+  RecordTypeStatistics::read(begin, begin + sidecar.size(), byName);
+  BOOST_CHECK_EQUAL(3U, byName.size());
+  BOOST_CHECK_EQUAL(10, byName["a"].getMinInteger());
+  BOOST_CHECK_EQUAL(109, byName["a"].getMaxInteger());
+  BOOST_CHECK_EQUAL(50U, byName["b"].getNullCount());
+  BOOST_CHECK_EQUAL("k8", byName["b"].getMaxString());
+  BOOST_CHECK_EQUAL(49.5, byName["c"].getMaxReal());
+  BOOST_CHECK_THROW(RecordTypeStatistics::read(begin, begin + sidecar.size() - 1, byName),
+		    std::runtime_error);
+
+  // Columns are matched by name so the predicate may use another format.
+  std::vector<RecordMember> tableMembers;
+  tableMembers.push_back(RecordMember("z", Int32Type::Get(ctxt)));
+  tableMembers.push_back(RecordMember("c", DoubleType::Get(ctxt)));
+  tableMembers.push_back(RecordMember("a", Int32Type::Get(ctxt)));
+  RecordType tableTy(tableMembers);
+  BOOST_CHECK(ZoneMapPredicate(ctxt, &tableTy, "a >= 109 AND z = 3").mayMatch(byName));
+  BOOST_CHECK(!ZoneMapPredicate(ctxt, &tableTy, "a > 109").mayMatch(byName));
+  BOOST_CHECK(!ZoneMapPredicate(ctxt, &tableTy, "c < 0").mayMatch(byName));
+  // No statistics for z
+  BOOST_CHECK(ZoneMapPredicate(ctxt, &tableTy, "z > 1000").mayMatch(byName));
+
+  // NaN values don't poison the range.
+  ColumnStatistics nanStats(ColumnStatistics::REAL);
+  nanStats.add(std::numeric_limits<double>::quiet_NaN());
+  nanStats.add(1.5);
+  nanStats.add(std::numeric_limits<double>::quiet_NaN());
+  nanStats.add(3.5);
+  BOOST_CHECK_EQUAL(1.5, nanStats.getMinReal());
+  BOOST_CHECK_EQUAL(3.5, nanStats.getMaxReal());
+  byName["c"] = nanStats;
+  BOOST_CHECK(ZoneMapPredicate(ctxt, &tableTy, "c > 3").mayMatch(byName));
+  BOOST_CHECK(ZoneMapPredicate(ctxt, &tableTy, "c < 2").mayMatch(byName));
+  BOOST_CHECK(!ZoneMapPredicate(ctxt, &tableTy, "c > 4").mayMatch(byName));
+}
+
+BOOST_AUTO_TEST_CASE(testFileStatisticsFilter)
+{
+  DynamicRecordContext ctxt;
+  std::vector<RecordMember> members;
+  members.push_back(RecordMember("a", Int32Type::Get(ctxt)));
+  members.push_back(RecordMember("b", VarcharType::Get(ctxt)));
+  RecordType recTy(members);
+  RecordTypeStatistics recStats(&recTy);
+  // Three files: the first two have sidecars, the last does not.
+  std::vector<std::string> dataFiles;
+  for(int32_t f=0; f<3; ++f) {
+    boost::filesystem::path dataPath = boost::filesystem::temp_directory_path() / 
+      boost::filesystem::unique_path("trecul-stats-%%%%-%%%%.txt");
+    dataFiles.push_back(dataPath.string());
+    if (f == 2) break;
+    std::vector<ColumnStatistics> stats;
+    recStats.init(stats);
+    for(int32_t i=0; i<10; ++i) {
+      RecordBuffer buf = recTy.GetMalloc()->malloc();
+      recTy.setInt32("a", i, buf);
+      recTy.setVarchar("b", (boost::format("%1%%2%") % (f ? "m" : "k") % i).str().c_str(), buf);
+      recStats.add(buf, stats);
+      recTy.getFree().free(buf);
+    }
+    std::string sidecar;
+    recStats.write(stats, sidecar);
+    std::ofstream out((dataFiles.back() + RecordTypeStatistics::SUFFIX).c_str(),
+		      std::ios::binary);
+    out << sidecar;
+  }
+  std::vector<boost::shared_ptr<FileChunk> > files;
+  for(std::size_t f=0; f<dataFiles.size(); ++f) {
+    // Two chunks per file
+    std::string uri = "file://" + dataFiles[f];
+    files.push_back(boost::make_shared<FileChunk>(uri, 0, 100));
+    files.push_back(boost::make_shared<FileChunk>(uri, 100, 200));
+  }
+  {
+    std::vector<boost::shared_ptr<FileChunk> > tmp(files);
+    FileStatisticsFilter::prune(ZoneMapPredicate(ctxt, &recTy, "b = 'k9'"), tmp);
+    BOOST_REQUIRE_EQUAL(4U, tmp.size());
+    BOOST_CHECK_EQUAL(files[0]->getFilename(), tmp[0]->getFilename());
+    BOOST_CHECK_EQUAL(files[1]->getEnd(), tmp[1]->getEnd());
+    BOOST_CHECK_EQUAL(files[4]->getFilename(), tmp[2]->getFilename());
+  }
+  {
+    std::vector<boost::shared_ptr<FileChunk> > tmp(files);
+    FileStatisticsFilter::prune(ZoneMapPredicate(ctxt, &recTy, "b > 'k9' AND a >= 9"), tmp);
+    BOOST_REQUIRE_EQUAL(4U, tmp.size());
+    BOOST_CHECK_EQUAL(files[2]->getFilename(), tmp[0]->getFilename());
+    BOOST_CHECK_EQUAL(files[4]->getFilename(), tmp[2]->getFilename());
+  }
+  {
+    std::vector<boost::shared_ptr<FileChunk> > tmp(files);
+    FileStatisticsFilter::prune(ZoneMapPredicate(ctxt, &recTy, "b = 'l'"), tmp);
+    BOOST_REQUIRE_EQUAL(2U, tmp.size());
+    BOOST_CHECK_EQUAL(files[4]->getFilename(), tmp[0]->getFilename());
+  }
+  {
+    std::vector<boost::shared_ptr<FileChunk> > tmp(files);
+    FileStatisticsFilter::prune(ZoneMapPredicate(ctxt, &recTy, "b <= 'k0'"), tmp);
+    BOOST_CHECK_EQUAL(4U, tmp.size());
+  }
+  for(std::size_t f=0; f<2; ++f) {
+    boost::filesystem::remove(dataFiles[f] + RecordTypeStatistics::SUFFIX);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(testZoneMapLiterals)
+{
+  DynamicRecordContext ctxt;
+  std::vector<RecordMember> members;
+  members.push_back(RecordMember("a", VarcharType::Get(ctxt)));
+  members.push_back(RecordMember("d", DateType::Get(ctxt)));
+  members.push_back(RecordMember("t", DatetimeType::Get(ctxt)));
+  RecordType recTy(members);
+  RecordTypeStatistics recStats(&recTy);
+  std::vector<ColumnStatistics> stats;
+  recStats.init(stats);
+  const char * strs [] = {"it's", "tab\there", "x"};
+  const char * dates [] = {"2011-04-07", "2011-05-01", "2011-06-30"};
+  const char * times [] = {"2011-04-07 10:00:00", "2011-05-01 00:00:00", 
+			   "2011-06-30 23:59:59"};
+  for(int32_t i=0; i<3; ++i) {
+    RecordBuffer buf = recTy.GetMalloc()->malloc();
+    recTy.setVarchar("a", strs[i], buf);
+    recTy.setDate("d", boost::gregorian::from_string(dates[i]), buf);
+    recTy.setDatetime("t", boost::posix_time::time_from_string(times[i]), buf);
+    recStats.add(buf, stats);
+    recTy.getFree().free(buf);
+  }
+  // Escapes are decoded before comparing with the statistics.
+  BOOST_CHECK(ZoneMapPredicate(ctxt, &recTy, "a = 'it\\'s'").mayMatch(stats));
+  BOOST_CHECK(ZoneMapPredicate(ctxt, &recTy, "a = 'x'").mayMatch(stats));
+  BOOST_CHECK(!ZoneMapPredicate(ctxt, &recTy, "a < 'it\\'s'").mayMatch(stats));
+  BOOST_CHECK(!ZoneMapPredicate(ctxt, &recTy, "a > 'x'").mayMatch(stats));
+  BOOST_CHECK(!ZoneMapPredicate(ctxt, &recTy, "a = 'it'").mayMatch(stats));
+
+  BOOST_CHECK(ZoneMapPredicate(ctxt, &recTy, 
+			       "d = CAST('2011-04-07' AS DATE)").mayMatch(stats));
+  BOOST_CHECK(ZoneMapPredicate(ctxt, &recTy, 
+			       "d >= CAST('2011-06-30' AS DATE)").mayMatch(stats));
+  BOOST_CHECK(!ZoneMapPredicate(ctxt, &recTy, 
+				"d < CAST('2011-04-07' AS DATE)").mayMatch(stats));
+  BOOST_CHECK(!ZoneMapPredicate(ctxt, &recTy, 
+				"CAST('2011-07-01' AS DATE) <= d").mayMatch(stats));
+  BOOST_CHECK(ZoneMapPredicate(ctxt, &recTy, 
+			       "t = CAST('2011-06-30 23:59:59' AS DATETIME)").mayMatch(stats));
+  BOOST_CHECK(!ZoneMapPredicate(ctxt, &recTy, 
+				"t > CAST('2011-06-30 23:59:59' AS DATETIME)").mayMatch(stats));
+}
+
+BOOST_AUTO_TEST_CASE(testRecordIndexFile)
+{
+  boost::filesystem::path dataPath = boost::filesystem::temp_directory_path() / 
+    boost::filesystem::unique_path("trecul-index-%%%%-%%%%.txt");
+  std::string dataFile = dataPath.string();
+  std::vector<RecordIndexFile::Entry> entries;
+  {
+    std::ofstream out(dataFile.c_str());
+    uint64_t offset = 0;
+    for(uint32_t i=0; i<100; ++i) {
+      std::string line = (boost::format("key%1%\t%2%\n") % (i%7) % i).str();
+      out << line;
+      RecordIndexFile::Entry e;
+      e.mHash = i%7;
+      e.mOffset = offset;
+      e.mLength = (uint32_t) line.size();
+      entries.push_back(e);
+      offset += line.size();
+    }
+  }
+  // Entries are written unsorted.
+  std::reverse(entries.begin(), entries.end());
+  RecordIndexFile::write(dataFile, entries);
+  {
+    RecordIndexFile idx(dataFile);
+    BOOST_CHECK_EQUAL(100U, idx.size());
+    std::vector<RecordIndexFile::Entry> found;
+    idx.find(3, found);
+    BOOST_CHECK_EQUAL(14U, found.size());
+    std::string record;
+    for(std::size_t i=0; i<found.size(); ++i) {
+      idx.read(found[i], record);
+      BOOST_CHECK_EQUAL((boost::format("key3\t%1%\n") % (3+7*i)).str(), record);
+    }
+    found.clear();
+    idx.find(7, found);
+    BOOST_CHECK_EQUAL(0U, found.size());
+  }
+  // An index from an older version or a different hash is rejected.
+  for(int32_t field=0; field<2; ++field) {
+    RecordIndexFile::write(dataFile, entries);
+    {
+      std::fstream idxOut((dataFile + RecordIndexFile::SUFFIX).c_str(), 
+			  std::ios::in | std::ios::out | std::ios::binary);
+      idxOut.seekp(4 + 4*field);
+      idxOut.put((char) 0x7f);
+    }
+    BOOST_CHECK_THROW(RecordIndexFile idx(dataFile), std::runtime_error);
+  }
+  boost::filesystem::remove(dataFile + RecordIndexFile::SUFFIX);
+  boost::filesystem::remove(dataFile);
+  BOOST_CHECK_THROW(RecordIndexFile idx(dataFile), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(testRecordIndexFileGzip)
+{
+  boost::filesystem::path dataPath = boost::filesystem::temp_directory_path() / 
+    boost::filesystem::unique_path("trecul-index-%%%%-%%%%.gz");
+  std::string dataFile = dataPath.string();
+  // Large enough for several access points and written as 
+  // two gzip members.
+  std::string data;
+  std::vector<RecordIndexFile::Entry> entries;
+  for(uint32_t member=0; member<2; ++member) {
+    gzFile out = ::gzopen(dataFile.c_str(), member ? "ab" : "wb");
+    BOOST_REQUIRE(out != NULL);
+    for(uint32_t i=member*120000; i<(member ? 200000U : 120000U); ++i) {
+      std::string line = (boost::format("key%1%\t%2%\n") % (i%20011) % i).str();
+      ::gzwrite(out, line.c_str(), (unsigned) line.size());
+      RecordIndexFile::Entry e;
+      e.mHash = i%20011;
+      e.mOffset = data.size();
+      e.mLength = (uint32_t) line.size();
+      entries.push_back(e);
+      data += line;
+    }
+    ::gzclose(out);
+  }
+  std::vector<RecordIndexFile::AccessPoint> points;
+  {
+    RecordIndexScanner scanner(dataFile);
+    std::string scanned;
+    uint8_t buf[5000];
+    std::size_t sz;
+    while((sz = scanner.read(buf, sizeof(buf))) > 0) {
+      scanned.append((const char *) buf, sz);
+    }
+    BOOST_CHECK(data == scanned);
+    points = scanner.getAccessPoints();
+  }
+  BOOST_CHECK(points.size() > 2);
+  BOOST_CHECK_EQUAL(0U, points[0].mOut);
+  BOOST_CHECK_EQUAL(0U, points[0].mIn);
+  BOOST_CHECK_EQUAL(0U, points[0].mWindow.size());
+  RecordIndexFile::write(dataFile, entries, points);
+  {
+    RecordIndexFile idx(dataFile);
+    BOOST_CHECK_EQUAL(200000U, idx.size());
+    std::vector<RecordIndexFile::Entry> found;
+    idx.find(5, found);
+    BOOST_CHECK_EQUAL(10U, found.size());
+    std::string record;
+    for(std::size_t i=0; i<found.size(); ++i) {
+      idx.read(found[i], record);
+      BOOST_CHECK_EQUAL((boost::format("key5\t%1%\n") % (5+20011*i)).str(), record);
+    }
+    // Records from across the file and one spanning the 
+    // two members.
+    for(std::size_t i=0; i<entries.size(); i+=997) {
+      idx.read(entries[i], record);
+      BOOST_CHECK_EQUAL(data.substr(entries[i].mOffset, entries[i].mLength), record);
+    }
+    RecordIndexFile::Entry e = entries[119999];
+    e.mLength += entries[120000].mLength;
+    idx.read(e, record);
+    BOOST_CHECK_EQUAL(data.substr(e.mOffset, e.mLength), record);
+  }
+  boost::filesystem::remove(dataFile + RecordIndexFile::SUFFIX);
+  boost::filesystem::remove(dataFile);
+}
@@ -37,6 +37,8 @@
 #include <boost/date_time/posix_time/posix_time.hpp>
 
 #include "CodeGenerationContext.hh"
+#include "Hash64.h"
+#include "IQLInterpreter.hh"
 #include "LLVMGen.h"
 #include "RecordType.hh"
 #include "TypeCheckContext.hh"
@@ -2773,6 +2775,45 @@ CodeGenerationContext::buildVarcharCompare(llvm::Value * e1,
   return IQLToLLVMValue::eLocal;
 }
 
+IQLToLLVMValue::ValueType 
+CodeGenerationContext::buildConstantRLike(llvm::Value * e1, 
+					  llvm::Value * e2,
+					  const std::string& pattern,
+					  llvm::Value * ret)
+{
+  std::string literal;
+  RLikePattern::Kind kind = RLikePattern::analyze(pattern, literal);
+  const char * fun = NULL;
+  switch(kind) {
+  case RLikePattern::EQUALS:
+    fun = "InternalVarcharEquals";
+    break;
+  case RLikePattern::PREFIX:
+    fun = "InternalVarcharStartsWith";
+    break;
+  case RLikePattern::SUFFIX:
+    fun = "InternalVarcharEndsWith";
+    break;
+  case RLikePattern::CONTAINS:
+    fun = "InternalVarcharContains";
+    break;
+  case RLikePattern::REGEX:
+  default:
+    fun = "InternalVarcharRLikeConstant";
+    break;
+  }
+  llvm::IRBuilder<> * b = llvm::unwrap(LLVMBuilder);
+  llvm::Value * callArgs[3];
+  llvm::Value * fn = llvm::unwrap(LLVMModule)->getFunction(fun);
+  callArgs[0] = e1;
+  callArgs[1] = kind == RLikePattern::REGEX ? 
+    e2 : buildVarcharConstant(literal)->getValue();
+  callArgs[2] = b->CreateLoad(getContextArgumentRef());
+  llvm::Value * cmp = b->CreateCall(fn, llvm::makeArrayRef(&callArgs[0], 3), "varcharrliketmp");
+  b->CreateStore(cmp, ret);
+  return IQLToLLVMValue::eLocal;
+}
+
 IQLToLLVMValue::ValueType 
 CodeGenerationContext::buildCompare(const IQLToLLVMValue * lhs, 
 				    const FieldType * lhsType, 
@@ -2821,6 +2862,14 @@ CodeGenerationContext::buildCompare(const IQLToLLVMValue * lhs,
   // TODO: Fix this by storing promoted type in syntax tree or rewriting the syntax tree with a cast.
   const FieldType * promoted = TypeCheckContext::leastCommonTypeNullable(lhsType, rhsType);
   lhs = buildCastNonNullable(lhs, lhsType, promoted);
+  if (op == IQLToLLVMOpRLike) {
+    // Check for a literal pattern before the cast below hides it.
+    std::map<const llvm::Value *, std::string>::const_iterator it = 
+      mVarcharLiterals.find(rhs->getValue());
+    if (it != mVarcharLiterals.end()) {
+      return buildConstantRLike(lhs->getValue(), rhs->getValue(), it->second, ret);
+    }
+  }
   rhs = buildCastNonNullable(rhs, rhsType, promoted);
   
   // Call out to external function.  The trick is that we always pass a pointer to data.
@@ -2911,39 +2960,87 @@ const IQLToLLVMValue * CodeGenerationContext::buildCompare(const IQLToLLVMValue
   return buildNullableBinaryOp(lhs, lhsType, rhs, rhsType, resultType, opFun);
 }
 
-const IQLToLLVMValue * CodeGenerationContext::buildHash(const std::vector<IQLToLLVMTypedValue> & args)
+llvm::Value * CodeGenerationContext::buildHash64Step(llvm::Value * h, llvm::Value * k)
 {
-  // Call out to external function.  The trick is that we always pass a pointer to data.
-  // Handle the cases here.  For value types, we must alloca storage so
-  // we have a pointer to pass.
+  // Must agree with Hash64Step in Hash64.h
   llvm::IRBuilder<> * b = llvm::unwrap(LLVMBuilder);
-  llvm::Value * callArgs[3];
-  llvm::Value * fn = llvm::unwrap(LLVMModule)->getFunction("SuperFastHash");
+  k = b->CreateMul(k, b->getInt64(0x87c37b91114253d5ULL));
+  k = b->CreateOr(b->CreateShl(k, 31), b->CreateLShr(k, 33));
+  k = b->CreateMul(k, b->getInt64(0x4cf5ad432745937fULL));
+  h = b->CreateXor(h, k);
+  h = b->CreateOr(b->CreateShl(h, 27), b->CreateLShr(h, 37));
+  return b->CreateAdd(b->CreateMul(h, b->getInt64(5)), b->getInt64(0x52dce729));
+}
 
-  // Save the previous hash so we can feed it into the next.  
-  llvm::Value * previousHash=NULL;
+llvm::Value * CodeGenerationContext::buildHash64Finish(llvm::Value * h)
+{
+  // Must agree with Hash64Finish in Hash64.h
+  llvm::IRBuilder<> * b = llvm::unwrap(LLVMBuilder);
+  h = b->CreateXor(h, b->CreateLShr(h, 33));
+  h = b->CreateMul(h, b->getInt64(0xff51afd7ed558ccdULL));
+  h = b->CreateXor(h, b->CreateLShr(h, 33));
+  h = b->CreateMul(h, b->getInt64(0xc4ceb9fe1a85ec53ULL));
+  return b->CreateXor(h, b->CreateLShr(h, 33));
+}
+
+llvm::Value * CodeGenerationContext::buildHash64Bytes(llvm::Value * ptr, 
+						      int32_t len,
+						      llvm::Value * h)
+{
+  // Must agree with Hash64Bytes in Hash64.c.  Length is a compile
+  // time constant so the word loop is completely unrolled.
+  llvm::IRBuilder<> * b = llvm::unwrap(LLVMBuilder);
+  ptr = b->CreateBitCast(ptr, llvm::PointerType::get(b->getInt8Ty(), 0));
+  int32_t i=0;
+  for(; i+8 <= len; i += 8) {
+    llvm::Value * wordPtr = b->CreateBitCast(b->CreateConstGEP1_64(ptr, i),
+					     llvm::PointerType::get(b->getInt64Ty(), 0));
+    llvm::LoadInst * word = b->CreateLoad(wordPtr);
+    word->setAlignment(1);
+    h = buildHash64Step(h, word);
+  }
+  if (i < len) {
+    llvm::Value * word = b->getInt64(0);
+    for(int32_t j=0; i+j < len; ++j) {
+      llvm::Value * c = b->CreateZExt(b->CreateLoad(b->CreateConstGEP1_64(ptr, i+j)),
+				      b->getInt64Ty());
+      word = b->CreateOr(word, b->CreateShl(c, 8*j));
+    }
+    h = buildHash64Step(h, word);
+  }
+  return buildHash64Step(h, b->getInt64(len));
+}
+
+const IQLToLLVMValue * CodeGenerationContext::buildHash(const std::vector<IQLToLLVMTypedValue> & args)
+{
+  // Fixed size values are hashed inline 64 bits at a time, only
+  // variable length data calls out to Hash64Bytes.  A NULL value
+  // contributes a fixed constant regardless of the (garbage) value
+  // behind it.  INTEGER is sign extended so that it hashes like a
+  // BIGINT with the same value.
+  llvm::IRBuilder<> * b = llvm::unwrap(LLVMBuilder);
+  llvm::Value * h = b->getInt64(HASH64_SEED);
   for(std::size_t i=0; i<args.size(); i++) {
     llvm::Value * argVal = args[i].getValue()->getValue();
-    llvm::Type * argTy = llvm::PointerType::get(b->getInt8Ty(), 0);
-    // TODO: Not handling NULL values in a coherent way.
-    // TODO: I should be able to reliably get the length of fixed size fields from the LLVM type.
+    llvm::Value * isNull = args[i].getValue()->getNull();
+    llvm::Value * fieldHash = NULL;
     if (argVal->getType() == b->getInt32Ty()) {
-      llvm::Value * tmpVal = buildEntryBlockAlloca(argVal->getType(), "hash32tmp");
-      b->CreateStore(argVal, tmpVal);
-      callArgs[0] = b->CreateBitCast(tmpVal, argTy);
-      callArgs[1] = b->getInt32(4);
-      callArgs[2] = i==0 ? b->getInt32(4) : previousHash;
-    } else if (argVal->getType() == b->getInt64Ty() ||
-	       argVal->getType() == b->getDoubleTy()) {
-      llvm::Value * tmpVal = buildEntryBlockAlloca(argVal->getType(), "hash64tmp");
-      b->CreateStore(argVal, tmpVal);
-      callArgs[0] = b->CreateBitCast(tmpVal, argTy);
-      callArgs[1] = b->getInt32(8);
-      callArgs[2] = i==0 ? b->getInt32(8) : previousHash;
+      fieldHash = buildHash64Step(h, b->CreateSExt(argVal, b->getInt64Ty()));
+    } else if (argVal->getType() == b->getInt64Ty()) {
+      fieldHash = buildHash64Step(h, argVal);
+    } else if (argVal->getType() == b->getDoubleTy()) {
+      fieldHash = buildHash64Step(h, b->CreateBitCast(argVal, b->getInt64Ty()));
     } else if (args[i].getType()->GetEnum() == FieldType::VARCHAR) {
+      // Don't dereference the varchar of a NULL value.
+      llvm::Value * callArgs[3];
       callArgs[0] = buildVarcharGetPtr(argVal);
       callArgs[1] = buildVarcharGetSize(argVal);
-      callArgs[2] = i==0 ? callArgs[1] : previousHash;
+      if (isNull) {
+	callArgs[1] = b->CreateSelect(isNull, b->getInt32(0), callArgs[1]);
+      }
+      callArgs[2] = h;
+      llvm::Value * fn = llvm::unwrap(LLVMModule)->getFunction("Hash64Bytes");
+      fieldHash = b->CreateCall(fn, llvm::makeArrayRef(&callArgs[0], 3), "hash");
     } else if (isChar(argVal)) {
       // Hash on array length - 1 for CHAR types because of trailing null char and we want
       // consistency with varchar hashing.
@@ -2951,20 +3048,23 @@ const IQLToLLVMValue * CodeGenerationContext::buildHash(const std::vector<IQLToL
       if (args[i].getType()->GetEnum() == FieldType::CHAR) {
 	arrayLen -= 1;
       }
-      callArgs[0] = b->CreateBitCast(argVal, argTy);
-      callArgs[1] = b->getInt32(arrayLen);
-      callArgs[2] = i==0 ? b->getInt32(arrayLen) : previousHash;    
+      fieldHash = buildHash64Bytes(argVal, arrayLen, h);
     } else if (args[i].getType()->GetEnum() == FieldType::BIGDECIMAL) {
-      callArgs[0] = b->CreateBitCast(argVal, argTy);
-      callArgs[1] = b->getInt32(16);
-      callArgs[2] = i==0 ? b->getInt32(16) : previousHash;
+      fieldHash = buildHash64Bytes(argVal, 16, h);
     } else {
       throw std::runtime_error("CodeGenerationContext::buildHash unexpected type");
     }
-    previousHash = b->CreateCall(fn, llvm::makeArrayRef(&callArgs[0], 3), "hash");
+    if (isNull) {
+      h = b->CreateSelect(isNull, 
+			  buildHash64Step(h, b->getInt64(HASH64_NULL)),
+			  fieldHash);
+    } else {
+      h = fieldHash;
+    }
   }
 
-  return IQLToLLVMValue::get(this, previousHash, IQLToLLVMValue::eLocal);
+  h = buildHash64Finish(h);
+  return IQLToLLVMValue::get(this, h, IQLToLLVMValue::eLocal);
 }
 
 // TODO: Handle all types.
@@ -3330,8 +3430,6 @@ const IQLToLLVMValue * CodeGenerationContext::buildDoubleLiteral(const char * va
 
 const IQLToLLVMValue * CodeGenerationContext::buildVarcharLiteral(const char * val)
 {
-  llvm::LLVMContext * c = llvm::unwrap(LLVMContext);
-  llvm::IRBuilder<> * b = llvm::unwrap(LLVMBuilder);
   // Strip off quotes
   // TODO: Proper unquotification
   int32_t len = strlen(val);
@@ -3348,6 +3446,15 @@ const IQLToLLVMValue * CodeGenerationContext::buildVarcharLiteral(const char * v
   boost::replace_all(str, "\\r", "\r");
   boost::replace_all(str, "\\'", "'");
 
+  const IQLToLLVMValue * ret = buildVarcharConstant(str);
+  mVarcharLiterals[ret->getValue()] = str;
+  return ret;
+}
+
+const IQLToLLVMValue * CodeGenerationContext::buildVarcharConstant(const std::string& str)
+{
+  llvm::LLVMContext * c = llvm::unwrap(LLVMContext);
+  llvm::IRBuilder<> * b = llvm::unwrap(LLVMBuilder);
   llvm::Type * int8Ty = b->getInt8Ty();
   if (str.size() < Varchar::MIN_LARGE_STRING_SIZE) {
     // Create type for small varchar
@@ -304,6 +304,25 @@ private:
   // check not during code generation.
   std::map<std::string, std::string> mTreculNameToSymbol;
 
+  // Values of VARCHAR literals in the module.  Lets
+  // operators such as RLIKE specialize on constant arguments.
+  std::map<const llvm::Value *, std::string> mVarcharLiterals;
+
+  /**
+   * Create a VARCHAR constant with the (unescaped) value str.
+   */
+  const IQLToLLVMValue * buildVarcharConstant(const std::string& str);
+
+  /**
+   * RLIKE against a pattern known at compile time.  Trivial patterns
+   * become equality, prefix, suffix or substring tests; others are
+   * compiled once and cached by the runtime context.
+   */
+  IQLToLLVMValue::ValueType buildConstantRLike(llvm::Value * e1, 
+					       llvm::Value * e2,
+					       const std::string& pattern,
+					       llvm::Value * ret);
+
   /**
    * Private Interface to the VARCHAR datatype.
    */
@@ -1006,6 +1025,13 @@ public:
    * Hash a sequence of values
    */
   const IQLToLLVMValue * buildHash(const std::vector<IQLToLLVMTypedValue> & args);
+  /**
+   * Inline versions of Hash64Step, Hash64Finish and Hash64Bytes 
+   * (the latter for byte strings of length known at compile time).
+   */
+  llvm::Value * buildHash64Step(llvm::Value * h, llvm::Value * k);
+  llvm::Value * buildHash64Finish(llvm::Value * h);
+  llvm::Value * buildHash64Bytes(llvm::Value * ptr, int32_t len, llvm::Value * h);
 
   /**
    * Create a poor man's normalized key out of a sequence of sort keys
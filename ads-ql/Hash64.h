@@ -0,0 +1,94 @@
+/**
+ * Copyright (c) 2012, Akamai Technologies
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * 
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ * 
+ *   Neither the name of the Akamai Technologies nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __HASH64_H
+#define __HASH64_H
+
+#include <stdint.h>
+
+/**
+ * 64-bit hash used by the IQL #() operator.  Code generation inlines
+ * Hash64Step and Hash64Finish for fixed size values; these
+ * definitions are the reference that generated code must agree with.
+ * Byte strings are consumed as little endian 64-bit words with the
+ * final partial word zero padded, followed by the length.
+ */
+
+#define HASH64_SEED 0x9e3779b97f4a7c15ULL
+#define HASH64_NULL 0x9ae16a3b2f90404fULL
+
+/**
+ * Identifies the values #() produces.  Bump whenever they change
+ * (seed, mixing or how fields are fed in) so that persisted
+ * hashes such as build_index files are rejected rather than silently
+ * failing to match.
+ */
+#define HASH64_ID 2
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  static inline uint64_t Hash64Rotl(uint64_t x, int32_t r)
+  {
+    return (x << r) | (x >> (64 - r));
+  }
+
+  static inline uint64_t Hash64Step(uint64_t h, uint64_t k)
+  {
+    k *= 0x87c37b91114253d5ULL;
+    k = Hash64Rotl(k, 31);
+    k *= 0x4cf5ad432745937fULL;
+    h ^= k;
+    h = Hash64Rotl(h, 27);
+    return h*5 + 0x52dce729;
+  }
+
+  static inline uint64_t Hash64Finish(uint64_t h)
+  {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+  }
+
+  uint64_t Hash64Bytes(const char * data, int32_t len, uint64_t h);
+  
+#ifdef __cplusplus
+}
+#endif
+
+#endif
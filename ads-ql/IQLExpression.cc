@@ -983,6 +983,43 @@ IQLExpressionRef IQLBuildCast(IQLTreeFactoryRef ctxtRef,
   return wrap(CastExpr::create(ctxt, unwrap(ty), unwrap(arg), SourceLocation(line, column)));
 }
 
+/**
+ * Strip the quotes from a string literal token and decode the
+ * escape sequences the same way the code generator does so that
+ * the AST carries the value the compiled expression will see.
+ */
+static std::string IQLUnquoteString(const char * text)
+{
+  std::size_t l = strlen(text);
+  if (l < 2) {
+    throw std::runtime_error("Internal Error: Invalid text for "
+			     "IQL string literal");
+  }
+  std::string s;
+  s.reserve(l-2);
+  for(const char * c = text+1, * e = text+l-1; c != e; ++c) {
+    if (*c != '\\' || c+1 == e) {
+      s.push_back(*c);
+      continue;
+    }
+    switch(*++c) {
+    case '\\': s.push_back('\\'); break;
+    case 'b': s.push_back('\b'); break;
+    case 't': s.push_back('\t'); break;
+    case 'n': s.push_back('\n'); break;
+    case 'f': s.push_back('\f'); break;
+    case 'r': s.push_back('\r'); break;
+    case '\'': s.push_back('\''); break;
+    default:
+      // Leave anything else as is.
+      s.push_back('\\');
+      s.push_back(*c);
+      break;
+    }
+  }
+  return s;
+}
+
 IQLExpressionRef IQLBuildLiteralCast(IQLTreeFactoryRef ctxtRef,
 				     const char * typeName,
 				     const char * arg,
@@ -993,12 +1030,13 @@ IQLExpressionRef IQLBuildLiteralCast(IQLTreeFactoryRef ctxtRef,
   if (boost::algorithm::iequals("date", typeName)) {
     ty = DateType::Get(ctxt);
   } else if (boost::algorithm::iequals("datetime", typeName)) {
-    ty = DateType::Get(ctxt);
+    ty = DatetimeType::Get(ctxt);
   } else {
     throw std::runtime_error((boost::format("Invalid type: %1%") %
 			      typeName).str());
   }
-  return wrap(CastExpr::create(ctxt, ty, StringExpr::create(ctxt, arg, SourceLocation(line, column)),
+  return wrap(CastExpr::create(ctxt, ty, StringExpr::create(ctxt, IQLUnquoteString(arg).c_str(), 
+						  SourceLocation(line, column)),
 			       SourceLocation(line, column)));
 }
 
@@ -1082,13 +1120,7 @@ IQLExpressionRef IQLBuildString(IQLTreeFactoryRef ctxtRef,
 				int line, int column)
 {
   DynamicRecordContext & ctxt(*unwrap(ctxtRef));
-  int l = strlen(text);
-  if (l < 2) {
-    throw std::runtime_error("Internal Error: Invalid text for "
-			     "IQL string literal");
-  }
-  std::string s(text+1, text+l-2);
-  boost::algorithm::replace_all(s, "''", "'");
+  std::string s = IQLUnquoteString(text);
   return wrap(StringExpr::create(ctxt, s.c_str(), SourceLocation(line, column)));  
 }
 
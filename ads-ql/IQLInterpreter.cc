@@ -33,6 +33,7 @@
  */
 
 #include <cstdlib>
+#include <time.h>
 #include <iostream>
 #include <stdexcept>
 #include <boost/utility.hpp>
@@ -100,32 +101,165 @@ extern "C" void InternalInt64FromDatetime(boost::posix_time::ptime arg,
 					  InterpreterContext * ctxt);
 
 
-InterpreterContext::InterpreterContext() {
+InterpreterContext::InterpreterContext() 
+  :
+  mArenaCurrent(0),
+  mArenaPtr(NULL),
+  mArenaEnd(NULL)
+{
   decContextDefault(&mDecimalContext, DEC_INIT_DECIMAL128);
 }
 
 InterpreterContext::~InterpreterContext() {
   clear();
+  for(std::vector<char *>::iterator it = mArenaBlocks.begin();
+      it != mArenaBlocks.end();
+      ++it) {
+    ::free(*it);
+  }
 }
 
-void * InterpreterContext::malloc(size_t sz) {
-  void * tmp = ::malloc(sz);
-  mToFree.insert(tmp);
+void * InterpreterContext::mallocSlow(size_t sz) {
+  if (sz > ARENA_BLOCK_SIZE/4) {
+    void * tmp = ::malloc(sz);
+    mOversized.push_back(tmp);
+    return tmp;
+  }
+  // Move on to the next block, allocating one if we have run out.
+  // The first time through there is no current block.
+  std::size_t next = mArenaPtr == NULL ? 0 : mArenaCurrent + 1;
+  if (next == mArenaBlocks.size()) {
+    mArenaBlocks.push_back((char *) ::malloc(ARENA_BLOCK_SIZE));
+  }
+  mArenaCurrent = next;
+  mArenaPtr = mArenaBlocks[next];
+  mArenaEnd = mArenaPtr + ARENA_BLOCK_SIZE;
+  void * tmp = mArenaPtr;
+  mArenaPtr += sz;
   return tmp;
 }
 
-void InterpreterContext::erase(void * ptr) {
-  mToFree.erase(ptr);
+bool InterpreterContext::isArenaOwned(const void * ptr) const {
+  const char * p = (const char *) ptr;
+  for(std::size_t i=0; i<mArenaBlocks.size() && i<=mArenaCurrent; ++i) {
+    if (p >= mArenaBlocks[i] && p < mArenaBlocks[i] + ARENA_BLOCK_SIZE) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void * InterpreterContext::escape(void * ptr, size_t sz) {
+  // Oversized allocations are already on the heap; just
+  // stop tracking them.
+  for(std::vector<void *>::reverse_iterator it = mOversized.rbegin();
+      it != mOversized.rend();
+      ++it) {
+    if (*it == ptr) {
+      mOversized.erase(--it.base());
+      return ptr;
+    }
+  }
+  if (!isArenaOwned(ptr)) {
+    return ptr;
+  }
+  void * tmp = ::malloc(sz);
+  ::memcpy(tmp, ptr, sz);
+  return tmp;
 }
 
 void InterpreterContext::clear() {
-  for(std::set<void *>::iterator it = mToFree.begin();
-      it != mToFree.end();
+  for(std::vector<void *>::iterator it = mOversized.begin();
+      it != mOversized.end();
       ++it) {
-    void * ptr = *it;
-    ::free(ptr);
+    ::free(*it);
+  }
+  mOversized.clear();
+  // Don't hold on to memory from an unusually greedy call.
+  while(mArenaBlocks.size() > ARENA_MAX_RETAINED_BLOCKS) {
+    ::free(mArenaBlocks.back());
+    mArenaBlocks.pop_back();
+  }
+  mArenaCurrent = 0;
+  if (mArenaBlocks.size()) {
+    mArenaPtr = mArenaBlocks[0];
+    mArenaEnd = mArenaPtr + ARENA_BLOCK_SIZE;
+  } 
+}
+
+IQLCompileStatistics::IQLCompileStatistics()
+  :
+  mEnabled(false)
+{
+  clear();
+}
+
+IQLCompileStatistics & IQLCompileStatistics::get()
+{
+  static IQLCompileStatistics stats;
+  return stats;
+}
+
+const char * IQLCompileStatistics::getPhaseName(Phase phase)
+{
+  static const char * names[NUM_PHASES] = {
+    "parse", "typeCheck", "llvmInit", "codeGen", "optimize", "jit"
+  };
+  return names[phase];
+}
+
+uint64_t IQLCompileStatistics::now()
+{
+  struct timespec ts;
+  ::clock_gettime(CLOCK_MONOTONIC, &ts);
+  return 1000000000ULL*ts.tv_sec + ts.tv_nsec;
+}
+
+void IQLCompileStatistics::clear()
+{
+  for(int i=0; i<NUM_PHASES; ++i) {
+    mNanos[i] = 0;
+  }
+  mCompilations = 0;
+}
+
+void IQLCompileStatistics::add(Phase phase, uint64_t nanos)
+{
+  __sync_fetch_and_add(&mNanos[phase], nanos);
+}
+
+void IQLCompileStatistics::addCompilation()
+{
+  __sync_fetch_and_add(&mCompilations, 1);
+}
+
+IQLCompilePhaseTimer::IQLCompilePhaseTimer(IQLCompileStatistics::Phase phase)
+  :
+  mEnabled(IQLCompileStatistics::get().isEnabled()),
+  mPhase(phase),
+  mStart(0)
+{
+  if (mEnabled) {
+    IQLCompileStatistics::get().addCompilation();
+    mStart = IQLCompileStatistics::now();
+  }
+}
+
+IQLCompilePhaseTimer::~IQLCompilePhaseTimer()
+{
+  if (mEnabled) {
+    IQLCompileStatistics::get().add(mPhase, IQLCompileStatistics::now() - mStart);
   }
-  mToFree.clear();
+}
+
+void IQLCompilePhaseTimer::next(IQLCompileStatistics::Phase phase)
+{
+  if (mEnabled) {
+    uint64_t t = IQLCompileStatistics::now();
+    IQLCompileStatistics::get().add(mPhase, t - mStart);
+    mStart = t;
+  }
+  mPhase = phase;
 }
 
 bool InterpreterContext::regex_match(const char* regex_source_c, const char* string) {
@@ -147,6 +281,81 @@ bool InterpreterContext::regex_match(const char* regex_source_c, const char* str
   return boost::regex_match(string, regex);
 }
 
+bool InterpreterContext::regex_match_constant(const char* regex_source_c, const char* string) {
+  constant_regex_cache_type::iterator it = 
+    mConstantRegexCache.find(regex_source_c, ConstantRegexHash(), 
+			     ConstantRegexEqual());
+  if (it == mConstantRegexCache.end()) {
+    it = mConstantRegexCache.insert(std::make_pair(std::string(regex_source_c), 
+						   boost::regex(regex_source_c))).first;
+  }
+  return boost::regex_match(string, it->second);
+}
+
+RLikePattern::Kind RLikePattern::analyze(const std::string& pattern, 
+					 std::string& literal)
+{
+  literal.clear();
+  std::size_t begin = 0;
+  std::size_t end = pattern.size();
+  // RLIKE always matches the whole string so anchors are redundant.
+  if (begin < end && pattern[begin] == '^') {
+    begin += 1;
+  }
+  if (begin < end && pattern[end-1] == '$') {
+    // Make sure the $ isn't escaped.
+    std::size_t slashes = 0;
+    while(end-1-slashes > begin && pattern[end-2-slashes] == '\\') {
+      slashes += 1;
+    }
+    if (0 == slashes % 2) {
+      end -= 1;
+    }
+  }
+  bool leadingAny = false;
+  bool trailingAny = false;
+  if (end - begin >= 2 && pattern.compare(begin, 2, ".*") == 0) {
+    leadingAny = true;
+    begin += 2;
+  }
+  if (end - begin >= 2 && pattern.compare(end-2, 2, ".*") == 0) {
+    std::size_t slashes = 0;
+    while(end-2-slashes > begin && pattern[end-3-slashes] == '\\') {
+      slashes += 1;
+    }
+    if (0 == slashes % 2) {
+      trailingAny = true;
+      end -= 2;
+    }
+  }
+  for(std::size_t i=begin; i<end; ++i) {
+    char c = pattern[i];
+    if (c == '\\') {
+      // An escaped punctuation character stands for itself; 
+      // anything else (\d, \w, \n, word and buffer boundaries...) 
+      // is left to the regex engine.
+      if (i+1 == end || isalnum(pattern[i+1]) || 
+	  strchr("<>`'", pattern[i+1]) != NULL) {
+	return REGEX;
+      }
+      literal.push_back(pattern[++i]);
+    } else if (strchr(".[]{}()*+?|^$", c) != NULL) {
+      return REGEX;
+    } else {
+      literal.push_back(c);
+    }
+  }
+  if (leadingAny && trailingAny) {
+    return CONTAINS;
+  } else if (leadingAny) {
+    return SUFFIX;
+  } else if (trailingAny) {
+    return PREFIX;
+  } else {
+    return EQUALS;
+  }
+}
+
 char * Varchar::allocateLarge(int32_t len, 
 			      InterpreterContext * ctxt)
 {
@@ -524,9 +733,11 @@ extern "C" void InternalVarcharCopy(Varchar * lhs, Varchar * result, int32_t tra
 }
 
 extern "C" void InternalVarcharErase(Varchar * lhs, InterpreterContext * ctxt) {
-  // Remove varchar pointer from internal heap tracking
+  // The varchar is being moved into a record; take it out of the
+  // temporary arena so that it survives the end of the call.
   if (lhs->Large.Large) {
-    ctxt->erase(const_cast<char *>(lhs->Large.Ptr));
+    lhs->Large.Ptr = (char *) ctxt->escape(const_cast<char *>(lhs->Large.Ptr),
+					   lhs->Large.Size + 1);
   }
 }
 
@@ -574,6 +785,24 @@ extern "C" int32_t InternalVarcharRLike(Varchar* lhs, Varchar* rhs, InterpreterC
   return ctxt->regex_match(rhs->c_str(), lhs->c_str());
 }
 
+extern "C" int32_t InternalVarcharRLikeConstant(Varchar* lhs, Varchar* rhs, InterpreterContext * ctxt) {
+  return ctxt->regex_match_constant(rhs->c_str(), lhs->c_str());
+}
+
+extern "C" int32_t InternalVarcharStartsWith(Varchar* lhs, Varchar* rhs, InterpreterContext * ctxt) {
+  return lhs->size() >= rhs->size() &&
+    0 == memcmp(lhs->c_str(), rhs->c_str(), rhs->size());
+}
+
+extern "C" int32_t InternalVarcharEndsWith(Varchar* lhs, Varchar* rhs, InterpreterContext * ctxt) {
+  return lhs->size() >= rhs->size() &&
+    0 == memcmp(lhs->c_str() + lhs->size() - rhs->size(), rhs->c_str(), rhs->size());
+}
+
+extern "C" int32_t InternalVarcharContains(Varchar* lhs, Varchar* rhs, InterpreterContext * ctxt) {
+  return NULL != strstr(lhs->c_str(), rhs->c_str());
+}
+
 /**
  * convert a hex char to its nibble value.
  * return 127 if not valid hex char.
@@ -1523,6 +1752,34 @@ void LLVMBase::InitializeLLVM()
   funTy = LLVMFunctionType(LLVMInt32TypeInContext(mContext->LLVMContext), &argumentTypes[0], numArguments, 0);
   libFunVal = ::LoadAndValidateExternalFunction(*this, "InternalVarcharRLike", funTy);
 
+  numArguments = 0;
+  argumentTypes[numArguments++] = LLVMPointerType(mContext->LLVMVarcharType, 0);
+  argumentTypes[numArguments++] = LLVMPointerType(mContext->LLVMVarcharType, 0);
+  argumentTypes[numArguments++] = mContext->LLVMDecContextPtrType;
+  funTy = LLVMFunctionType(LLVMInt32TypeInContext(mContext->LLVMContext), &argumentTypes[0], numArguments, 0);
+  libFunVal = ::LoadAndValidateExternalFunction(*this, "InternalVarcharRLikeConstant", funTy);
+
+  numArguments = 0;
+  argumentTypes[numArguments++] = LLVMPointerType(mContext->LLVMVarcharType, 0);
+  argumentTypes[numArguments++] = LLVMPointerType(mContext->LLVMVarcharType, 0);
+  argumentTypes[numArguments++] = mContext->LLVMDecContextPtrType;
+  funTy = LLVMFunctionType(LLVMInt32TypeInContext(mContext->LLVMContext), &argumentTypes[0], numArguments, 0);
+  libFunVal = ::LoadAndValidateExternalFunction(*this, "InternalVarcharStartsWith", funTy);
+
+  numArguments = 0;
+  argumentTypes[numArguments++] = LLVMPointerType(mContext->LLVMVarcharType, 0);
+  argumentTypes[numArguments++] = LLVMPointerType(mContext->LLVMVarcharType, 0);
+  argumentTypes[numArguments++] = mContext->LLVMDecContextPtrType;
+  funTy = LLVMFunctionType(LLVMInt32TypeInContext(mContext->LLVMContext), &argumentTypes[0], numArguments, 0);
+  libFunVal = ::LoadAndValidateExternalFunction(*this, "InternalVarcharEndsWith", funTy);
+
+  numArguments = 0;
+  argumentTypes[numArguments++] = LLVMPointerType(mContext->LLVMVarcharType, 0);
+  argumentTypes[numArguments++] = LLVMPointerType(mContext->LLVMVarcharType, 0);
+  argumentTypes[numArguments++] = mContext->LLVMDecContextPtrType;
+  funTy = LLVMFunctionType(LLVMInt32TypeInContext(mContext->LLVMContext), &argumentTypes[0], numArguments, 0);
+  libFunVal = ::LoadAndValidateExternalFunction(*this, "InternalVarcharContains", funTy);
+
   numArguments = 0;
   argumentTypes[numArguments++] = LLVMPointerType(mContext->LLVMVarcharType, 0);
   argumentTypes[numArguments++] = LLVMPointerType(mContext->LLVMVarcharType, 0);
@@ -2027,9 +2284,9 @@ void LLVMBase::InitializeLLVM()
   numArguments = 0;
   argumentTypes[numArguments++] = LLVMPointerType(LLVMInt8TypeInContext(mContext->LLVMContext), 0);
   argumentTypes[numArguments++] = LLVMInt32TypeInContext(mContext->LLVMContext);
-  argumentTypes[numArguments++] = LLVMInt32TypeInContext(mContext->LLVMContext);
-  funTy = LLVMFunctionType(LLVMInt32TypeInContext(mContext->LLVMContext), &argumentTypes[0], numArguments, 0);
-  libFunVal = ::LoadAndValidateExternalFunction(*this, "SuperFastHash", funTy);
+  argumentTypes[numArguments++] = LLVMInt64TypeInContext(mContext->LLVMContext);
+  funTy = LLVMFunctionType(LLVMInt64TypeInContext(mContext->LLVMContext), &argumentTypes[0], numArguments, 0);
+  libFunVal = ::LoadAndValidateExternalFunction(*this, "Hash64Bytes", funTy);
 
   numArguments = 0;
   argumentTypes[numArguments++] = LLVMDoubleTypeInContext(mContext->LLVMContext);
@@ -2695,12 +2952,15 @@ RecordTypeTransfer::RecordTypeTransfer(DynamicRecordContext& recCtxt, const std:
   mImpl(NULL),
   mIsIdentity(false)
 {
+  IQLCompilePhaseTimer timer(IQLCompileStatistics::PARSE);
   IQLParserStuff p;
   const TypeCheckConfiguration & typeCheckConfig(TypeCheckConfiguration::get());
   p.parseTransfer(transfer);
+  timer.next(IQLCompileStatistics::TYPE_CHECK);
   mTarget = p.typeCheckTransfer(typeCheckConfig, recCtxt, source);
 
   // Create a valid code generation context based on the input and output record formats.
+  timer.next(IQLCompileStatistics::LLVM_INIT);
   InitializeLLVM();
 
   std::vector<std::string> argumentNames;
@@ -2724,6 +2984,7 @@ RecordTypeTransfer::RecordTypeTransfer(DynamicRecordContext& recCtxt, const std:
     // Set state about whether we want move or copy semantics
     mContext->IQLMoveSemantics = i;
     // Code generate
+    timer.next(IQLCompileStatistics::CODE_GEN);
     ANTLR3AutoPtr<IQLToLLVM> toLLVM(IQLToLLVMNew(p.getNodes()));  
     toLLVM->recordConstructor(toLLVM.get(), wrap(mContext));
     LLVMBuildRetVoid(mContext->LLVMBuilder);
@@ -2735,12 +2996,15 @@ RecordTypeTransfer::RecordTypeTransfer(DynamicRecordContext& recCtxt, const std:
     llvm::verifyFunction(*llvm::unwrap<llvm::Function>(mContext->LLVMFunction));
     // llvm::outs() << "We just constructed this LLVM module:\n\n" << *llvm::unwrap(mContext->LLVMModule);
     // // Now run optimizer over the IR
+    timer.next(IQLCompileStatistics::OPTIMIZE);
     mFPM->run(*llvm::unwrap<llvm::Function>(mContext->LLVMFunction));
     // llvm::outs() << "We just optimized this LLVM module:\n\n" << *llvm::unwrap(mContext->LLVMModule);
     // llvm::outs() << "\n\nRunning foo: ";
     // llvm::outs().flush();
   }
 
+  // Bitcode round trip and machine code generation are charged to the JIT
+  timer.next(IQLCompileStatistics::JIT);
   // Save the built module as bitcode
   llvm::raw_string_ostream writer(mBitcode);
   llvm::WriteBitcodeToFile(llvm::unwrap(mContext->LLVMModule), writer);
@@ -2824,7 +3088,8 @@ void IQLTransferModule::execute(RecordBuffer & source, RecordBuffer & target, cl
 {
   BOOST_ASSERT(target == RecordBuffer());
   target = mMalloc.malloc();
-  if (isSourceMove) {
+  // Moving would modify the source; not allowed if it is shared.
+  if (isSourceMove && !RecordBuffer::isShared(source)) {
     (*mMoveFunction)((char *) source.Ptr, (char *) target.Ptr, ctxt);  
   } else {
     (*mCopyFunction)((char *) source.Ptr, (char *) target.Ptr, ctxt);  
@@ -3024,12 +3289,16 @@ void IQLTransferModule2::execute(RecordBuffer * sources,
 }
 
 IQLUpdateModule::IQLUpdateModule(const std::string& funName, 
-				 const std::string& bitcode)
+				 const std::string& bitcode,
+				 IQLTransferModule * sourceCopy,
+				 IQLTransferModule * targetCopy)
   :
   mFunName(funName),
   mBitcode(bitcode),
   mFunction(NULL),
-  mImpl(NULL)
+  mImpl(NULL),
+  mSourceCopy(sourceCopy),
+  mTargetCopy(targetCopy)
 {
   initImpl();
 }
@@ -3037,6 +3306,8 @@ IQLUpdateModule::IQLUpdateModule(const std::string& funName,
 IQLUpdateModule::~IQLUpdateModule()
 {
   delete mImpl;
+  delete mSourceCopy;
+  delete mTargetCopy;
 }
 
 void IQLUpdateModule::initImpl()
@@ -3049,10 +3320,30 @@ void IQLUpdateModule::initImpl()
   mFunction = (LLVMFuncType) mImpl->getFunPtr(funNames[0]);
 }
 
-void IQLUpdateModule::execute(RecordBuffer & source, RecordBuffer target, class InterpreterContext * ctxt) const
+static void copyIfShared(const IQLTransferModule * copy, RecordBuffer & buf, 
+			 class InterpreterContext * ctxt)
+{
+  if (copy == NULL || buf.Ptr == NULL || !RecordBuffer::isShared(buf))
+    return;
+  RecordBuffer tmp;
+  copy->execute(buf, tmp, ctxt, false);
+  // Other references keep the original alive.
+  RecordBuffer::release(buf);
+  buf = tmp;
+}
+
+void IQLUpdateModule::execute(RecordBuffer & source, RecordBuffer & target, class InterpreterContext * ctxt) const
 {
-    (*mFunction)((char *) source.Ptr, (char *) target.Ptr, ctxt);    
-    ctxt->clear();
+  copyIfShared(mTargetCopy, target, ctxt);
+  (*mFunction)((char *) source.Ptr, (char *) target.Ptr, ctxt);    
+  ctxt->clear();
+}
+
+void IQLUpdateModule::execute(RecordBuffer & source, class InterpreterContext * ctxt) const
+{
+  copyIfShared(mSourceCopy, source, ctxt);
+  (*mFunction)((char *) source.Ptr, NULL, ctxt);    
+  ctxt->clear();
 }
 
 RecordTypeInPlaceUpdate::RecordTypeInPlaceUpdate(class DynamicRecordContext& recCtxt, 
@@ -3060,7 +3351,9 @@ RecordTypeInPlaceUpdate::RecordTypeInPlaceUpdate(class DynamicRecordContext& rec
 						 const std::vector<const RecordType *>& sources, 
 						 const std::string& statements)
   :
-  mImpl(NULL)
+  mImpl(NULL),
+  mSourceCopy(NULL),
+  mTargetCopy(NULL)
 {
   // By default include all fields in all sources.
   std::vector<boost::dynamic_bitset<> > masks;
@@ -3077,7 +3370,9 @@ RecordTypeInPlaceUpdate::RecordTypeInPlaceUpdate(class DynamicRecordContext& rec
 						 const std::vector<boost::dynamic_bitset<> >& masks,
 						 const std::string& statements)
   :
-  mImpl(NULL)
+  mImpl(NULL),
+  mSourceCopy(NULL),
+  mTargetCopy(NULL)
 {
   init(recCtxt, funName, sources, masks, statements);
 }
@@ -3085,6 +3380,8 @@ RecordTypeInPlaceUpdate::RecordTypeInPlaceUpdate(class DynamicRecordContext& rec
 RecordTypeInPlaceUpdate::~RecordTypeInPlaceUpdate()
 {
   delete mImpl;
+  delete mSourceCopy;
+  delete mTargetCopy;
 }
 
 void RecordTypeInPlaceUpdate::init(class DynamicRecordContext& recCtxt, 
@@ -3134,23 +3431,56 @@ void RecordTypeInPlaceUpdate::init(class DynamicRecordContext& recCtxt,
   funNames.push_back(mFunName);
   mImpl = new IQLRecordBufferMethodHandle(mBitcode, funNames);
   mUpdateFunction = (LLVMFuncType) mImpl->getFunPtr(mFunName);
+
+  // Shared records are immutable so we update a copy of them.
+  if (mSources.size() > 0 && mSources[0]->size() > 0) {
+    mSourceCopy = new RecordTypeTransfer(recCtxt, mFunName + "$sourceCopy", 
+					 mSources[0], "input.*");
+  }
+  if (mSources.size() > 1 && mSources[1]->size() > 0) {
+    mTargetCopy = new RecordTypeTransfer(recCtxt, mFunName + "$targetCopy", 
+					 mSources[1], "input.*");
+  }
+}
+
+static void copyIfShared(const RecordTypeTransfer * copy, RecordBuffer & buf, 
+			 class InterpreterContext * ctxt)
+{
+  if (copy == NULL || buf.Ptr == NULL || !RecordBuffer::isShared(buf))
+    return;
+  RecordBuffer tmp = copy->getTarget()->getMalloc().malloc();
+  copy->execute(buf, tmp, ctxt, false);
+  // Other references keep the original alive.
+  RecordBuffer::release(buf);
+  buf = tmp;
 }
 
-void RecordTypeInPlaceUpdate::execute(RecordBuffer & source, RecordBuffer target, class InterpreterContext * ctxt) const
+void RecordTypeInPlaceUpdate::execute(RecordBuffer & source, RecordBuffer & target, class InterpreterContext * ctxt) const
 {
-    (*mUpdateFunction)((char *) source.Ptr, (char *) target.Ptr, ctxt);    
+  copyIfShared(mTargetCopy, target, ctxt);
+  (*mUpdateFunction)((char *) source.Ptr, (char *) target.Ptr, ctxt);    
+}
+
+void RecordTypeInPlaceUpdate::execute(RecordBuffer & source, class InterpreterContext * ctxt) const
+{
+  copyIfShared(mSourceCopy, source, ctxt);
+  (*mUpdateFunction)((char *) source.Ptr, NULL, ctxt);    
 }
 
 IQLUpdateModule * RecordTypeInPlaceUpdate::create() const
 {
-  return new IQLUpdateModule(mFunName, mBitcode);
+  return new IQLUpdateModule(mFunName, mBitcode,
+			     mSourceCopy ? mSourceCopy->create() : NULL,
+			     mTargetCopy ? mTargetCopy->create() : NULL);
 }
 
 IQLFunctionModule::IQLFunctionModule(const std::string& funName, 
-				     const std::string& bitcode)
+				     const std::string& bitcode,
+				     bool isInt64)
   :
   mFunName(funName),
   mBitcode(bitcode),
+  mIsInt64(isInt64),
   mFunction(NULL),
   mImpl(NULL)
 {
@@ -3172,12 +3502,40 @@ void IQLFunctionModule::initImpl()
 
 int32_t IQLFunctionModule::execute(RecordBuffer sourceA, RecordBuffer sourceB, class InterpreterContext * ctxt) const
 {
+  if (mIsInt64) {
+    return (int32_t) execute64(sourceA, sourceB, ctxt);
+  }
   int32_t ret;
   (*mFunction)((char *) sourceA.Ptr, (char *) sourceB.Ptr, &ret, ctxt);    
   ctxt->clear();
   return ret;
 }
 
+int64_t IQLFunctionModule::execute64(RecordBuffer sourceA, RecordBuffer sourceB, class InterpreterContext * ctxt) const
+{
+  if (!mIsInt64) {
+    return execute(sourceA, sourceB, ctxt);
+  }
+  int64_t ret;
+  (*((LLVMFunc64Type) mFunction))((char *) sourceA.Ptr, (char *) sourceB.Ptr, &ret, ctxt);    
+  ctxt->clear();
+  return ret;
+}
+
+IQLFunctionModule::LLVMFuncType IQLFunctionModule::getRawFunction () const
+{
+  if (mIsInt64) 
+    throw std::runtime_error((boost::format("Function %1% returns BIGINT not INTEGER") % mFunName).str());
+  return mFunction;
+}
+
+IQLFunctionModule::LLVMFunc64Type IQLFunctionModule::getRawFunction64 () const
+{
+  if (!mIsInt64) 
+    throw std::runtime_error((boost::format("Function %1% returns INTEGER not BIGINT") % mFunName).str());
+  return (LLVMFunc64Type) mFunction;
+}
+
 IQLExpression * RecordTypeFunction::getAST(class DynamicRecordContext& recCtxt,
 						  const std::string& f)
 {
@@ -3193,6 +3551,7 @@ RecordTypeFunction::RecordTypeFunction(class DynamicRecordContext& recCtxt,
   :
   mFunName(funName),
   mStatements(statements),
+  mIsInt64(false),
   mFunction(NULL),
   mImpl(NULL)
 {
@@ -3215,6 +3574,7 @@ RecordTypeFunction::RecordTypeFunction(class DynamicRecordContext& recCtxt,
   mSources(sources),
   mFunName(funName),
   mStatements(statements),
+  mIsInt64(false),
   mFunction(NULL),
   mImpl(NULL)
 {
@@ -3232,6 +3592,7 @@ void RecordTypeFunction::init(DynamicRecordContext& recCtxt)
   if (mSources.size() != 2)
     throw std::runtime_error("RecordTypeFunction requires 2 source record types (the second may be empty)");
 
+  IQLCompilePhaseTimer timer(IQLCompileStatistics::PARSE);
   // Feed from an in place stream
   ANTLR3AutoPtr<ANTLR3_INPUT_STREAM> input(antlr3NewAsciiStringInPlaceStream((pANTLR3_UINT8) mStatements.c_str(),
 									     mStatements.size(), 
@@ -3261,6 +3622,7 @@ void RecordTypeFunction::init(DynamicRecordContext& recCtxt)
   // input record with a name and then inserting all the members of the record type
   // with a symbol table.
   // TODO: check for name ambiguity and resolve.
+  timer.next(IQLCompileStatistics::TYPE_CHECK);
   TypeCheckContext typeCheckContext(TypeCheckConfiguration::get(), recCtxt, mSources);
 
   ANTLR3AutoPtr<ANTLR3_COMMON_TREE_NODE_STREAM> nodes(antlr3CommonTreeNodeStreamNewTree(parserRet.tree, ANTLR3_SIZE_HINT));
@@ -3272,16 +3634,23 @@ void RecordTypeFunction::init(DynamicRecordContext& recCtxt)
     throw std::runtime_error("Type check failed");
 
   // There should be a present for us now...
-  if (unwrap(retTy)->clone(true) != Int32Type::Get(recCtxt, true))
-    throw std::runtime_error("Only supporting int32_t return type on functions right now");
+  if (unwrap(retTy)->clone(true) == Int64Type::Get(recCtxt, true)) {
+    mIsInt64 = true;
+  } else if (unwrap(retTy)->clone(true) != Int32Type::Get(recCtxt, true)) {
+    throw std::runtime_error("Only supporting int32_t and int64_t return types on functions right now");
+  }
 
+  timer.next(IQLCompileStatistics::LLVM_INIT);
   InitializeLLVM();
 
   // Setup LLVM access to our external structure(s).  
   std::vector<std::string> argumentNames;
   for(std::size_t i=0; i<mSources.size(); i++)
     argumentNames.push_back((boost::format("__BasePointer%1%__") % i).str());
-  ConstructFunction(mFunName, argumentNames, llvm::unwrap(LLVMInt32TypeInContext(mContext->LLVMContext)));
+  ConstructFunction(mFunName, argumentNames, 
+		    mIsInt64 ?
+		    llvm::unwrap(LLVMInt64TypeInContext(mContext->LLVMContext)) :
+		    llvm::unwrap(LLVMInt32TypeInContext(mContext->LLVMContext)));
 
   // Inject the members of the input struct into the symbol table.
   // For the moment just make sure we don't have any ambiguous references
@@ -3298,6 +3667,7 @@ void RecordTypeFunction::init(DynamicRecordContext& recCtxt)
   mContext->IQLOutputRecord = NULL;
   mContext->IQLMoveSemantics = 0;
 
+  timer.next(IQLCompileStatistics::CODE_GEN);
   ANTLR3AutoPtr<IQLToLLVM> toLLVM(IQLToLLVMNew(nodes.get()));  
   toLLVM->singleExpression(toLLVM.get(), wrap(mContext));
   LLVMBuildRetVoid(mContext->LLVMBuilder);
@@ -3305,11 +3675,14 @@ void RecordTypeFunction::init(DynamicRecordContext& recCtxt)
   llvm::verifyFunction(*llvm::unwrap<llvm::Function>(mContext->LLVMFunction));
   // llvm::outs() << "We just constructed this LLVM module:\n\n" << *llvm::unwrap(mContext->LLVMModule);
   // Now run optimizer over the IR
+  timer.next(IQLCompileStatistics::OPTIMIZE);
   mFPM->run(*llvm::unwrap<llvm::Function>(mContext->LLVMFunction));
   // llvm::outs() << "We just optimized this LLVM module:\n\n" << *llvm::unwrap(mContext->LLVMModule);
   // llvm::outs() << "\n\nRunning foo: ";
   // llvm::outs().flush();
 
+  // Bitcode round trip and machine code generation are charged to the JIT
+  timer.next(IQLCompileStatistics::JIT);
   // Save the built module as bitcode
   llvm::raw_string_ostream writer(mBitcode);
   llvm::WriteBitcodeToFile(llvm::unwrap(mContext->LLVMModule), writer);
@@ -3325,14 +3698,41 @@ void RecordTypeFunction::init(DynamicRecordContext& recCtxt)
 
 int32_t RecordTypeFunction::execute(RecordBuffer source, RecordBuffer target, class InterpreterContext * ctxt) const
 {
+  if (mIsInt64) {
+    return (int32_t) execute64(source, target, ctxt);
+  }
   int32_t ret;
   (*mFunction)((char *) source.Ptr, (char *) target.Ptr, &ret, ctxt);    
   return ret;
 }
 
+int64_t RecordTypeFunction::execute64(RecordBuffer source, RecordBuffer target, class InterpreterContext * ctxt) const
+{
+  if (!mIsInt64) {
+    return execute(source, target, ctxt);
+  }
+  int64_t ret;
+  (*((LLVMFunc64Type) mFunction))((char *) source.Ptr, (char *) target.Ptr, &ret, ctxt);    
+  return ret;
+}
+
+RecordTypeFunction::LLVMFuncType RecordTypeFunction::getRawFunction () const
+{
+  if (mIsInt64) 
+    throw std::runtime_error((boost::format("Function %1% returns BIGINT not INTEGER") % mFunName).str());
+  return mFunction;
+}
+
+RecordTypeFunction::LLVMFunc64Type RecordTypeFunction::getRawFunction64 () const
+{
+  if (!mIsInt64) 
+    throw std::runtime_error((boost::format("Function %1% returns INTEGER not BIGINT") % mFunName).str());
+  return (LLVMFunc64Type) mFunction;
+}
+
 IQLFunctionModule * RecordTypeFunction::create() const
 {
-  return new IQLFunctionModule(mFunName, mBitcode);
+  return new IQLFunctionModule(mFunName, mBitcode, mIsInt64);
 }
 
 
@@ -35,6 +35,7 @@
 #if !defined(__IQLINTERPRETER_HH)
 #define __IQLINTERPRETER_HH
 
+#include <cstring>
 #include <string>
 #include <vector>
 #include <set>
@@ -44,6 +45,8 @@
 #include <boost/serialization/string.hpp>
 #include <boost/serialization/vector.hpp>
 #include <boost/regex.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/functional/hash.hpp>
 
 // decNumber
 extern "C" {
@@ -73,21 +76,155 @@ namespace llvm {
 class InterpreterContext {
 private:
   decContext mDecimalContext;
-  std::set<void *> mToFree;
+
+  // Temporaries created while evaluating an expression are bump
+  // allocated out of a list of blocks that is reset by clear().
+  // Blocks are kept across calls so that steady state evaluation
+  // does no heap allocation.  Requests too big to share a block
+  // get their own heap allocation.
+  static const std::size_t ARENA_BLOCK_SIZE = 64*1024;
+  static const std::size_t ARENA_MAX_RETAINED_BLOCKS = 16;
+  std::vector<char *> mArenaBlocks;
+  std::size_t mArenaCurrent;
+  char * mArenaPtr;
+  char * mArenaEnd;
+  std::vector<void *> mOversized;
+
+  bool isArenaOwned(const void * ptr) const;
 
   typedef std::map<std::string, boost::regex> regex_cache_type;
   static const size_t MAX_REGEX_CACHE = 20;
   regex_cache_type mRegexCache; 
+  // Compiled constant patterns keyed by pattern text.  The hash and
+  // equality also accept a const char * so that lookups don't build
+  // a std::string per call.
+  struct ConstantRegexHash
+  {
+    std::size_t operator()(const char * s) const
+    {
+      return boost::hash_range(s, s + ::strlen(s));
+    }
+    std::size_t operator()(const std::string & s) const
+    {
+      return boost::hash_range(s.begin(), s.end());
+    }
+  };
+  struct ConstantRegexEqual
+  {
+    bool operator()(const char * lhs, const std::string & rhs) const
+    {
+      return rhs == lhs;
+    }
+    bool operator()(const std::string & lhs, const std::string & rhs) const
+    {
+      return lhs == rhs;
+    }
+  };
+  typedef boost::unordered_map<std::string, boost::regex, 
+			       ConstantRegexHash, ConstantRegexEqual> constant_regex_cache_type;
+  constant_regex_cache_type mConstantRegexCache;
 public:
   InterpreterContext();
   ~InterpreterContext();
   decContext * getDecimalContext() {
     return &mDecimalContext;
   }
-  void * malloc(size_t sz);
-  void erase(void * ptr);
+  /**
+   * Allocate temporary memory that lives until the next call to clear().
+   */
+  void * malloc(size_t sz)
+  {
+    sz = (sz + 7) & ~((size_t) 7);
+    if (sz <= (size_t) (mArenaEnd - mArenaPtr)) {
+      void * tmp = mArenaPtr;
+      mArenaPtr += sz;
+      return tmp;
+    }
+    return mallocSlow(sz);
+  }
+  void * mallocSlow(size_t sz);
+  /**
+   * A temporary of size sz is being moved into a record and must
+   * survive clear().  Returns a pointer to memory that the caller 
+   * now owns and must release with ::free.  Pointers not allocated
+   * by this context are returned unchanged.
+   */
+  void * escape(void * ptr, size_t sz);
+  /**
+   * Release all temporaries.
+   */
   void clear();
   bool regex_match(const char* regex, const char* string);
+  /**
+   * Match against a pattern that is a literal in generated code.  The
+   * pattern is compiled on first use and never evicted; the cache is
+   * keyed by pattern text so it stays bounded by the number of
+   * distinct literals and is safe across modules sharing a context.
+   */
+  bool regex_match_constant(const char* regex, const char* string);
+};
+
+/**
+ * Classifies RLIKE patterns that are string literals.  Patterns
+ * that are nothing more than a literal string, optionally preceded
+ * and/or followed by .*, can be matched with an equality, prefix,
+ * suffix or substring test rather than by the regex engine.
+ */
+class RLikePattern
+{
+public:
+  enum Kind { EQUALS, PREFIX, SUFFIX, CONTAINS, REGEX };
+  /**
+   * Return the kind of matcher required by pattern and for all kinds
+   * other than REGEX put the string to test against in literal.
+   */
+  static Kind analyze(const std::string& pattern, std::string& literal);
+};
+
+/**
+ * Cumulative wall clock time spent in each phase of IQL compilation.
+ * Collection is off by default; when enabled every RecordTypeTransfer
+ * and RecordTypeFunction constructed in the process adds its phase
+ * timings here.  Counters are updated atomically so compilation may
+ * happen on multiple threads.
+ */
+class IQLCompileStatistics
+{
+public:
+  enum Phase { PARSE, TYPE_CHECK, LLVM_INIT, CODE_GEN, OPTIMIZE, JIT, NUM_PHASES };
+private:
+  bool mEnabled;
+  uint64_t mNanos[NUM_PHASES];
+  uint64_t mCompilations;
+  IQLCompileStatistics();
+public:
+  static IQLCompileStatistics & get();
+  static const char * getPhaseName(Phase phase);
+  static uint64_t now();
+  void enable(bool enabled) { mEnabled = enabled; }
+  bool isEnabled() const { return mEnabled; }
+  void clear();
+  void add(Phase phase, uint64_t nanos);
+  void addCompilation();
+  uint64_t getNanos(Phase phase) const { return mNanos[phase]; }
+  uint64_t getCompilations() const { return mCompilations; }
+};
+
+/**
+ * Charges elapsed time to successive compilation phases.  Calling
+ * next() closes the current phase and opens another; the last phase
+ * is closed on destruction.  Does nothing if statistics are disabled.
+ */
+class IQLCompilePhaseTimer
+{
+private:
+  bool mEnabled;
+  IQLCompileStatistics::Phase mPhase;
+  uint64_t mStart;
+public:
+  IQLCompilePhaseTimer(IQLCompileStatistics::Phase phase);
+  ~IQLCompilePhaseTimer();
+  void next(IQLCompileStatistics::Phase phase);
 };
 
 class LLVMBase
@@ -156,6 +293,9 @@ private:
   typedef void (*LLVMFuncType)(char*, char*, class InterpreterContext *);
   LLVMFuncType mFunction;
   class IQLRecordBufferMethodHandle * mImpl;
+  // Copies of the updated record, used when it is shared.
+  class IQLTransferModule * mSourceCopy;
+  class IQLTransferModule * mTargetCopy;
 
   // Create the LLVM module from the bitcode.
   void initImpl();
@@ -167,12 +307,16 @@ private:
   {
     ar & BOOST_SERIALIZATION_NVP(mFunName);
     ar & BOOST_SERIALIZATION_NVP(mBitcode);
+    ar & BOOST_SERIALIZATION_NVP(mSourceCopy);
+    ar & BOOST_SERIALIZATION_NVP(mTargetCopy);
   }
   template <class Archive>
   void load(Archive & ar, const unsigned int version) 
   {
     ar & BOOST_SERIALIZATION_NVP(mFunName);
     ar & BOOST_SERIALIZATION_NVP(mBitcode);
+    ar & BOOST_SERIALIZATION_NVP(mSourceCopy);
+    ar & BOOST_SERIALIZATION_NVP(mTargetCopy);
 
     initImpl();
   }
@@ -180,18 +324,30 @@ private:
   IQLUpdateModule()
     :
     mFunction(NULL),
-    mImpl(NULL)
+    mImpl(NULL),
+    mSourceCopy(NULL),
+    mTargetCopy(NULL)
   {
   }
 public:
+  /**
+   * Takes ownership of the copy modules (either may be NULL
+   * if the corresponding record has no fields).
+   */
   IQLUpdateModule(const std::string& funName, 
-		    const std::string& bitcode);
+		  const std::string& bitcode,
+		  class IQLTransferModule * sourceCopy,
+		  class IQLTransferModule * targetCopy);
   ~IQLUpdateModule();
   /**
-   * Copy or move the contents of source to target depending on the value
-   * of flag isSourceMove.
+   * Update target in place reading from source.  If target is
+   * shared it is replaced by a private copy first.
    */
-  void execute(RecordBuffer & source, RecordBuffer target, class InterpreterContext * ctxt) const;
+  void execute(RecordBuffer & source, RecordBuffer & target, class InterpreterContext * ctxt) const;
+  /**
+   * Update a single record in place, copying it first if it is shared.
+   */
+  void execute(RecordBuffer & source, class InterpreterContext * ctxt) const;
 };
 
 /**
@@ -212,6 +368,9 @@ private:
   typedef void (*LLVMFuncType)(char*, char*, class InterpreterContext *);
   LLVMFuncType mUpdateFunction;
   class IQLRecordBufferMethodHandle * mImpl;
+  // Copies of the updated record, used when it is shared.
+  class RecordTypeTransfer * mSourceCopy;
+  class RecordTypeTransfer * mTargetCopy;
 
   void init(class DynamicRecordContext& recCtxt, 
 	    const std::string & funName, 
@@ -238,10 +397,14 @@ public:
 
   ~RecordTypeInPlaceUpdate();
   /**
-   * Copy or move the contents of source to target depending on the value
-   * of flag isSourceMove.
+   * Update target in place reading from source.  If target is
+   * shared it is replaced by a private copy first.
+   */
+  void execute(RecordBuffer & source, RecordBuffer & target, class InterpreterContext * ctxt) const;
+  /**
+   * Update a single record in place, copying it first if it is shared.
    */
-  void execute(RecordBuffer & source, RecordBuffer target, class InterpreterContext * ctxt) const;
+  void execute(RecordBuffer & source, class InterpreterContext * ctxt) const;
 
   /**
    * Create serializable update function.
@@ -693,9 +856,12 @@ class IQLFunctionModule
 {
 public:
   typedef void (*LLVMFuncType)(char*, char*, int32_t *, class InterpreterContext *);
+  typedef void (*LLVMFunc64Type)(char*, char*, int64_t *, class InterpreterContext *);
 private:
   std::string mFunName;
   std::string mBitcode;
+  // Does the function return BIGINT rather than INTEGER?
+  bool mIsInt64;
   LLVMFuncType mFunction;
   class IQLRecordBufferMethodHandle * mImpl;
 
@@ -709,39 +875,50 @@ private:
   {
     ar & BOOST_SERIALIZATION_NVP(mFunName);
     ar & BOOST_SERIALIZATION_NVP(mBitcode);
+    ar & BOOST_SERIALIZATION_NVP(mIsInt64);
   }
   template <class Archive>
   void load(Archive & ar, const unsigned int version) 
   {
     ar & BOOST_SERIALIZATION_NVP(mFunName);
     ar & BOOST_SERIALIZATION_NVP(mBitcode);
+    ar & BOOST_SERIALIZATION_NVP(mIsInt64);
 
     initImpl();
   }
   BOOST_SERIALIZATION_SPLIT_MEMBER()
   IQLFunctionModule()
     :
+    mIsInt64(false),
     mFunction(NULL),
     mImpl(NULL)
   {
   }
 public:
   IQLFunctionModule(const std::string& funName, 
-		    const std::string& bitcode);
+		    const std::string& bitcode,
+		    bool isInt64 = false);
   ~IQLFunctionModule();
   /**
-   * Execute the method.
+   * Execute the method.  A BIGINT result is truncated.
    */
   int32_t execute(RecordBuffer sourceA, RecordBuffer sourceB, class InterpreterContext * ctxt) const;
+  /**
+   * Execute the method.  An INTEGER result is sign extended.
+   */
+  int64_t execute64(RecordBuffer sourceA, RecordBuffer sourceB, class InterpreterContext * ctxt) const;
   /**
    * For those who want to make a copy of the function pointer into another
    * data structure...
+   * getRawFunction throws unless the function returns INTEGER and
+   * getRawFunction64 throws unless it returns BIGINT.
    */
-  LLVMFuncType getRawFunction () const { return mFunction; }
+  LLVMFuncType getRawFunction () const;
+  LLVMFunc64Type getRawFunction64 () const;
 };
 
 /**
- * Evaluate an integer value expression against a set of input records.
+ * Evaluate an INTEGER or BIGINT expression against a set of input records.
  * TODO: Templatize on the output parameter.  Gracefully handle an
  * arbitrary number of input records (currently must be one or two).
  */
@@ -750,11 +927,14 @@ class RecordTypeFunction : public LLVMBase
 public:
   // TODO: change this to support more than two inputs (using char** presumably)
   typedef void (*LLVMFuncType)(char*, char*, int32_t *, class InterpreterContext *);
+  typedef void (*LLVMFunc64Type)(char*, char*, int64_t *, class InterpreterContext *);
 private:
   std::vector<AliasedRecordType> mSources;
   std::string mFunName;
   std::string mStatements;
   std::string mBitcode;
+  // Does the expression have type BIGINT rather than INTEGER?
+  bool mIsInt64;
 
   LLVMFuncType mFunction;
   class IQLRecordBufferMethodHandle * mImpl;
@@ -784,15 +964,26 @@ public:
   ~RecordTypeFunction();
 
   /**
-   * Evaluate and return.
+   * Evaluate and return.  A BIGINT result is truncated.
    */
   int32_t execute(RecordBuffer sourceA, RecordBuffer sourceB, class InterpreterContext * ctxt) const;
 
+  /**
+   * Evaluate and return.  An INTEGER result is sign extended.
+   */
+  int64_t execute64(RecordBuffer sourceA, RecordBuffer sourceB, class InterpreterContext * ctxt) const;
+
+  /**
+   * Does the expression have type BIGINT?
+   */
+  bool isInt64() const { return mIsInt64; }
+
   /**
    * For those who want to make a copy of the function pointer into another
    * data structure...
    */
-  LLVMFuncType getRawFunction () const { return mFunction; }
+  LLVMFuncType getRawFunction () const;
+  LLVMFunc64Type getRawFunction64 () const;
   
   /**
    * Create a serializable representation of the function that can be sent on the wire.
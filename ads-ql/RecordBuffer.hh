@@ -40,8 +40,23 @@
 #include <string.h>
 #include <stdexcept>
 
+/**
+ * Every record is preceded by a small header holding the number of
+ * references to it.  A freshly allocated record has a single reference.
+ * Operators that fan a record out unchanged (e.g. copy and broadcast) 
+ * hand out additional references with share() instead of making deep 
+ * copies.  A shared record is immutable: code that wants to modify
+ * a record in place (including moving fields out of it) must check 
+ * isShared() and copy instead.
+ */
 class RecordBuffer
 {
+private:
+  // 16 bytes so that records keep the alignment malloc gives us.
+  enum { HeaderSize = 16 };
+  static int32_t * refCount(uint8_t * ptr) {
+    return (int32_t *) (ptr - HeaderSize);
+  }
 public:
   uint8_t * Ptr;
   operator bool() { return Ptr != NULL; }
@@ -50,16 +65,42 @@ public:
     return buf;
   }
   static RecordBuffer malloc(std::size_t sz) {
-    RecordBuffer buf((uint8_t *) ::malloc(sz));
-    if (buf.Ptr == NULL)
+    uint8_t * base = (uint8_t *) ::malloc(sz + HeaderSize);
+    if (base == NULL)
       throw std::runtime_error("Allocation failure");
-    memset(buf.Ptr, 0, sz);
+    memset(base, 0, sz + HeaderSize);
+    RecordBuffer buf(base + HeaderSize);
+    *refCount(buf.Ptr) = 1;
     return buf;
   }
+  /**
+   * Release the memory of the record regardless of references.
+   * Use release() first for records that may be shared.
+   */
   static void free(RecordBuffer & buf) {
-    if (NULL != buf.Ptr) ::free(buf.Ptr);
+    if (NULL != buf.Ptr) ::free(buf.Ptr - HeaderSize);
     buf.Ptr = NULL;
   }
+  /**
+   * Add a reference to a record.
+   */
+  static RecordBuffer share(RecordBuffer buf) {
+    __sync_fetch_and_add(refCount(buf.Ptr), 1);
+    return buf;
+  }
+  static bool isShared(RecordBuffer buf) {
+    return *refCount(buf.Ptr) > 1;
+  }
+  /**
+   * Drop a reference to a record.  Returns true if the
+   * caller held the last reference and must free the record.
+   */
+  static bool release(RecordBuffer buf) {
+    // Unshared records are the common case; don't pay for
+    // an atomic on them.
+    int32_t * rc = refCount(buf.Ptr);
+    return *rc == 1 || __sync_sub_and_fetch(rc, 1) == 0;
+  }
   static bool isEOS(RecordBuffer & buf) {
     return buf.Ptr == NULL;
   }
@@ -1469,6 +1469,319 @@ bool RecordTypeDeserialize::Do(uint8_t * & input, uint8_t * inputEnd, RecordBuff
   return true;
 }
 
+CompactStringDictionary::CompactStringDictionary()
+{
+}
+
+CompactStringDictionary::~CompactStringDictionary()
+{
+  clear();
+}
+
+void CompactStringDictionary::clear()
+{
+  for(std::vector<char *>::iterator it = mCopies.begin();
+      it != mCopies.end();
+      ++it) {
+    delete [] *it;
+  }
+  mCopies.clear();
+  mEntries.clear();
+  std::fill(mTable.begin(), mTable.end(), -1);
+}
+
+void CompactStringDictionary::truncate(std::size_t sz)
+{
+  if (sz >= mEntries.size()) {
+    return;
+  }
+  for(std::size_t i=sz; i<mCopies.size(); ++i) {
+    delete [] mCopies[i];
+  }
+  if (mCopies.size() > sz) {
+    mCopies.resize(sz);
+  }
+  mEntries.resize(sz);
+  // Rare (once per block) so just rebuild.
+  rehash(mTable.size());
+}
+
+void CompactStringDictionary::rehash(std::size_t tableSize)
+{
+  mTable.assign(tableSize, -1);
+  std::size_t mask = tableSize - 1;
+  for(std::size_t i=0; i<mEntries.size(); ++i) {
+    std::size_t pos = mEntries[i].mHash & mask;
+    while(mTable[pos] != -1) {
+      pos = (pos + 1) & mask;
+    }
+    mTable[pos] = (int32_t) i;
+  }
+}
+
+int32_t CompactStringDictionary::findOrInsert(const char * s, int32_t sz)
+{
+  if (!isEligible(sz)) {
+    return -1;
+  }
+  if (2*(mEntries.size()+1) > mTable.size()) {
+    rehash(mTable.size() ? 2*mTable.size() : 1024);
+  }
+  uint32_t h = hash(s, sz);
+  std::size_t mask = mTable.size() - 1;
+  std::size_t pos = h & mask;
+  while(mTable[pos] != -1) {
+    const Entry & e(mEntries[mTable[pos]]);
+    if (e.mHash == h && e.mSize == sz && 0 == ::memcmp(e.mPtr, s, sz)) {
+      return mTable[pos];
+    }
+    pos = (pos + 1) & mask;
+  }
+  char * copy = new char [sz];
+  ::memcpy(copy, s, sz);
+  mCopies.push_back(copy);
+  Entry e = { copy, sz, h };
+  mTable[pos] = (int32_t) mEntries.size();
+  mEntries.push_back(e);
+  return -1;
+}
+
+static inline uint64_t compactZigZag(int64_t val)
+{
+  return (((uint64_t) val) << 1) ^ (uint64_t) (val >> 63);
+}
+
+static inline int64_t compactUnZigZag(uint64_t val)
+{
+  return (int64_t) (val >> 1) ^ -(int64_t) (val & 1);
+}
+
+static inline bool compactWriteVarint(uint8_t * & output, uint8_t * outputEnd, 
+				      uint64_t val)
+{
+  while(val >= 0x80) {
+    if (output == outputEnd) return false;
+    *output++ = (uint8_t) (val | 0x80);
+    val >>= 7;
+  }
+  if (output == outputEnd) return false;
+  *output++ = (uint8_t) val;
+  return true;
+}
+
+static inline uint64_t compactReadVarint(const uint8_t * & input, 
+					 const uint8_t * inputEnd)
+{
+  uint64_t val = 0;
+  for(int32_t shift = 0; shift < 64; shift += 7) {
+    if (input == inputEnd) break;
+    uint8_t b = *input++;
+    val |= ((uint64_t) (b & 0x7f)) << shift;
+    if (0 == (b & 0x80)) {
+      return val;
+    }
+  }
+  throw std::runtime_error("Corrupt or truncated compact record");
+}
+
+RecordTypeCompactSerialize::RecordTypeCompactSerialize()
+  :
+  mHasNullFields(false)
+{
+}
+
+RecordTypeCompactSerialize::RecordTypeCompactSerialize(const std::vector<CompactField>& fields,
+						       bool hasNullFields)
+  :
+  mFields(fields),
+  mHasNullFields(hasNullFields)
+{
+}
+
+RecordTypeCompactSerialize::~RecordTypeCompactSerialize()
+{
+}
+
+bool RecordTypeCompactSerialize::doit(uint8_t * & output, uint8_t * outputEnd, 
+				      RecordBuffer buf, 
+				      CompactStringDictionary& dict) const
+{
+  uint8_t * out = output;
+  uint8_t * nullBits = NULL;
+  std::size_t dictSize = dict.size();
+  if (mHasNullFields) {
+    std::size_t sz = (mFields.size() + 7)/8;
+    if ((std::size_t) (outputEnd - out) < sz) {
+      return false;
+    }
+    nullBits = out;
+    ::memset(nullBits, 0, sz);
+    for(std::size_t i=0; i<mFields.size(); ++i) {
+      if (mFields[i].mAddress.isNull(buf)) {
+	nullBits[i>>3] |= (uint8_t) (1 << (i&7));
+      }
+    }
+    out += sz;
+  }
+  for(std::size_t i=0; i<mFields.size(); ++i) {
+    if (nullBits && (nullBits[i>>3] & (1 << (i&7)))) {
+      continue;
+    }
+    const CompactField & f(mFields[i]);
+    bool ok = true;
+    switch(f.mTag) {
+    case FieldType::INT32:
+    case FieldType::INTERVAL:
+      ok = compactWriteVarint(out, outputEnd, 
+			      compactZigZag(f.mAddress.getInt32(buf)));
+      break;
+    case FieldType::INT64:
+      ok = compactWriteVarint(out, outputEnd, 
+			      compactZigZag(f.mAddress.getInt64(buf)));
+      break;
+    case FieldType::DATE:
+      {
+	int32_t tmp;
+	::memcpy(&tmp, f.mAddress.getCharPtr(buf), sizeof(tmp));
+	ok = compactWriteVarint(out, outputEnd, compactZigZag(tmp));
+	break;
+      }
+    case FieldType::DATETIME:
+      {
+	int64_t tmp;
+	::memcpy(&tmp, f.mAddress.getCharPtr(buf), sizeof(tmp));
+	ok = compactWriteVarint(out, outputEnd, compactZigZag(tmp));
+	break;
+      }
+    case FieldType::VARCHAR:
+      {
+	const Varchar * v = f.mAddress.getVarcharPtr(buf);
+	int32_t sz = v->size();
+	int32_t idx = dict.findOrInsert(v->c_str(), sz);
+	if (idx >= 0) {
+	  ok = compactWriteVarint(out, outputEnd, (((uint64_t) idx) << 1) | 1);
+	} else {
+	  ok = compactWriteVarint(out, outputEnd, ((uint64_t) sz) << 1) &&
+	    (std::size_t) (outputEnd - out) >= (std::size_t) sz;
+	  if (ok) {
+	    ::memcpy(out, v->c_str(), sz);
+	    out += sz;
+	  }
+	}
+	break;
+      }
+    default:
+      // Fixed size types are copied verbatim
+      ok = (std::size_t) (outputEnd - out) >= f.mSize;
+      if (ok) {
+	::memcpy(out, f.mAddress.getCharPtr(buf), f.mSize);
+	out += f.mSize;
+      }
+      break;
+    }
+    if (!ok) {
+      dict.truncate(dictSize);
+      return false;
+    }
+  }
+  output = out;
+  return true;
+}
+
+RecordTypeCompactDeserialize::RecordTypeCompactDeserialize()
+  :
+  mHasNullFields(false)
+{
+}
+
+RecordTypeCompactDeserialize::RecordTypeCompactDeserialize(const std::vector<CompactField>& fields,
+							   bool hasNullFields)
+  :
+  mFields(fields),
+  mHasNullFields(hasNullFields)
+{
+}
+
+RecordTypeCompactDeserialize::~RecordTypeCompactDeserialize()
+{
+}
+
+void RecordTypeCompactDeserialize::doit(const uint8_t * & input, 
+					const uint8_t * inputEnd, 
+					RecordBuffer buf, 
+					CompactStringDictionary& dict) const
+{
+  const uint8_t * in = input;
+  const uint8_t * nullBits = NULL;
+  if (mHasNullFields) {
+    std::size_t sz = (mFields.size() + 7)/8;
+    if ((std::size_t) (inputEnd - in) < sz) {
+      throw std::runtime_error("Corrupt or truncated compact record");
+    }
+    nullBits = in;
+    in += sz;
+  }
+  for(std::size_t i=0; i<mFields.size(); ++i) {
+    const CompactField & f(mFields[i]);
+    if (nullBits && (nullBits[i>>3] & (1 << (i&7)))) {
+      f.mAddress.setNull(buf);
+      continue;
+    }
+    f.mAddress.clearNull(buf);
+    switch(f.mTag) {
+    case FieldType::INT32:
+    case FieldType::INTERVAL:
+      f.mAddress.setInt32((int32_t) compactUnZigZag(compactReadVarint(in, inputEnd)), buf);
+      break;
+    case FieldType::INT64:
+      f.mAddress.setInt64(compactUnZigZag(compactReadVarint(in, inputEnd)), buf);
+      break;
+    case FieldType::DATE:
+      {
+	int32_t tmp = (int32_t) compactUnZigZag(compactReadVarint(in, inputEnd));
+	::memcpy(f.mAddress.getCharPtr(buf), &tmp, sizeof(tmp));
+	break;
+      }
+    case FieldType::DATETIME:
+      {
+	int64_t tmp = compactUnZigZag(compactReadVarint(in, inputEnd));
+	::memcpy(f.mAddress.getCharPtr(buf), &tmp, sizeof(tmp));
+	break;
+      }
+    case FieldType::VARCHAR:
+      {
+	uint64_t tag = compactReadVarint(in, inputEnd);
+	if (tag & 1) {
+	  std::size_t idx = (std::size_t) (tag >> 1);
+	  if (idx >= dict.size()) {
+	    throw std::runtime_error("Corrupt compact record: invalid string reference");
+	  }
+	  f.mAddress.SetVariableLengthString(buf, dict.getPtr(idx), dict.getSize(idx));
+	} else {
+	  uint64_t sz = tag >> 1;
+	  if (sz > (uint64_t) (inputEnd - in)) {
+	    throw std::runtime_error("Corrupt or truncated compact record");
+	  }
+	  f.mAddress.SetVariableLengthString(buf, (const char *) in, (std::size_t) sz);
+	  if (CompactStringDictionary::isEligible((int32_t) sz)) {
+	    dict.push_back((const char *) in, (int32_t) sz);
+	  }
+	  in += sz;
+	}
+	break;
+      }
+    default:
+      if ((std::size_t) (inputEnd - in) < f.mSize) {
+	throw std::runtime_error("Corrupt or truncated compact record");
+      }
+      ::memcpy(f.mAddress.getCharPtr(buf), in, f.mSize);
+      in += f.mSize;
+      break;
+    }
+  }
+  input = in;
+}
+
 RecordTypeFree::RecordTypeFree()
   :
   mSize(0)
@@ -1489,6 +1802,8 @@ RecordTypeFree::~RecordTypeFree()
 void RecordTypeFree::free(RecordBuffer buf) const
 {
   if (buf.Ptr == NULL) return;
+  // Other references to the record keep it (and its varchars) alive.
+  if (!RecordBuffer::release(buf)) return;
 
   for(std::vector<FieldAddress>::const_iterator it = mOffsets.begin();
       it != mOffsets.end();
@@ -1549,6 +1864,7 @@ RecordType::RecordType(const std::vector<RecordMember>& members)
   std::size_t sz= mHasNullFields ? ((mMembers.size()+31)/32)*sizeof(uint32_t) : 0;
   std::vector<FieldAddress> offsets;
   std::vector<TaggedFieldAddress> taggedOffsets;
+  std::vector<CompactField> compactFields;
   for(const_member_iterator it = begin_members();
       it != end_members();
       ++it) {
@@ -1564,6 +1880,8 @@ RecordType::RecordType(const std::vector<RecordMember>& members)
     mByteOffsetToPosition[sz] = pos;
     mMemberOffsets.push_back(FieldAddress(sz32, pos));
     taggedOffsets.push_back(TaggedFieldAddress(mMemberOffsets.back(), it->GetType()->GetEnum()));
+    compactFields.push_back(CompactField(mMemberOffsets.back(), it->GetType()->GetEnum(),
+					 (uint32_t) it->GetType()->GetAllocSize()));
     if (FieldType::VARCHAR == it->GetType()->GetEnum()) {
       offsets.push_back(FieldAddress(sz32, pos));
     }
@@ -1576,6 +1894,8 @@ RecordType::RecordType(const std::vector<RecordMember>& members)
   mSerialize = boost::shared_ptr<RecordTypeSerialize>(new RecordTypeSerialize(sz, offsets));
   mDeserialize = boost::shared_ptr<RecordTypeDeserialize>(new RecordTypeDeserialize(sz, offsets));
   mPrint = boost::shared_ptr<RecordTypePrint>(new RecordTypePrint(taggedOffsets));
+  mCompactSerialize = boost::shared_ptr<RecordTypeCompactSerialize>(new RecordTypeCompactSerialize(compactFields, mHasNullFields));
+  mCompactDeserialize = boost::shared_ptr<RecordTypeCompactDeserialize>(new RecordTypeCompactDeserialize(compactFields, mHasNullFields));
 }
 
 RecordType::~RecordType()
@@ -1112,6 +1112,186 @@ public:
   bool Do(uint8_t * & input, uint8_t * inputEnd, RecordBufferIterator & outputPos, RecordBuffer buf) const;
 };
 
+/**
+ * A field as seen by the compact record format.
+ */
+class CompactField
+{
+public:
+  FieldAddress mAddress;
+  FieldType::FieldTypeEnum mTag;
+  // Bytes of storage for types that are copied verbatim.
+  uint32_t mSize;
+private:
+  // Serialization
+  friend class boost::serialization::access;
+  template <class Archive>
+  void serialize(Archive & ar, const unsigned int version)
+  {
+    ar & BOOST_SERIALIZATION_NVP(mAddress);
+    ar & BOOST_SERIALIZATION_NVP(mTag);
+    ar & BOOST_SERIALIZATION_NVP(mSize);
+  }
+public:
+  CompactField()
+    :
+    mTag(FieldType::INT32),
+    mSize(0)
+  {
+  }
+  CompactField(const FieldAddress& address, FieldType::FieldTypeEnum tag,
+	       uint32_t sz)
+    :
+    mAddress(address),
+    mTag(tag),
+    mSize(sz)
+  {
+  }
+};
+
+/**
+ * Strings written so far in a block of compact records.  A
+ * string that has been seen before is written as its index in the 
+ * dictionary.  Both writer and reader add every string of length 
+ * 1 through MAX_STRING_SIZE in the order they appear so the 
+ * indexes agree without the dictionary being sent.
+ */
+class CompactStringDictionary
+{
+public:
+  enum { MAX_STRING_SIZE = 1024 };
+private:
+  struct Entry
+  {
+    const char * mPtr;
+    int32_t mSize;
+    uint32_t mHash;
+  };
+  std::vector<Entry> mEntries;
+  // Copies of the strings for the writer.  The reader points into
+  // the block.
+  std::vector<char *> mCopies;
+  // Open addressing hash table of indexes into mEntries (writer only).
+  std::vector<int32_t> mTable;
+
+  static uint32_t hash(const char * s, int32_t sz)
+  {
+    // FNV-1a
+    uint32_t h = 2166136261U;
+    for(int32_t i=0; i<sz; ++i) {
+      h = (h ^ (uint8_t) s[i]) * 16777619U;
+    }
+    return h;
+  }
+  void rehash(std::size_t tableSize);
+public:
+  CompactStringDictionary();
+  ~CompactStringDictionary();
+  /**
+   * Number of strings.
+   */
+  std::size_t size() const 
+  {
+    return mEntries.size();
+  }
+  /**
+   * Empty the dictionary at the start of a block.
+   */
+  void clear();
+  /**
+   * Remove strings added after the dictionary had sz of them.
+   */
+  void truncate(std::size_t sz);
+  /**
+   * Writer: Return the index of a string, or -1 if it is
+   * not present in which case it is added if eligible.
+   */
+  int32_t findOrInsert(const char * s, int32_t sz);
+  /**
+   * Reader: Add a string that lives in the block being read.
+   */
+  void push_back(const char * s, int32_t sz)
+  {
+    Entry e = { s, sz, 0 };
+    mEntries.push_back(e);
+  }
+  /**
+   * Reader: Lookup by index.
+   */
+  const char * getPtr(std::size_t idx) const 
+  {
+    return mEntries[idx].mPtr;
+  }
+  int32_t getSize(std::size_t idx) const 
+  {
+    return mEntries[idx].mSize;
+  }
+  static bool isEligible(int32_t sz) 
+  {
+    return sz > 0 && sz <= MAX_STRING_SIZE;
+  }
+};
+
+/**
+ * A compact, portable encoding of records for exchange over the 
+ * network.  Records are written one after another into a block 
+ * that shares a CompactStringDictionary.  Integers, dates and
+ * datetimes are zigzag varints, repeated strings are dictionary
+ * references and NULL fields take one bit.
+ */
+class RecordTypeCompactSerialize
+{
+private:
+  std::vector<CompactField> mFields;
+  bool mHasNullFields;
+
+  // Serialization
+  friend class boost::serialization::access;
+  template <class Archive>
+  void serialize(Archive & ar, const unsigned int version)
+  {
+    ar & BOOST_SERIALIZATION_NVP(mFields);
+    ar & BOOST_SERIALIZATION_NVP(mHasNullFields);
+  }
+public:
+  RecordTypeCompactSerialize();
+  RecordTypeCompactSerialize(const std::vector<CompactField>& fields, bool hasNullFields);
+  ~RecordTypeCompactSerialize();
+  /**
+   * Append buf to output.  If the record doesn't fit, output and 
+   * dict are left unchanged and false is returned.
+   */
+  bool doit(uint8_t * & output, uint8_t * outputEnd, RecordBuffer buf, 
+	    CompactStringDictionary& dict) const;
+};
+
+class RecordTypeCompactDeserialize
+{
+private:
+  std::vector<CompactField> mFields;
+  bool mHasNullFields;
+
+  // Serialization
+  friend class boost::serialization::access;
+  template <class Archive>
+  void serialize(Archive & ar, const unsigned int version)
+  {
+    ar & BOOST_SERIALIZATION_NVP(mFields);
+    ar & BOOST_SERIALIZATION_NVP(mHasNullFields);
+  }
+public:
+  RecordTypeCompactDeserialize();
+  RecordTypeCompactDeserialize(const std::vector<CompactField>& fields, bool hasNullFields);
+  ~RecordTypeCompactDeserialize();
+  /**
+   * Read one record from input into buf.  The input must hold 
+   * complete records; throws if it does not.  Strings added to 
+   * dict point into input so it must outlive any use of dict.
+   */
+  void doit(const uint8_t * & input, const uint8_t * inputEnd, RecordBuffer buf, 
+	    CompactStringDictionary& dict) const;
+};
+
 class RecordTypeFree
 {
 private:
@@ -1316,6 +1496,8 @@ private:
   boost::shared_ptr<RecordTypeSerialize> mSerialize;
   boost::shared_ptr<RecordTypeDeserialize> mDeserialize;
   boost::shared_ptr<RecordTypePrint> mPrint;
+  boost::shared_ptr<RecordTypeCompactSerialize> mCompactSerialize;
+  boost::shared_ptr<RecordTypeCompactDeserialize> mCompactDeserialize;
   std::vector<FieldAddress> mMemberOffsets;
   // Index to lookup up position of a field by its byte offset
   std::map<uint32_t, uint32_t> mByteOffsetToPosition;
@@ -1360,6 +1542,8 @@ public:
   const RecordTypeSerialize& getSerialize() const { return *mSerialize.get(); }
   const RecordTypeDeserialize& getDeserialize() const { return *mDeserialize.get(); }
   const RecordTypePrint& getPrint() const { return *mPrint.get(); }
+  const RecordTypeCompactSerialize& getCompactSerialize() const { return *mCompactSerialize.get(); }
+  const RecordTypeCompactDeserialize& getCompactDeserialize() const { return *mCompactDeserialize.get(); }
 
   // This does not belong here!
   void Print(RecordBuffer buf, std::ostream& ostr) const;
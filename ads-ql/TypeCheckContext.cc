@@ -690,8 +690,9 @@ const FieldType * TypeCheckContext::buildCall(const char * f, std::vector<const
 
 const FieldType * TypeCheckContext::buildHash(std::vector<const FieldType *> & ty)
 {
-  // For the moment, we can hash anything.  Always returns an integer.
-  return buildInt32Type();
+  // For the moment, we can hash anything.  Always returns the full 
+  // 64-bit hash as a BIGINT.
+  return buildInt64Type();
 }
 
 const FieldType * TypeCheckContext::buildSortPrefix(std::vector<const FieldType *> & ty) 
@@ -0,0 +1,245 @@
+/**
+ * Copyright (c) 2012, Akamai Technologies
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * 
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ * 
+ *   Neither the name of the Akamai Technologies nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Micro-benchmark for IQL compilation and evaluation.  Compiles a
+ * corpus of representative predicates and transfers, reporting the
+ * average time spent in each compilation phase and the cost per record
+ * of evaluating the compiled code.
+ *
+ * Usage: ads-ql-bench [records] [compilations]
+ */
+
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <stdexcept>
+#include <boost/format.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include "IQLInterpreter.hh"
+#include "RecordType.hh"
+
+struct BenchmarkExpression
+{
+  const char * Name;
+  bool IsTransfer;
+  const char * Text;
+};
+
+static BenchmarkExpression corpus[] = {
+  { "int_compare", false, "c > 100" },
+  { "conjunction", false, "c > 100 AND d < 5000000000LL AND e <> 0.0e0" },
+  { "char_equals", false, "a = 'abcdef'" },
+  { "varchar_equals", false, "b = 'a moderately long string value'" },
+  { "hash", false, "#(a, b, c, d)" },
+  { "case", false, "CASE WHEN c < 10 THEN 0 WHEN c < 1000 THEN 1 ELSE 2 END" },
+  { "rlike", false, "b RLIKE '^a.*[0-9]+$'" },
+  { "project", true, "a, b, c, d, e" },
+  { "arithmetic", true, "c+1 AS x, d*2LL AS y, e*2.0e0 + 1.0e0 AS z" },
+  { "concat", true, "b + '_suffix' AS s" },
+  { "md5", true, "md5(b) AS h" },
+  { "case_varchar", true, "CASE WHEN c > 100 THEN b ELSE 'small' END AS s, c" },
+  { NULL, false, NULL }
+};
+
+class IQLBenchmark
+{
+private:
+  DynamicRecordContext mContext;
+  InterpreterContext mRuntimeContext;
+  RecordType * mInput;
+  RecordType * mEmpty;
+  std::vector<RecordBuffer> mRecords;
+  int32_t mCompilations;
+
+  static double nanosPer(uint64_t nanos, int64_t n)
+  {
+    return n > 0 ? double(nanos)/double(n) : 0.0;
+  }
+  void runFunction(const BenchmarkExpression & expr, std::ostream & ostr);
+  void runTransfer(const BenchmarkExpression & expr, std::ostream & ostr);
+public:
+  IQLBenchmark(int32_t numRecords, int32_t compilations);
+  ~IQLBenchmark();
+  void run(std::ostream & ostr);
+};
+
+IQLBenchmark::IQLBenchmark(int32_t numRecords, int32_t compilations)
+  :
+  mInput(NULL),
+  mEmpty(NULL),
+  mCompilations(compilations)
+{
+  std::vector<RecordMember> members;
+  members.push_back(RecordMember("a", CharType::Get(mContext, 6)));
+  members.push_back(RecordMember("b", VarcharType::Get(mContext)));
+  members.push_back(RecordMember("c", Int32Type::Get(mContext)));
+  members.push_back(RecordMember("d", Int64Type::Get(mContext)));
+  members.push_back(RecordMember("e", DoubleType::Get(mContext)));
+  mInput = new RecordType(members);
+  std::vector<RecordMember> emptyMembers;
+  mEmpty = new RecordType(emptyMembers);
+
+  // Mix of short (inline) and long (heap) strings and a spread of
+  // integer values so that branches are not perfectly predictable.
+  for(int32_t i=0; i<numRecords; ++i) {
+    RecordBuffer buf = mInput->getMalloc().malloc();
+    mInput->setChar("a", (i % 3) ? "abcdef" : "zyxwvu", buf);
+    std::string b = (i % 2) ? 
+      (boost::format("a%1%") % i).str() :
+      (boost::format("a moderately long string value %1%") % i).str();
+    mInput->setVarchar("b", b.c_str(), buf);
+    mInput->setInt32("c", (i*7919) % 2000, buf);
+    mInput->setInt64("d", int64_t(i)*1000003LL, buf);
+    mInput->setDouble("e", i*0.5, buf);
+    mRecords.push_back(buf);
+  }
+}
+
+IQLBenchmark::~IQLBenchmark()
+{
+  for(std::vector<RecordBuffer>::iterator it = mRecords.begin();
+      it != mRecords.end();
+      ++it) {
+    mInput->getFree().free(*it);
+  }
+  delete mInput;
+  delete mEmpty;
+}
+
+void IQLBenchmark::runFunction(const BenchmarkExpression & expr, 
+			       std::ostream & ostr)
+{
+  std::vector<const RecordType *> types;
+  types.push_back(mInput);
+  types.push_back(mEmpty);
+  uint64_t start = IQLCompileStatistics::now();
+  RecordTypeFunction * f = NULL;
+  for(int32_t i=0; i<mCompilations; ++i) {
+    delete f;
+    f = new RecordTypeFunction(mContext, expr.Name, types, expr.Text);
+  }
+  uint64_t compiled = IQLCompileStatistics::now();
+  int64_t sum = 0;
+  for(std::vector<RecordBuffer>::iterator it = mRecords.begin();
+      it != mRecords.end();
+      ++it) {
+    sum += f->execute(*it, RecordBuffer(), &mRuntimeContext);
+  }
+  uint64_t evaluated = IQLCompileStatistics::now();
+  mRuntimeContext.clear();
+  delete f;
+  ostr << expr.Name << "\t" 
+       << std::fixed << std::setprecision(1)
+       << nanosPer(compiled - start, mCompilations)/1000.0 << "\t" 
+       << nanosPer(evaluated - compiled, (int64_t) mRecords.size()) << "\t"
+       << sum << std::endl;
+}
+
+void IQLBenchmark::runTransfer(const BenchmarkExpression & expr, 
+			       std::ostream & ostr)
+{
+  uint64_t start = IQLCompileStatistics::now();
+  RecordTypeTransfer * t = NULL;
+  for(int32_t i=0; i<mCompilations; ++i) {
+    delete t;
+    t = new RecordTypeTransfer(mContext, expr.Name, mInput, expr.Text);
+  }
+  uint64_t compiled = IQLCompileStatistics::now();
+  // Allocate and free outputs as an operator would; that is part of the
+  // per record cost of a transfer.
+  const RecordType * target = t->getTarget();
+  for(std::vector<RecordBuffer>::iterator it = mRecords.begin();
+      it != mRecords.end();
+      ++it) {
+    RecordBuffer out = target->getMalloc().malloc();
+    t->execute(*it, out, &mRuntimeContext, false);
+    target->getFree().free(out);
+  }
+  uint64_t evaluated = IQLCompileStatistics::now();
+  mRuntimeContext.clear();
+  delete t;
+  ostr << expr.Name << "\t" 
+       << std::fixed << std::setprecision(1)
+       << nanosPer(compiled - start, mCompilations)/1000.0 << "\t" 
+       << nanosPer(evaluated - compiled, (int64_t) mRecords.size()) << "\t"
+       << "-" << std::endl;
+}
+
+void IQLBenchmark::run(std::ostream & ostr)
+{
+  IQLCompileStatistics & stats(IQLCompileStatistics::get());
+  stats.enable(true);
+  stats.clear();
+  ostr << "expression\tcompileMicros\tnanosPerRecord\tchecksum" << std::endl;
+  for(BenchmarkExpression * expr = &corpus[0]; expr->Name != NULL; ++expr) {
+    if (expr->IsTransfer) {
+      runTransfer(*expr, ostr);
+    } else {
+      runFunction(*expr, ostr);
+    }
+  }
+  ostr << std::endl << "phase\tmicrosPerCompilation" << std::endl;
+  uint64_t total = 0;
+  for(int i=0; i<IQLCompileStatistics::NUM_PHASES; ++i) {
+    IQLCompileStatistics::Phase p = (IQLCompileStatistics::Phase) i;
+    total += stats.getNanos(p);
+    ostr << IQLCompileStatistics::getPhaseName(p) << "\t" 
+	 << std::fixed << std::setprecision(1)
+	 << nanosPer(stats.getNanos(p), stats.getCompilations())/1000.0 
+	 << std::endl;
+  }
+  ostr << "total\t" 
+       << nanosPer(total, stats.getCompilations())/1000.0 
+       << std::endl;
+  stats.enable(false);
+}
+
+int main(int argc, char ** argv)
+{
+  try {
+    int32_t numRecords = argc > 1 ? boost::lexical_cast<int32_t>(argv[1]) : 1000000;
+    int32_t compilations = argc > 2 ? boost::lexical_cast<int32_t>(argv[2]) : 20;
+    if (numRecords <= 0 || compilations <= 0) {
+      throw std::runtime_error("Usage: ads-ql-bench [records] [compilations]");
+    }
+    IQLBenchmark bench(numRecords, compilations);
+    bench.run(std::cout);
+  } catch(std::exception & ex) {
+    std::cerr << ex.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
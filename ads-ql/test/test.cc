@@ -42,7 +42,7 @@
 
 #include "IQLInterpreter.hh"
 #include "IQLExpression.hh"
-#include "SuperFastHash.h"
+#include "Hash64.h"
 
 #define BOOST_TEST_MODULE MyTest
 #include <boost/test/unit_test.hpp>
@@ -98,6 +98,55 @@ BOOST_AUTO_TEST_CASE(testVarcharDataType)
   }
 }
 
+BOOST_AUTO_TEST_CASE(testRecordBufferShare)
+{
+  RecordBuffer buf = RecordBuffer::malloc(32);
+  BOOST_CHECK(!RecordBuffer::isShared(buf));
+  RecordBuffer other = RecordBuffer::share(buf);
+  BOOST_CHECK_EQUAL(buf.Ptr, other.Ptr);
+  BOOST_CHECK(RecordBuffer::isShared(buf));
+  BOOST_CHECK(!RecordBuffer::release(other));
+  BOOST_CHECK(!RecordBuffer::isShared(buf));
+  BOOST_CHECK(RecordBuffer::release(buf));
+  RecordBuffer::free(buf);
+  BOOST_CHECK(buf.Ptr == NULL);
+}
+
+BOOST_AUTO_TEST_CASE(testInterpreterContextArena)
+{
+  InterpreterContext runtimeCtxt;
+  const char * buf = "a string that is too long to be small";
+  for(int32_t iter=0; iter<3; ++iter) {
+    // Enough temporaries to span several arena blocks.
+    std::vector<Varchar> temps(10000);
+    for(std::size_t i=0; i<temps.size(); ++i) {
+      temps[i].assign(buf, ::strlen(buf), &runtimeCtxt);
+      BOOST_CHECK(temps[i].Large.Large);
+    }
+    for(std::size_t i=0; i<temps.size(); ++i) {
+      BOOST_CHECK(boost::algorithm::equals(buf, temps[i].c_str()));
+    }
+    // Escaped values must survive clear().
+    void * small = runtimeCtxt.escape(const_cast<char *>(temps[17].Large.Ptr),
+				      temps[17].size() + 1);
+    BOOST_CHECK(small != temps[17].Large.Ptr);
+    std::string big(1024*1024, 'x');
+    Varchar bigVal;
+    bigVal.assign(big.c_str(), big.size(), &runtimeCtxt);
+    void * bigEscaped = runtimeCtxt.escape(const_cast<char *>(bigVal.Large.Ptr),
+					   bigVal.size() + 1);
+    BOOST_CHECK(bigEscaped == bigVal.Large.Ptr);
+    // Memory the context didn't hand out is left alone.
+    int32_t local;
+    BOOST_CHECK(&local == runtimeCtxt.escape(&local, sizeof(local)));
+    runtimeCtxt.clear();
+    BOOST_CHECK(boost::algorithm::equals(buf, (const char *) small));
+    BOOST_CHECK(boost::algorithm::equals(big, (const char *) bigEscaped));
+    ::free(small);
+    ::free(bigEscaped);
+  }
+}
+
 BOOST_AUTO_TEST_CASE(testTransferStringLiteral)
 {
   DynamicRecordContext ctxt;
@@ -1021,7 +1070,7 @@ BOOST_AUTO_TEST_CASE(testIQLArrayDotProduct)
 			       "SET i = i-1;\n"
 			       "END WHILE\n"
 			       "SET e=accum;");
-    up.execute(inputBuf, NULL, &runtimeCtxt);
+    up.execute(inputBuf, &runtimeCtxt);
     BOOST_CHECK_CLOSE(expected, 
 		      recTy.getDouble("e", inputBuf),
 		      0.00000000001);
@@ -1070,7 +1119,7 @@ BOOST_AUTO_TEST_CASE(testIQLMultipleWhile)
 			       "SET d = d - 1;\n"
 			       "END WHILE"
 			       );
-    up.execute(lhs, NULL, &runtimeCtxt);
+    up.execute(lhs, &runtimeCtxt);
     BOOST_CHECK_EQUAL(0, recTy.getInt32("a", lhs));
     BOOST_CHECK_EQUAL(92347, recTy.getInt32("b", lhs));
     BOOST_CHECK_EQUAL(9923432, recTy.getInt32("c", lhs));
@@ -1107,53 +1156,78 @@ BOOST_AUTO_TEST_CASE(testIQLRecordHash)
 
   {
     RecordTypeFunction hasher(ctxt, "charhash", types, "#(a)");
-    uint32_t val = (uint32_t) hasher.execute(inputBuf, RecordBuffer(NULL), &runtimeCtxt);
-    uint32_t expected = SuperFastHash("123456", 6, 6);
+    uint64_t val = (uint64_t) hasher.execute64(inputBuf, RecordBuffer(NULL), &runtimeCtxt);
+    uint64_t expected = Hash64Finish(Hash64Bytes("123456", 6, HASH64_SEED));
     BOOST_CHECK_EQUAL(val, expected);
   }
   {
     RecordTypeFunction hasher(ctxt, "varcharhash", types, "#(b)");
-    uint32_t val = (uint32_t) hasher.execute(inputBuf, RecordBuffer(NULL), &runtimeCtxt);
+    uint64_t val = (uint64_t) hasher.execute64(inputBuf, RecordBuffer(NULL), &runtimeCtxt);
     int32_t sz = strlen("abcdefghijklmnopqrstuvwxyz");
-    uint32_t expected = SuperFastHash("abcdefghijklmnopqrstuvwxyz", sz, sz);
+    uint64_t expected = Hash64Finish(Hash64Bytes("abcdefghijklmnopqrstuvwxyz", sz, HASH64_SEED));
     BOOST_CHECK_EQUAL(val, expected);
   }
   {
     RecordTypeFunction hasher(ctxt, "int32hash", types, "#(c)");
-    uint32_t val = (uint32_t) hasher.execute(inputBuf, RecordBuffer(NULL), &runtimeCtxt);
+    uint64_t val = (uint64_t) hasher.execute64(inputBuf, RecordBuffer(NULL), &runtimeCtxt);
     int32_t tmp = 9923432;
-    uint32_t expected = SuperFastHash((char *) &tmp, 4, 4);
+    uint64_t expected = Hash64Finish(Hash64Step(HASH64_SEED, (int64_t) tmp));
     BOOST_CHECK_EQUAL(val, expected);
   }
   {
     RecordTypeFunction hasher(ctxt, "int64hash", types, "#(d)");
-    uint32_t val = (uint32_t) hasher.execute(inputBuf, RecordBuffer(NULL), &runtimeCtxt);
+    uint64_t val = (uint64_t) hasher.execute64(inputBuf, RecordBuffer(NULL), &runtimeCtxt);
     int64_t tmp = 1239923432;
-    uint32_t expected = SuperFastHash((char *) &tmp, 8, 8);
+    uint64_t expected = Hash64Finish(Hash64Step(HASH64_SEED, tmp));
     BOOST_CHECK_EQUAL(val, expected);
   }
   {
     RecordTypeFunction hasher(ctxt, "doublehash", types, "#(e)");
-    uint32_t val = (uint32_t) hasher.execute(inputBuf, RecordBuffer(NULL), &runtimeCtxt);
+    uint64_t val = (uint64_t) hasher.execute64(inputBuf, RecordBuffer(NULL), &runtimeCtxt);
     double tmp = 8234.24344;
-    uint32_t expected = SuperFastHash((char *) &tmp, 8, 8);
+    uint64_t bits;
+    memcpy(&bits, &tmp, 8);
+    uint64_t expected = Hash64Finish(Hash64Step(HASH64_SEED, bits));
     BOOST_CHECK_EQUAL(val, expected);
   }
   {
     RecordTypeFunction hasher(ctxt, "varcharhash", types, "#(f)");
-    uint32_t val = (uint32_t) hasher.execute(inputBuf, RecordBuffer(NULL), &runtimeCtxt);
+    uint64_t val = (uint64_t) hasher.execute64(inputBuf, RecordBuffer(NULL), &runtimeCtxt);
     int32_t sz = strlen("abcd");
-    uint32_t expected = SuperFastHash("abcd", sz, sz);
+    uint64_t expected = Hash64Finish(Hash64Bytes("abcd", sz, HASH64_SEED));
     BOOST_CHECK_EQUAL(val, expected);
   }
   {
     RecordTypeFunction hasher(ctxt, "int64hash", types, "#(d,a)");
-    uint32_t val = (uint32_t) hasher.execute(inputBuf, RecordBuffer(NULL), &runtimeCtxt);
+    uint64_t val = (uint64_t) hasher.execute64(inputBuf, RecordBuffer(NULL), &runtimeCtxt);
     int64_t tmp = 1239923432;
-    uint32_t expected = SuperFastHash((char *) &tmp, 8, 8);
-    expected = SuperFastHash("123456", 6, expected);
+    uint64_t h = Hash64Step(HASH64_SEED, tmp);
+    h = Hash64Bytes("123456", 6, h);
+    uint64_t expected = Hash64Finish(h);
     BOOST_CHECK_EQUAL(val, expected);
   }
+  {
+    // Hash of CHAR and VARCHAR with same contents agree
+    RecordTypeFunction charHasher(ctxt, "charhash", types, "#(a)");
+    RecordTypeFunction varcharHasher(ctxt, "varcharhash", types, "#(CAST(a AS VARCHAR))");
+    BOOST_CHECK_EQUAL(charHasher.execute64(inputBuf, RecordBuffer(NULL), &runtimeCtxt),
+		      varcharHasher.execute64(inputBuf, RecordBuffer(NULL), &runtimeCtxt));
+  }
+  {
+    // Hash of INTEGER and BIGINT with the same value agree, 
+    // including negative values.
+    RecordTypeFunction int32Hasher(ctxt, "int32hash", types, "#(c)");
+    RecordTypeFunction int64Hasher(ctxt, "int64hash", types, "#(d)");
+    BOOST_CHECK(int32Hasher.isInt64());
+    BOOST_CHECK_THROW(int32Hasher.getRawFunction(), std::runtime_error);
+    int32_t vals [] = { 0, 1, -1, 9923432, -9923432, 0x7fffffff, (int32_t) 0x80000000 };
+    for(std::size_t i=0; i<sizeof(vals)/sizeof(int32_t); ++i) {
+      recTy.setInt32("c", vals[i], inputBuf);
+      recTy.setInt64("d", vals[i], inputBuf);
+      BOOST_CHECK_EQUAL(int32Hasher.execute64(inputBuf, RecordBuffer(NULL), &runtimeCtxt),
+			int64Hasher.execute64(inputBuf, RecordBuffer(NULL), &runtimeCtxt));
+    }
+  }
 
   recTy.GetFree()->free(inputBuf);
 }
@@ -1965,7 +2039,7 @@ BOOST_AUTO_TEST_CASE(testIQLArray)
 			       "xfer5up", 
 			       types, 
 			       "SET a[2] = d");
-    up.execute(lhs, NULL, &runtimeCtxt);
+    up.execute(lhs, &runtimeCtxt);
     BOOST_CHECK_EQUAL(12431, recTy.getInt32("c", lhs));
   }
   {
@@ -1973,7 +2047,7 @@ BOOST_AUTO_TEST_CASE(testIQLArray)
 			       "xfer5up", 
 			       types, 
 			       "SET c = a[1]");
-    up.execute(lhs, NULL, &runtimeCtxt);
+    up.execute(lhs, &runtimeCtxt);
     BOOST_CHECK_EQUAL(88311, recTy.getInt32("c", lhs));
   }
 }
@@ -2007,7 +2081,7 @@ BOOST_AUTO_TEST_CASE(testIQLWhile)
 			       "xfer5up", 
 			       types, 
 			       "WHILE a > 0 DO SET b = b + 1; SET a = a - 1; END WHILE");
-    up.execute(lhs, NULL, &runtimeCtxt);
+    up.execute(lhs, &runtimeCtxt);
     BOOST_CHECK_EQUAL(0, recTy.getInt32("a", lhs));
     BOOST_CHECK_EQUAL(92347, recTy.getInt32("b", lhs));
     BOOST_CHECK_EQUAL(9923432, recTy.getInt32("c", lhs));
@@ -2019,7 +2093,7 @@ BOOST_AUTO_TEST_CASE(testIQLWhile)
 			       "WHILE a > 0 DO SET b = b + 1; SET c = c+1; SET a = a-1; END WHILE");
     recTy.setInt32("a", 3, lhs);
     recTy.setInt32("b", 92344, lhs);
-    up.execute(lhs, NULL, &runtimeCtxt);
+    up.execute(lhs, &runtimeCtxt);
     BOOST_CHECK_EQUAL(0, recTy.getInt32("a", lhs));
     BOOST_CHECK_EQUAL(92347, recTy.getInt32("b", lhs));
     BOOST_CHECK_EQUAL(9923435, recTy.getInt32("c", lhs));
@@ -2039,7 +2113,7 @@ BOOST_AUTO_TEST_CASE(testIQLWhile)
     recTy.setInt32("a", 3, lhs);
     recTy.setInt32("b", 92344, lhs);
     recTy.setInt32("c", 9923432, lhs);
-    up.execute(lhs, NULL, &runtimeCtxt);
+    up.execute(lhs, &runtimeCtxt);
     BOOST_CHECK_EQUAL(-2, recTy.getInt32("a", lhs));
     BOOST_CHECK_EQUAL(92349, recTy.getInt32("b", lhs));
     BOOST_CHECK_EQUAL(9923437, recTy.getInt32("c", lhs));
@@ -2429,6 +2503,95 @@ BOOST_AUTO_TEST_CASE(testIQLRecordUpdate)
   }
 }
 
+BOOST_AUTO_TEST_CASE(testIQLRecordUpdateShared)
+{
+  DynamicRecordContext ctxt;
+  InterpreterContext runtimeCtxt;
+  std::vector<RecordMember> members;
+  members.push_back(RecordMember("a", Int32Type::Get(ctxt)));
+  members.push_back(RecordMember("b", VarcharType::Get(ctxt)));
+  RecordType recTy(members);
+  std::vector<RecordMember> rhsMembers;
+  rhsMembers.push_back(RecordMember("c", Int32Type::Get(ctxt)));
+  rhsMembers.push_back(RecordMember("d", VarcharType::Get(ctxt)));
+  RecordType rhsTy(rhsMembers);
+  std::vector<const RecordType *> types;
+  types.push_back(&recTy);
+  types.push_back(&rhsTy);
+
+  RecordTypeInPlaceUpdate up(ctxt, 
+			     "xfer5up", 
+			     types, 
+			     "SET c = c + a;\n"
+			     "SET d = b");
+  boost::shared_ptr<IQLUpdateModule> upModule(up.create());
+  for(int32_t useModule=0; useModule<2; ++useModule) {
+    RecordBuffer lhs = recTy.GetMalloc()->malloc();
+    recTy.setInt32("a", 5, lhs);
+    recTy.setVarchar("b", "a string long enough to be a large varchar", lhs);
+    RecordBuffer rhs = rhsTy.GetMalloc()->malloc();
+    rhsTy.setInt32("c", 10, rhs);
+    rhsTy.setVarchar("d", "another string long enough to be large", rhs);
+
+    // A shared source is only read.
+    RecordBuffer lhsRef = RecordBuffer::share(lhs);
+    // A shared target is copied before it is updated.
+    RecordBuffer rhsRef = RecordBuffer::share(rhs);
+    if (useModule) {
+      upModule->execute(lhs, rhs, &runtimeCtxt);
+    } else {
+      up.execute(lhs, rhs, &runtimeCtxt);
+    }
+    BOOST_CHECK_EQUAL(lhsRef.Ptr, lhs.Ptr);
+    BOOST_CHECK(rhsRef.Ptr != rhs.Ptr);
+    BOOST_CHECK(!RecordBuffer::isShared(rhs));
+    BOOST_CHECK(!RecordBuffer::isShared(rhsRef));
+    BOOST_CHECK_EQUAL(15, rhsTy.getInt32("c", rhs));
+    BOOST_CHECK(boost::algorithm::equals("a string long enough to be a large varchar", 
+					 rhsTy.getVarcharPtr("d", rhs)->c_str()));
+    BOOST_CHECK_EQUAL(10, rhsTy.getInt32("c", rhsRef));
+    BOOST_CHECK(boost::algorithm::equals("another string long enough to be large", 
+					 rhsTy.getVarcharPtr("d", rhsRef)->c_str()));
+
+    // An unshared target is updated in place.
+    RecordBuffer rhsPtr = rhs;
+    if (useModule) {
+      upModule->execute(lhs, rhs, &runtimeCtxt);
+    } else {
+      up.execute(lhs, rhs, &runtimeCtxt);
+    }
+    BOOST_CHECK_EQUAL(rhsPtr.Ptr, rhs.Ptr);
+    BOOST_CHECK_EQUAL(20, rhsTy.getInt32("c", rhs));
+
+    rhsTy.GetFree()->free(rhsRef);
+    rhsTy.GetFree()->free(rhs);
+    recTy.GetFree()->free(lhsRef);
+    recTy.GetFree()->free(lhs);
+  }
+
+  // A single record update copies the record if it is shared.
+  std::vector<const RecordType *> singleTypes;
+  std::vector<RecordMember> emptyMembers;
+  RecordType emptyTy(emptyMembers);
+  singleTypes.push_back(&recTy);
+  singleTypes.push_back(&emptyTy);
+  RecordTypeInPlaceUpdate single(ctxt, 
+				 "xfer6up", 
+				 singleTypes, 
+				 "SET a = a + 1");
+  RecordBuffer lhs = recTy.GetMalloc()->malloc();
+  recTy.setInt32("a", 5, lhs);
+  recTy.setVarchar("b", "abc", lhs);
+  RecordBuffer lhsRef = RecordBuffer::share(lhs);
+  single.execute(lhs, &runtimeCtxt);
+  BOOST_CHECK(lhsRef.Ptr != lhs.Ptr);
+  BOOST_CHECK_EQUAL(6, recTy.getInt32("a", lhs));
+  BOOST_CHECK_EQUAL(5, recTy.getInt32("a", lhsRef));
+  BOOST_CHECK(boost::algorithm::equals("abc", recTy.getVarcharPtr("b", lhs)->c_str()));
+  recTy.GetFree()->free(lhsRef);
+  recTy.GetFree()->free(lhs);
+}
+
 BOOST_AUTO_TEST_CASE(testRecordTypeSerialize)
 {
   DynamicRecordContext ctxt;
@@ -2602,6 +2765,87 @@ BOOST_AUTO_TEST_CASE(testRecordTypeSerializeNullable)
   }
 }
 
+BOOST_AUTO_TEST_CASE(testRecordTypeCompactSerialize)
+{
+  DynamicRecordContext ctxt;
+  InterpreterContext runtimeCtxt;
+  std::vector<RecordMember> members;
+  members.push_back(RecordMember("a", CharType::Get(ctxt, 6)));
+  members.push_back(RecordMember("b", VarcharType::Get(ctxt, true)));
+  members.push_back(RecordMember("c", Int32Type::Get(ctxt, true)));
+  members.push_back(RecordMember("d", Int64Type::Get(ctxt)));
+  members.push_back(RecordMember("e", DoubleType::Get(ctxt)));
+  RecordType recTy(members);
+
+  RecordBuffer inputBuf = recTy.GetMalloc()->malloc();
+  recTy.setChar("a", "123456", inputBuf);
+  recTy.setVarchar("b", "abcdefghijklmnop", inputBuf);
+  recTy.setInt32("c", -7, inputBuf);
+  recTy.setInt64("d", 1239923432, inputBuf);
+  recTy.setDouble("e", 8234.24344, inputBuf);
+  RecordBuffer nullBuf = recTy.GetMalloc()->malloc();
+  recTy.setChar("a", "654321", nullBuf);
+  recTy.setInt64("d", -3, nullBuf);
+  recTy.setDouble("e", 1.5, nullBuf);
+
+  // Write the record twice; the second time the string is a 
+  // dictionary reference and the small integers are one byte.
+  uint8_t bigBuf[128];
+  uint8_t * bufPtr = &bigBuf[0];
+  CompactStringDictionary writeDict;
+  BOOST_CHECK(recTy.getCompactSerialize().doit(bufPtr, bigBuf+128, inputBuf, writeDict));
+  uint8_t * firstEnd = bufPtr;
+  BOOST_CHECK(recTy.getCompactSerialize().doit(bufPtr, bigBuf+128, inputBuf, writeDict));
+  BOOST_CHECK(bufPtr - firstEnd < firstEnd - &bigBuf[0]);
+  BOOST_CHECK_EQUAL(1U, writeDict.size());
+  BOOST_CHECK(recTy.getCompactSerialize().doit(bufPtr, bigBuf+128, nullBuf, writeDict));
+  // Not enough room: nothing is written and the dictionary is 
+  // left as it was.
+  recTy.setVarchar("b", "qrstuvwxyz", inputBuf);
+  uint8_t * fullPtr = bufPtr;
+  BOOST_CHECK(!recTy.getCompactSerialize().doit(fullPtr, bufPtr+10, inputBuf, writeDict));
+  BOOST_CHECK_EQUAL(bufPtr, fullPtr);
+  BOOST_CHECK_EQUAL(1U, writeDict.size());
+
+  const uint8_t * readPtr = &bigBuf[0];
+  CompactStringDictionary readDict;
+  for(int32_t i=0; i<3; ++i) {
+    RecordBuffer outputBuf = recTy.GetMalloc()->malloc();
+    recTy.getCompactDeserialize().doit(readPtr, bufPtr, outputBuf, readDict);
+    if (i < 2) {
+      BOOST_CHECK(boost::algorithm::equals("123456",
+					   recTy.getFieldAddress("a").getCharPtr(outputBuf)));
+      BOOST_CHECK(boost::algorithm::equals("abcdefghijklmnop",
+					   recTy.getFieldAddress("b").getVarcharPtr(outputBuf)->c_str()));
+      BOOST_CHECK_EQUAL(-7, recTy.getFieldAddress("c").getInt32(outputBuf));
+      BOOST_CHECK_EQUAL(1239923432LL, recTy.getFieldAddress("d").getInt64(outputBuf));
+      BOOST_CHECK_EQUAL(8234.24344, recTy.getFieldAddress("e").getDouble(outputBuf));
+    } else {
+      BOOST_CHECK(boost::algorithm::equals("654321",
+					   recTy.getFieldAddress("a").getCharPtr(outputBuf)));
+      BOOST_CHECK(recTy.getFieldAddress("b").isNull(outputBuf));
+      BOOST_CHECK(recTy.getFieldAddress("c").isNull(outputBuf));
+      BOOST_CHECK_EQUAL(-3LL, recTy.getFieldAddress("d").getInt64(outputBuf));
+      BOOST_CHECK_EQUAL(1.5, recTy.getFieldAddress("e").getDouble(outputBuf));
+    }
+    recTy.getFree().free(outputBuf);
+  }
+  BOOST_CHECK_EQUAL(bufPtr, readPtr);
+
+  // Truncated input is an error
+  {
+    RecordBuffer outputBuf = recTy.GetMalloc()->malloc();
+    readPtr = &bigBuf[0];
+    CompactStringDictionary dict;
+    BOOST_CHECK_THROW(recTy.getCompactDeserialize().doit(readPtr, &bigBuf[4], 
+							 outputBuf, dict),
+		      std::runtime_error);
+    recTy.getFree().free(outputBuf);
+  }
+  recTy.getFree().free(inputBuf);
+  recTy.getFree().free(nullBuf);
+}
+
 BOOST_AUTO_TEST_CASE(testIQLRecordTransferIdentityDetection)
 {
   DynamicRecordContext ctxt;
@@ -6943,6 +7187,62 @@ bool iql_rlike_literal(const std::string& val, const std::string& expr)
 BOOST_AUTO_TEST_CASE(testIQLRLikeLiteral)
 {
   BOOST_CHECK(iql_rlike_literal("12834.da1", "a RLIKE '.*da1'"));
+  BOOST_CHECK(!iql_rlike_literal("12834.da12", "a RLIKE '.*da1'"));
+  BOOST_CHECK(iql_rlike_literal("abc", "a RLIKE 'abc'"));
+  BOOST_CHECK(!iql_rlike_literal("abcd", "a RLIKE 'abc'"));
+  BOOST_CHECK(iql_rlike_literal("abcd", "a RLIKE '^abc.*'"));
+  BOOST_CHECK(!iql_rlike_literal("xabcd", "a RLIKE '^abc.*'"));
+  BOOST_CHECK(iql_rlike_literal("a long string with abc in the middle", 
+				"a RLIKE '.*abc.*'"));
+  BOOST_CHECK(!iql_rlike_literal("a long string with ab c in the middle", 
+				 "a RLIKE '.*abc.*'"));
+  BOOST_CHECK(iql_rlike_literal("a.b", "a RLIKE 'a\\\\.b'"));
+  BOOST_CHECK(!iql_rlike_literal("axb", "a RLIKE 'a\\\\.b'"));
+  BOOST_CHECK(iql_rlike_literal("a89234b", "a RLIKE 'a[0-9]+b'"));
+  BOOST_CHECK(!iql_rlike_literal("a89234", "a RLIKE 'a[0-9]+b'"));
+  BOOST_CHECK(iql_rlike_literal("a89234b", "a RLIKE 'a[0-9]+b' AND a RLIKE 'a8.*'"));
+}
+
+BOOST_AUTO_TEST_CASE(testRegexMatchConstantCache)
+{
+  // The same buffer holding different patterns must not hit a stale
+  // cache entry.
+  InterpreterContext runtimeCtxt;
+  char pattern[16];
+  strcpy(pattern, "a+");
+  BOOST_CHECK(runtimeCtxt.regex_match_constant(pattern, "aaa"));
+  BOOST_CHECK(!runtimeCtxt.regex_match_constant(pattern, "bbb"));
+  strcpy(pattern, "b+");
+  BOOST_CHECK(runtimeCtxt.regex_match_constant(pattern, "bbb"));
+  BOOST_CHECK(!runtimeCtxt.regex_match_constant(pattern, "aaa"));
+  std::string copy("a+");
+  BOOST_CHECK(runtimeCtxt.regex_match_constant(copy.c_str(), "aaa"));
+}
+
+BOOST_AUTO_TEST_CASE(testRLikePatternAnalyze)
+{
+  std::string lit;
+  BOOST_CHECK_EQUAL(RLikePattern::EQUALS, RLikePattern::analyze("abc", lit));
+  BOOST_CHECK_EQUAL("abc", lit);
+  BOOST_CHECK_EQUAL(RLikePattern::EQUALS, RLikePattern::analyze("^abc$", lit));
+  BOOST_CHECK_EQUAL("abc", lit);
+  BOOST_CHECK_EQUAL(RLikePattern::PREFIX, RLikePattern::analyze("abc.*", lit));
+  BOOST_CHECK_EQUAL("abc", lit);
+  BOOST_CHECK_EQUAL(RLikePattern::SUFFIX, RLikePattern::analyze(".*abc", lit));
+  BOOST_CHECK_EQUAL("abc", lit);
+  BOOST_CHECK_EQUAL(RLikePattern::CONTAINS, RLikePattern::analyze(".*abc.*", lit));
+  BOOST_CHECK_EQUAL("abc", lit);
+  BOOST_CHECK_EQUAL(RLikePattern::SUFFIX, RLikePattern::analyze(".*", lit));
+  BOOST_CHECK_EQUAL("", lit);
+  BOOST_CHECK_EQUAL(RLikePattern::EQUALS, RLikePattern::analyze("a\\.b\\$", lit));
+  BOOST_CHECK_EQUAL("a.b$", lit);
+  BOOST_CHECK_EQUAL(RLikePattern::PREFIX, RLikePattern::analyze("a\\\\.*", lit));
+  BOOST_CHECK_EQUAL("a\\", lit);
+  BOOST_CHECK_EQUAL(RLikePattern::REGEX, RLikePattern::analyze("a\\.*", lit));
+  BOOST_CHECK_EQUAL(RLikePattern::REGEX, RLikePattern::analyze("a+", lit));
+  BOOST_CHECK_EQUAL(RLikePattern::REGEX, RLikePattern::analyze("a\\d", lit));
+  BOOST_CHECK_EQUAL(RLikePattern::REGEX, RLikePattern::analyze("(?i)abc", lit));
+  BOOST_CHECK_EQUAL(RLikePattern::REGEX, RLikePattern::analyze(".*a.*b.*", lit));
 }
 
 BOOST_AUTO_TEST_CASE(testStringLiteralEscapes)